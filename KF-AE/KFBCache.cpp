@@ -0,0 +1,171 @@
+/********************************************************************************************
+KFBCache.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Description:	A process wide cache of loaded .kfb data with a memory budget.
+				Released in least recently used order.  Keyframes still held outside the cache
+				(ie. in use by a render) are pinned.
+
+Licence:		GNU Affero General Public License
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBCache.h"
+
+#include <sstream>
+
+/*******************************************************************************************************
+The cache shared by every instance of the effect.
+Note: Never destroyed (released keyframes need the AE suites), it is cleared at global setdown.
+*******************************************************************************************************/
+KFBCache & KFBCache::Shared() {
+	static KFBCache * cache = new KFBCache();
+	return *cache;
+}
+
+/*******************************************************************************************************
+Make the key for a keyframe.
+Includes the file size and modified time so a changed file is never matched, and the storage
+type because the data is held differently.
+*******************************************************************************************************/
+std::string MakeKFBCacheKey(const std::string & canonicalPath, uint64_t size, int64_t modified, KFBStorage storage) {
+	std::ostringstream ss;
+	ss << canonicalPath << "|" << size << "|" << modified << "|" << static_cast<long>(storage);
+	return ss.str();
+}
+
+/*******************************************************************************************************
+Set the memory budget (in bytes).  Releases keyframes if we are now over budget.
+*******************************************************************************************************/
+void KFBCache::SetBudget(size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(bytes == budget) return;
+	budget = bytes;
+	evict();
+}
+
+/*******************************************************************************************************
+Get a keyframe from the cache.  Returns nullptr if it isn't cached.
+*******************************************************************************************************/
+std::shared_ptr<const KFBData> KFBCache::Find(const std::string & key) {
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = index.find(key);
+	if(found == index.end()) {
+		misses++;
+		return nullptr;
+	}
+	hits++;
+	entries.splice(entries.begin(), entries, found->second);
+	return found->second->data;
+}
+
+/*******************************************************************************************************
+Check if a keyframe is cached (does not count as a use).
+*******************************************************************************************************/
+bool KFBCache::Contains(const std::string & key) {
+	std::lock_guard<std::mutex> lock(mutex);
+	return index.count(key) != 0;
+}
+
+/*******************************************************************************************************
+Add a keyframe (replaces any existing copy), then release old keyframes to stay within budget.
+Note: The new keyframe is kept even if it is larger than the budget (the caller holds it anyway).
+*******************************************************************************************************/
+void KFBCache::Insert(const std::string & key, const std::shared_ptr<const KFBData> & data) {
+	if(!data) return;
+	std::lock_guard<std::mutex> lock(mutex);
+	auto found = index.find(key);
+	if(found != index.end()) {
+		found->second->data = data;
+		entries.splice(entries.begin(), entries, found->second);
+	}
+	else {
+		entries.push_front(Entry {key, data});
+		index[key] = entries.begin();
+	}
+	evict();
+}
+
+/*******************************************************************************************************
+Set the memory a holder (eg. an instance) keeps outside the cache that is made from keyframes, like its
+cached images.  It counts against the budget, so more of it releases keyframes.  Zero removes the holder.
+*******************************************************************************************************/
+void KFBCache::SetHeldBytes(const void * holder, size_t bytes) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(bytes == 0) {
+		held.erase(holder);
+		return;
+	}
+	auto & current = held[holder];
+	const bool grown = bytes > current;
+	current = bytes;
+	if(grown) evict();
+}
+
+/*******************************************************************************************************
+Release all keyframes.  Counters are kept.
+*******************************************************************************************************/
+void KFBCache::Clear() {
+	std::lock_guard<std::mutex> lock(mutex);
+	index.clear();
+	entries.clear();
+}
+
+/*******************************************************************************************************
+Get the cache statistics (for sizing the budget).
+*******************************************************************************************************/
+KFBCacheStats KFBCache::GetStats() {
+	std::lock_guard<std::mutex> lock(mutex);
+	KFBCacheStats stats;
+	stats.hits = hits;
+	stats.misses = misses;
+	stats.evictions = evictions;
+	stats.entries = entries.size();
+	stats.usedBytes = usedBytes();
+	stats.heldBytes = heldBytes();
+	stats.budgetBytes = budget;
+	return stats;
+}
+
+/*******************************************************************************************************
+Memory held outside the cache (see SetHeldBytes).  Mutex must be held.
+*******************************************************************************************************/
+size_t KFBCache::heldBytes() {
+	size_t total = 0;
+	for(auto & h : held) total += h.second;
+	return total;
+}
+
+/*******************************************************************************************************
+Memory held by the cached keyframes, and outside the cache.  Mutex must be held.
+*******************************************************************************************************/
+size_t KFBCache::usedBytes() {
+	size_t total = heldBytes();
+	for(auto & entry : entries) total += entry.data->memoryUsage();
+	return total;
+}
+
+/*******************************************************************************************************
+Release least recently used keyframes until we are within budget.  Mutex must be held.
+Pinned keyframes (held by someone else) are skipped.
+*******************************************************************************************************/
+void KFBCache::evict() {
+	auto used = usedBytes();
+	auto it = entries.end();
+	while(used > budget && it != entries.begin()) {
+		--it;
+		if(it->data.use_count() > 1) continue;		//Pinned
+		used -= std::min(used, it->data->memoryUsage());
+		index.erase(it->key);
+		it = entries.erase(it);
+		evictions++;
+	}
+}
@@ -0,0 +1,80 @@
+#pragma once
+/********************************************************************************************
+KFBCache.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Holds loaded keyframes (KFBData) up to a memory budget.
+There is one cache for the whole process, shared by every instance of the effect, so instances
+using the same .kfr share one copy of each keyframe.  Data stays cached when an instance is
+flattened or destroyed, so it is still there when the instance is set up again.
+Keyframes are keyed by file (see MakeKFBCacheKey), so a changed file is a different keyframe.
+The least recently used keyframes are released first.  A keyframe is pinned (never released)
+while anything outside the cache still holds it, e.g. the frames used by a render.
+The budget covers each keyframe's memoryUsage (its storage, including a mapped file, and the mip
+levels, grids and masks built from it) and the memory instances hold that is made from keyframes
+(their cached images and stages, see SetHeldBytes).  Only keyframes are released to make room.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBData.h"
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+struct KFBCacheStats {
+	size_t hits {0};
+	size_t misses {0};
+	size_t evictions {0};
+	size_t entries {0};
+	size_t usedBytes {0};			//Including heldBytes
+	size_t heldBytes {0};
+	size_t budgetBytes {0};
+};
+
+std::string MakeKFBCacheKey(const std::string & canonicalPath, uint64_t size, int64_t modified, KFBStorage storage);
+
+class KFBCache {
+	public:
+		static KFBCache & Shared();
+
+		void SetBudget(size_t bytes);
+		std::shared_ptr<const KFBData> Find(const std::string & key);
+		bool Contains(const std::string & key);
+		void Insert(const std::string & key, const std::shared_ptr<const KFBData> & data);
+		void SetHeldBytes(const void * holder, size_t bytes);
+		void Clear();
+		KFBCacheStats GetStats();
+
+	private:
+		struct Entry {
+			std::string key;
+			std::shared_ptr<const KFBData> data;
+		};
+
+		std::mutex mutex;
+		std::list<Entry> entries;												//Most recently used at the front
+		std::unordered_map<std::string, std::list<Entry>::iterator> index;	//Key to entry
+		size_t budget {0};
+		size_t hits {0};
+		size_t misses {0};
+		size_t evictions {0};
+		std::unordered_map<const void*, size_t> held;		//Bytes held outside the cache, by holder
+
+		size_t heldBytes();
+		size_t usedBytes();
+		void evict();
+};
@@ -8,8 +8,8 @@ Credits:		KeyFrameMovieMaker from the Kalles Fraktaler project was consulted for
 
 Description:	Holds the contents of a .kfb file.
 				.kfb file includes iteration data, smooth data, and colour data.
-				Has handels to hold (and destroy) a chached pre-rendered image of this data.
-				This class will clean-up chache handles and its own memory allocations.
+				Once read, the data is not changed, so it can be shared (see KFBCache).
+				This class will clean-up its own memory allocations.
 
 Licence:		GNU Affero General Public License
 
@@ -24,6 +24,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 ********************************************************************************************/
 
 #include "KFBData.h"
+#include "WorkerPool.h"
+#include "KFBSpan.h"
 #include "os.h"
 #include <cmath>
 #include <fstream>
@@ -31,32 +33,146 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include <sstream>
 #include <algorithm>
 #include <cassert>
+#include <vector>
+#include <cstring>
+#include <climits>
+#include <filesystem>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define KFB_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+constexpr long readBandColumns = 64;		//Number of kfb columns read from the file at a time.
+constexpr long transposeBlockSize = 32;	//Size of the square blocks used when rotating kfb data.
+constexpr int kfbDecodeBuffers = 8;		//Most bands being decoded (or read) at once.
+constexpr long padRowBlock = 256;			//Rows padded by each job.
+constexpr long mipRowBlock = 64;			//Mip level (or inside mask) rows built by each job.
+constexpr long mipMinimumSize = 4;			//Smallest width or height of a mip level (bicubic needs 4x4).
+constexpr double bicubicUndershoot = 0.28125;	//Most a bicubic sample is below its 16 values' minimum (as a fraction of their range).
+constexpr double insideMargin = 1e-12;		//Allows for rounding in sampling and blending (relative).
+
+//Header of a .kfbc sidecar file (one page).  The rest of the file is the decoded, padded data in the
+//same layout as a KFBData memory block: iteration data, then smooth data on the next page boundary.
+constexpr uint32_t sidecarVersion = 1;
+struct KFBSidecarHeader {
+	char id[4] {'K', 'F', 'B', 'C'};
+	uint32_t version {sidecarVersion};
+	int32_t width {0};
+	int32_t height {0};
+	int32_t padding {paddingSize};
+	int32_t maxIterations {0};
+	uint32_t colourDiv {0};
+	uint32_t numColours {0};
+	uint64_t sourceSize {0};		//Size of the .kfb this was made from
+	int64_t sourceTime {0};			//Modified time of the .kfb this was made from
+	uint64_t sourceHash {0};		//Hash of the .kfb's path, size and time (shared memory only, see KFBSharedHash)
+	uint64_t iterationOffset {0};	//Offset of the iteration data in this file
+	uint64_t smoothOffset {0};		//Offset of the smooth data in this file
+	uint64_t fileSize {0};			//Total size of this file
+	unsigned char colours[maxKFRColours * 3] {};
+};
+static_assert(sizeof(KFBSidecarHeader) <= kfbPageSize, "KFB sidecar header must fit in one page");
+
+//Header of a shared memory KFB (one page), followed by the same layout as a KFBData memory block.
+//The state packs (generation << 40) | (owner process << 8) | KFBSharedState, so it is changed with a
+//single compare and exchange.  Each claim increments the generation.
+//The owner records when it started (see ProcessStartTime) with the generation it claimed, so an owner
+//that died can be told from a new process that was given its ID.
+//users counts the KFBData objects (in every process) with the block open.  The last to close it
+//removes the block (see closeShared), so keyframes no longer used don't stay in memory.
+enum class KFBSharedState : uint64_t {
+	empty = 0,			//A new (zero filled) block
+	decoding,			//The owner process is decoding into the block
+	ready,				//Decoded, read only from now on
+	failed,				//The owner couldn't decode, the next process to look will try again
+};
+struct KFBSharedHeader {
+	std::atomic<uint64_t> state;
+	std::atomic<uint64_t> ownerStarted;		//(generation << 40) | the low 40 bits of the owner's start time
+	std::atomic<uint32_t> users;				//kfbSharedRemoved once the last user has closed it
+	KFBSidecarHeader info;			//Details of the kfb (only valid once ready)
+};
+static_assert(sizeof(KFBSharedHeader) <= kfbPageSize, "KFB shared header must fit in one page");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "KFB shared state must be lock free to work between processes");
+static_assert(std::atomic<uint32_t>::is_always_lock_free, "KFB shared users must be lock free to work between processes");
+constexpr uint32_t kfbSharedRemoved = UINT32_MAX;
+constexpr uint64_t kfbStartTimeMask = (uint64_t(1) << 40) - 1;
+constexpr auto kfbSharedRemoveWait = std::chrono::seconds(10);	//Longest to wait for a block being removed to go.
+constexpr auto kfbSharedWait = std::chrono::minutes(5);		//Longest to wait for another (running) process to decode.
+
+inline uint64_t makeSharedState(uint64_t generation, unsigned long owner, KFBSharedState state);
+inline KFBSharedState sharedState(uint64_t state) {return static_cast<KFBSharedState>(state & 0xFF);}
+inline unsigned long sharedOwner(uint64_t state) {return static_cast<unsigned long>((state >> 8) & 0xFFFFFFFF);}
+inline uint64_t sharedGeneration(uint64_t state) {return state >> 40;}
+inline uint64_t makeOwnerStarted(uint64_t generation, uint64_t started) {return (generation << 40) | (started & kfbStartTimeMask);}
+static bool sharedOwnerGone(const KFBSharedHeader & header, uint64_t state);
 
 inline long clampToLong(double d, long max);
+inline int clampPositive(int v);
+inline double clampPositive(double v);
 inline double BiLinearIterpolation(double x, double y, double ul, double ur, double ll, double lr);
 inline double biCubicIterpolation(const double values[][4], double x, double y);
+static SPBasicSuite * memorySuites();
 
 
 
 /*******************************************************************************************************
 Constuctor.
 Gets AE managed memory (non-zerod).
+Mapped storage doesn't allocate, the file is mapped when it is read.
+Shared storage doesn't allocate either, the shared block is opened when it is read.
+Compact storage allocates the raw (float) smooth data and the 16 bit iterations (see packCompact).
+Tiled storage rounds the size up to whole tiles.
 *******************************************************************************************************/
-KFBData::KFBData( int w, int h)
+KFBData::KFBData( int w, int h, KFBStorage storage)
 {
-	AEGP_SuiteHandler suites(globalTL_in_data->pica_basicP);
-	const auto handleSuite = suites.HandleSuite1();
-	if(!handleSuite) throw(std::exception("Unable to aquire HandleSuite1"));
-
 	//Note we request data and smoothData as one block of memory.
 	memWidth = w + paddingSize * 2;
 	memHeight = h + paddingSize * 2;
-
-
-	long dataSize = sizeof(int)* memWidth * memHeight;
-	this->memSize = dataSize + sizeof(double)* memWidth * memHeight;
 	this->width = w;
 	this->height = h;
+	this->storage = storage;
+	long cells = memWidth * memHeight;
+	if(storage == KFBStorage::tiled) {
+		this->tiled = true;
+		this->tilesX = (memWidth + kfbTileSize - 1) >> kfbTileShift;
+		cells = tilesX * ((memHeight + kfbTileSize - 1) >> kfbTileShift) * kfbTileSize * kfbTileSize;
+	}
+
+	//The smooth data starts on a page boundary, so the block has the same layout as a .kfbc sidecar.
+	long dataSize = sizeof(int)* cells;
+	this->smoothOffset = (dataSize + kfbPageSize - 1) / kfbPageSize * kfbPageSize;
+	if(storage == KFBStorage::mapped) return;
+	if(storage == KFBStorage::shared) {
+		this->memSize = smoothOffset + sizeof(double)* cells;
+		return;
+	}
+
+	SPBasicSuite * basicSuite = memorySuites();
+	if(!basicSuite) throw(std::exception("AE memory suites are not available on this thread"));
+	AEGP_SuiteHandler suites(basicSuite);
+	const auto handleSuite = suites.HandleSuite1();
+	if(!handleSuite) throw(std::exception("Unable to aquire HandleSuite1"));
+
+	if(storage == KFBStorage::compact) {
+		this->tilesX = (memWidth + kfbTileSize - 1) >> kfbTileShift;
+		this->compactTiles.resize(tilesX * ((memHeight + kfbTileSize - 1) >> kfbTileShift));
+		this->memSize = (sizeof(float) + sizeof(uint16_t)) * cells + sizeof(KFBCompactTile) * compactTiles.size();
+		this->handle = handleSuite->host_new_handle((sizeof(float) + sizeof(uint16_t)) * cells);
+		if(!this->handle) throw(PF_Err_OUT_OF_MEMORY);
+		this->compactRaw = static_cast<float*>(handleSuite->host_lock_handle(this->handle));
+		if(!this->compactRaw)  throw(PF_Err_OUT_OF_MEMORY);
+		this->compactDeltas = reinterpret_cast<uint16_t*>(this->compactRaw + cells);
+		return;
+	}
+
+	this->memSize = smoothOffset + sizeof(double)* cells;
 	
 	this->handle = handleSuite->host_new_handle(memSize);
 	if (!this->handle) throw(PF_Err_OUT_OF_MEMORY);
@@ -65,12 +181,21 @@ KFBData::KFBData( int w, int h)
 	
 	//Ugly pointer math to get a pointer to the smoothData (which is the 2nd part of the mem block)
 	char * c = reinterpret_cast<char*>(this->data);
-	c += dataSize;
+	c += smoothOffset;
 	this->smoothData = reinterpret_cast<double*>(c);
 	
 	
 	
 }
+/*******************************************************************************************************
+The basic suite to get the AE memory suites from.  Keyframes are allocated and released on threads AE
+didn't call us on (eg. KFBLoader's, or whichever thread drops the last reference), which have no
+in_data, so those use the one kept from global setup.  Null before global setup.
+*******************************************************************************************************/
+static SPBasicSuite * memorySuites() {
+	return (globalTL_in_data) ? globalTL_in_data->pica_basicP : globalBasicSuite;
+}
+
 /*******************************************************************************************************
 Deconstuctor.
 Dispose of AE managed memory buffer.
@@ -78,34 +203,50 @@ Dispose of AE managed memory buffer.
 KFBData::~KFBData()
 {
 	DebugMessage("~KFBData()\n");
-	AEGP_SuiteHandler suites(globalTL_in_data->pica_basicP);
+	UnmapFile(mappedFile);
+	closeShared();
+	mappedIterations = nullptr;
+	mappedSmooth = nullptr;
+
+	SPBasicSuite * basicSuite = memorySuites();
+	if(!basicSuite) return;
+	AEGP_SuiteHandler suites(basicSuite);
 	auto handleSuite = suites.HandleSuite1();
 	if(!handleSuite) return;
 
-	handleSuite->host_dispose_handle(this->handle);
+	if(this->handle) handleSuite->host_dispose_handle(this->handle);
 	smoothData = nullptr;
+	compactRaw = nullptr;
+	compactDeltas = nullptr;
 	data = nullptr;
 	handle = nullptr;
-	
-	DisposeOfCache();
 }
 
 /*******************************************************************************************************
-Releases the cached image for this kfb data.
+Reads a .kfb file into this object.
+KFB data is stored sideways (column by column), so each section is read in bands of whole columns and
+then transposed into the padded row layout, one cache sized block at a time.
+The smooth conversion and the top/bottom padding are done while the band is still in cache.
+Bands are decoded in parallel on the worker pool (the shared pool if none is given), while the next
+bands are read.  The jobs have the given priority (WorkPriority::load when a render is waiting).
 *******************************************************************************************************/
-void KFBData::DisposeOfCache() {
-	if(!this) return;  
-	AEGP_SuiteHandler suites(globalTL_in_data->pica_basicP);
-	if(this->isImageCached && this->cachedImageAEGP) {
-		suites.WorldSuite3()->AEGP_Dispose(this->cachedImageAEGP);
+void KFBData::ReadKFBFile(std::string fileName, WorkerPool * pool, WorkPriority priority) {
+	if(storage == KFBStorage::mapped) {
+		MapKFBFile(fileName);
+		return;
 	}
-	this->isImageCached = false;
+	if(!pool) pool = &WorkerPool::Shared();
+	if(storage == KFBStorage::shared) {
+		readShared(fileName, *pool, priority);
+		return;
+	}
+	decodeKFBFile(fileName, *pool, priority);
 }
 
-
-
-
-void KFBData::ReadKFBFile(std::string fileName) {
+/*******************************************************************************************************
+Decodes a .kfb file into data and smoothData (or compactRaw), see ReadKFBFile.
+*******************************************************************************************************/
+void KFBData::decodeKFBFile(const std::string & fileName, WorkerPool & pool, WorkPriority priority) {
 	//Readfile
 	std::ifstream file {fileName, std::ios::binary | std::ios::in};
 	if(!file) throw (std::exception("Unable to open KFB file\n"));
@@ -121,19 +262,187 @@ void KFBData::ReadKFBFile(std::string fileName) {
 	file.read(reinterpret_cast<char*>(&w), sizeof(w));
 	file.read(reinterpret_cast<char*>(&h), sizeof(h));
 	if(w != this->width || h != this->height) throw (std::exception("KFB file has incorrect size\n"));
-	if(w*h * sizeof(int) != dataSize()) throw (std::exception("Array size incorrect to read KFB file\n"));
+	if(static_cast<size_t>(w) * h * sizeof(int) != static_cast<size_t>(dataSize())) throw (std::exception("Array size incorrect to read KFB file\n"));
 
 	//Read Iteration Data (also rotate, because KFB data is sideways)
-	auto data = this->getIterationData();
-	for(long x = 0; x < width; x++) {
-		for(long y = 0; y < height; y++) {
-			auto index = makeIndex(x + paddingSize, y + paddingSize);
-			file.read(reinterpret_cast<char *>(&data[index]), sizeof(int));
+	//Compact storage decodes them into the memory of the raw smooth data, until they are packed.
+	if(storage == KFBStorage::compact) this->data = reinterpret_cast<int*>(compactRaw);
+	const int slots = decodeSlots(pool);
+	std::vector<std::vector<int>> iterationBands(slots, std::vector<int>(static_cast<size_t>(readBandColumns) * height));
+	pipelineBands(pool, priority, slots,
+		[&](int slot, long /*x*/, long columns) {
+			file.read(reinterpret_cast<char*>(iterationBands[slot].data()), columns * height * sizeof(int));
+			if(!file) throw (std::exception("KFB file is truncated\n"));
+		},
+		[&](int slot, long x, long columns) {transposeIterationBand(iterationBands[slot].data(), x, columns); });
+	iterationBands = std::vector<std::vector<int>>();
+	
+
+	readColours(file);
+	if(storage == KFBStorage::compact) {
+		readCompact(file, pool, priority, slots);
+		return;
+	}
+
+	//Read (raw) smooth data (needs all the iteration data first).
+	std::vector<std::vector<float>> smoothBands(slots, std::vector<float>(static_cast<size_t>(readBandColumns) * height));
+	pipelineBands(pool, priority, slots,
+		[&](int slot, long /*x*/, long columns) {
+			file.read(reinterpret_cast<char*>(smoothBands[slot].data()), columns * height * sizeof(float));
+			if(!file) throw (std::exception("KFB file is truncated\n"));
+		},
+		[&](int slot, long x, long columns) {transposeSmoothBand(smoothBands[slot].data(), x, columns); });
+
+	//Assign extapolated values to the left and right padding (top and bottom were done with each band).
+	padRows(pool, priority, [this](long y) {
+		padRow(data, y);
+		padRow(smoothData, y);
+	});
+}
+
+/*******************************************************************************************************
+Reads a .kfb into memory shared with other processes (named by the file's path, time and size).
+The first process to claim the block decodes into it, while the others wait and then use the same
+memory.  If the owner stops running (or fails) before the block is ready, the next process to look
+claims it again.  Once ready the block is never written to again.
+*******************************************************************************************************/
+void KFBData::readShared(const std::string & fileName, WorkerPool & pool, WorkPriority priority) {
+	const uint64_t hash = KFBSharedHash(fileName);
+	closeShared();
+	openShared(KFBSharedMemoryName(hash, width, height));
+	auto header = reinterpret_cast<KFBSharedHeader*>(sharedMemory.data);
+	this->data = reinterpret_cast<int*>(sharedMemory.data + kfbPageSize);
+	this->smoothData = reinterpret_cast<double*>(sharedMemory.data + kfbPageSize + smoothOffset);
+
+	const auto self = CurrentProcessID();
+	const auto started = std::chrono::steady_clock::now();
+	while(true) {
+		auto state = header->state.load(std::memory_order_acquire);
+		const auto current = sharedState(state);
+		if(current == KFBSharedState::ready) {
+			if(header->info.sourceHash != hash || header->info.width != width || header->info.height != height) throw(std::exception("KFB shared memory doesn't match the KFB file"));
+			readSidecarHeader(header->info);
+			return;
+		}
+
+		const bool abandoned = (current == KFBSharedState::decoding && sharedOwnerGone(*header, state));
+		if(current == KFBSharedState::empty || current == KFBSharedState::failed || abandoned) {
+			const auto generation = sharedGeneration(state) + 1;
+			const auto claimed = makeSharedState(generation, self, KFBSharedState::decoding);
+			if(!header->state.compare_exchange_strong(state, claimed, std::memory_order_acq_rel)) continue;
+			header->ownerStarted.store(makeOwnerStarted(generation, ProcessStartTime(self)), std::memory_order_release);
+			try {
+				DebugMessage("Decoding KFB into shared memory\n");
+				decodeKFBFile(fileName, pool, priority);
+				fillSidecarHeader(header->info);
+				header->info.sourceHash = hash;
+			}
+			catch(...) {
+				auto expected = claimed;
+				header->state.compare_exchange_strong(expected, makeSharedState(generation, self, KFBSharedState::failed), std::memory_order_release);
+				throw;
+			}
+			auto expected = claimed;
+			if(!header->state.compare_exchange_strong(expected, makeSharedState(generation, self, KFBSharedState::ready), std::memory_order_release)) throw(std::exception("KFB shared memory was claimed by another process while decoding"));
+			return;
 		}
+
+		if(std::chrono::steady_clock::now() - started > kfbSharedWait) throw(std::exception("Timed out waiting for another process to decode KFB file"));
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
 	}
-	
+}
 
-	//Read Colour information
+/*******************************************************************************************************
+Number of band buffers to use when decoding.  Enough to keep the pool busy while the next band is read.
+*******************************************************************************************************/
+int KFBData::decodeSlots(WorkerPool & pool) {
+	return std::clamp(pool.getThreads() + 1, 2, kfbDecodeBuffers);
+}
+
+/*******************************************************************************************************
+Decodes the file in bands of columns.
+Each band is read on this thread by read(slot, x, columns) into buffer "slot", then decoded on the pool
+by decode(slot, x, columns) while the following bands are read.  A buffer is reused once its band is
+decoded.  Returns when every band is decoded.
+*******************************************************************************************************/
+template <typename Read, typename Decode>
+void KFBData::pipelineBands(WorkerPool & pool, WorkPriority priority, int slots, Read read, Decode decode) {
+	std::vector<std::future<void>> pending(slots);
+	try {
+		long band = 0;
+		for(long x = 0; x < width; x += readBandColumns, band++) {
+			const int slot = static_cast<int>(band % slots);
+			pool.Wait(pending[slot]);
+			const long columns = std::min(readBandColumns, width - x);
+			read(slot, x, columns);
+			pending[slot] = pool.Submit([&decode, slot, x, columns] {decode(slot, x, columns); }, priority);
+		}
+		for(auto & p : pending) pool.Wait(p);
+	}
+	catch(...) {
+		//Jobs use the caller's buffers, so they must finish first.
+		for(auto & p : pending) if(p.valid()) p.wait();
+		throw;
+	}
+}
+
+/*******************************************************************************************************
+Assign extapolated values to the left and right padding of every row (in blocks of rows on the pool).
+pad(y) pads row y.
+*******************************************************************************************************/
+template <typename Pad>
+void KFBData::padRows(WorkerPool & pool, WorkPriority priority, Pad pad) {
+	std::vector<std::future<void>> pending;
+	for(long y = 0; y < memHeight; y += padRowBlock) {
+		const long yEnd = std::min(y + padRowBlock, memHeight);
+		pending.push_back(pool.Submit([&pad, y, yEnd] {for(long row = y; row < yEnd; row++) pad(row); }, priority));
+	}
+	for(auto & p : pending) pool.Wait(p);
+}
+
+/*******************************************************************************************************
+Opens (or creates) a shared block, and counts this object as one of its users.  A block whose last user
+has just closed it is being removed, so it is closed and opened again (as a new block).
+*******************************************************************************************************/
+void KFBData::openShared(const std::string & name) {
+	const auto started = std::chrono::steady_clock::now();
+	while(true) {
+		sharedMemory = OpenSharedMemory(name, kfbPageSize + memSize);
+		auto & users = reinterpret_cast<KFBSharedHeader*>(sharedMemory.data)->users;
+		auto count = users.load(std::memory_order_acquire);
+		while(count != kfbSharedRemoved && !users.compare_exchange_weak(count, count + 1, std::memory_order_acq_rel)) {}
+		if(count != kfbSharedRemoved) {
+			sharedName = name;
+			return;
+		}
+		CloseSharedMemory(sharedMemory);
+		if(std::chrono::steady_clock::now() - started > kfbSharedRemoveWait) throw(std::exception("Timed out waiting for KFB shared memory to be removed"));
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+/*******************************************************************************************************
+Closes the shared block (if open).  The last user marks it removed, so no one else starts using it,
+and removes its name.
+Note: A process that dies with the block open is never taken off its users, so (on POSIX) that block
+stays until the machine restarts.
+*******************************************************************************************************/
+void KFBData::closeShared() noexcept {
+	if(!sharedMemory.data) return;
+	auto & users = reinterpret_cast<KFBSharedHeader*>(sharedMemory.data)->users;
+	auto count = users.load(std::memory_order_acquire);
+	while(!users.compare_exchange_weak(count, (count == 1) ? kfbSharedRemoved : count - 1, std::memory_order_acq_rel)) {}
+	if(count == 1) RemoveSharedMemory(sharedName);
+	CloseSharedMemory(sharedMemory);
+	sharedName.clear();
+	data = nullptr;
+	smoothData = nullptr;
+}
+
+/*******************************************************************************************************
+Reads the colour information and max iterations (which sit between the iteration and smooth data).
+*******************************************************************************************************/
+void KFBData::readColours(std::istream & file) {
 	file.read(reinterpret_cast<char*>(&this->colourDiv), sizeof(int));
 	file.read(reinterpret_cast<char*>(&this->numColours), sizeof(int));
 	if(this->numColours > 1024) throw(std::exception("Number of KFB colours invalid."));
@@ -145,85 +454,517 @@ void KFBData::ReadKFBFile(std::string fileName) {
 
 	//Read max iterations
 	file.read(reinterpret_cast<char*>(&this->maxIterations), sizeof(int));
-	
+}
 
-	//Read (raw) smooth data;
-	auto smooth = this->getSmoothData();
-	float temp;
-	for(long x = 0; x < width; x++) {
-		for(long y = 0; y < height; y++) {
-			file.read(reinterpret_cast<char*>(&temp), sizeof(temp));
-			const auto index = makeIndex(x + paddingSize, y + paddingSize);
-			smooth[index] = static_cast<double>(data[index]) + 1 - static_cast<double>(temp);
+/*******************************************************************************************************
+Reads the rest of a .kfb file (after the colours) into compact storage.
+The iterations have been decoded into data (see decodeKFBFile), so they are padded and packed (see
+packCompact) before the raw smooth data is read over them.
+*******************************************************************************************************/
+void KFBData::readCompact(std::istream & file, WorkerPool & pool, WorkPriority priority, int slots) {
+	padRows(pool, priority, [this](long y) {padRow(data, y); });
+	packCompact(pool, priority);
+
+	std::vector<std::vector<float>> smoothBands(slots, std::vector<float>(static_cast<size_t>(readBandColumns) * height));
+	pipelineBands(pool, priority, slots,
+		[&](int slot, long /*x*/, long columns) {
+			file.read(reinterpret_cast<char*>(smoothBands[slot].data()), columns * height * sizeof(float));
+			if(!file) throw (std::exception("KFB file is truncated\n"));
+		},
+		[&](int slot, long x, long columns) {transposeRawBand(smoothBands[slot].data(), x, columns); });
+
+	padRows(pool, priority, [this](long y) {
+		padCompact(paddingSize, y, -1, 0);
+		padCompact(memWidth - paddingSize - 1, y, 1, 0);
+	});
+}
+
+/*******************************************************************************************************
+Packs the iterations of compact storage (all of them, padding included, in data) into a base for each
+tile and a 16 bit difference from it for each pixel.  The iterations of a tile too far apart for that
+(eg. inside pixels next to shallow ones) are kept as they are, in compactOverflow.
+Afterwards data is null, as its memory is the raw smooth data's.
+*******************************************************************************************************/
+void KFBData::packCompact(WorkerPool & pool, WorkPriority priority) {
+	const long tilesY = static_cast<long>(compactTiles.size()) / tilesX;
+	auto forEachPixel = [this](long tile, auto pixel) {
+		const long tx = (tile % tilesX) << kfbTileShift;
+		const long ty = (tile / tilesX) << kfbTileShift;
+		for(long y = ty; y < std::min(ty + kfbTileSize, memHeight); y++) {
+			for(long x = tx; x < std::min(tx + kfbTileSize, memWidth); x++) pixel(x, y);
+		}
+	};
+
+	//Each tile's base, and whether it fits.
+	pool.RunTiles(tilesY, priority, [&](long row) {
+		for(long tile = row * tilesX; tile < (row + 1) * tilesX; tile++) {
+			int lowest = INT_MAX, highest = INT_MIN;
+			forEachPixel(tile, [&](long x, long y) {
+				lowest = std::min(lowest, data[makeIndex(x, y)]);
+				highest = std::max(highest, data[makeIndex(x, y)]);
+			});
+			compactTiles[tile].base = lowest;
+			compactTiles[tile].overflow = (static_cast<int64_t>(highest) - lowest > UINT16_MAX) ? 0 : -1;
 		}
+	});
+	long overflowSize = 0;
+	for(auto & tile : compactTiles) {
+		if(tile.overflow < 0) continue;
+		tile.overflow = overflowSize;
+		overflowSize += kfbTileSize * kfbTileSize;
 	}
-	
+	compactOverflow.assign(overflowSize, 0);
+
+	pool.RunTiles(tilesY, priority, [&](long row) {
+		constexpr long mask = kfbTileSize - 1;
+		for(long tile = row * tilesX; tile < (row + 1) * tilesX; tile++) {
+			const KFBCompactTile t = compactTiles[tile];
+			forEachPixel(tile, [&](long x, long y) {
+				const long index = makeIndex(x, y);
+				if(t.overflow < 0) compactDeltas[index] = static_cast<uint16_t>(data[index] - t.base);
+				else compactOverflow[t.overflow + ((y & mask) << kfbTileShift) + (x & mask)] = data[index];
+			});
+		}
+	});
+	data = nullptr;
+}
+
+/*******************************************************************************************************
+Maps a .kfb file rather than reading it.
+Only the header and colours are copied, samples are read from the mapped sections on demand.
+*******************************************************************************************************/
+void KFBData::MapKFBFile(const std::string & fileName) {
+	UnmapFile(mappedFile);
+	mappedFile = MapFileReadOnly(fileName);
+	const char * file = mappedFile.data;
+	const size_t headerSize = 3 + sizeof(int) * 2;
+	const size_t sectionSize = static_cast<size_t>(width) * height * sizeof(int);
+	if(mappedFile.size < headerSize + sectionSize + sizeof(int) * 2) throw (std::exception("KFB file is truncated\n"));
+
+	//Check ID
+	if(!(file[0] == 'K' && file[1] == 'F' && file[2] == 'B')) throw (std::exception("KFB file has invalid ID\n"));
+
+	//Read Size
+	int h, w;
+	std::memcpy(&w, file + 3, sizeof(w));
+	std::memcpy(&h, file + 3 + sizeof(w), sizeof(h));
+	if(w != this->width || h != this->height) throw (std::exception("KFB file has incorrect size\n"));
+	mappedIterations = file + headerSize;
+
+	//Read Colour information
+	const char * p = mappedIterations + sectionSize;
+	std::memcpy(&this->colourDiv, p, sizeof(int));
+	std::memcpy(&this->numColours, p + sizeof(int), sizeof(int));
+	p += sizeof(int) * 2;
+	if(this->numColours > 1024) throw(std::exception("Number of KFB colours invalid."));
+	if(mappedFile.size < static_cast<size_t>(p - file) + this->numColours * 3 + sizeof(int) + sectionSize) throw (std::exception("KFB file is truncated\n"));
+	for(unsigned int i = 0; i < this->numColours; i++) {
+		this->kfbColours[i].red = static_cast<unsigned char>(*p++);
+		this->kfbColours[i].green = static_cast<unsigned char>(*p++);
+		this->kfbColours[i].blue = static_cast<unsigned char>(*p++);
+	}
+
+	//Read max iterations
+	std::memcpy(&this->maxIterations, p, sizeof(int));
+	mappedSmooth = p + sizeof(int);
+}
+
+/*******************************************************************************************************
+Reads the .kfbc sidecar of a .kfb file (see WriteSidecar), if there is a valid one.
+The sidecar is already decoded, so it is read with a single read (or mapped, for mapped storage).
+Compact storage converts the smooth data back to raw values as it reads.
+Returns false if there is no sidecar, or it doesn't match the .kfb (the caller should read the .kfb).
+Shared storage doesn't use sidecars (the shared block is already decoded once per machine).
+*******************************************************************************************************/
+bool KFBData::ReadSidecar(const std::string & kfbFileName) {
+	if(storage == KFBStorage::shared) return false;
+	const auto sidecarName = KFBSidecarFileName(kfbFileName);
+	std::error_code ec;
+	if(!fs::exists(sidecarName, ec)) return false;
+	const auto sourceSize = fs::file_size(kfbFileName, ec);
+	if(ec) return false;
+	const auto sourceTime = fs::last_write_time(kfbFileName, ec).time_since_epoch().count();
+	if(ec) return false;
+
+	std::ifstream file {sidecarName, std::ios::binary | std::ios::in};
+	if(!file) return false;
+	KFBSidecarHeader header;
+	file.read(reinterpret_cast<char*>(&header), sizeof(header));
+	if(!file) return false;
+
+	//Check it matches this object, and the .kfb it was made from.
+	if(std::memcmp(header.id, "KFBC", 4) != 0 || header.version != sidecarVersion || header.padding != paddingSize) return false;
+	if(header.width != this->width || header.height != this->height || header.numColours > maxKFRColours) return false;
+	//Sidecars are always in the row layout.
+	const uint64_t smoothBytes = sizeof(double) * static_cast<uint64_t>(memWidth) * memHeight;
+	const uint64_t rowSmoothOffset = (sizeof(int) * static_cast<uint64_t>(memWidth) * memHeight + kfbPageSize - 1) / kfbPageSize * kfbPageSize;
+	if(header.iterationOffset != kfbPageSize || header.smoothOffset != kfbPageSize + rowSmoothOffset) return false;
+	if(header.fileSize != header.smoothOffset + smoothBytes || fs::file_size(sidecarName, ec) != header.fileSize) return false;
+	if(header.sourceSize != sourceSize || header.sourceTime != sourceTime) return false;		//Changed (or just touched) since, decode it again
+
+	readSidecarHeader(header);
+
+	if(storage == KFBStorage::mapped) {
+		file.close();
+		UnmapFile(mappedFile);
+		mappedFile = MapFileReadOnly(sidecarName);
+		if(mappedFile.size != header.fileSize) {
+			UnmapFile(mappedFile);
+			return false;
+		}
+		//Read only view, we never write to data once it is loaded.
+		mappedIterations = nullptr;
+		mappedSmooth = nullptr;
+		this->data = reinterpret_cast<int*>(const_cast<char*>(mappedFile.data + header.iterationOffset));
+		this->smoothData = reinterpret_cast<double*>(const_cast<char*>(mappedFile.data + header.smoothOffset));
+		return true;
+	}
+
+	if(storage == KFBStorage::compact) {
+		//The iteration data is in the same layout, so is read (over the raw smooth data) and packed.
+		//The smooth data is converted a row at a time.
+		file.seekg(header.iterationOffset);
+		file.read(reinterpret_cast<char*>(this->compactRaw), sizeof(int) * memWidth * memHeight);
+		if(!file) return false;
+		this->data = reinterpret_cast<int*>(compactRaw);
+		packCompact(WorkerPool::Shared(), WorkPriority::decode);
+		file.seekg(header.smoothOffset);
+		std::vector<double> row(memWidth);
+		for(long y = 0; y < memHeight; y++) {
+			file.read(reinterpret_cast<char*>(row.data()), row.size() * sizeof(double));
+			if(!file) return false;
+			for(long x = 0; x < memWidth; x++) {
+				compactRaw[makeIndex(x, y)] = static_cast<float>(static_cast<double>(compactIteration(x, y)) + 1 - row[x]);
+			}
+		}
+		return true;
+	}
+
+	if(tiled) {
+		//Copy each row into the tiles.
+		file.seekg(header.iterationOffset);
+		std::vector<int> iterationRow(memWidth);
+		for(long y = 0; y < memHeight; y++) {
+			file.read(reinterpret_cast<char*>(iterationRow.data()), iterationRow.size() * sizeof(int));
+			if(!file) return false;
+			for(long x = 0; x < memWidth; x++) data[makeIndex(x, y)] = iterationRow[x];
+		}
+		file.seekg(header.smoothOffset);
+		std::vector<double> smoothRow(memWidth);
+		for(long y = 0; y < memHeight; y++) {
+			file.read(reinterpret_cast<char*>(smoothRow.data()), smoothRow.size() * sizeof(double));
+			if(!file) return false;
+			for(long x = 0; x < memWidth; x++) smoothData[makeIndex(x, y)] = smoothRow[x];
+		}
+		return true;
+	}
+
+	file.seekg(header.iterationOffset);
+	file.read(reinterpret_cast<char*>(this->data), memSize);
+	return static_cast<bool>(file);
+}
+
+/*******************************************************************************************************
+Writes the decoded data to a .kfbc sidecar next to the .kfb file, so it doesn't need decoding next time.
+Written to a temporary file first, so a partly written sidecar is never used.
+Standard storage already has the sidecar's layout, so is written in one go.  Other storage is written a
+row at a time from its values (a mapped .kfb's are made from the file as they are written).
+Note: Must hold the keyframe (ie. after ReadKFBFile), shared storage can't write a sidecar.
+*******************************************************************************************************/
+void KFBData::WriteSidecar(const std::string & kfbFileName) const {
+	if(storage == KFBStorage::shared || (!this->data && !this->compactDeltas && !this->mappedIterations)) throw(std::exception("KFB data must be loaded to write a sidecar"));
+	const auto sidecarName = KFBSidecarFileName(kfbFileName);
+	const auto tempName = sidecarName + ".tmp";
+
+	KFBSidecarHeader header;
+	fillSidecarHeader(header);
+	header.sourceSize = fs::file_size(kfbFileName);
+	header.sourceTime = fs::last_write_time(kfbFileName).time_since_epoch().count();
+
+	{
+		std::ofstream file {tempName, std::ios::binary | std::ios::out | std::ios::trunc};
+		if(!file) throw(std::exception("Unable to create KFB sidecar file\n"));
+		std::vector<char> page(kfbPageSize, 0);
+		std::memcpy(page.data(), &header, sizeof(header));
+		file.write(page.data(), page.size());
+		if(storage == KFBStorage::standard) {
+			file.write(reinterpret_cast<const char*>(this->data), memSize);
+		}
+		else {
+			std::vector<int> iterationRow(memWidth);
+			for(long y = 0; y < memHeight; y++) {
+				for(long x = 0; x < memWidth; x++) iterationRow[x] = iterationValue(x, y);
+				file.write(reinterpret_cast<const char*>(iterationRow.data()), iterationRow.size() * sizeof(int));
+			}
+			std::vector<char> gap(header.smoothOffset - header.iterationOffset - sizeof(int) * static_cast<uint64_t>(memWidth) * memHeight, 0);
+			file.write(gap.data(), gap.size());
+			std::vector<double> smoothRow(memWidth);
+			for(long y = 0; y < memHeight; y++) {
+				for(long x = 0; x < memWidth; x++) smoothRow[x] = smoothValue(x, y);
+				file.write(reinterpret_cast<const char*>(smoothRow.data()), smoothRow.size() * sizeof(double));
+			}
+		}
+		if(!file) {
+			file.close();
+			fs::remove(tempName);
+			throw(std::exception("Unable to write KFB sidecar file\n"));
+		}
+	}
+	fs::rename(tempName, sidecarName);
+}
+
+/*******************************************************************************************************
+Fills in the details of this kfb (size, layout and colours) in a sidecar header.
+*******************************************************************************************************/
+void KFBData::fillSidecarHeader(KFBSidecarHeader & header) const {
+	header = KFBSidecarHeader {};
+	header.width = static_cast<int32_t>(this->width);
+	header.height = static_cast<int32_t>(this->height);
+	header.maxIterations = this->maxIterations;
+	header.colourDiv = this->colourDiv;
+	header.numColours = this->numColours;
+	for(unsigned int i = 0; i < this->numColours; i++) {
+		header.colours[i * 3] = this->kfbColours[i].red;
+		header.colours[i * 3 + 1] = this->kfbColours[i].green;
+		header.colours[i * 3 + 2] = this->kfbColours[i].blue;
+	}
+	//Always the row layout (whatever the storage), see ReadSidecar.
+	const uint64_t iterationBytes = sizeof(int) * static_cast<uint64_t>(memWidth) * memHeight;
+	header.iterationOffset = kfbPageSize;
+	header.smoothOffset = kfbPageSize + (iterationBytes + kfbPageSize - 1) / kfbPageSize * kfbPageSize;
+	header.fileSize = header.smoothOffset + sizeof(double) * static_cast<uint64_t>(memWidth) * memHeight;
+}
+
+/*******************************************************************************************************
+Copies the max iterations and colours from a (checked) sidecar header.
+*******************************************************************************************************/
+void KFBData::readSidecarHeader(const KFBSidecarHeader & header) {
+	this->maxIterations = header.maxIterations;
+	this->colourDiv = header.colourDiv;
+	this->numColours = header.numColours;
+	for(unsigned int i = 0; i < this->numColours; i++) {
+		this->kfbColours[i].red = header.colours[i * 3];
+		this->kfbColours[i].green = header.colours[i * 3 + 1];
+		this->kfbColours[i].blue = header.colours[i * 3 + 2];
+	}
+}
+
+/*******************************************************************************************************
+Gets a value (at padded co-ordinates) directly from a mapped kfb.
+Padding is extrapolated on the fly, giving the same result as the padding in a decoded kfb.
+T is int for iteration data, double for smooth data.
+*******************************************************************************************************/
+template <typename T>
+T KFBData::mappedValue(long x, long y) const {
+	//Left and right padding (includes corners)
+	if(x < paddingSize || x >= width + paddingSize) {
+		const bool left = x < paddingSize;
+		const long edgeX = left ? paddingSize : width + paddingSize - 1;
+		const long innerX = left ? paddingSize + 1 : width + paddingSize - 2;
+		const T edge = mappedValue<T>(edgeX, y);
+		const T diff = edge - mappedValue<T>(innerX, y);
+		return clampPositive(edge + diff * static_cast<T>(left ? edgeX - x : x - edgeX));
+	}
+
+	//Top and bottom padding
+	if(y < paddingSize || y >= height + paddingSize) {
+		const bool top = y < paddingSize;
+		const long edgeY = top ? paddingSize : height + paddingSize - 1;
+		const long innerY = top ? paddingSize + 1 : height + paddingSize - 2;
+		const T edge = mappedValue<T>(x, edgeY);
+		const T diff = edge - mappedValue<T>(x, innerY);
+		return clampPositive(edge + diff * static_cast<T>(top ? edgeY - y : y - edgeY));
+	}
+
+	//KFB data is sideways (column major), and not aligned.
+	const size_t offset = (static_cast<size_t>(x - paddingSize) * height + (y - paddingSize)) * sizeof(int);
+	int iterations;
+	std::memcpy(&iterations, mappedIterations + offset, sizeof(int));
+	if constexpr(std::is_same_v<T, int>) {
+		return iterations;
+	}
+	else {
+		float raw;
+		std::memcpy(&raw, mappedSmooth + offset, sizeof(float));
+		return static_cast<double>(iterations) + 1 - static_cast<double>(raw);
+	}
+}
 
+/*******************************************************************************************************
+Transposes a band of raw iteration data (column major, as read from the kfb) into the padded buffer.
+band[c * height + y] is written to pixel (x + c, y).
+Works in small square blocks so both the reads and the writes stay in cache.
+The SSE path writes 4 pixel runs of 4 rows, so it is only used for the row layout (not tiled).
+*******************************************************************************************************/
+void KFBData::transposeIterationBand(const int * band, long x, long columns) {
+	for(long yBlock = 0; yBlock < height; yBlock += transposeBlockSize) {
+		const long yEnd = std::min(yBlock + transposeBlockSize, height);
+		for(long cBlock = 0; cBlock < columns; cBlock += transposeBlockSize) {
+			const long cEnd = std::min(cBlock + transposeBlockSize, columns);
+			long y = yBlock;
+#ifdef KFB_USE_SSE2
+			for(; !tiled && y + 4 <= yEnd; y += 4) {
+				long c = cBlock;
+				for(; c + 4 <= cEnd; c += 4) {
+					__m128 r0 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&band[(c + 0) * height + y])));
+					__m128 r1 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&band[(c + 1) * height + y])));
+					__m128 r2 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&band[(c + 2) * height + y])));
+					__m128 r3 = _mm_castsi128_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(&band[(c + 3) * height + y])));
+					_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+					const long index = makeIndex(x + c + paddingSize, y + paddingSize);
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(&data[index]), _mm_castps_si128(r0));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(&data[index + memWidth]), _mm_castps_si128(r1));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(&data[index + memWidth * 2]), _mm_castps_si128(r2));
+					_mm_storeu_si128(reinterpret_cast<__m128i*>(&data[index + memWidth * 3]), _mm_castps_si128(r3));
+				}
+				for(; c < cEnd; c++) {
+					for(long i = 0; i < 4; i++) data[makeIndex(x + c + paddingSize, y + i + paddingSize)] = band[c * height + y + i];
+				}
+			}
+#endif
+			for(; y < yEnd; y++) {
+				for(long c = cBlock; c < cEnd; c++) {
+					data[makeIndex(x + c + paddingSize, y + paddingSize)] = band[c * height + y];
+				}
+			}
+		}
+	}
+	for(long c = 0; c < columns; c++) padColumn(data, x + c + paddingSize);
+}
 
-	//Assign extapolated values to padded iteration values.
-	for(int x = 0; x < memWidth; x++) {
-		//Pad top
-		auto edge = data[makeIndex(x, 2)];
-		auto diff = edge  - data[makeIndex(x, 3)];
-		data[makeIndex(x, 1)] = std::max(edge + diff, 0);
-		data[makeIndex(x, 0)] = std::max(edge + (diff * 2), 0);
-		
-		//Pad Bottom
-		edge = data[makeIndex(x, memHeight -3)];
-		diff = edge - data[makeIndex(x, memHeight-4)];
-		data[makeIndex(x, memHeight -2)] = std::max(edge + diff, 0);
-		data[makeIndex(x, memHeight -1)] = std::max(edge + (diff * 2), 0);
-	}
-	for(int y = 0; y < memHeight; y++) {
-		//Pad left
-		auto edge = data[makeIndex(2,y)];
-		auto diff = edge - data[makeIndex(3,y)];
-		data[makeIndex(1, y)] = std::max(edge + diff, 0);
-		data[makeIndex(0, y)] = std::max(edge + (diff * 2), 0);
-
-		//Pad right
-		edge = data[makeIndex(memWidth - 3,y)];
-		diff = edge - data[makeIndex(memWidth - 4,y)];
-		data[makeIndex(memWidth - 2,y)] = std::max(edge + diff, 0);
-		data[makeIndex(memWidth - 1,y)] = std::max(edge + (diff * 2), 0);
-	}
-
-	//Assign extapolated values to padded smooth values.
-	for(int x = 0; x < memWidth; x++) {
-		//Pad top
-		auto edge = smoothData[makeIndex(x, 2)];
-		auto diff = edge - smoothData[makeIndex(x, 3)];
-		smoothData[makeIndex(x, 1)] = std::fmax(edge + diff, 0.0f);
-		smoothData[makeIndex(x, 0)] = std::fmax(edge + (diff * 2), 0.0f);
-
-		//Pad Bottom
-		edge = smoothData[makeIndex(x, memHeight - 3)];
-		diff = edge - smoothData[makeIndex(x, memHeight - 4)];
-		smoothData[makeIndex(x, memHeight - 2)] = std::fmax(edge + diff, 0.0f);
-		smoothData[makeIndex(x, memHeight - 1)] = std::fmax(edge + (diff * 2), 0.0f);
-	}
-	for(int y = 0; y < memHeight; y++) {
-		//Pad left
-		auto edge = smoothData[makeIndex(2, y)];
-		auto diff = edge - smoothData[makeIndex(3, y)];
-		smoothData[makeIndex(1, y)] = std::fmax(edge + diff, 0.0f);
-		smoothData[makeIndex(0, y)] = std::fmax(edge + (diff * 2), 0.0f);
-
-		//Pad right
-		edge = smoothData[makeIndex(memWidth - 3, y)];
-		diff = edge - smoothData[makeIndex(memWidth - 4, y)];
-		smoothData[makeIndex(memWidth - 2, y)] = std::fmax(edge + diff, 0.0f);
-		smoothData[makeIndex(memWidth - 1, y)] = std::fmax(edge + (diff * 2), 0.0f);
+/*******************************************************************************************************
+Transposes a band of raw smooth data (column major, as read from the kfb) into the padded buffer.
+The iteration data must already be loaded, as the smooth value is (iteration + 1 - raw).
+*******************************************************************************************************/
+void KFBData::transposeSmoothBand(const float * band, long x, long columns) {
+	for(long yBlock = 0; yBlock < height; yBlock += transposeBlockSize) {
+		const long yEnd = std::min(yBlock + transposeBlockSize, height);
+		for(long cBlock = 0; cBlock < columns; cBlock += transposeBlockSize) {
+			const long cEnd = std::min(cBlock + transposeBlockSize, columns);
+			long y = yBlock;
+#ifdef KFB_USE_SSE2
+			const __m128d one = _mm_set1_pd(1.0);
+			for(; !tiled && y + 4 <= yEnd; y += 4) {
+				long c = cBlock;
+				for(; c + 4 <= cEnd; c += 4) {
+					__m128 rows[4];
+					rows[0] = _mm_loadu_ps(&band[(c + 0) * height + y]);
+					rows[1] = _mm_loadu_ps(&band[(c + 1) * height + y]);
+					rows[2] = _mm_loadu_ps(&band[(c + 2) * height + y]);
+					rows[3] = _mm_loadu_ps(&band[(c + 3) * height + y]);
+					_MM_TRANSPOSE4_PS(rows[0], rows[1], rows[2], rows[3]);
+					for(long i = 0; i < 4; i++) {
+						const long index = makeIndex(x + c + paddingSize, y + i + paddingSize);
+						const __m128i it = _mm_loadu_si128(reinterpret_cast<const __m128i*>(&data[index]));
+						const __m128d low = _mm_sub_pd(_mm_add_pd(_mm_cvtepi32_pd(it), one), _mm_cvtps_pd(rows[i]));
+						const __m128d high = _mm_sub_pd(_mm_add_pd(_mm_cvtepi32_pd(_mm_unpackhi_epi64(it, it)), one), _mm_cvtps_pd(_mm_movehl_ps(rows[i], rows[i])));
+						_mm_storeu_pd(&smoothData[index], low);
+						_mm_storeu_pd(&smoothData[index + 2], high);
+					}
+				}
+				for(; c < cEnd; c++) {
+					for(long i = 0; i < 4; i++) {
+						const long index = makeIndex(x + c + paddingSize, y + i + paddingSize);
+						smoothData[index] = static_cast<double>(data[index]) + 1 - static_cast<double>(band[c * height + y + i]);
+					}
+				}
+			}
+#endif
+			for(; y < yEnd; y++) {
+				for(long c = cBlock; c < cEnd; c++) {
+					const long index = makeIndex(x + c + paddingSize, y + paddingSize);
+					smoothData[index] = static_cast<double>(data[index]) + 1 - static_cast<double>(band[c * height + y]);
+				}
+			}
+		}
 	}
+	for(long c = 0; c < columns; c++) padColumn(smoothData, x + c + paddingSize);
+}
 
+/*******************************************************************************************************
+Transposes a band of raw smooth data into compact storage (see readCompact).
+The raw smooth values are kept as they are, so sampling makes exactly the smooth values of the other
+storage (see smoothValue).
+*******************************************************************************************************/
+void KFBData::transposeRawBand(const float * band, long x, long columns) {
+	for(long yBlock = 0; yBlock < height; yBlock += transposeBlockSize) {
+		const long yEnd = std::min(yBlock + transposeBlockSize, height);
+		for(long cBlock = 0; cBlock < columns; cBlock += transposeBlockSize) {
+			const long cEnd = std::min(cBlock + transposeBlockSize, columns);
+			for(long y = yBlock; y < yEnd; y++) {
+				for(long c = cBlock; c < cEnd; c++) {
+					compactRaw[makeIndex(x + c + paddingSize, y + paddingSize)] = band[c * height + y];
+				}
+			}
+		}
+	}
+	for(long c = x + paddingSize; c < x + columns + paddingSize; c++) {
+		padCompact(c, paddingSize, 0, -1);
+		padCompact(c, memHeight - paddingSize - 1, 0, 1);
+	}
+}
+
+/*******************************************************************************************************
+Assign extapolated values to the top and bottom padding of one column.
+Values are clamped to zero.
+*******************************************************************************************************/
+template <typename T>
+void KFBData::padColumn(T * buffer, long x) {
+	//Pad top
+	auto edge = buffer[makeIndex(x, 2)];
+	auto diff = edge - buffer[makeIndex(x, 3)];
+	buffer[makeIndex(x, 1)] = clampPositive(edge + diff);
+	buffer[makeIndex(x, 0)] = clampPositive(edge + (diff * 2));
+
+	//Pad Bottom
+	edge = buffer[makeIndex(x, memHeight - 3)];
+	diff = edge - buffer[makeIndex(x, memHeight - 4)];
+	buffer[makeIndex(x, memHeight - 2)] = clampPositive(edge + diff);
+	buffer[makeIndex(x, memHeight - 1)] = clampPositive(edge + (diff * 2));
+}
+
+/*******************************************************************************************************
+Assign extapolated values to the left and right padding of one row.
+Must be done after the top/bottom padding so the corners are filled.
+*******************************************************************************************************/
+template <typename T>
+void KFBData::padRow(T * buffer, long y) {
+	//Pad left
+	auto edge = buffer[makeIndex(2, y)];
+	auto diff = edge - buffer[makeIndex(3, y)];
+	buffer[makeIndex(1, y)] = clampPositive(edge + diff);
+	buffer[makeIndex(0, y)] = clampPositive(edge + (diff * 2));
+
+	//Pad right
+	edge = buffer[makeIndex(memWidth - 3, y)];
+	diff = edge - buffer[makeIndex(memWidth - 4, y)];
+	buffer[makeIndex(memWidth - 2, y)] = clampPositive(edge + diff);
+	buffer[makeIndex(memWidth - 1, y)] = clampPositive(edge + (diff * 2));
+}
+
+/*******************************************************************************************************
+Assign extapolated smooth values to the padding of compact storage, outwards from the edge pixel (x,y)
+in the direction (dx,dy).  The smooth values are extrapolated like padColumn and padRow do for
+smoothData, and stored as the raw value that gives them with the padded iteration (so the iteration
+padding must be done first).  The raw values of the padding are rounded to floats.
+*******************************************************************************************************/
+void KFBData::padCompact(long x, long y, long dx, long dy) {
+	const double edge = smoothValue(x, y);
+	const double diff = edge - smoothValue(x - dx, y - dy);
+	for(long i = 1; i <= paddingSize; i++) {
+		const long index = makeIndex(x + dx * i, y + dy * i);
+		compactRaw[index] = static_cast<float>(static_cast<double>(compactIteration(x + dx * i, y + dy * i)) + 1 - clampPositive(edge + diff * i));
+	}
 }
 
 /*******************************************************************************************************
 Calculates an iteration value, given decimal (x,y) values.
 The value is the weighted value of the surrounding pixels.
 Returns the nearest edge pixel if requeted pixel is out of bounds
+With a mip level (see PrepareMipLevel) the smooth value is sampled from that level.
 *******************************************************************************************************/
-double KFBData::calculateIterationCountBiCubic(double x, double y, bool smooth) {
+double KFBData::calculateIterationCountBiCubic(double x, double y, bool smooth, int mipLevel) const {
+	if(smooth && mipLevel > 0) return mipBiCubic(mipLevel, x, y);
 	x += paddingSize;
 	y += paddingSize;
 	const double floorX = std::floor(x);
@@ -233,17 +974,18 @@ double KFBData::calculateIterationCountBiCubic(double x, double y, bool smooth)
 	
 	//If we are passed an integer pixel, no need to Interpolate. (always the case building cache)
 	if(floorX == x && floorY == y) {
-		const long index = calcIndexAndClamp(xl, yl);
-		return (smooth) ? smoothData[index] : static_cast<double>(data[index]);
+		return (smooth) ? smoothValue(clampX(xl), clampY(yl)) : static_cast<double>(iterationValue(clampX(xl), clampY(yl)));
 	}
 	
-	//Get 16 surrounding pixels.
+	//Get 16 surrounding pixels (the block must start inside the padding).
+	const long left = std::max(xl - 1, 0L);
+	const long top = std::max(yl - 1, 0L);
 	double values[4][4];
 	if(smooth) {
-		for(int i = 0; i < 4; i++) for(int j = 0; j < 4; j++) values[i][j] = smoothValue(xl + i - 1, yl + j - 1);
+		gatherSmooth(left, top, values);
 	}
 	else {
-		for(int i = 0; i < 4; i++) for(int j = 0; j < 4; j++) values[i][j] = static_cast<double>(smoothValue(xl + i - 1, yl + j - 1));
+		for(int i = 0; i < 4; i++) for(int j = 0; j < 4; j++) values[i][j] = static_cast<double>(smoothValue(left + i, top + j));
 	}
 	
 
@@ -251,13 +993,151 @@ double KFBData::calculateIterationCountBiCubic(double x, double y, bool smooth)
 	
 }
 
+/*******************************************************************************************************
+Calculates the iteration values of a row of samples at (xs[i], y), exactly as calculateIterationCountBiCubic
+would for each sample (including the integer pixel and edge cases).
+Every sample shares the same 4 rows, so each column is stepped vertically once and then each sample
+only needs the horizontal step (see KFBSpan.h).  Uses the vector kernels for this CPU.
+Mip levels, non-smooth values and a mapped .kfb are sampled one at a time.
+*******************************************************************************************************/
+void KFBData::calculateIterationCountBiCubicSpan(const float * xs, long count, double y, double * out, bool smooth, int mipLevel) const {
+	if(!smooth || mipLevel > 0 || (!smoothData && !compactRaw)) {
+		for(long i = 0; i < count; i++) out[i] = calculateIterationCountBiCubic(xs[i], y, smooth, mipLevel);
+		return;
+	}
+	y += paddingSize;
+	const double floorY = std::floor(y);
+	const long yl = clampToLong(floorY, height - 1);
+	const long top = std::max(yl - 1, 0L);
+	const bool integerRow = (floorY == y);
+	const auto & kernels = ActiveKFBSpanKernels();
+
+	int xl[kfbSpanBlock];
+	int left[kfbSpanBlock];
+	double offsets[kfbSpanBlock];
+	double columns[kfbSpanColumns];
+	for(long start = 0; start < count; start += kfbSpanBlock) {
+		const long n = std::min(kfbSpanBlock, count - start);
+		double * result = out + start;
+		long integerPixels = 0;
+		for(long i = 0; i < n; i++) {
+			const double x = static_cast<double>(xs[start + i]) + paddingSize;
+			const double floorX = std::floor(x);
+			xl[i] = static_cast<int>(clampToLong(floorX, width - 1));
+			left[i] = std::max(xl[i] - 1, 0);
+			offsets[i] = x - floorX;
+			if(floorX == x) integerPixels++;
+		}
+
+		//If we are passed an integer pixel, no need to Interpolate. (always the case building cache)
+		if(integerRow && integerPixels == n) {
+			for(long i = 0; i < n; i++) result[i] = smoothValue(clampX(xl[i]), clampY(yl));
+			continue;
+		}
+
+		//Samples are taken in runs whose columns fit in the column buffer (usually the whole block).
+		for(long i = 0; i < n; ) {
+			long lo = left[i];
+			long hi = left[i];
+			long end = i + 1;
+			for(; end < n; end++) {
+				const long l = left[end];
+				if(std::max(hi, l) - std::min(lo, l) + 4 > kfbSpanColumns) break;
+				lo = std::min(lo, l);
+				hi = std::max(hi, l);
+			}
+			spanColumns(kernels, lo, top, hi - lo + 4, y - floorY, columns);
+			for(long k = i; k < end; k++) left[k] -= static_cast<int>(lo);
+			kernels.samples(columns, left + i, offsets + i, end - i, result + i);
+			i = end;
+		}
+
+		if(integerRow && integerPixels > 0) {
+			for(long i = 0; i < n; i++) {
+				if(offsets[i] == 0) result[i] = smoothValue(clampX(xl[i]), clampY(yl));
+			}
+		}
+	}
+}
+
+/*******************************************************************************************************
+Copies count smooth values of row y, starting at column x (padded co-ordinates, must be within the padding).
+*******************************************************************************************************/
+void KFBData::getSmoothRow(long x, long y, long count, double * out) const {
+	if(!tiled && smoothData) {
+		std::copy_n(&smoothData[makeIndex(x, y)], count, out);
+	}
+	else if(compactRaw) {
+		//A tile at a time, as each has its own base.
+		for(long i = 0; i < count; ) {
+			const long run = std::min(count - i, kfbTileSize - ((x + i) & (kfbTileSize - 1)));
+			const KFBCompactTile & tile = compactTiles[makeTileIndex(x + i, y)];
+			const long index = makeIndex(x + i, y);
+			if(tile.overflow < 0) {
+				for(long k = 0; k < run; k++) out[i + k] = static_cast<double>(tile.base + compactDeltas[index + k]) + 1 - static_cast<double>(compactRaw[index + k]);
+			}
+			else {
+				for(long k = 0; k < run; k++) out[i + k] = smoothValue(x + i + k, y);
+			}
+			i += run;
+		}
+	}
+	else {
+		for(long i = 0; i < count; i++) out[i] = smoothValue(x + i, y);
+	}
+}
+
+/*******************************************************************************************************
+The vertical bicubic step of count columns starting at x, using rows top to top + 3 (padded co-ordinates).
+Tiled storage is stepped a tile at a time, as only the rows within a tile are contiguous.  So is
+compact storage, as each tile has its own base (a tile whose iterations overflow makes its values
+first, and uses the standard kernel).
+*******************************************************************************************************/
+void KFBData::spanColumns(const KFBSpanKernels & kernels, long x, long top, long count, double offset, double * out) const {
+	for(long c = 0; c < count; ) {
+		const long run = (tiled || compactRaw) ? std::min(count - c, kfbTileSize - ((x + c) & (kfbTileSize - 1))) : count - c;
+		if(smoothData) {
+			const double * rows[4];
+			for(int j = 0; j < 4; j++) rows[j] = &smoothData[makeIndex(x + c, top + j)];
+			kernels.columns(rows, run, offset, out + c);
+		}
+		else {
+			const uint16_t * deltas[4];
+			int bases[4];
+			const float * raws[4];
+			bool overflow = false;
+			for(int j = 0; j < 4; j++) {
+				const KFBCompactTile & tile = compactTiles[makeTileIndex(x + c, top + j)];
+				const long index = makeIndex(x + c, top + j);
+				deltas[j] = &compactDeltas[index];
+				bases[j] = tile.base;
+				raws[j] = &compactRaw[index];
+				overflow |= (tile.overflow >= 0);
+			}
+			if(!overflow) {
+				kernels.columnsCompact(deltas, bases, raws, run, offset, out + c);
+			}
+			else {
+				double values[4][kfbTileSize];
+				const double * rows[4];
+				for(int j = 0; j < 4; j++) {
+					getSmoothRow(x + c, top + j, run, values[j]);
+					rows[j] = values[j];
+				}
+				kernels.columns(rows, run, offset, out + c);
+			}
+		}
+		c += run;
+	}
+}
+
 /*******************************************************************************************************
 Calculates an iteration value, given decimal (x,y) values.
 The value is the weighted value of the surrounding pixels.
 Returns the nearest edge pixel if requeted pixel is out of bounds
 //Note: Only Smooth
 *******************************************************************************************************/
-inline double KFBData::calculateIterationCountBiLinear(double x, double y) {
+inline double KFBData::calculateIterationCountBiLinear(double x, double y) const {
 	return calculateIterationCountBiLinearNoPad(x + paddingSize, y + paddingSize);
 }
 
@@ -265,7 +1145,10 @@ inline double KFBData::calculateIterationCountBiLinear(double x, double y) {
 /*******************************************************************************************************
 BiLinear with values already padded.
 *******************************************************************************************************/
-double KFBData::calculateIterationCountBiLinearNoPad(double x, double y) {
+double KFBData::calculateIterationCountBiLinearNoPad(double x, double y) const {
+	//Stay within the padded data (the layout may not be rows, so we can't read past an edge).
+	x = std::clamp(x, 0.0, static_cast<double>(memWidth - 1));
+	y = std::clamp(y, 0.0, static_cast<double>(memHeight - 1));
 	const double floorX = std::floor(x);
 	const double floorY = std::floor(y);
 	const long xl = clampToLong(floorX, memWidth - 1);
@@ -276,21 +1159,201 @@ double KFBData::calculateIterationCountBiLinearNoPad(double x, double y) {
 		return smoothValue(xl, yl);
 	}
 	double ul, ur, ll, lr;
+	const long xr = std::min(xl + 1, memWidth - 1);
+	const long yb = std::min(yl + 1, memHeight - 1);
 
 	ul = smoothValue(xl, yl);
-	ur = smoothValue(xl + 1, yl);
-	ll = smoothValue(xl, yl + 1);
-	lr = smoothValue(xl + 1, yl + 1);
+	ur = smoothValue(xr, yl);
+	ll = smoothValue(xl, yb);
+	lr = smoothValue(xr, yb);
 
 
 	return BiLinearIterpolation(x, y, ul, ur, ll, lr);
 }
 
+/*******************************************************************************************************
+Gets the 4x4 smooth values with top left at (x,y) (padded co-ordinates), values[i][j] is (x + i, y + j).
+Decoded data is read with one index and fixed strides when the block is in one row block (or tile).
+*******************************************************************************************************/
+void KFBData::gatherSmooth(long x, long y, double values[][4]) const {
+	if(smoothData) {
+		constexpr long mask = kfbTileSize - 1;
+		const bool oneTile = tiled && (x & mask) <= kfbTileSize - 4 && (y & mask) <= kfbTileSize - 4;
+		if(!tiled || oneTile) {
+			const double * p = &smoothData[makeIndex(x, y)];
+			const long stride = tiled ? kfbTileSize : memWidth;
+			for(int j = 0; j < 4; j++, p += stride) for(int i = 0; i < 4; i++) values[i][j] = p[i];
+			return;
+		}
+	}
+	for(int i = 0; i < 4; i++) for(int j = 0; j < 4; j++) values[i][j] = smoothValue(x + i, y + j);
+}
+
+/*******************************************************************************************************
+Bicubic smooth value from a mip level, given decimal (x,y) values at full size.
+A level pixel is centred on the block of pixels it was made from.
+*******************************************************************************************************/
+double KFBData::mipBiCubic(int mipLevel, double x, double y) const {
+	const KFBMipLevel & level = *mipLevels[mipLevel];
+	const double scale = 1.0 / static_cast<double>(1 << mipLevel);
+	x = (x + 0.5) * scale - 0.5;
+	y = (y + 0.5) * scale - 0.5;
+	const long xl = static_cast<long>(std::floor(x));
+	const long yl = static_cast<long>(std::floor(y));
+
+	double values[4][4];
+	for(int i = 0; i < 4; i++) for(int j = 0; j < 4; j++) values[i][j] = level.value(xl + i - 1, yl + j - 1);
+	return biCubicIterpolation(values, x, y);
+}
+
+/*******************************************************************************************************
+Choose (and build, if needed) the mip level for sampling at "step" kfb pixels per output pixel.
+Returns the level, which is the largest level still at least as detailed as the output (0 for no mip).
+Must be called (eg. once per frame) before sampling the level, then the level can be sampled from any
+thread.  Levels are kept until this object is released.
+*******************************************************************************************************/
+int KFBData::PrepareMipLevel(double step, WorkerPool * pool) const {
+	int level = 0;
+	while(level + 1 < kfbMipLevels && step >= 2.0) {
+		if((width >> (level + 1)) < mipMinimumSize || (height >> (level + 1)) < mipMinimumSize) break;
+		step /= 2;
+		level++;
+	}
+	if(level == 0) return 0;
+
+	std::lock_guard<std::mutex> lock(buildMutex);
+	if(!pool) pool = &WorkerPool::Shared();
+	for(int l = 1; l <= level; l++) {
+		if(!mipLevels[l]) buildMipLevel(l, *pool);
+	}
+	return level;
+}
+
+/*******************************************************************************************************
+Build (if needed) the mask of blocks whose bicubic samples are certainly inside the set, and its tile
+summary (see KFBInsideMask).  Built when a keyframe is loaded, so rendering can skip sampling pixels
+that will be inside.
+The weights of a bicubic sample sum to 1, and the negative ones to at most bicubicUndershoot, so a
+sample is at least min - bicubicUndershoot * (max - min) of its 16 values.  A block is only inside if
+that (less a margin for rounding) is at least maxIterations, so the mask never changes a pixel.
+Note: Only smooth values at full size (mip level 0) are covered.
+*******************************************************************************************************/
+void KFBData::PrepareInsideMask(WorkerPool * pool) const {
+	std::lock_guard<std::mutex> lock(buildMutex);
+	if(insideMask.load(std::memory_order_acquire)) return;
+	if(!pool) pool = &WorkerPool::Shared();
+
+	auto mask = std::make_unique<KFBInsideMask>();
+	mask->width = width;
+	mask->height = height;
+	mask->words = (width + 63) / 64;
+	mask->tilesX = (width + kfbTileSize - 1) / kfbTileSize;
+	mask->tilesY = (height + kfbTileSize - 1) / kfbTileSize;
+	mask->bits.assign(static_cast<size_t>(mask->words) * height, 0);
+	mask->tiles.assign(static_cast<size_t>(mask->tilesX) * mask->tilesY, KFBInsideTile::outside);
+	const double inside = static_cast<double>(maxIterations);
+
+	//Each tile is a block of rows.  The minimum and maximum of each row's 4 wide blocks are found
+	//once, then each block's are those of 4 rows.
+	KFBInsideMask * m = mask.get();
+	const long blocks = (height + mipRowBlock - 1) / mipRowBlock;
+	pool->RunTiles(blocks, WorkPriority::build, [this, m, inside](long block) {
+		const long yBlock = block * mipRowBlock;
+		const long yEnd = std::min(yBlock + mipRowBlock, height);
+		std::vector<double> row(width + 3);
+		std::vector<double> lows(4 * static_cast<size_t>(width));
+		std::vector<double> highs(4 * static_cast<size_t>(width));
+		for(long r = yBlock; r < yEnd + 3; r++) {
+			getSmoothRow(0, r, width + 3, row.data());
+			double * low = &lows[(r & 3) * width];
+			double * high = &highs[(r & 3) * width];
+			for(long x = 0; x < width; x++) {
+				low[x] = std::min({row[x], row[x + 1], row[x + 2], row[x + 3]});
+				high[x] = std::max({row[x], row[x + 1], row[x + 2], row[x + 3]});
+			}
+			const long y = r - 3;
+			if(y < yBlock) continue;
+			uint64_t * bits = &m->bits[y * m->words];
+			for(long x = 0; x < width; x++) {
+				const double lo = std::min({lows[x], lows[width + x], lows[2 * width + x], lows[3 * width + x]});
+				const double hi = std::max({highs[x], highs[width + x], highs[2 * width + x], highs[3 * width + x]});
+				if(lo - bicubicUndershoot * (hi - lo) - insideMargin * std::abs(hi) >= inside) bits[x >> 6] |= uint64_t(1) << (x & 63);
+			}
+		}
+	});
+
+	for(long ty = 0; ty < m->tilesY; ty++) {
+		for(long tx = 0; tx < m->tilesX; tx++) {
+			long count = 0;
+			const long x0 = tx * kfbTileSize;
+			const long x1 = std::min(x0 + kfbTileSize, width);
+			const long y0 = ty * kfbTileSize;
+			const long y1 = std::min(y0 + kfbTileSize, height);
+			for(long y = y0; y < y1; y++) for(long x = x0; x < x1; x++) count += m->inside(x, y);
+			const long blocks = (x1 - x0) * (y1 - y0);
+			m->tiles[ty * m->tilesX + tx] = (count == 0) ? KFBInsideTile::outside : ((count == blocks) ? KFBInsideTile::inside : KFBInsideTile::mixed);
+		}
+	}
+
+	derivedBytes += m->bits.size() * sizeof(uint64_t) + m->tiles.size();
+	insideMaskData = std::move(mask);
+	insideMask.store(insideMaskData.get(), std::memory_order_release);
+}
+
+/*******************************************************************************************************
+Builds a mip level from the one above it.  buildMutex must be held.
+Each pixel is the mean of a 2x2 block.  If half or more of the block is inside the set, the pixel is
+inside (so the inside/outside edge doesn't grow a fringe of averaged values).
+*******************************************************************************************************/
+void KFBData::buildMipLevel(int level, WorkerPool & pool) const {
+	const KFBMipLevel * above = (level > 1) ? mipLevels[level - 1].get() : nullptr;
+	const long aboveWidth = (above) ? above->width : width;
+	const long aboveHeight = (above) ? above->height : height;
+	auto source = [&](long x, long y) {
+		x = std::min(x, aboveWidth - 1);
+		y = std::min(y, aboveHeight - 1);
+		return (above) ? above->smooth[y * aboveWidth + x] : smoothValue(x + paddingSize, y + paddingSize);
+	};
+
+	auto mip = std::make_unique<KFBMipLevel>();
+	mip->width = (aboveWidth + 1) / 2;
+	mip->height = (aboveHeight + 1) / 2;
+	mip->smooth.resize(static_cast<size_t>(mip->width) * mip->height);
+	const double inside = static_cast<double>(maxIterations);
+
+	const long blocks = (mip->height + mipRowBlock - 1) / mipRowBlock;
+	pool.RunTiles(blocks, WorkPriority::build, [&](long block) {
+		const long yBlock = block * mipRowBlock;
+		const long yEnd = std::min(yBlock + mipRowBlock, mip->height);
+		for(long y = yBlock; y < yEnd; y++) {
+			for(long x = 0; x < mip->width; x++) {
+				const double block[4] = {source(x * 2, y * 2), source(x * 2 + 1, y * 2), source(x * 2, y * 2 + 1), source(x * 2 + 1, y * 2 + 1)};
+				double total = 0;
+				double insideValue = 0;
+				int outsideCount = 0;
+				for(auto v : block) {
+					if(v >= inside) {
+						insideValue = std::max(insideValue, v);
+					}
+					else {
+						total += v;
+						outsideCount++;
+					}
+				}
+				mip->smooth[y * mip->width + x] = (outsideCount > 2) ? total / outsideCount : insideValue;
+			}
+		}
+	});
+
+	derivedBytes += mip->smooth.size() * sizeof(double);
+	mipLevels[level] = std::move(mip);
+}
+
 /*******************************************************************************************************
 Gets a matrix of 9 pixel values surrounding (x,y)
 If "minimal", we just calculate a cross, not all 9 values.
 *******************************************************************************************************/
-void  KFBData::getDistanceMatrix(double p[][3], double x, double y, double step, bool minimal) {
+void  KFBData::getDistanceMatrix(double p[][3], double x, double y, double step, bool minimal) const {
 	x += paddingSize;
 	y += paddingSize;
 	auto xMinusStep = std::max(0.0, x - step);
@@ -353,25 +1416,87 @@ void  KFBData::getDistanceMatrix(double p[][3], double x, double y, double step,
 Get's the iteration count at co-ordinates (x,y)
 Returns boundry pixel if out of bounds
 *******************************************************************************************************/
-int KFBData::getIterationCount(long x, long y) {
+int KFBData::getIterationCount(long x, long y) const {
 	x += paddingSize;
 	y += paddingSize;
-	auto index = calcIndexAndClamp(x, y);
-	return data[index];
+	return iterationValue(clampX(x), clampY(y));
 }
 
 /*******************************************************************************************************
 Get's the iteration count at co-ordinates (x,y)
 Returns boundry pixel if out of bounds
 *******************************************************************************************************/
-double KFBData::getIterationCountSmooth(long x, long y) {
+double KFBData::getIterationCountSmooth(long x, long y) const {
 	x += paddingSize;
 	y += paddingSize;
-	auto index = calcIndexAndClamp(x, y);
-	return smoothData[index];
+	return smoothValue(clampX(x), clampY(y));
+}
+
+
+
+/*******************************************************************************************************
+Name of the .kfbc sidecar for a .kfb file.
+*******************************************************************************************************/
+std::string KFBSidecarFileName(const std::string & kfbFileName) {
+	return kfbFileName + "c";
+}
+
+/*******************************************************************************************************
+Name of the shared memory block holding a decoded kfb (see readShared).
+*******************************************************************************************************/
+std::string KFBSharedMemoryName(uint64_t hash, long width, long height) {
+	std::stringstream name;
+	name << "KFMovieMaker-KFB-" << std::hex << hash << std::dec << "-" << width << "x" << height << "-" << paddingSize;
+	return name.str();
+}
+
+/*******************************************************************************************************
+Hash that names the shared memory of a .kfb (see KFBSharedMemoryName).
+Made from the file's path, size and modified time, like the keys of the keyframe cache (see
+MakeKFBCacheKey), so a changed file gets a new block.
+*******************************************************************************************************/
+uint64_t KFBSharedHash(const std::string & kfbFileName) {
+	std::error_code ec;
+	auto path = fs::canonical(kfbFileName, ec).string();
+	if(ec) path = kfbFileName;
+	const uint64_t size = fs::file_size(kfbFileName);
+	const auto modified = fs::last_write_time(kfbFileName).time_since_epoch().count();
+	uint64_t hash = HashKFBBytes(kfbHashSeed, path.data(), path.size());
+	hash = HashKFBBytes(hash, reinterpret_cast<const char*>(&size), sizeof(size));
+	return HashKFBBytes(hash, reinterpret_cast<const char*>(&modified), sizeof(modified));
+}
+
+/*******************************************************************************************************
+Packs the state of a shared memory kfb (see KFBSharedHeader).
+*******************************************************************************************************/
+inline uint64_t makeSharedState(uint64_t generation, unsigned long owner, KFBSharedState state) {
+	return (generation << 40) | (static_cast<uint64_t>(owner & 0xFFFFFFFF) << 8) | static_cast<uint64_t>(state);
 }
 
+/*******************************************************************************************************
+Whether the process that claimed a shared block (in state) has gone, so won't finish decoding it.
+Its ID may have been given to a new process since, so the start time it recorded is checked too.
+Until it has recorded one, a running process with its ID is taken to be the owner.
+*******************************************************************************************************/
+static bool sharedOwnerGone(const KFBSharedHeader & header, uint64_t state) {
+	const auto owner = sharedOwner(state);
+	if(!IsProcessRunning(owner)) return true;
+	const uint64_t recorded = header.ownerStarted.load(std::memory_order_acquire);
+	if((recorded >> 40) != sharedGeneration(state)) return false;
+	const uint64_t started = ProcessStartTime(owner);
+	return started != 0 && (started & kfbStartTimeMask) != (recorded & kfbStartTimeMask);
+}
 
+/*******************************************************************************************************
+Adds bytes to a 64 bit FNV-1a hash (start with kfbHashSeed).
+*******************************************************************************************************/
+uint64_t HashKFBBytes(uint64_t hash, const char * bytes, size_t count) {
+	for(size_t i = 0; i < count; i++) {
+		hash ^= static_cast<unsigned char>(bytes[i]);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
 
 /*******************************************************************************************************
 Computes the by linear interpolation.
@@ -403,6 +1528,16 @@ inline double BiLinearIterpolation(double x, double y, double ul, double ur, dou
 }
 
 
+/*******************************************************************************************************
+Clamp extrapolated padding values so they are never negative.
+*******************************************************************************************************/
+inline int clampPositive(int v) {
+	return std::max(v, 0);
+}
+inline double clampPositive(double v) {
+	return std::fmax(v, 0.0f);
+}
+
 /*******************************************************************************************************
 Clamps a value between 0 and max.
 *******************************************************************************************************/
@@ -428,20 +1563,6 @@ The value will be clamped within range.
 
 
 
-/******************************************************************************************************
-Calculate one cubic line.  
-Given 4 consecutative pixel values (v0..v3)
-Returns a weighted value between v1 and v2 based on the offset from v1.
-v0 and v3 are used to build a cubic spline to caclulate the results.
-*******************************************************************************************************/
-inline double biCubicStep(double v0, double v1, double v2, double v3, double offset) {
-	double a = (-v0 / 2) + (3 * v1) / 2 - (3 * v2) / 2 + (v3 / 2);
-	double b = v0 - (5 * v1) / 2 + (2 * v2) - (v3 / 2);
-	double c = -v0 / 2 + v2 / 2;
-	double d = v1;
-	return a* std::pow(offset, 3) + b * std::pow(offset, 2) + c* offset + d;
-}
-
 /*inline double biCubicStep(double v0, double v1, double v2, double v3, double offset) {
 double a = (v3 - v2) - (v0 - v1);
 double b = (v0 - v1) - a;
@@ -9,8 +9,8 @@ Credits:		KeyFrameMovieMaker from the Kalles Fraktaler project was consulted for
 
 Description:	Holds the contents of a .kfb file.  
 				.kfb file includes iteration data, smooth data, and colour data.
-				Has handels to hold (and destroy) a chached pre-rendered image of this data.
-				This class will clean-up chache handles and its own memory allocations.
+				Once read, the data is not changed, so it can be shared (see KFBCache).
+				This class will clean-up its own memory allocations.
 
 Licence:		GNU Affero General Public License
 
@@ -24,8 +24,78 @@ You should have received a copy of the GNU Affero General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 ********************************************************************************************/
 #include "KFMovieMaker.h"
+#include "OS.h"
+#include "WorkerPool.h"
 #include <string>
+#include <istream>
+#include <type_traits>
+#include <cstdint>
+#include <cmath>
+#include <array>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
 constexpr int paddingSize = 2;		//The edge of the image is padded by this amount.			
+constexpr long kfbPageSize = 4096;	//Alignment of the smooth data, and of the sections in a .kfbc sidecar file.
+constexpr long kfbTileShift = 5;		//Tiled storage uses square tiles of 2^kfbTileShift pixels.
+constexpr long kfbTileSize = 1 << kfbTileShift;
+constexpr int kfbMipLevels = 6;		//Level n of the smooth data is 1/2^n the size (level 0 is the kfb itself).
+
+//How the kfb data is held in memory.
+enum class KFBStorage : long {
+	standard = 1,		//Decoded into a padded, row ordered AE memory block.
+	mapped,				//The .kfb file is memory mapped, samples are read directly from the file's (sideways) layout.
+	compact,			//16 bit iterations (from a base for each tile) and the raw (float) smooth data of the kfb (half the memory).
+	shared,				//Decoded into memory shared by every process on the machine (one process decodes, the rest attach).
+	tiled,				//Decoded like standard, but stored in square tiles, so sampling a neighbourhood touches fewer cache lines and pages.
+};
+
+struct KFBSpanKernels;
+struct KFBSidecarHeader;
+
+//A tile of compact storage (kfbTileSize square, in padded co-ordinates), see KFBData::packCompact.
+struct KFBCompactTile {
+	int base			{0};		//Lowest iteration in the tile, each pixel holds its difference from this
+	long overflow		{-1};		//Offset of the tile's iterations in compactOverflow, if they are too far apart for 16 bit differences
+};
+
+//Summary of a tile of the inside mask.
+enum class KFBInsideTile : unsigned char {
+	outside,		//No block is certainly inside (most are outside the set).
+	mixed,
+	inside,			//Every block is certainly inside.
+};
+
+//Where samples are certainly inside the set (see KFBData::PrepareInsideMask).
+//Block (x, y) is the 4x4 pixels with top left (x, y) (padded co-ordinates), which is what a bicubic
+//sample reads from.  Its bit is set if every bicubic sample of the block is at least maxIterations.
+//Tiles summarise kfbTileSize x kfbTileSize blocks.
+struct KFBInsideMask {
+	long width {0};
+	long height {0};
+	long words {0};						//Words of bits per row
+	long tilesX {0};
+	long tilesY {0};
+	std::vector<uint64_t> bits;
+	std::vector<KFBInsideTile> tiles;
+
+	bool inside(long x, long y) const {return (bits[y * words + (x >> 6)] >> (x & 63)) & 1;}
+	KFBInsideTile tile(long tx, long ty) const {return tiles[ty * tilesX + tx];}
+};
+
+//A reduced copy of the smooth data (see KFBData::PrepareMipLevel).
+struct KFBMipLevel {
+	long width {0};
+	long height {0};
+	std::vector<double> smooth;			//Row ordered, no padding
+
+	double value(long x, long y) const {
+		x = (x < 0) ? 0 : ((x > width - 1) ? width - 1 : x);
+		y = (y < 0) ? 0 : ((y > height - 1) ? height - 1 : y);
+		return smooth[y * width + x];
+	}
+};
 
 class KFBData {
 	public:
@@ -34,56 +104,131 @@ class KFBData {
 		unsigned int numColours			{0};			//Num colours as read from kfb
 		RGB kfbColours[maxKFRColours];					//Colour data as read from the .kfb file
 		
-		bool isImageCached				{false};		//Is the image cache valid
-		PF_EffectWorld cachedImage		{};				//The EffectWorld handle. pre-rendered copy of this .kfb data
-		AEGP_WorldH cachedImageAEGP		{};				//The AEGP handle of the cached image
-		
 
 
 	private:
+		KFBStorage storage				{KFBStorage::standard};
 		PF_Handle handle				{nullptr};		//AE memory handle
 		int * data						{nullptr};		//The actual iteration data
 		double * smoothData				{nullptr};		//double containing offsets for smooth shading
+		float * compactRaw				{nullptr};		//Raw smooth data, smooth is iteration + 1 - raw (compact storage only)
+		uint16_t * compactDeltas		{nullptr};		//Iteration less the base of its tile (compact storage only)
+		std::vector<KFBCompactTile> compactTiles;		//Compact storage only
+		std::vector<int> compactOverflow;				//Iterations of the tiles that don't fit compactDeltas, a tile at a time
 		
 		long memSize					{0};			//Size of the data array
 		long width						{0};			//Width of kfb
 		long height						{0};			//Height (in AE orientation)
 		long memWidth					{0};			//Width in actual memory (includes padding)
 		long memHeight {0};
+		bool tiled						{false};		//Tiled storage (see makeIndex)
+		long tilesX						{0};			//Tiles across (tiled and compact storage only)
+		long smoothOffset				{0};			//Offset (bytes) from data to smoothData
+
+		MappedFile mappedFile			{};				//The mapped .kfb or .kfbc (mapped storage only)
+		const char * mappedIterations	{nullptr};		//Start of the iteration section in the mapped file
+		const char * mappedSmooth		{nullptr};		//Start of the smooth section in the mapped file
+		SharedMemory sharedMemory		{};				//The shared block (shared storage only)
+		std::string sharedName;							//Its name (see closeShared)
+
+		//Mip levels and the inside mask are built on demand (see PrepareMipLevel and PrepareInsideMask)
+		//and then never changed.
+		mutable std::mutex buildMutex;
+		mutable std::array<std::unique_ptr<const KFBMipLevel>, kfbMipLevels> mipLevels;
+		mutable std::unique_ptr<const KFBInsideMask> insideMaskData;
+		mutable std::atomic<const KFBInsideMask*> insideMask	{nullptr};		//Set once insideMaskData is complete
+		mutable std::atomic<size_t> derivedBytes	{0};					//Memory used by the above
 	public:
-		KFBData(int w, int h);
+		KFBData(int w, int h, KFBStorage storage = KFBStorage::standard);
 		~KFBData();
 
-		long dataSize() {return width*height * sizeof(int);}
-		long getWidth() {return width;} 
-		long getHeight() {return height;} 
-		int * getIterationData() {return data;}
-		double * getSmoothData() {return smoothData;}
+		long dataSize() const {return width*height * sizeof(int);}
+		KFBStorage getStorage() const {return storage;}
+		//Includes the whole of a mapped file, as sampling a keyframe soon touches all of it.
+		size_t memoryUsage() const {return static_cast<size_t>(memSize) + compactOverflow.size() * sizeof(int) + mappedFile.size + derivedBytes.load();}
+		long getWidth() const {return width;} 
+		long getHeight() const {return height;} 
+		const int * getIterationData() const {return data;}
+		const double * getSmoothData() const {return smoothData;}
 		
 		
-		int getIterationCount(long x, long y);
-		double getIterationCountSmooth(long x, long y);
-		double calculateIterationCountBiCubic(double x, double y, bool smooth = true);
-		double calculateIterationCountBiLinear(double x, double y);
-		double calculateIterationCountBiLinearNoPad(double x, double y);
-		void getDistanceMatrix(double p[][3], double x, double y, double step, bool minimal=false);
+		int getIterationCount(long x, long y) const;
+		double getIterationCountSmooth(long x, long y) const;
+		double calculateIterationCountBiCubic(double x, double y, bool smooth = true, int mipLevel = 0) const;
+		void calculateIterationCountBiCubicSpan(const float * xs, long count, double y, double * out, bool smooth = true, int mipLevel = 0) const;
+		void getSmoothRow(long x, long y, long count, double * out) const;
+		double calculateIterationCountBiLinear(double x, double y) const;
+		double calculateIterationCountBiLinearNoPad(double x, double y) const;
+		void getDistanceMatrix(double p[][3], double x, double y, double step, bool minimal=false) const;
+		int PrepareMipLevel(double step, WorkerPool * pool = nullptr) const;
+		void PrepareInsideMask(WorkerPool * pool = nullptr) const;
+		const KFBInsideMask * getInsideMask() const {return insideMask.load(std::memory_order_acquire);}
 		
 		
-		void DisposeOfCache();
-		void ReadKFBFile(std::string fileName);
+		void ReadKFBFile(std::string fileName, WorkerPool * pool = nullptr, WorkPriority priority = WorkPriority::decode);
+		bool ReadSidecar(const std::string & kfbFileName);
+		void WriteSidecar(const std::string & kfbFileName) const;
 
 	private:
-		long makeIndex(long x, long y) {return  y*memWidth + x;}
-		
-		long calcIndexAndClamp(long x, long y) {
-			x = (x < 0) ? 0 : ((x > width - 1) ? width - 1 : x);
-			y = (y < 0) ? 0 : ((y > height - 1) ? height - 1 : y);
-			return  y*memWidth + x;
+		void decodeKFBFile(const std::string & fileName, WorkerPool & pool, WorkPriority priority);
+		void readShared(const std::string & fileName, WorkerPool & pool, WorkPriority priority);
+		void openShared(const std::string & name);
+		void closeShared() noexcept;
+		void fillSidecarHeader(KFBSidecarHeader & header) const;
+		void readSidecarHeader(const KFBSidecarHeader & header);
+		void transposeIterationBand(const int * band, long x, long columns);
+		void transposeSmoothBand(const float * band, long x, long columns);
+		void transposeRawBand(const float * band, long x, long columns);
+		template <typename T> void padColumn(T * buffer, long x);
+		template <typename T> void padRow(T * buffer, long y);
+		template <typename Pad> void padRows(WorkerPool & pool, WorkPriority priority, Pad pad);
+		void padCompact(long x, long y, long dx, long dy);
+		template <typename Read, typename Decode> void pipelineBands(WorkerPool & pool, WorkPriority priority, int slots, Read read, Decode decode);
+		int decodeSlots(WorkerPool & pool);
+		void readColours(std::istream & file);
+		void readCompact(std::istream & file, WorkerPool & pool, WorkPriority priority, int slots);
+		void packCompact(WorkerPool & pool, WorkPriority priority);
+		void MapKFBFile(const std::string & fileName);
+		template <typename T> T mappedValue(long x, long y) const;
+		void buildMipLevel(int level, WorkerPool & pool) const;
+		double mipBiCubic(int mipLevel, double x, double y) const;
+		void gatherSmooth(long x, long y, double values[][4]) const;
+		void spanColumns(const KFBSpanKernels & kernels, long x, long top, long count, double offset, double * out) const;
+
+		//Index of padded co-ordinates.  Tiled storage holds each tile's rows together, one tile after another.
+		long makeIndex(long x, long y) const {
+			if(!tiled) return y*memWidth + x;
+			constexpr long mask = kfbTileSize - 1;
+			return (((y >> kfbTileShift) * tilesX + (x >> kfbTileShift)) << (kfbTileShift * 2)) + ((y & mask) << kfbTileShift) + (x & mask);
 		}
+		long makeTileIndex(long x, long y) const {return (y >> kfbTileShift) * tilesX + (x >> kfbTileShift);}
+		long clampX(long x) const {return (x < 0) ? 0 : ((x > width - 1) ? width - 1 : x);}
+		long clampY(long y) const {return (y < 0) ? 0 : ((y > height - 1) ? height - 1 : y);}
 
-		double smoothValue(long x, long y) { return smoothData[y*memWidth + x];}
-		int iterationValue(long x, long y) { return data[y*memWidth + x]; }
+		//Values at padded co-ordinates.
+		//Note: A mapped .kfbc sidecar is already decoded, so only a mapped .kfb has no data pointers.
+		//Compact storage makes the smooth value as it is sampled, the same way as it is decoded (see transposeSmoothBand).
+		double smoothValue(long x, long y) const {
+			if(smoothData) return smoothData[makeIndex(x, y)];
+			if(compactRaw) return static_cast<double>(compactIteration(x, y)) + 1 - static_cast<double>(compactRaw[makeIndex(x, y)]);
+			return mappedValue<double>(x, y);
+		}
+		int iterationValue(long x, long y) const {
+			if(data) return data[makeIndex(x, y)];
+			if(compactDeltas) return compactIteration(x, y);
+			return mappedValue<int>(x, y);
+		}
+		int compactIteration(long x, long y) const {
+			const KFBCompactTile & tile = compactTiles[makeTileIndex(x, y)];
+			if(tile.overflow < 0) return tile.base + compactDeltas[makeIndex(x, y)];
+			constexpr long mask = kfbTileSize - 1;
+			return compactOverflow[tile.overflow + ((y & mask) << kfbTileShift) + (x & mask)];
+		}
 		
 };
 
-
+std::string KFBSidecarFileName(const std::string & kfbFileName);
+std::string KFBSharedMemoryName(uint64_t hash, long width, long height);
+uint64_t KFBSharedHash(const std::string & kfbFileName);
+constexpr uint64_t kfbHashSeed = 14695981039346656037ull;
+uint64_t HashKFBBytes(uint64_t hash, const char * bytes, size_t count);
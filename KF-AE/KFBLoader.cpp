@@ -0,0 +1,265 @@
+/********************************************************************************************
+KFBLoader.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Description:	Loads .kfb files on demand, or in the background ahead of the render.
+				Demand loads are started on the calling (render) thread, and their bands
+				are decoded at WorkPriority::load, so the shared pool runs them before the
+				bands of speculative loads (WorkPriority::decode).  Background loads are
+				started by a small pool of worker threads.
+				A demand for a keyframe whose speculative load has already started waits
+				for that load.
+
+Licence:		GNU Affero General Public License
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBLoader.h"
+#include "OS.h"
+
+#include <algorithm>
+
+/*******************************************************************************************************
+Constructor
+Worker threads are not started until something is prefetched.
+*******************************************************************************************************/
+KFBLoader::KFBLoader()
+{
+}
+
+/*******************************************************************************************************
+Destructor
+Drops any queued work and waits for the worker threads to finish their current file.
+*******************************************************************************************************/
+KFBLoader::~KFBLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		stopping = true;
+		cancelAll();
+	}
+	wake.notify_all();
+	for(auto & worker : workers) worker.join();
+}
+
+/*******************************************************************************************************
+Set the files (and format) to load.  Anything queued or loaded for the previous sequence is dropped.
+*******************************************************************************************************/
+void KFBLoader::SetSequence(const std::vector<std::string> & files, const std::vector<std::string> & keys, int width, int height, KFBStorage storage) {
+	std::lock_guard<std::mutex> lock(mutex);
+	cancelAll();
+	this->files = files;
+	this->keys = keys;
+	this->width = width;
+	this->height = height;
+	this->storage = storage;
+}
+
+/*******************************************************************************************************
+Get a keyframe now.
+If it has already been prefetched it is returned straight away.  If it is being loaded by another
+thread we wait for that load.  Otherwise it is loaded on this thread, ahead of any loads in the
+background (see WorkPriority::load).
+*******************************************************************************************************/
+std::shared_ptr<const KFBData> KFBLoader::Load(long keyFrame) {
+	std::unique_lock<std::mutex> lock(mutex);
+	if(keyFrame < 0 || keyFrame >= static_cast<long>(files.size())) throw(std::exception("Invalid keyFrame requested in LoadKFB()"));
+
+	auto found = requests.find(keyFrame);
+	auto request = (found != requests.end()) ? found->second : makeRequest(keyFrame);
+	std::shared_ptr<const KFBData> data;
+
+	if(request->started) {
+		//Already loading (or loaded), just wait for it.
+		auto result = request->result;
+		lock.unlock();
+		data = result.get();
+	}
+	else {
+		//Load on this thread (takes the request away from the workers if it was queued).
+		request->started = true;
+		const auto fileName = files[keyFrame];
+		const auto key = keys[keyFrame];
+		const auto w = width;
+		const auto h = height;
+		const auto s = storage;
+		const auto sidecar = useSidecars;
+		lock.unlock();
+		try {
+			data = loadNow(fileName, key, w, h, s, sidecar, WorkPriority::load);
+			request->promise.set_value(data);
+		}
+		catch(...) {
+			request->promise.set_exception(std::current_exception());
+			lock.lock();
+			found = requests.find(keyFrame);
+			if(found != requests.end() && found->second == request) requests.erase(found);
+			throw;
+		}
+	}
+
+	//The caller has the data now, so we no longer need to track it.
+	lock.lock();
+	found = requests.find(keyFrame);
+	if(found != requests.end() && found->second == request) requests.erase(found);
+	return data;
+}
+
+/*******************************************************************************************************
+Load these keyframes in the background (in order of priority).
+Any queued or loaded keyframes not in the list are dropped.
+Note: Loads that have already started will finish, but the result is discarded.
+*******************************************************************************************************/
+void KFBLoader::Prefetch(const std::vector<long> & keyFrames) {
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		if(stopping) return;
+
+		//Drop anything that is no longer wanted
+		for(auto it = requests.begin(); it != requests.end();) {
+			if(std::find(keyFrames.begin(), keyFrames.end(), it->first) == keyFrames.end()) {
+				it->second->cancelled = true;
+				it = requests.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		queue.erase(std::remove_if(queue.begin(), queue.end(), [](const auto & r) {return r->cancelled; }), queue.end());
+
+		//Queue anything new
+		for(const auto keyFrame : keyFrames) {
+			if(keyFrame < 0 || keyFrame >= static_cast<long>(files.size())) continue;
+			if(requests.count(keyFrame)) continue;
+			queue.push_back(makeRequest(keyFrame));
+		}
+		if(queue.empty()) return;
+
+		if(workers.empty()) {
+			for(int i = 0; i < kfbLoaderThreads; i++) workers.emplace_back(&KFBLoader::workerLoop, this);
+		}
+	}
+	wake.notify_all();
+}
+
+/*******************************************************************************************************
+Drop all queued and loaded keyframes.
+*******************************************************************************************************/
+void KFBLoader::Cancel() {
+	std::lock_guard<std::mutex> lock(mutex);
+	cancelAll();
+}
+
+/*******************************************************************************************************
+Turn .kfbc sidecar files on or off.  Applies to loads that haven't started yet.
+*******************************************************************************************************/
+void KFBLoader::SetUseSidecars(bool use) {
+	std::lock_guard<std::mutex> lock(mutex);
+	useSidecars = use;
+}
+
+/*******************************************************************************************************
+Creates a request and adds it to the map.  Mutex must be held.
+*******************************************************************************************************/
+std::shared_ptr<KFBLoader::Request> KFBLoader::makeRequest(long keyFrame) {
+	auto request = std::make_shared<Request>();
+	request->keyFrame = keyFrame;
+	request->result = request->promise.get_future().share();
+	requests[keyFrame] = request;
+	return request;
+}
+
+/*******************************************************************************************************
+Drop all queued and loaded keyframes.  Mutex must be held.
+*******************************************************************************************************/
+void KFBLoader::cancelAll() {
+	for(auto & request : requests) request.second->cancelled = true;
+	requests.clear();
+	queue.clear();
+}
+
+/*******************************************************************************************************
+Get a keyframe from the shared cache, or read it and add it to the cache.
+The inside mask is built as it is read (see KFBData::PrepareInsideMask).
+*******************************************************************************************************/
+std::shared_ptr<const KFBData> KFBLoader::loadNow(const std::string & fileName, const std::string & key, int w, int h, KFBStorage s, bool sidecar, WorkPriority priority) {
+	auto & cache = KFBCache::Shared();
+	std::shared_ptr<const KFBData> data = cache.Find(key);
+	if(data) return data;
+	data = readFile(fileName, w, h, s, sidecar, priority);
+	data->PrepareInsideMask();
+	cache.Insert(key, data);
+	return data;
+}
+
+/*******************************************************************************************************
+Actually read a .kfb file.
+With sidecars on, a valid .kfbc is read instead.  If there isn't one, the .kfb is read and a sidecar is
+written from it for next time.  Failing to write a sidecar (eg. read only folder) is not an error.
+Mapped storage then maps the new sidecar, as it is sampled faster than the .kfb (see mappedValue).
+Shared storage ignores sidecars.
+*******************************************************************************************************/
+std::shared_ptr<KFBData> KFBLoader::readFile(const std::string & fileName, int w, int h, KFBStorage s, bool sidecar, WorkPriority priority) {
+	auto data = std::make_shared<KFBData>(w, h, s);
+	sidecar = sidecar && s != KFBStorage::shared;
+	if(sidecar && data->ReadSidecar(fileName)) {
+		DebugMessage("Read KFB Sidecar:"); DebugMessage(fileName); DebugMessage("\n");
+		return data;
+	}
+
+	DebugMessage("Reading KFB File:"); DebugMessage(fileName); DebugMessage("\n");
+	data->ReadKFBFile(fileName, nullptr, priority);
+	if(!sidecar) return data;
+	try {
+		data->WriteSidecar(fileName);
+	}
+	catch(const std::exception & e) {
+		DebugMessage("Unable to write KFB Sidecar: "); DebugMessage(e.what()); DebugMessage("\n");
+		return data;
+	}
+	if(s == KFBStorage::mapped && !data->ReadSidecar(fileName)) data->ReadKFBFile(fileName, nullptr, priority);
+	return data;
+}
+
+/*******************************************************************************************************
+Worker thread.  Takes speculative loads off the queue until told to stop.
+These threads have no in_data, so KFBData gets the AE memory suites (which are thread safe) from the
+basic suite kept at global setup (see globalBasicSuite).
+*******************************************************************************************************/
+void KFBLoader::workerLoop() {
+	std::unique_lock<std::mutex> lock(mutex);
+	while(true) {
+		wake.wait(lock, [this] {return stopping || !queue.empty(); });
+		if(stopping) return;
+
+		auto request = queue.front();
+		queue.pop_front();
+		if(request->started || request->cancelled) continue;
+		request->started = true;
+		const auto fileName = files[request->keyFrame];
+		const auto key = keys[request->keyFrame];
+		const auto w = width;
+		const auto h = height;
+		const auto s = storage;
+		const auto sidecar = useSidecars;
+		lock.unlock();
+
+		try {
+			request->promise.set_value(loadNow(fileName, key, w, h, s, sidecar, WorkPriority::decode));
+		}
+		catch(...) {
+			request->promise.set_exception(std::current_exception());
+		}
+		request = nullptr;		//If it was cancelled, the data is released here.
+
+		lock.lock();
+	}
+}
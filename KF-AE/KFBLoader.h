@@ -0,0 +1,85 @@
+#pragma once
+/********************************************************************************************
+KFBLoader.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Loads .kfb files for a sequence, either on demand (the render is waiting) or speculatively in
+the background (keyframes we expect to need soon).
+A keyframe is only ever loaded once at a time. A render asking for a keyframe that is already
+being loaded waits for that load rather than starting another.
+A render's own loads decode at a higher priority (WorkPriority::load) than loads ahead, so their
+jobs are taken first by the shared WorkerPool.
+Loaded keyframes go into the shared KFBCache (so other instances can use them), and keyframes
+already in the cache are not loaded again.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBData.h"
+#include "KFBCache.h"
+
+#include <condition_variable>
+#include <deque>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr int kfbLoaderThreads = 2;		//Background threads.  Loading is mostly disk bound, so keep this small.
+
+class KFBLoader {
+	public:
+		KFBLoader();
+		~KFBLoader();
+		KFBLoader(const KFBLoader &) = delete;
+		KFBLoader & operator=(const KFBLoader &) = delete;
+
+		void SetSequence(const std::vector<std::string> & files, const std::vector<std::string> & keys, int width, int height, KFBStorage storage);
+		std::shared_ptr<const KFBData> Load(long keyFrame);
+		void Prefetch(const std::vector<long> & keyFrames);
+		void Cancel();
+		void SetUseSidecars(bool use);
+
+	private:
+		struct Request {
+			long keyFrame {-1};
+			bool started {false};		//A thread has begun loading
+			bool cancelled {false};		//No longer wanted, result will be discarded
+			std::promise<std::shared_ptr<const KFBData>> promise;
+			std::shared_future<std::shared_ptr<const KFBData>> result;
+		};
+
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::vector<std::thread> workers;
+		bool stopping {false};
+
+		std::map<long, std::shared_ptr<Request>> requests;		//Queued, loading, or loaded but not yet collected
+		std::deque<std::shared_ptr<Request>> queue;				//Speculative loads, in priority order
+
+		//Sequence details (protected by mutex)
+		std::vector<std::string> files;
+		std::vector<std::string> keys;		//Cache key of each file
+		int width {0};
+		int height {0};
+		KFBStorage storage {KFBStorage::standard};
+		bool useSidecars {false};			//Read (and write) .kfbc sidecar files
+
+		std::shared_ptr<Request> makeRequest(long keyFrame);
+		std::shared_ptr<const KFBData> loadNow(const std::string & fileName, const std::string & key, int w, int h, KFBStorage s, bool sidecar, WorkPriority priority);
+		std::shared_ptr<KFBData> readFile(const std::string & fileName, int w, int h, KFBStorage s, bool sidecar, WorkPriority priority);
+		void cancelAll();
+		void workerLoop();
+};
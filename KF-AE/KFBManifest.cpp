@@ -0,0 +1,445 @@
+/********************************************************************************************
+KFBManifest.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Description:	A saved list of the .kfb files of a sequence, with statistics about each keyframe.
+				Keyframes that are new or have changed are scanned by a small pool of background
+				threads, and the manifest is saved again when they are done.
+
+Licence:		GNU Affero General Public License
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBManifest.h"
+#include "KFBData.h"
+#include "OS.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <limits>
+#include <sstream>
+
+namespace fs = std::filesystem;
+
+static int64_t modifiedTime(const fs::path & path);
+
+/*******************************************************************************************************
+Destructor
+Stops any background scan (the manifest is not saved).
+*******************************************************************************************************/
+KFBManifest::~KFBManifest()
+{
+	Close();
+}
+
+/*******************************************************************************************************
+Open the manifest for a .kfr file.
+The saved manifest is used if there is one.  The folder is only listed if it has changed since, and
+only keyframes whose size or modified time have changed are scanned again (in the background).
+*******************************************************************************************************/
+void KFBManifest::Open(const std::string & kfrFileName) {
+	Close();
+	std::unique_lock<std::mutex> lock(mutex);
+	manifestFileName = fs::path(kfrFileName).replace_extension(".kfbm").string();
+	folder = fs::weakly_canonical(fs::path(kfrFileName)).parent_path().string();
+	keyFrames.clear();
+	width = 0;
+	height = 0;
+
+	std::vector<KFBKeyFrameStats> saved;
+	int64_t savedFolderModified = 0;
+	const bool haveSaved = read(saved, savedFolderModified);
+	folderModified = modifiedTime(folder);
+	bool changed = !haveSaved || savedFolderModified != folderModified;
+
+	if(!changed) {
+		keyFrames = std::move(saved);
+	}
+	else {
+		//Files have been added or removed.  Keep what we know about the ones still here.
+		list();
+		for(auto & entry : keyFrames) {
+			auto found = std::find_if(saved.begin(), saved.end(), [&entry](const auto & s) {return s.fileName == entry.fileName; });
+			if(found != saved.end()) entry = *found;
+		}
+	}
+
+	//Check each file is the same as when it was scanned.
+	bool needsScan = false;
+	for(auto & entry : keyFrames) {
+		const auto path = fs::path(folder) / entry.fileName;
+		std::error_code ec;
+		const uint64_t size = fs::file_size(path, ec);
+		const int64_t modified = modifiedTime(path);
+		if(entry.size != size || entry.modified != modified) {
+			const auto name = entry.fileName;
+			entry = KFBKeyFrameStats {};
+			entry.fileName = name;
+			entry.size = size;
+			entry.modified = modified;
+			changed = true;
+		}
+		if(!entry.scanned) needsScan = true;
+	}
+
+	if(keyFrames.empty()) return;
+	readSize();
+	lock.unlock();
+	if(needsScan) {
+		scanner = std::thread(&KFBManifest::scan, this);
+	}
+	else if(changed) {
+		write();
+	}
+}
+
+/*******************************************************************************************************
+Stop any background scan.
+*******************************************************************************************************/
+void KFBManifest::Close() {
+	stopping = true;
+	if(scanner.joinable()) scanner.join();
+	stopping = false;
+}
+
+/*******************************************************************************************************
+The .kfb files (full path), in keyframe order.
+*******************************************************************************************************/
+std::vector<std::string> KFBManifest::GetFiles() {
+	std::lock_guard<std::mutex> lock(mutex);
+	std::vector<std::string> files;
+	for(const auto & entry : keyFrames) files.push_back((fs::path(folder) / entry.fileName).string());
+	return files;
+}
+
+/*******************************************************************************************************
+Get the statistics for a keyframe.  Returns false if it hasn't been scanned (yet).
+*******************************************************************************************************/
+bool KFBManifest::GetStats(long keyFrame, KFBKeyFrameStats & stats) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(keyFrame < 0 || keyFrame >= static_cast<long>(keyFrames.size())) return false;
+	if(!keyFrames[keyFrame].scanned) return false;
+	stats = keyFrames[keyFrame];
+	return true;
+}
+
+/*******************************************************************************************************
+Get the size and modified time of a keyframe's file (as checked when the manifest was opened).
+*******************************************************************************************************/
+bool KFBManifest::GetFileInfo(long keyFrame, uint64_t & size, int64_t & modified) {
+	std::lock_guard<std::mutex> lock(mutex);
+	if(keyFrame < 0 || keyFrame >= static_cast<long>(keyFrames.size())) return false;
+	size = keyFrames[keyFrame].size;
+	modified = keyFrames[keyFrame].modified;
+	return true;
+}
+
+/*******************************************************************************************************
+Read the saved manifest.  Returns false if there isn't one (or it can't be used).
+Mutex must be held.
+*******************************************************************************************************/
+bool KFBManifest::read(std::vector<KFBKeyFrameStats> & saved, int64_t & savedFolderModified) {
+	std::ifstream file {manifestFileName};
+	if(!file) return false;
+
+	std::string line;
+	int version = 0;
+	while(std::getline(file, line)) {
+		auto ss = std::istringstream(line);
+		std::string lineHeader;
+		ss >> lineHeader;
+		if(lineHeader == "KFBManifest:") ss >> version;
+		if(lineHeader == "Folder:") ss >> savedFolderModified;
+		if(lineHeader == "KeyFrame:") {
+			KFBKeyFrameStats entry;
+			ss >> std::quoted(entry.fileName) >> entry.size >> entry.modified >> entry.scanned >> entry.hash;
+			ss >> entry.width >> entry.height >> entry.maxIterations >> entry.colourDiv;
+			ss >> entry.minIteration >> entry.maxIteration;
+			for(auto & p : entry.iterationPercentiles) ss >> p;
+			ss >> entry.minSmooth >> entry.maxSmooth;
+			for(auto & p : entry.smoothPercentiles) ss >> p;
+			if(ss.fail()) return false;
+			saved.push_back(entry);
+		}
+		if(lineHeader == "Colours:" && !saved.empty()) {
+			int red = 0, green = 0, blue = 0;
+			char c1 = 0, c2 = 0, c3 = 0;
+			while(ss >> red >> c1 >> green >> c2 >> blue >> c3 && saved.back().colours.size() < maxKFRColours) {
+				saved.back().colours.push_back(RGB(red, green, blue));
+			}
+		}
+	}
+	return version == kfbManifestVersion && !saved.empty();
+}
+
+/*******************************************************************************************************
+Save the manifest next to the .kfr (through a temporary file).
+Saving changes the folder's modified time, so the time is patched in afterwards (changing a file's
+contents doesn't change the folder).
+Not being able to save it (eg. read only folder) is not an error, it is just rebuilt next time.
+*******************************************************************************************************/
+void KFBManifest::write() {
+	std::vector<KFBKeyFrameStats> entries;
+	std::string fileName;
+	std::string folderName;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		entries = keyFrames;
+		fileName = manifestFileName;
+		folderName = folder;
+	}
+	const auto tempName = fileName + ".tmp";
+	const auto writeFolderTime = [](std::ostream & file, int64_t time) {
+		file << std::setw(21) << std::setfill('0') << std::internal << std::showpos << time << std::noshowpos << std::setfill(' ');
+	};
+
+	try {
+		std::streamoff folderTimePosition = 0;
+		{
+			std::ofstream file {tempName, std::ios::out | std::ios::binary | std::ios::trunc};
+			if(!file) throw(std::exception("Unable to create manifest\n"));
+			file << std::setprecision(std::numeric_limits<double>::max_digits10);
+			file << "KFBManifest: " << kfbManifestVersion << "\n";
+			file << "Folder: ";
+			folderTimePosition = file.tellp();
+			writeFolderTime(file, 0);
+			file << "\n";
+			for(const auto & entry : entries) {
+				file << "KeyFrame: " << std::quoted(entry.fileName) << " " << entry.size << " " << entry.modified << " " << entry.scanned << " " << entry.hash;
+				file << " " << entry.width << " " << entry.height << " " << entry.maxIterations << " " << entry.colourDiv;
+				file << " " << entry.minIteration << " " << entry.maxIteration;
+				for(const auto p : entry.iterationPercentiles) file << " " << p;
+				file << " " << entry.minSmooth << " " << entry.maxSmooth;
+				for(const auto p : entry.smoothPercentiles) file << " " << p;
+				file << "\n";
+				if(entry.colours.empty()) continue;
+				file << "Colours: ";
+				for(const auto & c : entry.colours) file << static_cast<int>(c.red) << "," << static_cast<int>(c.green) << "," << static_cast<int>(c.blue) << ",";
+				file << "\n";
+			}
+			if(!file) throw(std::exception("Unable to write manifest\n"));
+		}
+		fs::rename(tempName, fileName);
+
+		const auto modified = modifiedTime(folderName);
+		std::fstream file {fileName, std::ios::in | std::ios::out | std::ios::binary};
+		file.seekp(folderTimePosition);
+		writeFolderTime(file, modified);
+		if(!file) throw(std::exception("Unable to write manifest\n"));
+		std::lock_guard<std::mutex> lock(mutex);
+		folderModified = modified;
+	}
+	catch(const std::exception & e) {
+		DebugMessage("Unable to save KFB manifest: "); DebugMessage(e.what()); DebugMessage("\n");
+		std::error_code ec;
+		fs::remove(tempName, ec);
+	}
+}
+
+/*******************************************************************************************************
+List the .kfb files in the folder (sorted as keyframes are numbered).  Mutex must be held.
+*******************************************************************************************************/
+void KFBManifest::list() {
+	keyFrames.clear();
+	std::vector<std::string> names;
+	for(const auto & entry : fs::directory_iterator(folder)) {
+		if(entry.path().extension().compare(".kfb") == 0) {
+			names.push_back(entry.path().filename().string());
+		}
+	}
+	std::sort(names.rbegin(), names.rend());
+	for(const auto & name : names) {
+		KFBKeyFrameStats entry;
+		entry.fileName = name;
+		keyFrames.push_back(entry);
+	}
+}
+
+/*******************************************************************************************************
+Get the size of the sequence.  From the manifest if the first keyframe has been scanned, otherwise
+from the header of the first .kfb.  Mutex must be held.
+*******************************************************************************************************/
+void KFBManifest::readSize() {
+	if(keyFrames[0].scanned) {
+		width = keyFrames[0].width;
+		height = keyFrames[0].height;
+		return;
+	}
+	const auto fileName = fs::path(folder) / keyFrames[0].fileName;
+	if(!fs::exists(fileName)) throw (std::exception("KFB file missing\n"));
+
+	//Readfile
+	std::ifstream file {fileName, std::ios::binary | std::ios::in};
+	if(!file) throw (std::exception("Unable to open KFB file\n"));
+
+	//Check ID
+	char id[3];
+	file.read(id, 3);
+	if(!(id[0] == 'K' && id[1] == 'F' && id[2] == 'B')) throw (std::exception("KFB file has invalid ID\n"));
+
+	//Read Size
+	file.read(reinterpret_cast<char*>(&width), sizeof(width));
+	file.read(reinterpret_cast<char*>(&height), sizeof(height));
+}
+
+/*******************************************************************************************************
+Background thread.  Scans all keyframes that haven't been scanned (in parallel), then saves.
+*******************************************************************************************************/
+void KFBManifest::scan() {
+	std::vector<size_t> todo;
+	{
+		std::lock_guard<std::mutex> lock(mutex);
+		for(size_t i = 0; i < keyFrames.size(); i++) if(!keyFrames[i].scanned) todo.push_back(i);
+	}
+
+	std::atomic<size_t> next {0};
+	auto worker = [this, &todo, &next]() {
+		while(!stopping) {
+			const size_t i = next++;
+			if(i >= todo.size()) return;
+			KFBKeyFrameStats entry;
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				entry = keyFrames[todo[i]];
+			}
+			try {
+				entry = scanFile(entry);
+			}
+			catch(const std::exception & e) {
+				DebugMessage("Unable to scan KFB file: "); DebugMessage(entry.fileName); DebugMessage(e.what()); DebugMessage("\n");
+				continue;
+			}
+			std::lock_guard<std::mutex> lock(mutex);
+			keyFrames[todo[i]] = entry;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	const size_t threads = std::min(todo.size(), static_cast<size_t>(kfbScanThreads));
+	for(size_t i = 0; i < threads; i++) workers.emplace_back(worker);
+	for(auto & w : workers) w.join();
+	if(!stopping) write();
+}
+
+/*******************************************************************************************************
+Read a whole .kfb and gather its statistics (and content hash).
+The file is read in order so it is hashed as it is read.  Each section is streamed a chunk at a time:
+the smooth value needs the iteration count, so the iteration data is read again (through a second
+stream) alongside the smooth data rather than kept.  Percentiles are taken from a sample of about
+kfbScanSamples values, so a scanner holds a few MB whatever the size of the keyframe.
+Returns the entry unscanned if we are stopping.
+*******************************************************************************************************/
+KFBKeyFrameStats KFBManifest::scanFile(const KFBKeyFrameStats & entry) {
+	KFBKeyFrameStats result = entry;
+	std::ifstream file {fs::path(folder) / entry.fileName, std::ios::binary | std::ios::in};
+	if(!file) throw (std::exception("Unable to open KFB file\n"));
+	uint64_t hash = kfbHashSeed;
+	auto readHashed = [&file, &hash](void * buffer, size_t bytes) {
+		file.read(static_cast<char*>(buffer), bytes);
+		if(!file) throw (std::exception("KFB file is truncated\n"));
+		hash = HashKFBBytes(hash, static_cast<const char*>(buffer), bytes);
+	};
+
+	//Header
+	char id[3];
+	readHashed(id, 3);
+	if(!(id[0] == 'K' && id[1] == 'F' && id[2] == 'B')) throw (std::exception("KFB file has invalid ID\n"));
+	readHashed(&result.width, sizeof(int));
+	readHashed(&result.height, sizeof(int));
+	if(result.width <= 0 || result.height <= 0) throw (std::exception("KFB file has incorrect size\n"));
+	const size_t count = static_cast<size_t>(result.width) * result.height;
+	const size_t stride = std::max<size_t>(1, count / kfbScanSamples);
+	const size_t chunk = 1 << 18;
+	const auto iterationStart = file.tellg();
+
+	//Iteration data (only the range and samples are kept)
+	std::vector<int> iterations(std::min(chunk, count));
+	std::vector<int> iterationSamples;
+	iterationSamples.reserve(count / stride + 1);
+	result.minIteration = std::numeric_limits<int>::max();
+	result.maxIteration = std::numeric_limits<int>::lowest();
+	for(size_t i = 0; i < count; i += chunk) {
+		if(stopping) return entry;
+		const size_t n = std::min(chunk, count - i);
+		readHashed(iterations.data(), n * sizeof(int));
+		for(size_t j = 0; j < n; j++) {
+			result.minIteration = std::min(result.minIteration, iterations[j]);
+			result.maxIteration = std::max(result.maxIteration, iterations[j]);
+			if((i + j) % stride == 0) iterationSamples.push_back(iterations[j]);
+		}
+	}
+
+	//Colour information and max iterations
+	unsigned int numColours = 0;
+	readHashed(&result.colourDiv, sizeof(int));
+	readHashed(&numColours, sizeof(int));
+	if(numColours > maxKFRColours) throw(std::exception("Number of KFB colours invalid."));
+	result.colours.resize(numColours);
+	for(auto & colour : result.colours) {
+		unsigned char rgb[3];
+		readHashed(rgb, 3);
+		colour = RGB(rgb[0], rgb[1], rgb[2]);
+	}
+	readHashed(&result.maxIterations, sizeof(int));
+
+	//Smooth data, with the iteration data read again alongside it.
+	std::ifstream iterationFile {fs::path(folder) / entry.fileName, std::ios::binary | std::ios::in};
+	iterationFile.seekg(iterationStart);
+	std::vector<float> raw(iterations.size());
+	std::vector<double> smoothSamples;
+	smoothSamples.reserve(iterationSamples.size());
+	result.minSmooth = std::numeric_limits<double>::max();
+	result.maxSmooth = std::numeric_limits<double>::lowest();
+	for(size_t i = 0; i < count; i += chunk) {
+		if(stopping) return entry;
+		const size_t n = std::min(chunk, count - i);
+		iterationFile.read(reinterpret_cast<char*>(iterations.data()), n * sizeof(int));
+		if(!iterationFile) throw (std::exception("Unable to read KFB iteration data\n"));
+		readHashed(raw.data(), n * sizeof(float));
+		for(size_t j = 0; j < n; j++) {
+			const double smooth = static_cast<double>(iterations[j]) + 1 - static_cast<double>(raw[j]);
+			result.minSmooth = std::min(result.minSmooth, smooth);
+			result.maxSmooth = std::max(result.maxSmooth, smooth);
+			if((i + j) % stride == 0) smoothSamples.push_back(smooth);
+		}
+	}
+
+	//Anything after the smooth data is part of the file's hash too.
+	std::vector<char> rest(chunk);
+	while(file.read(rest.data(), rest.size()) || file.gcount() > 0) {
+		hash = HashKFBBytes(hash, rest.data(), static_cast<size_t>(file.gcount()));
+	}
+	result.hash = hash;
+
+	//Percentiles
+	const double percentiles[3] = {0.01, 0.5, 0.99};
+	for(int p = 0; p < 3; p++) {
+		const size_t index = static_cast<size_t>(percentiles[p] * (iterationSamples.size() - 1));
+		std::nth_element(iterationSamples.begin(), iterationSamples.begin() + index, iterationSamples.end());
+		std::nth_element(smoothSamples.begin(), smoothSamples.begin() + index, smoothSamples.end());
+		result.iterationPercentiles[p] = iterationSamples[index];
+		result.smoothPercentiles[p] = smoothSamples[index];
+	}
+	result.scanned = true;
+	return result;
+}
+
+/*******************************************************************************************************
+Modified time of a file or folder (0 if it doesn't exist).
+*******************************************************************************************************/
+static int64_t modifiedTime(const fs::path & path) {
+	std::error_code ec;
+	const auto time = fs::last_write_time(path, ec);
+	if(ec) return 0;
+	return static_cast<int64_t>(time.time_since_epoch().count());
+}
@@ -0,0 +1,90 @@
+#pragma once
+/********************************************************************************************
+KFBManifest.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+A list of the .kfb files of a sequence, with statistics about each keyframe.
+Saved as a text file next to the .kfr, so opening a project doesn't need to list the folder or
+open any .kfb files.  Entries are checked against each file's size and modified time, and any
+that have changed (or are new) are scanned again in the background.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFMovieMaker.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+constexpr int kfbManifestVersion = 1;
+constexpr int kfbScanThreads = 4;				//Scanning is mostly disk bound.
+constexpr size_t kfbScanSamples = 65536;		//Values sampled from each keyframe for the percentiles.
+
+//Statistics for one keyframe.  Percentiles are 1%, 50% and 99%.
+struct KFBKeyFrameStats {
+	std::string fileName;					//Name only (the .kfb is in the same folder as the .kfr)
+	uint64_t size {0};						//File size and modified time when scanned
+	int64_t modified {0};
+	bool scanned {false};					//False if only the name, size and time are known.
+	uint64_t hash {0};						//FNV-1a hash of the whole file (see HashKFBBytes)
+	int width {0};
+	int height {0};
+	int maxIterations {0};
+	unsigned int colourDiv {0};
+	std::vector<RGB> colours;
+	int minIteration {0};
+	int maxIteration {0};
+	std::array<int, 3> iterationPercentiles {};
+	double minSmooth {0};
+	double maxSmooth {0};
+	std::array<double, 3> smoothPercentiles {};
+};
+
+class KFBManifest {
+	public:
+		KFBManifest() {};
+		~KFBManifest();
+		KFBManifest(const KFBManifest &) = delete;
+		KFBManifest & operator=(const KFBManifest &) = delete;
+
+		void Open(const std::string & kfrFileName);
+		void Close();
+		std::vector<std::string> GetFiles();
+		int getWidth() {return width;}
+		int getHeight() {return height;}
+		bool GetStats(long keyFrame, KFBKeyFrameStats & stats);
+		bool GetFileInfo(long keyFrame, uint64_t & size, int64_t & modified);
+
+	private:
+		std::mutex mutex;
+		std::string manifestFileName;
+		std::string folder;							//Canonical path of the folder
+		int64_t folderModified {0};
+		int width {0};
+		int height {0};
+		std::vector<KFBKeyFrameStats> keyFrames;		//Sorted as the keyframes are numbered.  Size is fixed once open.
+
+		std::thread scanner;
+		std::atomic<bool> stopping {false};
+
+		bool read(std::vector<KFBKeyFrameStats> & saved, int64_t & savedFolderModified);
+		void write();
+		void list();
+		void readSize();
+		void scan();
+		KFBKeyFrameStats scanFile(const KFBKeyFrameStats & entry);
+};
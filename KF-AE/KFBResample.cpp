@@ -0,0 +1,172 @@
+/********************************************************************************************
+KFBResample.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Resampling a keyframe on the grid of a frame (see KFBResample.h).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBResample.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+
+static std::atomic<uint64_t> nextPlanID {1};
+
+//The horizontally stepped rows of one plan, kept by a thread.
+struct ResampleRows {
+	uint64_t plan {0};
+	std::array<long, kfbResampleRows> rows {};		//kfb row held in each slot (padded co-ordinates)
+	std::array<uint64_t, kfbResampleRows> used {};	//When each slot was last used (the oldest is replaced)
+	uint64_t uses {0};
+	std::vector<double> values;						//Each slot's row, one value per output column first to last.
+};
+
+//Each thread keeps rows for two plans (the active and next keyframes).
+thread_local std::array<ResampleRows, 2> threadRows;
+thread_local int threadRowsReplace {0};
+
+/*******************************************************************************************************
+Plans the samples of one axis at the given locations (unpadded), in a keyframe of size pixels.
+The columns (or rows) and offset are found as calculateIterationCountBiCubicSpan does (including
+the locations being floats), and the weights are biCubicStep's polynomial for that offset.
+A whole offset has the weights 0, 1, 0, 0, so it gives the pixel exactly.
+*******************************************************************************************************/
+static void planAxis(KFBResampleAxis & axis, const std::vector<double> & locations, long size) {
+	axis.left.resize(locations.size());
+	axis.weights.resize(locations.size());
+	for(size_t i = 0; i < locations.size(); i++) {
+		const double p = static_cast<double>(static_cast<float>(locations[i])) + paddingSize;
+		const double floorP = std::floor(p);
+		const long l = std::clamp(static_cast<long>(floorP), 0L, size - 1);
+		const double t = p - floorP;
+		axis.left[i] = std::max(l - 1, 0L);
+		axis.weights[i] = {
+			t * ((2 - t) * t - 1) / 2,
+			(t * t * (3 * t - 5) + 2) / 2,
+			t * ((4 - 3 * t) * t + 1) / 2,
+			t * t * (t - 1) / 2
+		};
+	}
+}
+
+/*******************************************************************************************************
+Plans how kfb is sampled at columns xs (output columns first to last only) and rows ys.
+*******************************************************************************************************/
+void PlanKFBResample(KFBResamplePlan & plan, const KFBData * kfb, const std::vector<double> & xs, long first, long last, const std::vector<double> & ys) {
+	plan.kfb = kfb;
+	plan.id = nextPlanID.fetch_add(1, std::memory_order_relaxed);
+	plan.first = first;
+	plan.last = last;
+	plan.inside = kfb->getInsideMask();
+	planAxis(plan.columns, xs, kfb->getWidth());
+	planAxis(plan.rows, ys, kfb->getHeight());
+	if(last < first) {
+		plan.firstColumn = 0;
+		plan.columnCount = 0;
+		return;
+	}
+	const auto range = std::minmax_element(plan.columns.left.begin() + first, plan.columns.left.begin() + last + 1);
+	plan.firstColumn = *range.first;
+	plan.columnCount = *range.second + 4 - plan.firstColumn;
+}
+
+/*******************************************************************************************************
+The horizontal step of kfb row y (padded co-ordinates) at every output column of the plan.
+*******************************************************************************************************/
+static void stepRow(const KFBResamplePlan & plan, long y, double * out) {
+	auto & scratch = ScratchArena::ForThread();
+	ScratchScope scope(scratch);
+	double * kfbRow = scratch.Allocate<double>(plan.columnCount);
+	plan.kfb->getSmoothRow(plan.firstColumn, y, plan.columnCount, kfbRow);
+	const double * row = kfbRow - plan.firstColumn;
+	const long * left = plan.columns.left.data();
+	const auto * weights = plan.columns.weights.data();
+	for(long x = plan.first; x <= plan.last; x++) {
+		const double * v = row + left[x];
+		const auto & w = weights[x];
+		out[x - plan.first] = w[0] * v[0] + w[1] * v[1] + w[2] * v[2] + w[3] * v[3];
+	}
+}
+
+/*******************************************************************************************************
+This thread's copy of kfb row y of the plan, horizontally stepped (indexed from output column first).
+The least recently used row is replaced, so the 4 rows of a span are never replaced by each other.
+*******************************************************************************************************/
+static const double * steppedRow(const KFBResamplePlan & plan, long y) {
+	ResampleRows * rows = nullptr;
+	for(auto & r : threadRows) if(r.plan == plan.id) rows = &r;
+	if(!rows) {
+		rows = &threadRows[threadRowsReplace];
+		threadRowsReplace = (threadRowsReplace + 1) % static_cast<int>(threadRows.size());
+		rows->plan = plan.id;
+		rows->rows.fill(-1);
+		rows->used.fill(0);
+		rows->values.resize(static_cast<size_t>(kfbResampleRows) * (plan.last - plan.first + 1));
+	}
+	const size_t width = static_cast<size_t>(plan.last - plan.first + 1);
+	rows->uses++;
+	int oldest = 0;
+	for(int slot = 0; slot < kfbResampleRows; slot++) {
+		if(rows->rows[slot] == y) {
+			rows->used[slot] = rows->uses;
+			return &rows->values[slot * width];
+		}
+		if(rows->used[slot] < rows->used[oldest]) oldest = slot;
+	}
+	rows->rows[oldest] = y;
+	rows->used[oldest] = rows->uses;
+	stepRow(plan, y, &rows->values[oldest * width]);
+	return &rows->values[oldest * width];
+}
+
+/*******************************************************************************************************
+Samples count pixels of output row y, starting at column x0 (which must be within first to last).
+*******************************************************************************************************/
+void ResampleKFBSpan(const KFBResamplePlan & plan, long x0, long y, long count, double * out) {
+	const long top = plan.rows.left[y];
+	const auto & w = plan.rows.weights[y];
+	const double * r0 = steppedRow(plan, top) + (x0 - plan.first);
+	const double * r1 = steppedRow(plan, top + 1) + (x0 - plan.first);
+	const double * r2 = steppedRow(plan, top + 2) + (x0 - plan.first);
+	const double * r3 = steppedRow(plan, top + 3) + (x0 - plan.first);
+	for(long i = 0; i < count; i++) out[i] = w[0] * r0[i] + w[1] * r1[i] + w[2] * r2[i] + w[3] * r3[i];
+}
+
+/*******************************************************************************************************
+True if every sample of output columns x0 to x1 of row y (within first to last) is certainly inside
+the set.  False if unsure, or the keyframe has no inside mask.
+The tiles of the mask are checked first, so runs in (or far from) the set are decided quickly.
+*******************************************************************************************************/
+bool KFBResampleInside(const KFBResamplePlan & plan, long x0, long x1, long y) {
+	const KFBInsideMask * mask = plan.inside;
+	if(!mask) return false;
+	const long * left = plan.columns.left.data();
+	const long top = plan.rows.left[y];
+	const long ty = top >> kfbTileShift;
+	const long tx0 = std::min(left[x0], left[x1]) >> kfbTileShift;
+	const long tx1 = std::max(left[x0], left[x1]) >> kfbTileShift;
+	bool mixed = false;
+	for(long tx = tx0; tx <= tx1; tx++) {
+		const auto tile = mask->tile(tx, ty);
+		if(tile == KFBInsideTile::outside) return false;
+		if(tile == KFBInsideTile::mixed) mixed = true;
+	}
+	if(!mixed) return true;
+	for(long x = x0; x <= x1; x++) {
+		if(!mask->inside(left[x], top)) return false;
+	}
+	return true;
+}
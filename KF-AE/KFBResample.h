@@ -0,0 +1,60 @@
+#pragma once
+/********************************************************************************************
+KFBResample.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Resampling a keyframe on the grid of a frame.  The location sampled by an output pixel is
+separable (its column depends only on x, and its row only on y), so a plan holds the 4 kfb
+columns and bicubic weights of each output column, and the same for each output row.
+A span is then the vertical step of 4 kfb rows that have already been stepped horizontally.
+Each thread keeps the last few horizontally stepped rows, so consecutive output rows mostly
+reuse them.
+
+The result is the bicubic value of KFBData::calculateIterationCountBiCubicSpan, stepped in the
+other order with precomputed weights (so it may differ in the last bits).
+Only smooth values at full size (mip level 0) are planned.
+The keyframe's inside mask (see KFBData::PrepareInsideMask) tells whether a run of samples is
+certainly inside the set, without sampling.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBData.h"
+
+#include <array>
+#include <cstdint>
+#include <vector>
+
+constexpr int kfbResampleRows = 8;		//Horizontally stepped rows kept by each thread, for each plan.
+
+//The 4 kfb columns (or rows) and their weights for each output column (or row).
+struct KFBResampleAxis {
+	std::vector<long> left;							//First of the 4 (padded co-ordinates)
+	std::vector<std::array<double, 4>> weights;
+};
+
+//How one keyframe is sampled by the output of a frame (see PlanKFBResample).
+struct KFBResamplePlan {
+	const KFBData * kfb {nullptr};		//Null if the keyframe isn't sampled with a plan.
+	uint64_t id {0};					//Unique to each plan made (identifies the rows each thread keeps).
+	long first {0};						//Output columns first to last sample the keyframe.
+	long last {-1};
+	long firstColumn {0};				//The kfb columns read from each row (padded co-ordinates).
+	long columnCount {0};
+	const KFBInsideMask * inside {nullptr};		//The keyframe's inside mask (if it is built).
+	KFBResampleAxis columns;
+	KFBResampleAxis rows;
+};
+
+void PlanKFBResample(KFBResamplePlan & plan, const KFBData * kfb, const std::vector<double> & xs, long first, long last, const std::vector<double> & ys);
+void ResampleKFBSpan(const KFBResamplePlan & plan, long x0, long y, long count, double * out);
+bool KFBResampleInside(const KFBResamplePlan & plan, long x0, long x1, long y);
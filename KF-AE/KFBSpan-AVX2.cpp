@@ -0,0 +1,121 @@
+/********************************************************************************************
+KFBSpan-AVX2.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+AVX2 span kernels (see KFBSpan.h), 4 doubles at a time.  Only used if the CPU supports AVX2.
+Note: FMA is deliberately not used, so the results match the scalar kernels.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBSpan.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+#define KFB_USE_AVX2
+#include <immintrin.h>
+#endif
+
+//Only the kernels are built for AVX2 (not the whole file), so the inline functions of the headers
+//this file shares with the others (eg. biCubicStep) are never built with instructions the CPU may not have.
+#if defined(__GNUC__)
+#define KFB_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define KFB_TARGET_AVX2
+#endif
+
+#ifdef KFB_USE_AVX2
+/*******************************************************************************************************
+biCubicStep on 4 lanes (the same operations, in the same order).
+*******************************************************************************************************/
+KFB_TARGET_AVX2 static inline __m256d biCubicStep4(__m256d v0, __m256d v1, __m256d v2, __m256d v3, __m256d offset) {
+	const __m256d half = _mm256_set1_pd(0.5);
+	const __m256d negHalfV0 = _mm256_mul_pd(_mm256_xor_pd(v0, _mm256_set1_pd(-0.0)), half);
+	const __m256d halfV3 = _mm256_mul_pd(v3, half);
+	__m256d a = _mm256_add_pd(negHalfV0, _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(3.0), v1), half));
+	a = _mm256_add_pd(_mm256_sub_pd(a, _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(3.0), v2), half)), halfV3);
+	__m256d b = _mm256_sub_pd(v0, _mm256_mul_pd(_mm256_mul_pd(_mm256_set1_pd(5.0), v1), half));
+	b = _mm256_sub_pd(_mm256_add_pd(b, _mm256_mul_pd(_mm256_set1_pd(2.0), v2)), halfV3);
+	const __m256d c = _mm256_add_pd(negHalfV0, _mm256_mul_pd(v2, half));
+	__m256d r = _mm256_add_pd(_mm256_mul_pd(a, offset), b);
+	r = _mm256_add_pd(_mm256_mul_pd(r, offset), c);
+	return _mm256_add_pd(_mm256_mul_pd(r, offset), v1);
+}
+
+/*******************************************************************************************************
+Vertical step of 4 rows, column by column.
+*******************************************************************************************************/
+KFB_TARGET_AVX2 static void columnsAVX2(const double * const rows[4], long count, double offset, double * out) {
+	const __m256d t = _mm256_set1_pd(offset);
+	long c = 0;
+	for(; c + 4 <= count; c += 4) {
+		_mm256_storeu_pd(out + c, biCubicStep4(_mm256_loadu_pd(rows[0] + c), _mm256_loadu_pd(rows[1] + c), _mm256_loadu_pd(rows[2] + c), _mm256_loadu_pd(rows[3] + c), t));
+	}
+	for(; c < count; c++) out[c] = biCubicStep(rows[0][c], rows[1][c], rows[2][c], rows[3][c], offset);
+}
+
+/*******************************************************************************************************
+4 compact values of a row (base + delta + 1 - raw).
+*******************************************************************************************************/
+KFB_TARGET_AVX2 static inline __m256d compactValues4(const uint16_t * deltas, int base, const float * raws) {
+	const __m128i iterations = _mm_add_epi32(_mm_cvtepu16_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(deltas))), _mm_set1_epi32(base));
+	return _mm256_sub_pd(_mm256_add_pd(_mm256_cvtepi32_pd(iterations), _mm256_set1_pd(1.0)), _mm256_cvtps_pd(_mm_loadu_ps(raws)));
+}
+
+/*******************************************************************************************************
+Vertical step of 4 rows of compact (iteration and raw smooth) values.
+*******************************************************************************************************/
+KFB_TARGET_AVX2 static void columnsCompactAVX2(const uint16_t * const deltas[4], const int bases[4], const float * const raws[4], long count, double offset, double * out) {
+	const __m256d t = _mm256_set1_pd(offset);
+	auto value = [&](int j, long c) {return static_cast<double>(bases[j] + deltas[j][c]) + 1 - static_cast<double>(raws[j][c]);};
+	long c = 0;
+	for(; c + 4 <= count; c += 4) {
+		const __m256d v0 = compactValues4(deltas[0] + c, bases[0], raws[0] + c);
+		const __m256d v1 = compactValues4(deltas[1] + c, bases[1], raws[1] + c);
+		const __m256d v2 = compactValues4(deltas[2] + c, bases[2], raws[2] + c);
+		const __m256d v3 = compactValues4(deltas[3] + c, bases[3], raws[3] + c);
+		_mm256_storeu_pd(out + c, biCubicStep4(v0, v1, v2, v3, t));
+	}
+	for(; c < count; c++) out[c] = biCubicStep(value(0, c), value(1, c), value(2, c), value(3, c), offset);
+}
+
+/*******************************************************************************************************
+Horizontal step of each sample, gathering its 4 column values.
+*******************************************************************************************************/
+KFB_TARGET_AVX2 static void samplesAVX2(const double * columns, const int * left, const double * offsets, long count, double * out) {
+	long i = 0;
+	for(; i + 4 <= count; i += 4) {
+		const __m128i l = _mm_loadu_si128(reinterpret_cast<const __m128i*>(left + i));
+		const __m256d v0 = _mm256_i32gather_pd(columns, l, 8);
+		const __m256d v1 = _mm256_i32gather_pd(columns + 1, l, 8);
+		const __m256d v2 = _mm256_i32gather_pd(columns + 2, l, 8);
+		const __m256d v3 = _mm256_i32gather_pd(columns + 3, l, 8);
+		_mm256_storeu_pd(out + i, biCubicStep4(v0, v1, v2, v3, _mm256_loadu_pd(offsets + i)));
+	}
+	for(; i < count; i++) {
+		const double * v = columns + left[i];
+		out[i] = biCubicStep(v[0], v[1], v[2], v[3], offsets[i]);
+	}
+}
+
+static const KFBSpanKernels avx2Kernels {"AVX2", columnsAVX2, columnsCompactAVX2, samplesAVX2};
+#endif
+
+/*******************************************************************************************************
+The AVX2 kernels (nullptr if this compiler can't build them).
+*******************************************************************************************************/
+const KFBSpanKernels * KFBSpanKernelsAVX2() {
+#ifdef KFB_USE_AVX2
+	return &avx2Kernels;
+#else
+	return nullptr;
+#endif
+}
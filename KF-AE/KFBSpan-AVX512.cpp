@@ -0,0 +1,122 @@
+/********************************************************************************************
+KFBSpan-AVX512.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+AVX-512 span kernels (see KFBSpan.h), 8 doubles at a time.  Only used if the CPU supports AVX-512F.
+Note: FMA is deliberately not used, so the results match the scalar kernels.
+Negation is an integer xor, as AVX-512F has no xor_pd.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBSpan.h"
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__i386__)
+#define KFB_USE_AVX512
+#include <immintrin.h>
+#endif
+
+//Only the kernels are built for AVX-512 (not the whole file), so the inline functions of the headers
+//this file shares with the others (eg. biCubicStep) are never built with instructions the CPU may not have.
+#if defined(__GNUC__)
+#define KFB_TARGET_AVX512 __attribute__((target("avx512f")))
+#else
+#define KFB_TARGET_AVX512
+#endif
+
+#ifdef KFB_USE_AVX512
+/*******************************************************************************************************
+biCubicStep on 8 lanes (the same operations, in the same order).
+*******************************************************************************************************/
+KFB_TARGET_AVX512 static inline __m512d biCubicStep8(__m512d v0, __m512d v1, __m512d v2, __m512d v3, __m512d offset) {
+	const __m512d half = _mm512_set1_pd(0.5);
+	const __m512d negHalfV0 = _mm512_mul_pd(_mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(v0), _mm512_set1_epi64(static_cast<long long>(0x8000000000000000ull)))), half);
+	const __m512d halfV3 = _mm512_mul_pd(v3, half);
+	__m512d a = _mm512_add_pd(negHalfV0, _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(3.0), v1), half));
+	a = _mm512_add_pd(_mm512_sub_pd(a, _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(3.0), v2), half)), halfV3);
+	__m512d b = _mm512_sub_pd(v0, _mm512_mul_pd(_mm512_mul_pd(_mm512_set1_pd(5.0), v1), half));
+	b = _mm512_sub_pd(_mm512_add_pd(b, _mm512_mul_pd(_mm512_set1_pd(2.0), v2)), halfV3);
+	const __m512d c = _mm512_add_pd(negHalfV0, _mm512_mul_pd(v2, half));
+	__m512d r = _mm512_add_pd(_mm512_mul_pd(a, offset), b);
+	r = _mm512_add_pd(_mm512_mul_pd(r, offset), c);
+	return _mm512_add_pd(_mm512_mul_pd(r, offset), v1);
+}
+
+/*******************************************************************************************************
+Vertical step of 4 rows, column by column.
+*******************************************************************************************************/
+KFB_TARGET_AVX512 static void columnsAVX512(const double * const rows[4], long count, double offset, double * out) {
+	const __m512d t = _mm512_set1_pd(offset);
+	long c = 0;
+	for(; c + 8 <= count; c += 8) {
+		_mm512_storeu_pd(out + c, biCubicStep8(_mm512_loadu_pd(rows[0] + c), _mm512_loadu_pd(rows[1] + c), _mm512_loadu_pd(rows[2] + c), _mm512_loadu_pd(rows[3] + c), t));
+	}
+	for(; c < count; c++) out[c] = biCubicStep(rows[0][c], rows[1][c], rows[2][c], rows[3][c], offset);
+}
+
+/*******************************************************************************************************
+8 compact values of a row (base + delta + 1 - raw).
+*******************************************************************************************************/
+KFB_TARGET_AVX512 static inline __m512d compactValues8(const uint16_t * deltas, int base, const float * raws) {
+	const __m256i iterations = _mm256_add_epi32(_mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(deltas))), _mm256_set1_epi32(base));
+	return _mm512_sub_pd(_mm512_add_pd(_mm512_cvtepi32_pd(iterations), _mm512_set1_pd(1.0)), _mm512_cvtps_pd(_mm256_loadu_ps(raws)));
+}
+
+/*******************************************************************************************************
+Vertical step of 4 rows of compact (iteration and raw smooth) values.
+*******************************************************************************************************/
+KFB_TARGET_AVX512 static void columnsCompactAVX512(const uint16_t * const deltas[4], const int bases[4], const float * const raws[4], long count, double offset, double * out) {
+	const __m512d t = _mm512_set1_pd(offset);
+	auto value = [&](int j, long c) {return static_cast<double>(bases[j] + deltas[j][c]) + 1 - static_cast<double>(raws[j][c]);};
+	long c = 0;
+	for(; c + 8 <= count; c += 8) {
+		const __m512d v0 = compactValues8(deltas[0] + c, bases[0], raws[0] + c);
+		const __m512d v1 = compactValues8(deltas[1] + c, bases[1], raws[1] + c);
+		const __m512d v2 = compactValues8(deltas[2] + c, bases[2], raws[2] + c);
+		const __m512d v3 = compactValues8(deltas[3] + c, bases[3], raws[3] + c);
+		_mm512_storeu_pd(out + c, biCubicStep8(v0, v1, v2, v3, t));
+	}
+	for(; c < count; c++) out[c] = biCubicStep(value(0, c), value(1, c), value(2, c), value(3, c), offset);
+}
+
+/*******************************************************************************************************
+Horizontal step of each sample, gathering its 4 column values.
+*******************************************************************************************************/
+KFB_TARGET_AVX512 static void samplesAVX512(const double * columns, const int * left, const double * offsets, long count, double * out) {
+	long i = 0;
+	for(; i + 8 <= count; i += 8) {
+		const __m256i l = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(left + i));
+		const __m512d v0 = _mm512_i32gather_pd(l, columns, 8);
+		const __m512d v1 = _mm512_i32gather_pd(l, columns + 1, 8);
+		const __m512d v2 = _mm512_i32gather_pd(l, columns + 2, 8);
+		const __m512d v3 = _mm512_i32gather_pd(l, columns + 3, 8);
+		_mm512_storeu_pd(out + i, biCubicStep8(v0, v1, v2, v3, _mm512_loadu_pd(offsets + i)));
+	}
+	for(; i < count; i++) {
+		const double * v = columns + left[i];
+		out[i] = biCubicStep(v[0], v[1], v[2], v[3], offsets[i]);
+	}
+}
+
+static const KFBSpanKernels avx512Kernels {"AVX-512", columnsAVX512, columnsCompactAVX512, samplesAVX512};
+#endif
+
+/*******************************************************************************************************
+The AVX-512 kernels (nullptr if this compiler can't build them).
+*******************************************************************************************************/
+const KFBSpanKernels * KFBSpanKernelsAVX512() {
+#ifdef KFB_USE_AVX512
+	return &avx512Kernels;
+#else
+	return nullptr;
+#endif
+}
@@ -0,0 +1,147 @@
+/********************************************************************************************
+KFBSpan.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Scalar and SSE2 span kernels (see KFBSpan.h), and choosing the kernels for the CPU.
+AVX2 and AVX-512 kernels are in their own files, so only they are built for those instruction sets.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFBSpan.h"
+
+#include <atomic>
+#include <cstring>
+
+#if defined(_M_X64) || defined(__SSE2__)
+#define KFB_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+static std::atomic<int> spanLevelLimit {static_cast<int>(SIMDLevel::avx512)};		//See SetKFBSpanLevel
+
+/*******************************************************************************************************
+Scalar kernels
+*******************************************************************************************************/
+static void columnsScalar(const double * const rows[4], long count, double offset, double * out) {
+	for(long c = 0; c < count; c++) out[c] = biCubicStep(rows[0][c], rows[1][c], rows[2][c], rows[3][c], offset);
+}
+
+static void columnsCompactScalar(const uint16_t * const deltas[4], const int bases[4], const float * const raws[4], long count, double offset, double * out) {
+	auto value = [&](int j, long c) {return static_cast<double>(bases[j] + deltas[j][c]) + 1 - static_cast<double>(raws[j][c]);};
+	for(long c = 0; c < count; c++) out[c] = biCubicStep(value(0, c), value(1, c), value(2, c), value(3, c), offset);
+}
+
+static void samplesScalar(const double * columns, const int * left, const double * offsets, long count, double * out) {
+	for(long i = 0; i < count; i++) {
+		const double * v = columns + left[i];
+		out[i] = biCubicStep(v[0], v[1], v[2], v[3], offsets[i]);
+	}
+}
+
+static const KFBSpanKernels scalarKernels {"Scalar", columnsScalar, columnsCompactScalar, samplesScalar};
+
+#ifdef KFB_USE_SSE2
+/*******************************************************************************************************
+biCubicStep on 2 lanes (the same operations, in the same order).
+*******************************************************************************************************/
+static inline __m128d biCubicStep2(__m128d v0, __m128d v1, __m128d v2, __m128d v3, __m128d offset) {
+	const __m128d half = _mm_set1_pd(0.5);
+	const __m128d negHalfV0 = _mm_mul_pd(_mm_xor_pd(v0, _mm_set1_pd(-0.0)), half);
+	const __m128d halfV3 = _mm_mul_pd(v3, half);
+	__m128d a = _mm_add_pd(negHalfV0, _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(3.0), v1), half));
+	a = _mm_add_pd(_mm_sub_pd(a, _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(3.0), v2), half)), halfV3);
+	__m128d b = _mm_sub_pd(v0, _mm_mul_pd(_mm_mul_pd(_mm_set1_pd(5.0), v1), half));
+	b = _mm_sub_pd(_mm_add_pd(b, _mm_mul_pd(_mm_set1_pd(2.0), v2)), halfV3);
+	const __m128d c = _mm_add_pd(negHalfV0, _mm_mul_pd(v2, half));
+	__m128d r = _mm_add_pd(_mm_mul_pd(a, offset), b);
+	r = _mm_add_pd(_mm_mul_pd(r, offset), c);
+	return _mm_add_pd(_mm_mul_pd(r, offset), v1);
+}
+
+/*******************************************************************************************************
+SSE2 kernels (2 doubles at a time)
+*******************************************************************************************************/
+static void columnsSSE2(const double * const rows[4], long count, double offset, double * out) {
+	const __m128d t = _mm_set1_pd(offset);
+	long c = 0;
+	for(; c + 2 <= count; c += 2) {
+		_mm_storeu_pd(out + c, biCubicStep2(_mm_loadu_pd(rows[0] + c), _mm_loadu_pd(rows[1] + c), _mm_loadu_pd(rows[2] + c), _mm_loadu_pd(rows[3] + c), t));
+	}
+	for(; c < count; c++) out[c] = biCubicStep(rows[0][c], rows[1][c], rows[2][c], rows[3][c], offset);
+}
+
+static void columnsCompactSSE2(const uint16_t * const deltas[4], const int bases[4], const float * const raws[4], long count, double offset, double * out) {
+	const __m128d t = _mm_set1_pd(offset);
+	const __m128d one = _mm_set1_pd(1.0);
+	auto load = [&](int j, long c) {
+		int pair;
+		std::memcpy(&pair, deltas[j] + c, sizeof(pair));
+		const __m128i iterations = _mm_add_epi32(_mm_unpacklo_epi16(_mm_cvtsi32_si128(pair), _mm_setzero_si128()), _mm_set1_epi32(bases[j]));
+		const __m128d raw = _mm_cvtps_pd(_mm_castsi128_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(raws[j] + c))));
+		return _mm_sub_pd(_mm_add_pd(_mm_cvtepi32_pd(iterations), one), raw);
+	};
+	auto value = [&](int j, long c) {return static_cast<double>(bases[j] + deltas[j][c]) + 1 - static_cast<double>(raws[j][c]);};
+	long c = 0;
+	for(; c + 2 <= count; c += 2) {
+		_mm_storeu_pd(out + c, biCubicStep2(load(0, c), load(1, c), load(2, c), load(3, c), t));
+	}
+	for(; c < count; c++) out[c] = biCubicStep(value(0, c), value(1, c), value(2, c), value(3, c), offset);
+}
+
+static void samplesSSE2(const double * columns, const int * left, const double * offsets, long count, double * out) {
+	long i = 0;
+	for(; i + 2 <= count; i += 2) {
+		const double * p = columns + left[i];
+		const double * q = columns + left[i + 1];
+		const __m128d p01 = _mm_loadu_pd(p), p23 = _mm_loadu_pd(p + 2);
+		const __m128d q01 = _mm_loadu_pd(q), q23 = _mm_loadu_pd(q + 2);
+		const __m128d v0 = _mm_unpacklo_pd(p01, q01);
+		const __m128d v1 = _mm_unpackhi_pd(p01, q01);
+		const __m128d v2 = _mm_unpacklo_pd(p23, q23);
+		const __m128d v3 = _mm_unpackhi_pd(p23, q23);
+		_mm_storeu_pd(out + i, biCubicStep2(v0, v1, v2, v3, _mm_loadu_pd(offsets + i)));
+	}
+	samplesScalar(columns, left + i, offsets + i, count - i, out + i);
+}
+
+static const KFBSpanKernels sse2Kernels {"SSE2", columnsSSE2, columnsCompactSSE2, samplesSSE2};
+#endif
+
+/*******************************************************************************************************
+The kernels for an instruction set level (or the best available below it).
+*******************************************************************************************************/
+const KFBSpanKernels & KFBSpanKernelsFor(SIMDLevel level) {
+	if(level >= SIMDLevel::avx512 && KFBSpanKernelsAVX512()) return *KFBSpanKernelsAVX512();
+	if(level >= SIMDLevel::avx2 && KFBSpanKernelsAVX2()) return *KFBSpanKernelsAVX2();
+#ifdef KFB_USE_SSE2
+	if(level >= SIMDLevel::sse2) return sse2Kernels;
+#endif
+	return scalarKernels;
+}
+
+/*******************************************************************************************************
+The kernels used for sampling, the best the CPU supports (within any limit set by SetKFBSpanLevel).
+*******************************************************************************************************/
+const KFBSpanKernels & ActiveKFBSpanKernels() {
+	static const SIMDLevel detected = DetectSIMDLevel();
+	const auto limit = static_cast<SIMDLevel>(spanLevelLimit.load(std::memory_order_relaxed));
+	return KFBSpanKernelsFor(limit < detected ? limit : detected);
+}
+
+/*******************************************************************************************************
+Limit the instruction set used for sampling (eg. to compare kernels).  Levels the CPU doesn't
+support are never used.
+*******************************************************************************************************/
+void SetKFBSpanLevel(SIMDLevel level) {
+	spanLevelLimit.store(static_cast<int>(level), std::memory_order_relaxed);
+}
@@ -0,0 +1,61 @@
+#pragma once
+/********************************************************************************************
+KFBSpan.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Kernels for sampling a row of bicubic values from a kfb (see
+KFBData::calculateIterationCountBiCubicSpan).  Every sample in a row shares the same 4 kfb rows
+and the same vertical offset, so each kfb column is reduced to one value (the vertical cubic) once,
+then each sample is the horizontal cubic of 4 of those column values.  This gives the same result
+as biCubicIterpolation, which also steps vertically first.
+
+There is a set of kernels for each instruction set, chosen at run time for the CPU.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "OS.h"
+#include <cstdint>
+
+constexpr long kfbSpanBlock = 256;			//Samples handled at a time (sizes the scratch arrays on the stack).
+constexpr long kfbSpanColumns = 1024;		//Most kfb columns reduced at a time.
+
+//columns: out[c] = biCubicStep(rows[0][c], rows[1][c], rows[2][c], rows[3][c], offset) for count columns.
+//columnsCompact: the same, for compact storage (each value is bases[j] + deltas[j][c] + 1 - raws[j][c], like the kfb).
+//samples: out[i] = biCubicStep(columns[l], columns[l + 1], columns[l + 2], columns[l + 3], offsets[i]), where l = left[i].
+struct KFBSpanKernels {
+	const char * name;
+	void (*columns)(const double * const rows[4], long count, double offset, double * out);
+	void (*columnsCompact)(const uint16_t * const deltas[4], const int bases[4], const float * const raws[4], long count, double offset, double * out);
+	void (*samples)(const double * columns, const int * left, const double * offsets, long count, double * out);
+};
+
+const KFBSpanKernels & KFBSpanKernelsFor(SIMDLevel level);
+const KFBSpanKernels & ActiveKFBSpanKernels();
+void SetKFBSpanLevel(SIMDLevel level);
+const KFBSpanKernels * KFBSpanKernelsAVX2();
+const KFBSpanKernels * KFBSpanKernelsAVX512();
+
+/******************************************************************************************************
+Calculate one cubic line.
+Given 4 consecutative pixel values (v0..v3)
+Returns a weighted value between v1 and v2 based on the offset from v1.
+v0 and v3 are used to build a cubic spline to caclulate the results.
+Note: The span kernels repeat these operations in the same order, so they give the same results.
+*******************************************************************************************************/
+inline double biCubicStep(double v0, double v1, double v2, double v3, double offset) {
+	double a = (-v0 / 2) + (3 * v1) / 2 - (3 * v2) / 2 + (v3 / 2);
+	double b = v0 - (5 * v1) / 2 + (2 * v2) - (v3 / 2);
+	double c = -v0 / 2 + v2 / 2;
+	double d = v1;
+	return ((a * offset + b) * offset + c) * offset + d;
+}
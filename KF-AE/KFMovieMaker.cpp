@@ -22,6 +22,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "Parameters.h"
 #include "SequenceData.h"
 #include "Render.h"
+#include "KFBCache.h"
 
 static PF_Err GlobalSetup(PF_InData *in_data, PF_OutData *out_data);
 static PF_Err About(PF_InData *in_data, PF_OutData	*out_data);
@@ -31,6 +32,10 @@ static PF_Err About(PF_InData *in_data, PF_OutData	*out_data);
 
 thread_local PF_InData	* globalTL_in_data {nullptr};
 
+//The basic suite stays valid from global setup to global setdown (unlike in_data), so threads of our own
+//(eg. KFBLoader's) acquire the memory suites through it.
+SPBasicSuite * globalBasicSuite {nullptr};
+
 
 /*******************************************************************************************************
 Main Entry Point for the plug-in.
@@ -51,6 +56,7 @@ PF_Err EffectMain(PF_Cmd cmd, PF_InData	*in_data, PF_OutData *out_data, PF_Param
 			break;
 
 		case PF_Cmd_GLOBAL_SETDOWN:
+			KFBCache::Shared().Clear();			//Keyframes are shared by all instances, free them while the memory suites are still available.
 			break;
 
 		case PF_Cmd_PARAMS_SETUP:
@@ -93,7 +99,7 @@ PF_Err EffectMain(PF_Cmd cmd, PF_InData	*in_data, PF_OutData *out_data, PF_Param
 	catch (PF_Err &thrown_err) {
 		err = thrown_err;
 	}
-	catch (std::exception ex) {
+	catch (const std::exception & ex) {
 		strncpy_s(out_data->return_msg, ex.what(), 256);
 		out_data->out_flags |= PF_OutFlag_DISPLAY_ERROR_MESSAGE;
 	}
@@ -106,7 +112,7 @@ Plug-in data
 This an en entry point function that might be called by After Effects
 Note: Any changes should have a matching change in (.r) resource file.
 *******************************************************************************************************/
-extern "C" DllExport PF_Err PluginDataEntryFunction(PF_PluginDataPtr inPtr, PF_PluginDataCB inPluginDataCallBackPtr, SPBasicSuite* inSPBasicSuitePtr, const char* inHostName, const char* inHostVersion) {
+extern "C" DllExport PF_Err PluginDataEntryFunction(PF_PluginDataPtr inPtr, PF_PluginDataCB inPluginDataCallBackPtr, SPBasicSuite* /*inSPBasicSuitePtr*/, const char* /*inHostName*/, const char* /*inHostVersion*/) {
 	PF_Err result = PF_Err_INVALID_CALLBACK;
 	result = PF_REGISTER_EFFECT(inPtr, inPluginDataCallBackPtr, "KF Movie Maker", "Maths Town KF Movie Maker", "Maths Town", AE_RESERVED_INFO);
 	return result;
@@ -118,6 +124,7 @@ GlobalSetup
 Note: Changes to flags should have a matching change in (.r) resource file.
 *******************************************************************************************************/
 static PF_Err GlobalSetup(PF_InData *in_data, PF_OutData *out_data) {
+	globalBasicSuite = in_data->pica_basicP;
 	out_data->my_version = PF_VERSION(MAJOR_VERSION, MINOR_VERSION,	BUG_VERSION, STAGE_VERSION, BUILD_VERSION);
 	out_data->out_flags = PF_OutFlag_DEEP_COLOR_AWARE | PF_OutFlag_SEQUENCE_DATA_NEEDS_FLATTENING | PF_OutFlag_PIX_INDEPENDENT;
 	out_data->out_flags2 = PF_OutFlag2_SUPPORTS_SMART_RENDER | PF_OutFlag2_FLOAT_COLOR_AWARE;
@@ -57,6 +57,7 @@ extern "C" {
 }
 
 extern thread_local PF_InData * globalTL_in_data;
+extern SPBasicSuite * globalBasicSuite;		//From global setup, for threads AE didn't call us on (see KFMovieMaker.cpp)
 
 constexpr int maxKFRColours = 1024;
 struct RGB {
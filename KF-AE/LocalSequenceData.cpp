@@ -35,6 +35,15 @@ LocalSequenceData::LocalSequenceData()
 {
 }
 
+/*******************************************************************************************************
+Destructor
+The cached images go with this instance, so they no longer count against the shared cache.
+*******************************************************************************************************/
+LocalSequenceData::~LocalSequenceData()
+{
+	KFBCache::Shared().SetHeldBytes(this, 0);
+}
+
 /*******************************************************************************************************
 Setup the file date for rendering.  
 Input is a kfr file.  The kfb files in the same directory will provide the data.
@@ -48,8 +57,12 @@ void LocalSequenceData::SetupFileData(const std::string & fileName)
 	this->kfrFileName = fileName;
 	if (!fs::exists(fileName)) throw (std::exception("KFR file not found \n"));
 	this->readKFRfile();
-	this->getKFBlist();
-	this->getKFBStats();
+	this->manifest.Open(this->kfrFileName);
+	this->kfbFiles = this->manifest.GetFiles();
+	this->width = this->manifest.getWidth();
+	this->height = this->manifest.getHeight();
+	this->makeCacheKeys();
+	this->kfbLoader.SetSequence(this->kfbFiles, this->kfbKeys, this->width, this->height, this->kfbStorage);
 	if (this->width == 0 || this->height == 0) return;
 	this->readyToRender = true;
 }
@@ -72,6 +85,14 @@ void LocalSequenceData::clear()
 	this->nextFrameNumber = -1;
 	this->nextFrameKFB = nullptr;
 	this->kfrColours.fill(RGB(0,0,0));
+	this->kfbKeys.clear();
+	this->thirdFrameNumber = -1;
+	this->thirdFrameKFB = nullptr;
+	this->fourthFrameNumber = -1;
+	this->fourthFrameKFB = nullptr;
+	this->DisposeOfCachedImages();
+	this->kfbLoader.Cancel();
+	this->manifest.Close();
 
 }
 
@@ -92,7 +113,7 @@ void LocalSequenceData::readKFRfile() {
 		if(lineHeader == "IterDiv:") ss >> this->kfrIterationDivision;
 		if(lineHeader == "Colors:") {
 			int cIndex = 0;
-			while(!ss.eof() && cIndex < kfrColours.size()) {
+			while(!ss.eof() && cIndex < static_cast<int>(kfrColours.size())) {
 				int red = 0, green = 0, blue = 0;
 				char c1 = 0, c2 = 0, c3 = 0;
 				ss >> blue >> c1 >> green >>c2 >> red >> c3;
@@ -110,146 +131,196 @@ void LocalSequenceData::readKFRfile() {
 
 
 /*******************************************************************************************************
-Get a list of all the KFB files in the same directory as the kfr file.
+Setup the keyframes needed to render keyFrame (the active and next frame, plus two more for mercator).
+Keyframes come from the cache if possible, then queue the following keyframes to be loaded in the background.
 *******************************************************************************************************/
-void LocalSequenceData::getKFBlist()
-{
-	auto path = fs::path(this->kfrFileName).parent_path();
-	for (const auto & entry : fs::directory_iterator(path)) {
-		if (entry.path().extension().compare(".kfb") == 0) {
-			this->kfbFiles.push_back(entry.path().string());
-		}
-	}
-	std::sort(this->kfbFiles.rbegin(), this->kfbFiles.rend());
-}
+void LocalSequenceData::SetupActiveKFB(long keyFrame) {
+	if (!readyToRender) return;
+	const long numFrames = static_cast<long>(this->kfbFiles.size());
 
-/*******************************************************************************************************
+	//Release the frames from the last render first, so they are not pinned in the cache.
+	this->activeKFB = nullptr;
+	this->nextFrameKFB = nullptr;
+	this->thirdFrameKFB = nullptr;
+	this->fourthFrameKFB = nullptr;
 
-*******************************************************************************************************/
-void LocalSequenceData::getKFBStats() {
-	if(this->kfbFiles.empty()) return;
-	auto fileName = this->kfbFiles[0];
-	if(!fs::exists(fileName)) throw (std::exception("KFB file missing\n"));
+	//Active Frame
+	this->activeKFB = GetKFB(keyFrame);
+	this->activeFrameNumber = keyFrame;
 
-	//Readfile
-	std::ifstream file {fileName, std::ios::binary | std::ios::in};
+	//Next frame
+	const auto keyFrame2 = keyFrame + 1;
+	this->nextFrameKFB = (keyFrame2 < numFrames) ? GetKFB(keyFrame2) : nullptr;
+	this->nextFrameNumber = (keyFrame2 < numFrames) ? keyFrame2 : -1;
 
-	if(!file) throw (std::exception("Unable to open KFB file\n"));
+	//3rd and 4th Frame (mercator only).
+	const auto keyFrame3 = keyFrame + 2;
+	const auto keyFrame4 = keyFrame + 3;
+	this->thirdFrameKFB = (this->mercator && keyFrame3 < numFrames) ? GetKFB(keyFrame3) : nullptr;
+	this->thirdFrameNumber = (this->thirdFrameKFB) ? keyFrame3 : -1;
+	this->fourthFrameKFB = (this->mercator && keyFrame4 < numFrames) ? GetKFB(keyFrame4) : nullptr;
+	this->fourthFrameNumber = (this->fourthFrameKFB) ? keyFrame4 : -1;
+	
+	pruneCachedImages();
+	PrefetchKFBs(keyFrame);
+}
 
-	//Check ID
-	char id[3];
-	file.read(id, 3);
-	if(!(id[0] == 'K' && id[1] == 'F' && id[2] == 'B')) throw (std::exception("KFB file has invalid ID\n"));
+/*******************************************************************************************************
+Get a keyframe from the shared cache, or load it (the loader adds it to the cache).
+*******************************************************************************************************/
+std::shared_ptr<const KFBData> LocalSequenceData::GetKFB(long keyFrame) {
+	if (keyFrame < 0 || keyFrame >= static_cast<long>(this->kfbKeys.size())) throw(std::exception("Invalid keyFrame requested in GetKFB()"));
+	auto & cache = KFBCache::Shared();
+	auto data = cache.Find(this->kfbKeys[keyFrame]);
+	if (data) return data;
+
+	data = LoadKFB(keyFrame);
+
+	const auto stats = cache.GetStats();
+	std::ostringstream ss;
+	ss << "KFB cache: " << stats.entries << " keyframes, " << (stats.usedBytes >> 20) << "/" << (stats.budgetBytes >> 20) << "MB, ";
+	ss << stats.hits << " hits, " << stats.misses << " misses, " << stats.evictions << " evictions\n";
+	DebugMessage(ss.str());
+	return data;
+}
 
+/*******************************************************************************************************
+Queue the keyframes after the ones in use to be loaded in the background.
+Anything previously queued that is no longer in range is dropped.
+*******************************************************************************************************/
+void LocalSequenceData::PrefetchKFBs(long keyFrame) {
+	std::vector<long> wanted;
+	const long first = keyFrame + ((this->mercator) ? 4 : 2);
+	for (long k = first; k < first + this->prefetchCount && k < static_cast<long>(this->kfbFiles.size()); k++) {
+		if (KFBCache::Shared().Contains(this->kfbKeys[k])) continue;
+		wanted.push_back(k);
+	}
+	this->kfbLoader.Prefetch(wanted);
+}
 
-	//Read Size
-	file.read((char *) &this->width, sizeof(width));
-	file.read((char *) &this->height, sizeof(height));
+/*******************************************************************************************************
+Release this instance's kfb data (and anything being loaded in the background), eg. because the storage
+type has changed.  Data in the shared cache is left for other instances (or released as it ages).
+*******************************************************************************************************/
+void LocalSequenceData::DeleteKFBData() {
+	this->activeFrameNumber = -1;
+	this->activeKFB = nullptr;
+	this->nextFrameNumber = -1;
+	this->nextFrameKFB = nullptr;
+	this->thirdFrameNumber = -1;
+	this->thirdFrameKFB = nullptr;
+	this->fourthFrameNumber = -1;
+	this->fourthFrameKFB = nullptr;
+	this->DisposeOfCachedImages();
+	this->makeCacheKeys();
+	this->kfbLoader.SetSequence(this->kfbFiles, this->kfbKeys, this->width, this->height, this->kfbStorage);
+}
 
+/*******************************************************************************************************
+Make the shared cache key for each keyframe (see MakeKFBCacheKey).
+*******************************************************************************************************/
+void LocalSequenceData::makeCacheKeys() {
+	this->kfbKeys.clear();
+	for (long k = 0; k < static_cast<long>(this->kfbFiles.size()); k++) {
+		uint64_t size = 0;
+		int64_t modified = 0;
+		this->manifest.GetFileInfo(k, size, modified);
+		this->kfbKeys.push_back(MakeKFBCacheKey(this->kfbFiles[k], size, modified, this->kfbStorage));
+	}
 }
 
 /*******************************************************************************************************
+Get the pre-rendered image of a keyframe (made by this instance).  Returns nullptr if there isn't one.
+*******************************************************************************************************/
+WorldHolder * LocalSequenceData::GetCachedImage(long keyFrame) {
+	auto found = this->cachedImages.find(keyFrame);
+	if (found == this->cachedImages.end() || !found->second.handle) return nullptr;
+	return &found->second;
+}
 
+/*******************************************************************************************************
+Get an empty holder for the pre-rendered image of a keyframe (replaces any existing image).
 *******************************************************************************************************/
-void LocalSequenceData::SetupActiveKFB(long keyFrame, PF_InData* in_data) {
-	if (!readyToRender) return;
-	
+WorldHolder & LocalSequenceData::NewCachedImage(long keyFrame) {
+	auto & image = this->cachedImages[keyFrame];
+	image.Destroy();
+	return image;
+}
 
-	//Active Frame
-	if (activeFrameNumber != keyFrame) {
-		if (!mercator && activeFrameNumber >= 0) {
-			//If we are not using mercator, take a cached copy of the existing data (this will speed up reverse rendering)
-			this->thirdFrameKFB = this->fourthFrameKFB;
-			this->thirdFrameNumber = this->fourthFrameNumber;
-			this->fourthFrameKFB = this->activeKFB;
-			this->fourthFrameNumber = activeFrameNumber;
-		}
+/*******************************************************************************************************
+Get the fields and shading of a keyframe's cached image (empty if they haven't been made).
+*******************************************************************************************************/
+CachedStages & LocalSequenceData::GetCachedStages(long keyFrame) {
+	return this->cachedStages[keyFrame];
+}
 
-		if (fourthFrameNumber == keyFrame) {
-			this->activeKFB = this->fourthFrameKFB;
-			this->activeFrameNumber = keyFrame;
-		}
-		else if (thirdFrameNumber == keyFrame) {
-			this->activeKFB = this->thirdFrameKFB;
-			this->activeFrameNumber = keyFrame;
-		}
-		else if (nextFrameNumber == keyFrame) {
-			this->activeKFB = this->nextFrameKFB;
-			this->activeFrameNumber = keyFrame;
-		}
-		else {
-			auto data = std::make_shared<KFBData>(this->width, this->height);
-			LoadKFB(data, keyFrame);
-			activeFrameNumber = keyFrame;
-			this->activeKFB = data;
+/*******************************************************************************************************
+Release the pre-rendered images, and their stages from stage on (because render settings have changed).
+*******************************************************************************************************/
+void LocalSequenceData::DisposeOfCachedImages(CacheStage stage) {
+	this->cachedImages.clear();
+	if(stage == CacheStage::fields) {
+		this->cachedStages.clear();
+	}
+	else if(stage == CacheStage::shading) {
+		for (auto & [keyFrame, stages] : this->cachedStages) {
+			stages.shading.clear();
+			stages.shading.shrink_to_fit();
 		}
 	}
+	ReportCachedImageMemory();
+}
 
-	//Next frame
-	const auto keyFrame2 = keyFrame + 1;
-	if (nextFrameNumber != keyFrame2 && keyFrame2 < this->kfbFiles.size()) {
-		if (fourthFrameNumber == keyFrame2) {
-			this->nextFrameKFB = this->fourthFrameKFB;
-			this->nextFrameNumber = keyFrame2;
-		}
-		else if (thirdFrameNumber == keyFrame2) {
-			this->nextFrameKFB = this->thirdFrameKFB;
-			this->nextFrameNumber = keyFrame2;
+/*******************************************************************************************************
+Tell the shared cache how much memory this instance's cached images, their stages and the buffers
+they are blended on use, so it counts against the budget (see KFBCache::SetHeldBytes).
+*******************************************************************************************************/
+void LocalSequenceData::ReportCachedImageMemory() {
+	size_t bytes = 0;
+	auto world = [&bytes](const WorldHolder & holder) {
+		if(holder.handle) bytes += static_cast<size_t>(holder.effectWorld.rowbytes) * holder.effectWorld.height;
+	};
+	for (const auto & [keyFrame, image] : this->cachedImages) world(image);
+	for (const auto & [keyFrame, stages] : this->cachedStages) bytes += stages.fields.capacity() * sizeof(double) + stages.shading.capacity() * sizeof(float);
+	world(this->tempImageBuffer);
+	world(this->tempImageBuffer2);
+	KFBCache::Shared().SetHeldBytes(this, bytes);
+}
+
+/*******************************************************************************************************
+Release pre-rendered images of keyframes that are no longer in use, or in the shared cache.
+Stages are only kept for the keyframes in use: they are up to 16 bytes a pixel on top of the image.
+Both count against the shared cache's budget (see ReportCachedImageMemory).
+*******************************************************************************************************/
+void LocalSequenceData::pruneCachedImages() {
+	const auto inUse = [this](long k) {
+		return k == this->activeFrameNumber || k == this->nextFrameNumber || k == this->thirdFrameNumber || k == this->fourthFrameNumber;
+	};
+	for (auto it = this->cachedImages.begin(); it != this->cachedImages.end();) {
+		const long k = it->first;
+		if (inUse(k) || (k < static_cast<long>(this->kfbKeys.size()) && KFBCache::Shared().Contains(this->kfbKeys[k]))) {
+			++it;
 		}
 		else {
-			auto data = std::make_shared<KFBData>(this->width, this->height);
-			LoadKFB(data, keyFrame2);
-			nextFrameNumber = keyFrame2;
-			this->nextFrameKFB = data;
+			it = this->cachedImages.erase(it);
 		}
 	}
-
-	//3rd Frame (mercator only).
-	const auto keyFrame3 = keyFrame + 2;
-	if (this->mercator && thirdFrameNumber != keyFrame3 && keyFrame3 < this->kfbFiles.size()) {
-		if (fourthFrameNumber == keyFrame3) {
-			this->thirdFrameKFB = this->fourthFrameKFB;
-			this->thirdFrameNumber = keyFrame3;
+	for (auto it = this->cachedStages.begin(); it != this->cachedStages.end();) {
+		if (inUse(it->first)) {
+			++it;
 		}
 		else {
-			auto data = std::make_shared<KFBData>(this->width, this->height);
-			LoadKFB(data, keyFrame3);
-			thirdFrameNumber = keyFrame3;
-			this->thirdFrameKFB = data;
+			it = this->cachedStages.erase(it);
 		}
 	}
-
-	//4th Frame (mercator only). 
-	const auto keyFrame4 = keyFrame + 3;
-	if (this->mercator && fourthFrameNumber != keyFrame4 && keyFrame4 < this->kfbFiles.size()) {
-		auto data = std::make_shared<KFBData>(this->width, this->height);
-		LoadKFB(data, keyFrame4);
-		fourthFrameNumber = keyFrame3;
-		this->fourthFrameKFB = data;
-	}
-	
-}
-
-void LocalSequenceData::DeleteKFBData() {
-	this->activeFrameNumber = -1;
-	this->activeKFB = nullptr;
-	this->nextFrameNumber = -1;
-	this->nextFrameKFB = nullptr;
-	this->thirdFrameNumber = -1;
-	this->thirdFrameKFB = nullptr;
-	this->fourthFrameNumber = -1;
-	this->fourthFrameKFB = nullptr;
+	ReportCachedImageMemory();
 }
 
 /*******************************************************************************************************
-
+Get the data for a keyframe (waits if it is still being loaded in the background).
+Uses the .kfbc sidecar instead of the .kfb when sidecars are turned on and it is valid.
 *******************************************************************************************************/
-void LocalSequenceData::LoadKFB(std::shared_ptr<KFBData> & data, long keyFrame) {
-	if(keyFrame >= this->kfbFiles.size()) throw(std::exception("Invalid keyFrame requested in LoadKFB()"));
-	DebugMessage("Reading KFB File:"); DebugMessage(this->kfbFiles[keyFrame]); DebugMessage("\n");
-
-	auto fileName = this->kfbFiles[keyFrame];
-	data->ReadKFBFile(fileName);
+std::shared_ptr<const KFBData> LocalSequenceData::LoadKFB(long keyFrame) {
+	if(keyFrame >= static_cast<long>(this->kfbFiles.size())) throw(std::exception("Invalid keyFrame requested in LoadKFB()"));
+	return this->kfbLoader.Load(keyFrame);
 }
-
- 
\ No newline at end of file
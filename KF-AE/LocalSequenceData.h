@@ -26,16 +26,53 @@ You should have received a copy of the GNU Affero General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 ********************************************************************************************/
 #include "KFBData.h"
+#include "KFBLoader.h"
+#include "KFBCache.h"
+#include "KFBManifest.h"
+#include "KFBResample.h"
 
 #include <atomic>
 #include <string>
 #include <array>
+#include <map>
 #include <vector>
 #include <filesystem>
 
 
 
 
+//Where each output column and row samples the keyframes, for one render (see PrepareFrameCoordinates).
+//A pixel's location is separable (column x, row y), so these are tables per column and per row.
+struct FrameCoordinates {
+	std::vector<double> activeX;		//Location in the active keyframe
+	std::vector<double> activeY;
+	std::vector<double> nextX;			//Location in the next keyframe
+	std::vector<double> nextY;
+	std::vector<double> intraStepX;		//Step for intra-frame distances (the pixel's step is the larger of the two)
+	std::vector<double> intraStepY;
+	double activeStep {1};				//Step for blended distances in each keyframe (one output pixel)
+	double nextStep {1};
+	bool blendNext {false};				//The next keyframe is blended in
+	KFBResamplePlan activePlan;			//How each keyframe is sampled (if it can be, see KFBResample.h)
+	KFBResamplePlan nextPlan;
+};
+
+//The stages of a cached image, each made from the ones before it.  Only the stages whose settings
+//changed are made again (see DoCachedImages).
+enum class CacheStage {
+	fields,			//The value each pixel is coloured from (see StageFunctions)
+	shading,		//The slopes of each pixel
+	colours,		//The cached image itself
+};
+
+//The fields and shading of a keyframe, the size of its cached image.  Methods without stages don't have them.
+struct CachedStages {
+	A_long width {0};
+	A_long height {0};
+	std::vector<double> fields;		//-1 inside the set
+	std::vector<float> shading;		//Scale then add for each pixel (empty without slopes, or until made)
+};
+
 class LocalSequenceData {
 	public:
 		bool readyToRender{ false };
@@ -77,6 +114,8 @@ class LocalSequenceData {
 		bool mercator{ false };
 		long mercatorMode{ 1 };
 		double mercatorRadius{ 1 };
+		KFBStorage kfbStorage{ KFBStorage::standard };
+		long prefetchCount{ 2 };		//Number of keyframes to load ahead in the background
 
 		
 		//For sampling functions
@@ -85,18 +124,27 @@ class LocalSequenceData {
 		PF_SamplingFloatSuite1 * sample32 {nullptr};
 		PF_InData * in_data {nullptr};
 
-		std::shared_ptr<KFBData> activeKFB {nullptr};
+		std::shared_ptr<const KFBData> activeKFB {nullptr};
 		long activeFrameNumber {-1};
 		double activeZoomScale {1};
+		int activeMipLevel {0};		//Mip level sampled for this render (see KFBData::PrepareMipLevel)
 
-		std::shared_ptr<KFBData> nextFrameKFB {nullptr};
+		std::shared_ptr<const KFBData> nextFrameKFB {nullptr};
 		long nextFrameNumber {-1};
 		double nextZoomScale {2};
+		int nextMipLevel {0};
+		FrameCoordinates frameCoordinates;		//Sample locations for this render (see PrepareFrameCoordinates)
 
-		std::shared_ptr<KFBData> thirdFrameKFB{ nullptr };
+		std::shared_ptr<const KFBData> thirdFrameKFB{ nullptr };
 		long thirdFrameNumber{ -1 };
-		std::shared_ptr<KFBData> fourthFrameKFB{ nullptr };
+		std::shared_ptr<const KFBData> fourthFrameKFB{ nullptr };
 		long fourthFrameNumber{ -1 };
+
+		KFBLoader kfbLoader;
+		KFBManifest manifest;				//File list and per keyframe statistics
+		std::vector<std::string> kfbKeys;	//Shared cache key of each kfb file
+		std::map<long, WorldHolder> cachedImages;	//Pre-rendered image of each keyframe (this instance's settings)
+		std::map<long, CachedStages> cachedStages;	//What each cached image is coloured from (keyframes in use only)
 		
 		WorldHolder tempImageBuffer;
 		WorldHolder tempImageBuffer2;
@@ -104,10 +152,16 @@ class LocalSequenceData {
 		PF_EffectWorld* mercatorOutput{ nullptr }; //Mercator output image
 
 		LocalSequenceData();
+		~LocalSequenceData();
 
 		void SetupFileData(const std::string & fileName);
-		void SetupActiveKFB(long keyFrame, PF_InData *in_data);
+		void SetupActiveKFB(long keyFrame);
 		void DeleteKFBData();
+		WorldHolder * GetCachedImage(long keyFrame);
+		WorldHolder & NewCachedImage(long keyFrame);
+		CachedStages & GetCachedStages(long keyFrame);
+		void DisposeOfCachedImages(CacheStage stage = CacheStage::fields);
+		void ReportCachedImageMemory();
 
 		///Save a copy of parameters that might invalidate the cache.
 		void saveCachedParameters() {
@@ -128,29 +182,36 @@ class LocalSequenceData {
 			cache_slopeMethod = slopeMethod;
 			cache_sampling = sampling;
 			cache_special = special;
+			cache_kfbStorage = kfbStorage;
 		};
 
-		///Check if any parameters that would invalidate the cache have changed
-		bool isCacheInvalid() const {
+		///Check if any parameters that would invalidate a stage of the cache (or the stages before it) have changed
+		bool isCacheInvalid(CacheStage stage = CacheStage::colours) const {
 			if(sampling) return true;
-			return !(cache_colourDivision == colourDivision &&
-					 cache_modifier == modifier &&
+			const bool fieldsValid = cache_modifier == modifier &&
 					 cache_method == method &&
 					 cache_useSmooth == useSmooth &&
 					 cache_scaleFactorX == scaleFactorX &&
 					 cache_scaleFactorY == scaleFactorY &&
+					 cache_sampling == sampling &&
+					 cache_kfbStorage == kfbStorage;
+			if(!fieldsValid) return true;
+			if(stage == CacheStage::fields) return false;
+
+			const bool shadingValid = cache_slopesEnabled == slopesEnabled &&
+					 cache_slopeShadowDepth == slopeShadowDepth &&
+					 cache_slopeStrength == slopeStrength &&
+					 cache_slopeAngle == slopeAngle &&
+					 cache_slopeMethod == slopeMethod;
+			if(!shadingValid) return true;
+			if(stage == CacheStage::shading) return false;
+
+			return !(cache_colourDivision == colourDivision &&
 					 cache_bitDepth == bitDepth &&
 					 cache_insideColour == insideColour &&
 					 cache_colourOffset == colourOffset &&
 					 cache_distanceClamp == distanceClamp &&
-					 cache_slopesEnabled == slopesEnabled &&
-					 cache_slopeShadowDepth == slopeShadowDepth &&
-					 cache_slopeStrength == slopeStrength &&
-					 cache_slopeAngle == slopeAngle &&
-					 cache_slopeMethod == slopeMethod &&
-					 cache_sampling == sampling &&
 					 cache_special == special
-					
 				);
 		}
 		
@@ -173,12 +234,15 @@ private:
 		long cache_slopeMethod {1};
 		bool cache_sampling {false};
 		double cache_special {0};
+		KFBStorage cache_kfbStorage {KFBStorage::standard};
 		
 
 		void clear();
-		void getKFBlist();
-		void getKFBStats();
-		void LoadKFB(std::shared_ptr<KFBData> & data, long keyFrame);
+		std::shared_ptr<const KFBData> GetKFB(long keyFrame);
+		std::shared_ptr<const KFBData> LoadKFB(long keyFrame);
+		void makeCacheKeys();
+		void pruneCachedImages();
+		void PrefetchKFBs(long keyFrame);
 		void readKFRfile();
 		
 		
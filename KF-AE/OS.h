@@ -20,7 +20,42 @@ You should have received a copy of the GNU Affero General Public License
 along with this program.  If not, see <https://www.gnu.org/licenses/>.
 ********************************************************************************************/
 #include <string>
+#include <cstddef>
+#include <cstdint>
+
+//A read-only view of a whole file (see MapFileReadOnly).
+struct MappedFile {
+	const char * data {nullptr};		//Start of the mapped file
+	size_t size {0};					//Size of the file in bytes
+	void * fileHandle {nullptr};		//OS handles, only used by the OS specific code.
+	void * mappingHandle {nullptr};
+};
+
+//A block of memory shared (by name) with other processes on this machine (see OpenSharedMemory).
+struct SharedMemory {
+	char * data {nullptr};				//Start of the block (read/write)
+	size_t size {0};					//Size of the block in bytes
+	bool created {false};				//True if this call created the block (it is zero filled)
+	void * mappingHandle {nullptr};		//OS handle, only used by the OS specific code.
+};
+
+//Vector instruction sets, in order (see DetectSIMDLevel).
+enum class SIMDLevel : int {
+	scalar = 0,
+	sse2,
+	avx2,
+	avx512,
+};
 
 void DebugMessage(const std::string & str) noexcept;
 void ShowMessageBox(const std::string & str);
-std::string ShowFileOpenDialogKFR();
\ No newline at end of file
+std::string ShowFileOpenDialogKFR();
+MappedFile MapFileReadOnly(const std::string & fileName);
+void UnmapFile(MappedFile & file) noexcept;
+SharedMemory OpenSharedMemory(const std::string & name, size_t size);
+void CloseSharedMemory(SharedMemory & memory) noexcept;
+void RemoveSharedMemory(const std::string & name) noexcept;
+unsigned long CurrentProcessID() noexcept;
+bool IsProcessRunning(unsigned long processID) noexcept;
+uint64_t ProcessStartTime(unsigned long processID) noexcept;
+SIMDLevel DetectSIMDLevel() noexcept;
\ No newline at end of file
@@ -52,7 +52,7 @@ inline long useParam(ParameterID p);
 Setup Parameters
 Respond to the After Effects PF_Cmd_PARAMS_SETUP event.
 *******************************************************************************************************/
-PF_Err ParameterSetup(PF_InData	*in_data, PF_OutData *out_data, PF_ParamDef	*params[], PF_LayerDef *output) {
+PF_Err ParameterSetup(PF_InData	* /*in_data*/, PF_OutData *out_data, PF_ParamDef	* /*params*/[], PF_LayerDef * /*output*/) {
 	PF_Err err {PF_Err_NONE};
 	paramTranslate.fill(0);		//Prepare the location/id translation array.
 	paramsAdded = 1;			//Effect world is parameter number 0, so start at 1.
@@ -90,6 +90,12 @@ PF_Err ParameterSetup(PF_InData	*in_data, PF_OutData *out_data, PF_ParamDef	*par
 		AddSlider(ParameterID::radiusSize, "Radius Sample Size", 1, 100, 1, 100, 4, PF_Precision_TENTHS);
 		AddGroupEnd(ParameterID::topic_end_projection);
 	}
+	AddGroupStart(ParameterID::topic_start_performance, "Performance");
+	AddDropDown(ParameterID::kfbStorage, "KFB Memory", "Load into Memory|Memory Mapped|Load into Memory (Compact)|Shared Between Processes|Load into Memory (Tiled)", 1, PF_ParamFlag_CANNOT_TIME_VARY);
+	AddSlider(ParameterID::prefetchCount, "Key Frames to Preload", 0, 16, 0, 16, 2, PF_Precision_INTEGER, PF_ParamFlag_CANNOT_TIME_VARY);
+	AddSlider(ParameterID::cacheSize, "Key Frame Cache (MB)", 0, 1048576, 0, 65536, 4096, PF_Precision_INTEGER, PF_ParamFlag_CANNOT_TIME_VARY);
+	AddCheckBox(ParameterID::kfbSidecar, "Sidecar Files", "Write .kfbc files", false, PF_ParamFlag_CANNOT_TIME_VARY);
+	AddGroupEnd(ParameterID::topic_end_performance);
 	out_data->num_params = paramsAdded;
 	return err;
 }
@@ -107,7 +113,7 @@ inline long useParam(ParameterID p) {
 /*******************************************************************************************************
 File Select Button Clicked
 *******************************************************************************************************/
-PF_Err FileSelectButtonClicked(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef *params[]) {
+PF_Err FileSelectButtonClicked(PF_InData *in_data, PF_OutData * /*out_data*/, PF_ParamDef *params[]) {
 	auto fileName = ShowFileOpenDialogKFR();
 	if (fileName == "") return PF_Err_NONE;
 	
@@ -123,7 +129,6 @@ PF_Err FileSelectButtonClicked(PF_InData *in_data, PF_OutData *out_data, PF_Para
 		params[paramTranslate[static_cast<int>(ParameterID::colourDivision)]]->u.fs_d.value = sd->getLocalSequenceData()->kfrIterationDivision;
 		params[paramTranslate[static_cast<int>(ParameterID::colourDivision)]]->uu.change_flags = true;
 	}else {
-		auto numFiles = sd->getLocalSequenceData()->kfbFiles.size() - 1;
 		params[paramTranslate[static_cast<int>(ParameterID::keyFrameNumber)]]->u.fs_d.slider_max = 1;
 		params[paramTranslate[static_cast<int>(ParameterID::keyFrameNumber)]]->uu.change_flags = true;
 	}
@@ -398,7 +403,7 @@ Reads the index of a layer
 Uses check-in/check-out, so this is ok to use during a smart-render call. 
 (The actual layer should also be checked out, this only gets the index)
 *******************************************************************************************************/
-long readLayerParamIndex(PF_InData *in_data, ParameterID paramID) {
+long readLayerParamIndex(PF_InData * /*in_data*/, ParameterID paramID) {
 	auto parameterLocation = paramTranslate[static_cast<int> (paramID)];
 	if(parameterLocation == 0) throw ("Invalid request in readLayerParam");
 	/*PF_ParamDef param {};
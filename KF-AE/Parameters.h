@@ -50,6 +50,12 @@ enum class ParameterID : long {
 	topic_end_projection,
 	mercatorMode,
 	radiusSize,
+	topic_start_performance,
+	topic_end_performance,
+	kfbStorage,
+	prefetchCount,
+	cacheSize,
+	kfbSidecar,
 	__last,  //Must be last (used for array memory allocation)
 };
 
@@ -0,0 +1,214 @@
+/********************************************************************************************
+OS Specific function (POSIX)
+
+Author:			(c) 2019 Adam Sakareassen
+
+Description:	The functions of OS.h for Linux (and other POSIX systems).
+				The plug-in itself only builds for Windows (see Win/OS_Windows.cpp), this lets
+				the KFB code be built and tested without AE (see Tests).
+
+Licence:		GNU Affero General Public License
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "../OS.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <cerrno>
+#include <fstream>
+#include <sstream>
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+/*******************************************************************************************************
+Write a message to the debug stream (stderr, only if KFB_DEBUG_MESSAGES is set).
+*******************************************************************************************************/
+void DebugMessage(const std::string & str) noexcept {
+	static const bool enabled = (std::getenv("KFB_DEBUG_MESSAGES") != nullptr);
+	if(enabled) std::fputs(str.c_str(), stderr);
+}
+
+/*******************************************************************************************************
+There is no message box without a UI, so the message is written to stderr.
+*******************************************************************************************************/
+void ShowMessageBox(const std::string& str)
+{
+	std::fprintf(stderr, "Error: %s\n", str.c_str());
+}
+
+/*******************************************************************************************************
+There is no file dialog without a UI, so this always acts as if the user cancelled.
+*******************************************************************************************************/
+std::string ShowFileOpenDialogKFR() {
+	return "";
+}
+
+/*******************************************************************************************************
+Map a whole file into memory (read only).
+The pages are shared with the OS file cache, so multiple processes mapping the same file share memory.
+Throws if the file can't be mapped.
+*******************************************************************************************************/
+MappedFile MapFileReadOnly(const std::string & fileName) {
+	MappedFile file {};
+	const int fd = open(fileName.c_str(), O_RDONLY);
+	if(fd < 0) throw(std::runtime_error("Unable to open file for mapping"));
+
+	struct stat info {};
+	if(fstat(fd, &info) != 0 || info.st_size == 0) {
+		close(fd);
+		throw(std::runtime_error("Unable to map empty file"));
+	}
+
+	void * view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);		//The mapping keeps the file open.
+	if(view == MAP_FAILED) throw(std::runtime_error("Unable to map view of file"));
+	madvise(view, static_cast<size_t>(info.st_size), MADV_RANDOM);
+
+	file.data = static_cast<const char *>(view);
+	file.size = static_cast<size_t>(info.st_size);
+	return file;
+}
+
+/*******************************************************************************************************
+Release a file mapped with MapFileReadOnly. Safe to call on an empty MappedFile.
+*******************************************************************************************************/
+void UnmapFile(MappedFile & file) noexcept {
+	if(file.data) munmap(const_cast<char *>(file.data), file.size);
+	file = MappedFile {};
+}
+
+/*******************************************************************************************************
+Open (or create) a named block of memory shared by all processes on this machine.
+A new block is zero filled.  Throws if the block can't be created, or an existing block is too small.
+The creator sizes the block after creating it, so a process that opens it first waits (briefly) for
+the size to be set.
+Note: Unlike Windows, the block isn't freed when the last process closes it, it lasts until it is
+removed with shm_unlink (or the machine restarts).
+*******************************************************************************************************/
+SharedMemory OpenSharedMemory(const std::string & name, size_t size) {
+	SharedMemory memory {};
+	const auto fullName = "/" + name;
+	int fd = shm_open(fullName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+	const bool created = (fd >= 0);
+	if(!created) fd = shm_open(fullName.c_str(), O_RDWR, 0600);
+	if(fd < 0) throw(std::runtime_error("Unable to create shared memory"));
+
+	if(created) {
+		if(ftruncate(fd, static_cast<off_t>(size)) != 0) {
+			close(fd);
+			shm_unlink(fullName.c_str());
+			throw(std::runtime_error("Unable to size shared memory"));
+		}
+	}
+	else {
+		//An existing block keeps its original size.
+		struct stat info {};
+		for(int tries = 0; ; tries++) {
+			const bool sized = (fstat(fd, &info) == 0);
+			if(sized && static_cast<size_t>(info.st_size) >= size) break;
+			if(!sized || tries == 1000) {
+				close(fd);
+				throw(std::runtime_error("Shared memory is smaller than expected"));
+			}
+			usleep(1000);
+		}
+	}
+
+	void * view = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);		//The mapping keeps the block open.
+	if(view == MAP_FAILED) throw(std::runtime_error("Unable to map view of shared memory"));
+
+	memory.data = static_cast<char *>(view);
+	memory.size = size;
+	memory.created = created;
+	return memory;
+}
+
+/*******************************************************************************************************
+Release shared memory opened with OpenSharedMemory. Safe to call on an empty SharedMemory.
+*******************************************************************************************************/
+void CloseSharedMemory(SharedMemory & memory) noexcept {
+	if(memory.data) munmap(memory.data, memory.size);
+	memory = SharedMemory {};
+}
+
+/*******************************************************************************************************
+Remove the name of a shared memory block, so the next OpenSharedMemory creates a new one.  The block
+itself is freed once every process has closed it.
+*******************************************************************************************************/
+void RemoveSharedMemory(const std::string & name) noexcept {
+	shm_unlink(("/" + name).c_str());
+}
+
+/*******************************************************************************************************
+ID of this process.
+*******************************************************************************************************/
+unsigned long CurrentProcessID() noexcept {
+	return static_cast<unsigned long>(getpid());
+}
+
+/*******************************************************************************************************
+Check if a process is still running.
+A process we aren't allowed to signal is assumed to be running.
+Note: A finished child process counts as running until it is waited for.
+*******************************************************************************************************/
+bool IsProcessRunning(unsigned long processID) noexcept {
+	return kill(static_cast<pid_t>(processID), 0) == 0 || errno == EPERM;
+}
+
+/*******************************************************************************************************
+When a process started, so a process ID that has been reused can be told apart (the units don't
+matter, only that it differs).  Returns 0 if it isn't known.
+*******************************************************************************************************/
+uint64_t ProcessStartTime(unsigned long processID) noexcept {
+#ifdef __APPLE__
+	int mib[4] {CTL_KERN, KERN_PROC, KERN_PROC_PID, static_cast<int>(processID)};
+	struct kinfo_proc info {};
+	size_t size = sizeof(info);
+	if(sysctl(mib, 4, &info, &size, nullptr, 0) != 0 || size == 0) return 0;
+	return static_cast<uint64_t>(info.kp_proc.p_starttime.tv_sec) * 1000000 + info.kp_proc.p_starttime.tv_usec;
+#else
+	//Field 22 of /proc/<pid>/stat (clock ticks after boot).  The name (field 2) is in brackets, and may
+	//hold spaces or brackets itself, so fields are counted from the last bracket.
+	std::ifstream file {"/proc/" + std::to_string(processID) + "/stat"};
+	std::string line;
+	if(!std::getline(file, line)) return 0;
+	const auto nameEnd = line.rfind(')');
+	if(nameEnd == std::string::npos) return 0;
+	std::istringstream fields {line.substr(nameEnd + 1)};
+	std::string field;
+	for(int i = 3; i < 22 && fields >> field; i++) {}
+	uint64_t started = 0;
+	fields >> started;
+	return started;
+#endif
+}
+
+/*******************************************************************************************************
+The widest vector instruction set the CPU (and OS) supports.
+*******************************************************************************************************/
+SIMDLevel DetectSIMDLevel() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("avx512f")) return SIMDLevel::avx512;
+	if(__builtin_cpu_supports("avx2")) return SIMDLevel::avx2;
+	if(__builtin_cpu_supports("sse2")) return SIMDLevel::sse2;
+#endif
+	return SIMDLevel::scalar;
+}
@@ -24,12 +24,12 @@ constexpr double logScale = 10;
 /*******************************************************************************************************
 Rendering Code common to all bit depths
 *******************************************************************************************************/
-inline static double RenderCommon(const LocalSequenceData * local, A_long x, A_long y) {
-	double iCount = GetBlendedPixelValue(local, x, y);
+template<class Features>
+inline static double RenderCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
 	if(iCount >= local->activeKFB->maxIterations)  return -1;  //Inside pixel
 
 	double distance[3][3];
-	if(local->scalingMode == 1) {
+	if constexpr(Features::intraFrame) {
 		getDistanceIntraFrame(distance, x, y, local);
 	}
 	else {
@@ -54,73 +54,68 @@ inline static double RenderCommon(const LocalSequenceData * local, A_long x, A_l
 	
 	angle *= local->colourDivision;
 	angle += (local->colourOffset/1024)*2*pi;
-	angle = doModifier(local->modifier, angle);
+	angle = doModifier<Features::modifier>(angle);
 
 	double colour = (std::sin(angle)+1)/2;
 	
 
-	if(local->slopesEnabled) {
+	if constexpr(Features::slopes) {
 		double tempA, tempB;
-		doSlopes(distance, local, colour, tempA, tempB);
+		doSlopes<Features::slopeMethod>(distance, local, colour, tempA, tempB);
 	}
 	return colour;
 }
 
 
 /*******************************************************************************************************
-Render a pixel at 8-bit colour depth.
+The colour of one pixel, at any colour depth (see RenderKernelSpan).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_Angle::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	auto local = reinterpret_cast<LocalSequenceData*>(refcon);
+template<class Features>
+struct Render_Angle::SpanKernel {
+	static double Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommon<Features>(local, x, y, iCount);
+	}
+};
 
-	double colour = RenderCommon(local, x, y);
-	if(colour == -1) SetInsideColour8(local, out);
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_Angle::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, usesDistance>::Select(local);
+}
 
-	auto val = roundTo8Bit(colour * white8);
-	out->red = val;
-	out->blue = val;
-	out->green = val;
-	out->alpha = white8;
+template SpanFunction<PF_Pixel8> Render_Angle::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_Angle::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_Angle::SelectSpan(const LocalSequenceData * local);
 
+/*******************************************************************************************************
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_Angle::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
 
 /*******************************************************************************************************
 Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_Angle::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	auto local = reinterpret_cast<LocalSequenceData*>(refcon);
-
-	double colour = RenderCommon(local, x, y);
-	if(colour == -1) SetInsideColour16(local, out);
-
-	auto val = roundTo16Bit(colour * white16);
-
-	out->red = val;
-	out->blue = val;
-	out->green = val;
-	out->alpha = white16;
+PF_Err Render_Angle::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
 
 /*******************************************************************************************************
 Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_Angle::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * iP, PF_Pixel32 * out) {
-	auto local = reinterpret_cast<LocalSequenceData*>(refcon);
-
-	double colour = RenderCommon(local, x, y);
-	if(colour == -1) SetInsideColour32(local, out);
-
-	auto val = static_cast<float>(colour);
-	if(val < 0.0) val = 0.0; //Negative values causing rendering issues
-
-	out->red = val;
-	out->blue = val;
-	out->green = val;
-	out->alpha = white32;
+PF_Err Render_Angle::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
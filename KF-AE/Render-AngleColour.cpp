@@ -27,21 +27,23 @@ constexpr double overshoot = 0.002; //Overshoot the top of the sin wave, gives a
 static const double internalColour = greyColour * std::sin(((curveSize + overshoot) / curveSize) * pi / 2);
 
 /*******************************************************************************************************
-Rendering Code common to all bit depths
+The distances around a pixel, which its angle (and slopes) are made from.
 *******************************************************************************************************/
-inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y) {
-	double iCount = GetBlendedPixelValue(local, x, y);
-	if(iCount >= local->activeKFB->maxIterations)  return RGBdouble(-1, -1, -1);  //Inside pixel
-	
-	//Calculate Angle colour
-	double distance[3][3]{};
-	if(local->scalingMode == 1) {
+template<class Features>
+inline static void SlopeDistancesCommon(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+	if constexpr(Features::intraFrame) {
 		getDistanceIntraFrame(distance, x, y, local);
 	}
 	else {
 		GetBlendedDistanceMatrix(distance, local, x, y);
 	}
+}
 
+/*******************************************************************************************************
+The field of a pixel from the distances around it: its angle, after the modifier.
+*******************************************************************************************************/
+template<class Features>
+inline static double AngleField(double distance[][3]) {
 	double dx = (distance[0][1] - distance[2][1]);
 	double dy = (distance[1][0] - distance[1][2]);
 
@@ -58,11 +60,28 @@ inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x,
 	}
 	const double angle = std::atan2(dy, dx) + pi;
 
-	
-	
-	iCount = angle/(2*pi) *1024;  //scale angle from 0 to 1024
+	double iCount = angle/(2*pi) *1024;  //scale angle from 0 to 1024
 
-	iCount = doModifier(local->modifier, iCount);
+	return doModifier<Features::modifier>(iCount);
+}
+
+/*******************************************************************************************************
+The field of a pixel (-1 inside the set).
+*******************************************************************************************************/
+template<class Features>
+inline static double FieldCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+	if(iCount >= local->activeKFB->maxIterations)  return -1;  //Inside pixel
+
+	double distance[3][3]{};
+	SlopeDistancesCommon<Features>(distance, local, x, y);
+	return AngleField<Features>(distance);
+}
+
+/*******************************************************************************************************
+The colour of a field, before the slopes.
+*******************************************************************************************************/
+template<class Features>
+inline static RGBdouble MapCommon(const LocalSequenceData * local, double iCount) {
 	iCount *= local->colourDivision;  //Multiply, it makes more sense for angles
 	iCount += local->colourOffset;
 
@@ -77,72 +96,99 @@ inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x,
 	result.red = (lowColour.red * (1 - mixWeight) + highColour.red* mixWeight) / white8;
 	result.green = (lowColour.green * (1 - mixWeight) + highColour.green* mixWeight) / white8;
 	result.blue = (lowColour.blue * (1 - mixWeight) + highColour.blue *mixWeight) / white8;
+	return result;
+}
 
+/*******************************************************************************************************
+Rendering Code common to all bit depths
+The slopes are made from the same distances as the angle.
+*******************************************************************************************************/
+template<class Features>
+inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+	if(iCount >= local->activeKFB->maxIterations)  return RGBdouble(-1, -1, -1);  //Inside pixel
+	
+	//Calculate Angle colour
+	double distance[3][3]{};
+	SlopeDistancesCommon<Features>(distance, local, x, y);
+	iCount = AngleField<Features>(distance);
+
+	RGBdouble result = MapCommon<Features>(local, iCount);
 
-	if(local->slopesEnabled) {
+	if constexpr(Features::slopes) {
 		
-		doSlopes(distance, local, result.red, result.green, result.blue);
+		doSlopes<Features::slopeMethod>(distance, local, result.red, result.green, result.blue);
 	}
 	return  result;
 }
 
 
 /*******************************************************************************************************
-Render a pixel at 8-bit colour depth.
+The colour of one pixel, at any colour depth (see RenderKernelSpan), and its stages (see StageFunctions).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_AngleColour::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	if (!refcon) return PF_Err_NONE;
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
+template<class Features>
+struct Render_AngleColour::SpanKernel {
+	static constexpr long slopeMethod = Features::slopeMethod;
 
-	const auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour8(local, out);
+	static RGBdouble Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommon<Features>(local, x, y, iCount);
+	}
+	static double Field(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return FieldCommon<Features>(local, x, y, iCount);
+	}
+	static RGBdouble Map(const LocalSequenceData * local, double field) {
+		return MapCommon<Features>(local, field);
+	}
+	static void SlopeDistances(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+	}
+};
 
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_AngleColour::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, usesDistance>::Select(local);
+}
 
-	out->red = roundTo8Bit(colour.red * white8);
-	out->green = roundTo8Bit(colour.green * white8);
-	out->blue = roundTo8Bit(colour.blue * white8);
-	out->alpha = white8;
+template SpanFunction<PF_Pixel8> Render_AngleColour::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_AngleColour::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_AngleColour::SelectSpan(const LocalSequenceData * local);
 
-	return PF_Err_NONE;
+/*******************************************************************************************************
+The stages of cached images for a frame's settings.
+*******************************************************************************************************/
+StageFunctions Render_AngleColour::SelectStages(const LocalSequenceData * local) {
+	return StageKernelSelector<SpanKernel, usesDistance>::Select(local);
+}
 
+/*******************************************************************************************************
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_AngleColour::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
+	return PF_Err_NONE;
 }
 
 /*******************************************************************************************************
 Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_AngleColour::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	if (!refcon) return PF_Err_NONE;
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	const auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour16(local, out);
-
-	out->red = roundTo16Bit(colour.red * white16);
-	out->green = roundTo16Bit(colour.green * white16);
-	out->blue = roundTo16Bit(colour.blue * white16);
-	out->alpha = white16;
+PF_Err Render_AngleColour::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
 
 /*******************************************************************************************************
 Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_AngleColour::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * iP, PF_Pixel32 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour32(local, out);
-
-
-	if(colour.red < 0.0) colour.red = 0.0; //Negative values causing rendering issues
-	if(colour.green < 0.0) colour.green = 0.0;
-	if(colour.blue < 0.0) colour.blue = 0.0;
-
-	out->red = static_cast<float>(colour.red);
-	out->green = static_cast<float>(colour.green);
-	out->blue = static_cast<float>(colour.blue);
-	out->alpha = white32;
+PF_Err Render_AngleColour::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
@@ -30,7 +30,7 @@ static const double internalColour = greyColour * std::sin(((curveSize + oversho
 /*******************************************************************************************************
 Perform distance calculation
 *******************************************************************************************************/
-inline static double doDistance(double p[][3], A_long x, A_long y, const LocalSequenceData* local, bool locationBasedScale = true) {
+inline static double doDistance(double p[][3]) {
 
 	//Traditional
 	double gx = (p[0][1] - p[1][1]);
@@ -46,21 +46,25 @@ inline static double doDistance(double p[][3], A_long x, A_long y, const LocalSe
 /*******************************************************************************************************
 Rendering Code common to all bit depths
 *******************************************************************************************************/
-inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y) {
-	double iCount = GetBlendedPixelValue(local, x, y);
+template<class Features>
+inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
 	if(iCount >= local->activeKFB->maxIterations)  return ARGBdouble(-1, -1, -1, -1);  //Inside pixel
 	double distance[3][3];
 
-	ARGBdouble result(1.0, 0.5, 0.5, 0.5);
-	if(local->sampling) {
-		if(local->layer) {
-			if(local->scalingMode == 1) {
-				getDistanceIntraFrame(distance, x, y, local);
-			}
-			else {
-				GetBlendedDistanceMatrix(distance, local, x, y);
-			}
+	//The slopes need the distances too, even without a layer to sample.
+	const bool sampleLayer = Features::sampling && local->layer;
+	if(sampleLayer || Features::slopes) {
+		if constexpr(Features::intraFrame) {
+			getDistanceIntraFrame(distance, x, y, local);
+		}
+		else {
+			GetBlendedDistanceMatrix(distance, local, x, y);
+		}
+	}
 
+	ARGBdouble result(1.0, 0.5, 0.5, 0.5);
+	if constexpr(Features::sampling) {
+		if(sampleLayer) {
 			double dx = (distance[0][1] - distance[2][1]);
 			double dy = (distance[1][0] - distance[1][2]);
 
@@ -76,9 +80,9 @@ inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x,
 				}
 			}
 			double angle = std::atan2(dy, dx) + pi;
-			double dist = doDistance(distance, x, y, local, true);
+			double dist = doDistance(distance);
 	
-			dist =  doModifier(local->modifier, dist)*1000;
+			dist =  doModifier<Features::modifier>(dist)*1000;
 			dist = std::log(std::log(dist + 1)+1) * 20;
 			if(local->colourDivision > 0) dist /= local->colourDivision;
 
@@ -96,67 +100,62 @@ inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x,
 	}
 	
 
-	if(local->slopesEnabled) {
-		doSlopes(distance, local, result.red, result.green, result.blue);
+	if constexpr(Features::slopes) {
+		doSlopes<Features::slopeMethod>(distance, local, result.red, result.green, result.blue);
 	}
 	return  result;
 }
 
 
 /*******************************************************************************************************
-Render a pixel at 8-bit colour depth.
+The colour of one pixel, at any colour depth (see RenderKernelSpan).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_DEAndAngle::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour8(local, out);
+template<class Features>
+struct Render_DEAndAngle::SpanKernel {
+	static ARGBdouble Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommon<Features>(local, x, y, iCount);
+	}
+};
 
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_DEAndAngle::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, usesSampling | usesDistance>::Select(local);
+}
 
-	out->red = roundTo8Bit(colour.red * white8);
-	out->green = roundTo8Bit(colour.green * white8);
-	out->blue = roundTo8Bit(colour.blue * white8);
-	out->alpha = white8;
+template SpanFunction<PF_Pixel8> Render_DEAndAngle::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_DEAndAngle::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_DEAndAngle::SelectSpan(const LocalSequenceData * local);
 
+/*******************************************************************************************************
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_DEAndAngle::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
 
 /*******************************************************************************************************
 Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_DEAndAngle::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour16(local, out);
-
-	out->red = roundTo16Bit(colour.red * white16);
-	out->green = roundTo16Bit(colour.green * white16);
-	out->blue = roundTo16Bit(colour.blue * white16);
-	out->alpha = white16;
+PF_Err Render_DEAndAngle::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
 
 /*******************************************************************************************************
 Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_DEAndAngle::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * iP, PF_Pixel32 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour32(local, out);
-
-
-	if(colour.red < 0.0) colour.red = 0.0; //Negative values causing rendering issues
-	if(colour.green < 0.0) colour.green = 0.0;
-	if(colour.blue < 0.0) colour.blue = 0.0;
-
-	out->red = static_cast<float>(colour.red);
-	out->green = static_cast<float>(colour.green);
-	out->blue = static_cast<float>(colour.blue);
-	out->alpha = white32;
+PF_Err Render_DEAndAngle::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
@@ -31,7 +31,7 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 /*******************************************************************************************************
 Perform distance calculation
 *******************************************************************************************************/
-inline static double doDistance(double p[][3], A_long x, A_long y, const LocalSequenceData* local, bool locationBasedScale=true) {
+inline static double doDistance(double p[][3]) {
 	
 	//Traditional
 	double gx = (p[0][1] - p[1][1]) ;
@@ -47,36 +47,40 @@ inline static double doDistance(double p[][3], A_long x, A_long y, const LocalSe
 
 
 /*******************************************************************************************************
-The initial render calculations, common to all bit depths.
+The field of a pixel (-1 inside the set): its distance, after the modifier.
 *******************************************************************************************************/
-inline ARGBdouble RenderCommon(const LocalSequenceData * local,  A_long x, A_long y) {
+template<class Features>
+inline static double FieldCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
 	double distance[3][3];
 
-	//Get iteration value
-	double iCount = GetBlendedPixelValue(local, x, y);
-	if(iCount >= local->activeKFB->maxIterations)  return ARGBdouble(-1, -1, -1, -1);  //Inside pixel
-
-	
+	if(iCount >= local->activeKFB->maxIterations)  return -1;  //Inside pixel
 
-	
-	if(local->scalingMode == 1) {
+	if constexpr(Features::intraFrame) {
 		getDistanceIntraFrame(distance, x, y, local);		
 	}
 	else {
 		GetBlendedDistanceMatrix(distance, local, x, y);
 	}
 
-	iCount = doDistance(distance, x, y, local);
-	iCount = doModifier(local->modifier, iCount);
-	if(local->modifier == 4) iCount++; //log colouring needs minimum value to be 1.
+	iCount = doDistance(distance);
+	iCount = doModifier<Features::modifier>(iCount);
+	if constexpr(Features::modifier == 4) iCount++; //log colouring needs minimum value to be 1.
 	if(iCount > 1024) iCount = 1024;  //clamped to match KF. 
+	return iCount;
+}
+
+/*******************************************************************************************************
+The colour of a field, before the slopes.
+*******************************************************************************************************/
+template<class Features>
+inline static ARGBdouble MapCommon(const LocalSequenceData * local, double iCount) {
 	iCount /= local->colourDivision;
 	if(local->distanceClamp > 0 && iCount > local->distanceClamp) iCount = local->distanceClamp;
 	iCount += local->colourOffset;
 	
 
 	ARGBdouble result(1.0,0.5,0.5,0.5);
-	if(local->sampling) {
+	if constexpr(Features::sampling) {
 		if(local->layer) {
 			//Override, use sampled layer for colours.
 			double index = (std::fmod(iCount, 1024) / 1024)*(local->layer->width*local->layer->height);
@@ -97,70 +101,107 @@ inline ARGBdouble RenderCommon(const LocalSequenceData * local,  A_long x, A_lon
 		result.green = (lowColour.green * (1 - mixWeight) + highColour.green* mixWeight) / white8;
 		result.blue = (lowColour.blue * (1 - mixWeight) + highColour.blue *mixWeight) / white8;
 	}
+	return result;
+}
 
+/*******************************************************************************************************
+The distances the slopes of a pixel are made from.
+*******************************************************************************************************/
+template<class Features>
+inline static void SlopeDistancesCommon(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+	if constexpr(Features::intraFrame) {
+		getDistanceIntraFrame(distance, x, y, local, true);
+	}
+	else {
+		GetBlendedDistanceMatrix(distance, local, x, y);
+	}
+}
 
-	if(local->slopesEnabled) {
-		if(local->scalingMode == 1) {
-			getDistanceIntraFrame(distance, x, y, local, true);
-		}
-		else {
-			GetBlendedDistanceMatrix(distance, local, x, y);
-		}
+/*******************************************************************************************************
+The initial render calculations, common to all bit depths.
+*******************************************************************************************************/
+template<class Features>
+inline static ARGBdouble RenderCommon(const LocalSequenceData * local,  A_long x, A_long y, double iCount) {
+	iCount = FieldCommon<Features>(local, x, y, iCount);
+	if(iCount == -1)  return ARGBdouble(-1, -1, -1, -1);  //Inside pixel
+
+	ARGBdouble result = MapCommon<Features>(local, iCount);
 
-		doSlopes(distance, local, result.red, result.green, result.blue);
+	if constexpr(Features::slopes) {
+		double distance[3][3];
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+		doSlopes<Features::slopeMethod>(distance, local, result.red, result.green, result.blue);
 	}
 	return result;
 }
 
 /*******************************************************************************************************
-Distance Estimation 8bpc
+The colour of one pixel, at any colour depth (see RenderKernelSpan), and its stages (see StageFunctions).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_KFRDistance::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
+template<class Features>
+struct Render_KFRDistance::SpanKernel {
+	static constexpr long slopeMethod = Features::slopeMethod;
 
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour8(local, out);
+	static ARGBdouble Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommon<Features>(local, x, y, iCount);
+	}
+	static double Field(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return FieldCommon<Features>(local, x, y, iCount);
+	}
+	static ARGBdouble Map(const LocalSequenceData * local, double field) {
+		return MapCommon<Features>(local, field);
+	}
+	static void SlopeDistances(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+	}
+};
 
-	out->red = roundTo8Bit(colour.red * white8);
-	out->green = roundTo8Bit(colour.green * white8);
-	out->blue = roundTo8Bit(colour.blue * white8);
-	out->alpha = white8;
-	return PF_Err_NONE;
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_KFRDistance::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, usesSampling | usesDistance>::Select(local);
 }
 
+template SpanFunction<PF_Pixel8> Render_KFRDistance::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_KFRDistance::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_KFRDistance::SelectSpan(const LocalSequenceData * local);
+
 /*******************************************************************************************************
-Distance Estimation 16bpc
+The stages of cached images for a frame's settings.
 *******************************************************************************************************/
-PF_Err Render_KFRDistance::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour16(local, out);
+StageFunctions Render_KFRDistance::SelectStages(const LocalSequenceData * local) {
+	return StageKernelSelector<SpanKernel, usesSampling | usesDistance>::Select(local);
+}
 
-	out->red = roundTo16Bit(colour.red * white16);
-	out->green = roundTo16Bit(colour.green * white16);
-	out->blue = roundTo16Bit(colour.blue * white16);
-	out->alpha = white16;
+/*******************************************************************************************************
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_KFRDistance::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
 }
 
 /*******************************************************************************************************
-Distance Estimation 32bpc
+Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_KFRDistance::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * in, PF_Pixel32 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour32(local, out);
-
-
-	if(colour.red < 0.0) colour.red = 0.0; //Negative values causing rendering issues
-	if(colour.green < 0.0) colour.green = 0.0;
-	if(colour.blue < 0.0) colour.blue = 0.0;
+PF_Err Render_KFRDistance::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
+	return PF_Err_NONE;
+}
 
-	out->red = static_cast<float>(colour.red);
-	out->green = static_cast<float>(colour.green);
-	out->blue = static_cast<float>(colour.blue);
-	out->alpha = white32;
+/*******************************************************************************************************
+Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_KFRDistance::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
 }
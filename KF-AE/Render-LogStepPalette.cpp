@@ -21,13 +21,20 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 constexpr double logScale = 10;
 
 /*******************************************************************************************************
-Rendering Code common to all bit depths
+The field of a pixel (-1 inside the set).
 *******************************************************************************************************/
-inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y) {
-	double iCount = GetBlendedPixelValue(local, x, y);
-	if(iCount >= local->activeKFB->maxIterations)  return RGBdouble(-1, -1, -1);  //Inside pixel
+template<class Features>
+inline static double FieldCommon(const LocalSequenceData * local, double iCount) {
+	if(iCount >= local->activeKFB->maxIterations)  return -1;  //Inside pixel
+
+	return doModifier<Features::modifier>(iCount);
+}
 
-	iCount = doModifier(local->modifier, iCount);
+/*******************************************************************************************************
+The colour of a field, before the slopes.
+*******************************************************************************************************/
+template<class Features>
+inline static RGBdouble MapCommon(const LocalSequenceData * local, double iCount) {
 	iCount /= local->colourDivision;
 	iCount += local->colourOffset;
 
@@ -53,77 +60,108 @@ inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x,
 	result.red *= iCount;
 	result.green *= iCount;
 	result.blue *= iCount;
+	return result;
+}
 
+/*******************************************************************************************************
+The distances the slopes of a pixel are made from.
+*******************************************************************************************************/
+template<class Features>
+inline static void SlopeDistancesCommon(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+	if constexpr(Features::intraFrame) {
+		getDistanceIntraFrame(distance, x, y, local, true);
+	}
+	else {
+		GetBlendedDistanceMatrix(distance, local, x, y);
+	}
+}
+
+/*******************************************************************************************************
+Rendering Code common to all bit depths
+*******************************************************************************************************/
+template<class Features>
+inline static RGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+	iCount = FieldCommon<Features>(local, iCount);
+	if(iCount == -1)  return RGBdouble(-1, -1, -1);  //Inside pixel
 
-	if(local->slopesEnabled) {
+	RGBdouble result = MapCommon<Features>(local, iCount);
+
+	if constexpr(Features::slopes) {
 		double distance[3][3];
-		if(local->scalingMode == 1) {
-			getDistanceIntraFrame(distance, x, y, local, true);
-		}
-		else {
-			GetBlendedDistanceMatrix(distance, local, x, y);
-		}
-
-		doSlopes(distance, local, result.red, result.green, result.blue);
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+		doSlopes<Features::slopeMethod>(distance, local, result.red, result.green, result.blue);
 	}
 	return result;
 }
 
 
 /*******************************************************************************************************
-Render a pixel at 8-bit colour depth.
+The colour of one pixel, at any colour depth (see RenderKernelSpan), and its stages (see StageFunctions).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_LogStepPalette::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
+template<class Features>
+struct Render_LogStepPalette::SpanKernel {
+	static constexpr long slopeMethod = Features::slopeMethod;
 
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour8(local, out);
+	static RGBdouble Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommon<Features>(local, x, y, iCount);
+	}
+	static double Field(const LocalSequenceData * local, A_long /*x*/, A_long /*y*/, double iCount) {
+		return FieldCommon<Features>(local, iCount);
+	}
+	static RGBdouble Map(const LocalSequenceData * local, double field) {
+		return MapCommon<Features>(local, field);
+	}
+	static void SlopeDistances(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+	}
+};
 
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_LogStepPalette::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, 0>::Select(local);
+}
 
-	out->red = roundTo8Bit(colour.red * white8);
-	out->green = roundTo8Bit(colour.green * white8);
-	out->blue = roundTo8Bit(colour.blue * white8);
-	out->alpha = white8;
+template SpanFunction<PF_Pixel8> Render_LogStepPalette::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_LogStepPalette::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_LogStepPalette::SelectSpan(const LocalSequenceData * local);
 
-	return PF_Err_NONE;
+/*******************************************************************************************************
+The stages of cached images for a frame's settings.
+*******************************************************************************************************/
+StageFunctions Render_LogStepPalette::SelectStages(const LocalSequenceData * local) {
+	return StageKernelSelector<SpanKernel, 0>::Select(local);
+}
 
+/*******************************************************************************************************
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_LogStepPalette::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
+	return PF_Err_NONE;
 }
 
 /*******************************************************************************************************
 Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_LogStepPalette::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour16(local, out);
-
-	out->red = roundTo16Bit(colour.red * white16);
-	out->green = roundTo16Bit(colour.green * white16);
-	out->blue = roundTo16Bit(colour.blue * white16);
-	out->alpha = white16;
+PF_Err Render_LogStepPalette::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
 
 /*******************************************************************************************************
 Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_LogStepPalette::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * iP, PF_Pixel32 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour32(local, out);
-
-
-	if(colour.red < 0.0) colour.red = 0.0; //Negative values causing rendering issues
-	if(colour.green < 0.0) colour.green = 0.0;
-	if(colour.blue < 0.0) colour.blue = 0.0;
-
-	out->red = static_cast<float>(colour.red);
-	out->green = static_cast<float>(colour.green);
-	out->blue = static_cast<float>(colour.blue);
-	out->alpha = white32;
+PF_Err Render_LogStepPalette::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
@@ -22,89 +22,129 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 constexpr double logScale = 10;  
 
 /*******************************************************************************************************
-Rendering Code common to all bit depths
+The field of a pixel (-1 inside the set).
 *******************************************************************************************************/
-inline static double RenderCommonLogSteps(const LocalSequenceData * local, A_long x, A_long y) {
-	double iCount = GetBlendedPixelValue(local, x, y);
+template<class Features>
+inline static double FieldCommon(const LocalSequenceData * local, double iCount) {
 	if(iCount >= local->activeKFB->maxIterations)  return -1;  //Inside pixel
 
-	iCount = doModifier(local->modifier, iCount);
+	return doModifier<Features::modifier>(iCount);
+}
+
+/*******************************************************************************************************
+The colour of a field, before the slopes.
+*******************************************************************************************************/
+template<class Features>
+inline static double MapCommon(const LocalSequenceData * local, double iCount) {
 	iCount /= local->colourDivision;
 	iCount += local->colourOffset;
 
 	iCount = 1- std::fmod(iCount,1) ;
 	iCount = std::log((iCount * logScale)+1);
 	iCount = (iCount)  / std::log(logScale+1); //scaled from 0.0 to 1.0;
+	return iCount;
+}
+
+/*******************************************************************************************************
+The distances the slopes of a pixel are made from.
+*******************************************************************************************************/
+template<class Features>
+inline static void SlopeDistancesCommon(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+	if constexpr(Features::intraFrame) {
+		getDistanceIntraFrame(distance, x, y, local, true);
+	}
+	else {
+		GetBlendedDistanceMatrix(distance, local, x, y);
+	}
+}
+
+/*******************************************************************************************************
+Rendering Code common to all bit depths
+*******************************************************************************************************/
+template<class Features>
+inline static double RenderCommonLogSteps(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+	iCount = FieldCommon<Features>(local, iCount);
+	if(iCount == -1)  return -1;  //Inside pixel
 
-	if(local->slopesEnabled) {
+	iCount = MapCommon<Features>(local, iCount);
+
+	if constexpr(Features::slopes) {
 		double distance[3][3];
-		if(local->scalingMode == 1) {
-			getDistanceIntraFrame(distance, x, y, local, true);
-		}
-		else {
-			GetBlendedDistanceMatrix(distance, local, x, y);
-		}
+		SlopeDistancesCommon<Features>(distance, local, x, y);
 		double tempA, tempB;
-		doSlopes(distance, local, iCount, tempA, tempB);
+		doSlopes<Features::slopeMethod>(distance, local, iCount, tempA, tempB);
 	}
 	return iCount;
 }
 
 
 /*******************************************************************************************************
-Render a pixel at 8-bit colour depth.
+The colour of one pixel, at any colour depth (see RenderKernelSpan), and its stages (see StageFunctions).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_LogSteps::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
+template<class Features>
+struct Render_LogSteps::SpanKernel {
+	static constexpr long slopeMethod = Features::slopeMethod;
 
-	double colour = RenderCommonLogSteps(local, x, y);
-	if(colour == -1) SetInsideColour8(local, out);
+	static double Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommonLogSteps<Features>(local, x, y, iCount);
+	}
+	static double Field(const LocalSequenceData * local, A_long /*x*/, A_long /*y*/, double iCount) {
+		return FieldCommon<Features>(local, iCount);
+	}
+	static double Map(const LocalSequenceData * local, double field) {
+		return MapCommon<Features>(local, field);
+	}
+	static void SlopeDistances(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+	}
+};
 
-	auto val = roundTo8Bit(colour * white8);
-	out->red = val;
-	out->blue = val;
-	out->green = val;
-	out->alpha = white8;
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_LogSteps::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, 0>::Select(local);
+}
 
-	return PF_Err_NONE;
+template SpanFunction<PF_Pixel8> Render_LogSteps::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_LogSteps::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_LogSteps::SelectSpan(const LocalSequenceData * local);
 
+/*******************************************************************************************************
+The stages of cached images for a frame's settings.
+*******************************************************************************************************/
+StageFunctions Render_LogSteps::SelectStages(const LocalSequenceData * local) {
+	return StageKernelSelector<SpanKernel, 0>::Select(local);
 }
 
 /*******************************************************************************************************
-Render a pixel at 16-bit colour depth.
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_LogSteps::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	double colour = RenderCommonLogSteps(local, x, y);
-	if(colour == -1) SetInsideColour16(local, out);
-
-	auto val = roundTo16Bit(colour * white16);
-
-	out->red = val;
-	out->blue = val;
-	out->green = val;
-	out->alpha = white16;
+PF_Err Render_LogSteps::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
+}
 
+/*******************************************************************************************************
+Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_LogSteps::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
+	return PF_Err_NONE;
 }
 
 /*******************************************************************************************************
 Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_LogSteps::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * iP, PF_Pixel32 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	double colour = RenderCommonLogSteps(local, x, y);
-	if(colour == -1) SetInsideColour32(local, out);
-
-	auto val = static_cast<float>(colour);
-	if(val < 0.0) val = 0.0; //Negative values causing rendering issues
-
-	out->red = val;
-	out->blue = val;
-	out->green = val;
-	out->alpha = white32;
+PF_Err Render_LogSteps::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
-
 }
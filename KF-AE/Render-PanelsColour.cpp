@@ -27,20 +27,26 @@ constexpr double overshoot = 0.002; //Overshoot the top of the sin wave, gives a
 static const double internalColour = greyColour * std::sin(((curveSize + overshoot) / curveSize) * pi / 2);
 
 /*******************************************************************************************************
-Rendering Code common to all bit depths
+The field of a pixel (-1 inside the set).
 *******************************************************************************************************/
-inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y) {
-	if (!local) return ARGBdouble(-1, -1, -1, -1);
-	double iCount = GetBlendedPixelValue(local, x, y);
-	if(iCount >= local->activeKFB->maxIterations)  return ARGBdouble(-1, -1, -1, -1);  //Inside pixel
+template<class Features>
+inline static double FieldCommon(const LocalSequenceData * local, double iCount) {
+	if(iCount >= local->activeKFB->maxIterations)  return -1;  //Inside pixel
+
+	return doModifier<Features::modifier>(iCount);
+}
 
-	iCount = doModifier(local->modifier, iCount);
+/*******************************************************************************************************
+The colour of a field, before the slopes.
+*******************************************************************************************************/
+template<class Features>
+inline static ARGBdouble MapCommon(const LocalSequenceData * local, double iCount) {
 	iCount /= local->colourDivision;
 	iCount += local->colourOffset;
 
 	
 	ARGBdouble result(1.0,0.5,0.5,0.5);
-	if(local->sampling) {
+	if constexpr(Features::sampling) {
 		if(local->layer) {
 			//Override, use sampled layer for colours.
 			const double index = (std::fmod(floor(iCount), 1024) / 1024)*(local->layer->width*local->layer->height);
@@ -86,72 +92,109 @@ inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x,
 	result.red *= colour;
 	result.green *= colour;
 	result.blue *= colour;
+	return result;
+}
 
+/*******************************************************************************************************
+The distances the slopes of a pixel are made from.
+*******************************************************************************************************/
+template<class Features>
+inline static void SlopeDistancesCommon(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+	if constexpr(Features::intraFrame) {
+		getDistanceIntraFrame(distance, x, y, local, false);
+	}
+	else {
+		GetBlendedDistanceMatrix(distance, local, x, y);
+	}
+}
 
-	if(local->slopesEnabled) {
-		double distance[3][3]{};
-		if(local->scalingMode == 1 ) {
-			getDistanceIntraFrame(distance, x, y, local, false);
-		}
-		else {
-			GetBlendedDistanceMatrix(distance, local, x, y);
-		}
+/*******************************************************************************************************
+Rendering Code common to all bit depths
+*******************************************************************************************************/
+template<class Features>
+inline static ARGBdouble RenderCommon(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+	if (!local) return ARGBdouble(-1, -1, -1, -1);
+	iCount = FieldCommon<Features>(local, iCount);
+	if(iCount == -1)  return ARGBdouble(-1, -1, -1, -1);  //Inside pixel
 
-		doSlopes(distance, local, result.red, result.green, result.blue);
+	ARGBdouble result = MapCommon<Features>(local, iCount);
+
+	if constexpr(Features::slopes) {
+		double distance[3][3]{};
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+		doSlopes<Features::slopeMethod>(distance, local, result.red, result.green, result.blue);
 	}
 	return result;
 }
 
 
 /*******************************************************************************************************
-Render a pixel at 8-bit colour depth.
+The colour of one pixel, at any colour depth (see RenderKernelSpan), and its stages (see StageFunctions).
+Compiled for each combination of the frame's settings (see SpanKernelSelector).
 *******************************************************************************************************/
-PF_Err Render_PanelsColour::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * in, PF_Pixel8 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
+template<class Features>
+struct Render_PanelsColour::SpanKernel {
+	static constexpr long slopeMethod = Features::slopeMethod;
 
-	const auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour8(local, out);
+	static ARGBdouble Colour(const LocalSequenceData * local, A_long x, A_long y, double iCount) {
+		return RenderCommon<Features>(local, x, y, iCount);
+	}
+	static double Field(const LocalSequenceData * local, A_long /*x*/, A_long /*y*/, double iCount) {
+		return FieldCommon<Features>(local, iCount);
+	}
+	static ARGBdouble Map(const LocalSequenceData * local, double field) {
+		return MapCommon<Features>(local, field);
+	}
+	static void SlopeDistances(double distance[][3], const LocalSequenceData * local, A_long x, A_long y) {
+		SlopeDistancesCommon<Features>(distance, local, x, y);
+	}
+};
 
-	out->red = roundTo8Bit(colour.red * white8);
-	out->green = roundTo8Bit(colour.green * white8);
-	out->blue = roundTo8Bit(colour.blue * white8);
-	out->alpha = white8;
-	return PF_Err_NONE;
+/*******************************************************************************************************
+The span kernel for a frame's settings.
+*******************************************************************************************************/
+template<class PixelT>
+SpanFunction<PixelT> Render_PanelsColour::SelectSpan(const LocalSequenceData * local) {
+	return SpanKernelSelector<PixelT, SpanKernel, usesSampling>::Select(local);
 }
 
+template SpanFunction<PF_Pixel8> Render_PanelsColour::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel16> Render_PanelsColour::SelectSpan(const LocalSequenceData * local);
+template SpanFunction<PF_Pixel32> Render_PanelsColour::SelectSpan(const LocalSequenceData * local);
+
 /*******************************************************************************************************
-Render a pixel at 16-bit colour depth.
+The stages of cached images for a frame's settings.
 *******************************************************************************************************/
-PF_Err Render_PanelsColour::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * in, PF_Pixel16 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	const auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour16(local, out);
+StageFunctions Render_PanelsColour::SelectStages(const LocalSequenceData * local) {
+	return StageKernelSelector<SpanKernel, usesSampling>::Select(local);
+}
 
-	out->red = roundTo16Bit(colour.red * white16);
-	out->green = roundTo16Bit(colour.green * white16);
-	out->blue = roundTo16Bit(colour.blue * white16);
-	out->alpha = white16;
+/*******************************************************************************************************
+Render a pixel at 8-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_PanelsColour::Render8(void * refcon, A_long x, A_long y, PF_Pixel8 * /*in*/, PF_Pixel8 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel8>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
+}
 
+/*******************************************************************************************************
+Render a pixel at 16-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
+*******************************************************************************************************/
+PF_Err Render_PanelsColour::Render16(void * refcon, A_long x, A_long y, PF_Pixel16 * /*in*/, PF_Pixel16 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel16>(context.local)(context, y, x, x + 1, out);
+	return PF_Err_NONE;
 }
 
 /*******************************************************************************************************
 Render a pixel at 32-bit colour depth.
+Adapter for AE's pixel iterators (refcon is a RenderContext).
 *******************************************************************************************************/
-PF_Err Render_PanelsColour::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * iP, PF_Pixel32 * out) {
-	const auto* local = static_cast<LocalSequenceData*>(refcon);
-
-	auto colour = RenderCommon(local, x, y);
-	if(colour.red == -1) SetInsideColour32(local, out);
-
-	if(colour.red < 0.0) colour.red = 0.0; //Negative values causing rendering issues
-	if(colour.green < 0.0) colour.green = 0.0;
-	if(colour.blue < 0.0) colour.blue = 0.0;
-
-	out->red = static_cast<float>(colour.red);
-	out->green = static_cast<float>(colour.green);
-	out->blue = static_cast<float>(colour.blue);
-	out->alpha = white32;
+PF_Err Render_PanelsColour::Render32(void * refcon, A_long x, A_long y, PF_Pixel32 * /*in*/, PF_Pixel32 * out) {
+	const auto & context = *static_cast<const RenderContext*>(refcon);
+	SelectSpan<PF_Pixel32>(context.local)(context, y, x, x + 1, out);
 	return PF_Err_NONE;
 }
@@ -6,7 +6,7 @@ Author:			(c) 2019 Adam Sakareassen
 Licence:		GNU Affero General Public License
 
 Contains smart rendering and various common functions for rendering.
-Usually dispatches rendering to pixel iterator functions (defined elsewhere).
+Usually dispatches rendering to span kernels (defined elsewhere), one row at a time.
 Don't edit LocalSequenceData in pixel specific functions, it must remain read only to be 
 thread-safe once rendering begins.
 
@@ -36,25 +36,49 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "Render-Angle.h"
 #include "Render-AngleColour.h"
 #include "Render-DEAndAngle.h"
+#include "KFBSpan.h"
+#include "ZoomComposite.h"
 
 #include <cmath>
 
+#if defined(_M_X64) || defined(__SSE2__)
+#define RENDER_USE_SSE2
+#include <emmintrin.h>
+#endif
+
 //Function prototypes for pixel iterators.
 typedef PF_Err(*PixelFunction8)(void *refcon, A_long x, A_long y, PF_Pixel8 *in, PF_Pixel8 *out);
 typedef PF_Err(*PixelFunction16)(void* refcon, A_long x, A_long y, PF_Pixel16 *in, PF_Pixel16 *out);
 typedef PF_Err(*PixelFunction32)(void* refcon, A_long x, A_long y, PF_Pixel32 *in, PF_Pixel32 *out);
 
+constexpr A_long spanBandRows = 64;		//Rows rendered between checks for the user cancelling (AE's iterator).
+constexpr A_long spanGroupRows = 8;		//Consecutive rows rendered by one thread (they share resampled kfb rows).
+
+//Handed to AE's generic iterator, which calls renderRows once per group of rows.
+template<class PixelT>
+struct SpanRows {
+	const RenderContext * context {nullptr};
+	SpanFunction<PixelT> span {nullptr};
+	PF_EffectWorld * output {nullptr};
+	A_long firstRow {0};
+};
+
 static void setMaxOuputRectangle(PF_PreRenderExtra* preRender, long left, long right, long top, long bottom);
 static void setOuputRectangle(PF_PreRenderExtra* preRender, long left, long right, long top, long bottom);
 static PF_Err SetToBlack8(void *refcon, A_long xL, A_long yL, PF_Pixel8 *inP, PF_Pixel8 *outP);
 static PF_Err SetToBlack16(void *refcon, A_long xL, A_long yL, PF_Pixel16 *inP, PF_Pixel16 *outP);
-inline PixelFunction8 selectPixelRenderFunction8(long method);
-inline PixelFunction16 selectPixelRenderFunction16(long method);
-inline PixelFunction32 selectPixelRenderFunction32(long method);
-static void GenerateImage(PF_InData *in_data, PF_SmartRenderExtra* smartRender, PF_EffectWorld* output, LocalSequenceData * local);
+template<class PixelT> static SpanFunction<PixelT> selectSpanFunction(const LocalSequenceData * local);
+template<class PixelT> static void renderSpans(PF_InData * in_data, PF_EffectWorld * output, const RenderContext & context, WorkPriority priority);
+template<class PixelT> static PF_Err renderRows(void * refcon, A_long thread, A_long i, A_long iterations);
+template<class PixelT> static void renderGroup(const SpanRows<PixelT> & rows, A_long first, A_long end);
+static void GenerateImage(PF_InData *in_data, PF_SmartRenderExtra* smartRender, PF_EffectWorld* output, LocalSequenceData * local, WorkPriority priority = WorkPriority::render);
+static void prepareRender(LocalSequenceData * local, A_long width, A_long height);
 static void DoCachedImages(PF_InData *in_data, PF_SmartRenderExtra* smartRender, PF_EffectWorld* output, LocalSequenceData * local);
-static void ScaleAroundCentre(PF_InData *in_data, PF_EffectWorld* input, PF_EffectWorld* output, const PF_Rect * rect, double scale, double postScaleX, double postScaleY, double opacity);
-static void makeKFBCachedImage(std::shared_ptr<KFBData> &  kfb, PF_InData *in_data, PF_SmartRenderExtra* smartRender, LocalSequenceData * local);
+static void compositeZoomed(PF_InData *in_data, const WorldHolder * activeImage, const WorldHolder * nextImage, double nextOpacity, double centreX, double centreY, PF_EffectWorld* output, const LocalSequenceData * local);
+static void makeKFBCachedImage(long keyFrame, const std::shared_ptr<const KFBData> &  kfb, PF_InData *in_data, PF_SmartRenderExtra* smartRender, LocalSequenceData * local);
+static void makeCachedStages(PF_InData * in_data, const StageFunctions & functions, CachedStages & stages, A_long width, A_long height, LocalSequenceData * local);
+static void colourCachedImage(PF_InData * in_data, const StageFunctions & functions, const CachedStages & stages, PF_EffectWorld * image, const LocalSequenceData * local);
+static void newWorld(PF_InData *in_data, WorldHolder & world, short bitDepth, int width, int height);
 static void doMercator(PF_InData* in_data,  PF_EffectWorld* output, LocalSequenceData* local);
 PF_Err Mercator8(void* refcon, A_long x, A_long y, PF_Pixel8* in, PF_Pixel8* out) noexcept;
 
@@ -72,7 +96,7 @@ Gives AE the maximum output rectangle (always the size of the kfb).
 Gives AE an output rectangle, based on the reqest.
 Note: It is quite possible that AE will reqest negative locations, which we won't render.
 *******************************************************************************************************/
-PF_Err SmartPreRender(PF_InData *in_data, PF_OutData *out_data,  PF_PreRenderExtra* preRender) {
+PF_Err SmartPreRender(PF_InData *in_data, PF_OutData * /*out_data*/,  PF_PreRenderExtra* preRender) {
 	auto sd = SequenceData::GetSequenceData(in_data);
 	if(!sd) throw ("Sequence Data invalid");
 
@@ -137,7 +161,7 @@ PF_Err SmartPreRender(PF_InData *in_data, PF_OutData *out_data,  PF_PreRenderExt
 /*******************************************************************************************************
 Smart Render
 *******************************************************************************************************/
-PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRenderExtra* smartRender) {
+PF_Err SmartRender(PF_InData *in_data, PF_OutData * /*out_data*/, PF_SmartRenderExtra* smartRender) {
 	PF_Err err {PF_Err_NONE};
 
 	//Check that sequence data is ready to render, and extract localdata
@@ -145,7 +169,7 @@ PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRenderExtra
 	if(!sd) return PF_Err_INTERNAL_STRUCT_DAMAGED;
 	if(!sd->Validate()) return PF_Err_NONE;
 	auto local = sd->getLocalSequenceData();
-	if(!local) PF_Err_INTERNAL_STRUCT_DAMAGED;
+	if(!local) return PF_Err_INTERNAL_STRUCT_DAMAGED;
 
 	try {
 		//Read parameters.
@@ -184,6 +208,15 @@ PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRenderExtra
 		}
 		local->sampling = readCheckBoxParam(in_data, ParameterID::samplingOn);
 		local->special = readFloatSliderParam(in_data, ParameterID::special);
+		const auto kfbStorage = static_cast<KFBStorage>(readListParam(in_data, ParameterID::kfbStorage));
+		if(kfbStorage != local->kfbStorage) {
+			//Loaded data is in the wrong format, so start again.
+			local->kfbStorage = kfbStorage;
+			local->DeleteKFBData();
+		}
+		local->prefetchCount = static_cast<long>(readFloatSliderParam(in_data, ParameterID::prefetchCount));
+		KFBCache::Shared().SetBudget(static_cast<size_t>(readFloatSliderParam(in_data, ParameterID::cacheSize)) << 20);
+		local->kfbLoader.SetUseSidecars(readCheckBoxParam(in_data, ParameterID::kfbSidecar));
 		
 
 		//Setup data for active frame, and next frame.
@@ -191,7 +224,7 @@ PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRenderExtra
 		local->keyFramePercent = keyFrame - activeFrame;
 		local->activeZoomScale = std::exp(std::log(2) * (keyFrame - activeFrame));
 		local->nextZoomScale = std::exp(std::log(2) * (keyFrame - 1 - activeFrame));
-		local->SetupActiveKFB(activeFrame, in_data);
+		local->SetupActiveKFB(activeFrame);
 		local->scaleFactorX = static_cast<float>(in_data->downsample_x.den) / static_cast<float>(in_data->downsample_x.num);
 		local->scaleFactorY = static_cast<float>(in_data->downsample_y.den) / static_cast<float>(in_data->downsample_y.num);
 		local->bitDepth = smartRender->input->bitdepth;
@@ -251,7 +284,7 @@ PF_Err SmartRender(PF_InData *in_data, PF_OutData *out_data, PF_SmartRenderExtra
 		local->DeleteKFBData();
 		return thrown_err;
 	}
-	catch(std::exception ex) {
+	catch(const std::exception & ex) {
 		local->layer = nullptr;
 		local->sample8 = nullptr;
 		local->sample16 = nullptr;
@@ -285,75 +318,164 @@ inline void setOuputRectangle(PF_PreRenderExtra* preRender, long left, long righ
 
 /*******************************************************************************************************
 Actually generate the image in the output buffer.
-Calls a pixel iterator based on bit depth
+Renders rows with the span kernel for the method, based on bit depth.
+priority is the priority of the rows on the worker pool (a cached image is built below a frame).
 Note: Iterators will often return errors, usually because the render is canceled.
 *******************************************************************************************************/
-static void GenerateImage(PF_InData *in_data, PF_SmartRenderExtra* smartRender, PF_EffectWorld* output, LocalSequenceData * local) {
-	AEGP_SuiteHandler suites(in_data->pica_basicP);
-	
+static void GenerateImage(PF_InData *in_data, PF_SmartRenderExtra* smartRender, PF_EffectWorld* output, LocalSequenceData * local, WorkPriority priority) {
+	prepareRender(local, output->width, output->height);
+	const auto context = MakeRenderContext(local);
 	switch(smartRender->input->bitdepth) {
 		case 8:
-			{
-				auto fn = selectPixelRenderFunction8(local->method);
-			    
-				auto err = suites.Iterate8Suite1()->iterate(in_data, 0, output->height, nullptr, nullptr, (void*)local, fn, output);
-				if(err) throw (err);
-				break;
-			}
+			renderSpans<PF_Pixel8>(in_data, output, context, priority);
+			break;
 		case 16:
-			{
-				auto fn = selectPixelRenderFunction16(local->method);
-				auto err = suites.Iterate16Suite1()->iterate(in_data, 0, output->height, nullptr, nullptr, (void*)local, fn, output);
-				if(err) throw (err);
-				break;
-			}
+			renderSpans<PF_Pixel16>(in_data, output, context, priority);
+			break;
 		case 32:
-			{
-				auto fn = selectPixelRenderFunction32(local->method);
-				auto err = suites.IterateFloatSuite1()->iterate(in_data, 0, output->height, nullptr, nullptr, (void*)local, fn, output);
-				if(err) throw (err);
-				break;
-			}
+			renderSpans<PF_Pixel32>(in_data, output, context, priority);
+			break;
 		default:
 			break;
 	}
 }
 
+/*******************************************************************************************************
+Prepare the keyframes and sample locations for rendering width by height pixels.
+*******************************************************************************************************/
+static void prepareRender(LocalSequenceData * local, A_long width, A_long height) {
+	//Downsampled renders (and zooming out) sample a smaller copy of the smooth data.
+	const double scaleFactor = std::min(local->scaleFactorX, local->scaleFactorY);
+	local->activeMipLevel = (local->activeKFB && local->activeZoomScale > 0) ? local->activeKFB->PrepareMipLevel(scaleFactor / local->activeZoomScale) : 0;
+	local->nextMipLevel = (local->nextFrameKFB && local->nextZoomScale > 0) ? local->nextFrameKFB->PrepareMipLevel(scaleFactor / local->nextZoomScale) : 0;
+	if(local->activeKFB) local->activeKFB->PrepareInsideMask();
+	if(local->nextFrameKFB && local->nextZoomScale > 0) local->nextFrameKFB->PrepareInsideMask();
+	
+	PrepareFrameCoordinates(local, width, height);
+}
+
+/*******************************************************************************************************
+Render the whole output one row at a time with the span kernel for the method.
+Groups of rows are tiles on the worker pool (see RenderSpanTiles), checking for the user cancelling
+between tiles.  Methods that sample the layer use AE's sampling suites, so they must stay on AE's
+threads: AE's generic iterator spreads their groups of rows over its threads, in bands so a
+cancelled render stops soon after the user asks.
+*******************************************************************************************************/
+template<class PixelT>
+static void renderSpans(PF_InData * in_data, PF_EffectWorld * output, const RenderContext & context, WorkPriority priority) {
+	if(!context.local->sampling) {
+		PF_Err abortErr {PF_Err_NONE};
+		auto abort = [in_data, &abortErr] {
+			abortErr = PF_ABORT(in_data);
+			return abortErr != PF_Err_NONE;
+		};
+		if(!RenderSpanTiles<PixelT>(context, output, WorkerPool::Shared(), priority, abort)) throw (abortErr);
+		return;
+	}
+
+	AEGP_SuiteHandler suites(in_data->pica_basicP);
+	SpanRows<PixelT> rows {&context, selectSpanFunction<PixelT>(context.local), output, 0};
+
+	for(rows.firstRow = 0; rows.firstRow < output->height; rows.firstRow += spanBandRows) {
+		PF_Err err = PF_ABORT(in_data);
+		if(err) throw (err);
+		const A_long count = std::min(spanBandRows, output->height - rows.firstRow);
+		err = suites.Iterate8Suite1()->iterate_generic((count + spanGroupRows - 1) / spanGroupRows, &rows, renderRows<PixelT>);
+		if(err) throw (err);
+	}
+}
+
+/*******************************************************************************************************
+Render a group of rows (called by AE's generic iterator, i is the group within the band).
+*******************************************************************************************************/
+template<class PixelT>
+static PF_Err renderRows(void * refcon, A_long /*thread*/, A_long i, A_long /*iterations*/) {
+	const auto * rows = static_cast<const SpanRows<PixelT>*>(refcon);
+	const A_long first = rows->firstRow + i * spanGroupRows;
+	renderGroup(*rows, first, std::min({first + spanGroupRows, rows->firstRow + spanBandRows, rows->output->height}));
+	return PF_Err_NONE;
+}
+
+/*******************************************************************************************************
+Render rows first to end - 1.
+*******************************************************************************************************/
+template<class PixelT>
+static void renderGroup(const SpanRows<PixelT> & rows, A_long first, A_long end) {
+	for(A_long y = first; y < end; y++) {
+		auto * out = reinterpret_cast<PixelT*>(static_cast<char*>(rows.output->data) + static_cast<size_t>(y) * rows.output->rowbytes);
+		rows.span(*rows.context, y, 0, rows.output->width, out);
+	}
+}
+
+/*******************************************************************************************************
+Render the whole output on a worker pool, each tile is a group of rows (see spanGroupRows).
+abort is checked between tiles, returns false if it stopped the render.
+Doesn't use AE, so a render can be run (and timed) with any pool.  Methods that sample the layer
+can't be rendered this way.
+*******************************************************************************************************/
+template<class PixelT>
+bool RenderSpanTiles(const RenderContext & context, PF_EffectWorld * output, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort) {
+	const SpanRows<PixelT> rows {&context, selectSpanFunction<PixelT>(context.local), output, 0};
+	const long tiles = (output->height + spanGroupRows - 1) / spanGroupRows;
+	return pool.RunTiles(tiles, priority, [&rows](long tile) {
+		const A_long first = static_cast<A_long>(tile) * spanGroupRows;
+		renderGroup(rows, first, std::min(first + spanGroupRows, rows.output->height));
+	}, abort);
+}
+
+template bool RenderSpanTiles<PF_Pixel8>(const RenderContext &, PF_EffectWorld *, WorkerPool &, WorkPriority, const std::function<bool()> &);
+template bool RenderSpanTiles<PF_Pixel16>(const RenderContext &, PF_EffectWorld *, WorkerPool &, WorkPriority, const std::function<bool()> &);
+template bool RenderSpanTiles<PF_Pixel32>(const RenderContext &, PF_EffectWorld *, WorkerPool &, WorkPriority, const std::function<bool()> &);
+
+/*******************************************************************************************************
+Gather what the render methods need from local, once per render.
+*******************************************************************************************************/
+RenderContext MakeRenderContext(const LocalSequenceData * local) {
+	RenderContext context;
+	context.local = local;
+	SetInsideColour8(local, &context.inside8);
+	SetInsideColour16(local, &context.inside16);
+	SetInsideColour32(local, &context.inside32);
+	return context;
+}
+
 /*******************************************************************************************************
 Render using the chached image method.
 
-Note: I now render to an temporary buffer first which is twice the requested resolution.
-The cached images are blended on this buffer, then it is downsampled.
-AE was producing very ugly results scaling images to between 95% and 99%, creating very messy
-artifacts.  Oversampling has dramatically improved the result.
-In theory this probably limits the output resolution to 16k x 16k, which should be fine for now.
+The cached images are zoomed and blended straight into the output in one pass (see ZoomComposite.h).
+AE's transform_world produced very ugly results scaling images to between 95% and 99%, so this used
+to blend on a buffer twice the requested resolution and downsample it.  The compositor widens its
+filter when an image is shrunk, so it doesn't need the larger buffer.
+Mercator projections blend on buffers the size of the cached images (sampled by the projection).
 *******************************************************************************************************/
 static void DoCachedImages(PF_InData *in_data, PF_SmartRenderExtra* smartRender, PF_EffectWorld* output, LocalSequenceData * local) {
 	if (!local || !in_data || !smartRender || !output ||!local->activeKFB || !in_data->pica_basicP) throw(std::exception("Error in DoCachedImages()"));
 	
-	PF_Err err {PF_Err_NONE};
-	AEGP_SuiteHandler suites(in_data->pica_basicP);
-	if(local->isCacheInvalid()) {
-		if(local->activeKFB) local->activeKFB->DisposeOfCache();
-		if(local->nextFrameKFB) local->nextFrameKFB->DisposeOfCache();
-		if(local->thirdFrameKFB) local->thirdFrameKFB->DisposeOfCache();
-		if(local->fourthFrameKFB) local->fourthFrameKFB->DisposeOfCache();
+	//Release the first stage that is out of date, and every stage made from it.
+	for(const auto stage : {CacheStage::fields, CacheStage::shading, CacheStage::colours}) {
+		if(local->isCacheInvalid(stage)) {
+			local->DisposeOfCachedImages(stage);
+			break;
+		}
 	}
 
-	if(!local->activeKFB->isImageCached) {
-		makeKFBCachedImage(local->activeKFB, in_data, smartRender, local);
+	if(!local->GetCachedImage(local->activeFrameNumber)) {
+		makeKFBCachedImage(local->activeFrameNumber, local->activeKFB, in_data, smartRender, local);
 
 	}
 
-	if(local->nextFrameKFB && !local->nextFrameKFB->isImageCached) {
-		makeKFBCachedImage(local->nextFrameKFB, in_data, smartRender, local);
+	if(local->nextFrameKFB && !local->GetCachedImage(local->nextFrameNumber)) {
+		makeKFBCachedImage(local->nextFrameNumber, local->nextFrameKFB, in_data, smartRender, local);
 	}
-	if (local->mercator &&  local->thirdFrameKFB && !local->thirdFrameKFB->isImageCached) {
-		makeKFBCachedImage(local->thirdFrameKFB, in_data, smartRender, local);
+	if (local->mercator &&  local->thirdFrameKFB && !local->GetCachedImage(local->thirdFrameNumber)) {
+		makeKFBCachedImage(local->thirdFrameNumber, local->thirdFrameKFB, in_data, smartRender, local);
 	}
-	if (local->mercator && local->fourthFrameKFB && !local->fourthFrameKFB->isImageCached) {
-		makeKFBCachedImage(local->fourthFrameKFB, in_data, smartRender, local);
+	if (local->mercator && local->fourthFrameKFB && !local->GetCachedImage(local->fourthFrameNumber)) {
+		makeKFBCachedImage(local->fourthFrameNumber, local->fourthFrameKFB, in_data, smartRender, local);
 	}
+	auto activeImage = local->GetCachedImage(local->activeFrameNumber);
+	auto nextImage = (local->nextFrameKFB) ? local->GetCachedImage(local->nextFrameNumber) : nullptr;
+	local->ReportCachedImageMemory();
 
 
 
@@ -363,87 +485,66 @@ static void DoCachedImages(PF_InData *in_data, PF_SmartRenderExtra* smartRender,
 		nextOpacity = std::min(nextOpacity * 3, 1.0);
 	}
 
-	constexpr double tempScale = 2.0;
-	const int width = static_cast<int>(tempScale * local->activeKFB->getWidth() / local->scaleFactorX);
-	const int height = static_cast<int>(tempScale * local->activeKFB->getHeight() / local->scaleFactorY);
-	
-	if(local->tempImageBuffer.handle && (local->tempImageBuffer.bitDepth != smartRender->input->bitdepth || local->tempImageBuffer.effectWorld.width != width || local->tempImageBuffer.effectWorld.height != height)) {
-		local->tempImageBuffer.Destroy();
+	//The centre of the keyframe, in cached image pixels (the frame zooms about it, see columnLocation).
+	const double centreX = local->width / (2 * local->scaleFactorX);
+	const double centreY = local->height / (2 * local->scaleFactorY);
+	if (!local->mercator) {
+		compositeZoomed(in_data, activeImage, nextImage, nextOpacity, centreX, centreY, output, local);
+		return;
 	}
-	if (local->tempImageBuffer2.handle && (local->tempImageBuffer2.bitDepth != smartRender->input->bitdepth || local->tempImageBuffer2.effectWorld.width != width || local->tempImageBuffer2.effectWorld.height != height)) {
-		local->tempImageBuffer2.Destroy();
+
+	//Mercator projections sample the blended images (the size of the cached images).
+	const auto & activeWorld = activeImage->effectWorld;
+	for(auto * buffer : {&local->tempImageBuffer, &local->tempImageBuffer2}) {
+		if(buffer->handle && buffer->bitDepth == smartRender->input->bitdepth && buffer->effectWorld.width == activeWorld.width && buffer->effectWorld.height == activeWorld.height) continue;
+		newWorld(in_data, *buffer, smartRender->input->bitdepth, activeWorld.width, activeWorld.height);
+		local->ReportCachedImageMemory();
 	}
 
-	if(!local->tempImageBuffer.handle) {
-		//Create a new "world" (aka, an image buffer).
-		switch(smartRender->input->bitdepth) {
-			case 8:
-				err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_8, width, height, &local->tempImageBuffer.handle);
-				break;
-			case 16:
-				err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_16, width, height, &local->tempImageBuffer.handle);
-				break;
-			case 32:
-				err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_32, width, height, &local->tempImageBuffer.handle);
-				break;
-			default:
-				break;
-		}
-		if (err) throw (err);
-		
-		local->tempImageBuffer.bitDepth = smartRender->input->bitdepth;
-		err = suites.WorldSuite3()->AEGP_FillOutPFEffectWorld(local->tempImageBuffer.handle, &local->tempImageBuffer.effectWorld);
-		if(err) throw (err);
+	compositeZoomed(in_data, activeImage, nextImage, nextOpacity, centreX, centreY, &local->tempImageBuffer.effectWorld, local);
+
+	//Render 2nd buffer for mercator
+	if (!local->thirdFrameKFB) throw(std::exception("Error: thirdFrameKFB invalid in DoCachedImages()"));
+	auto thirdImage = local->GetCachedImage(local->thirdFrameNumber);
+	auto fourthImage = (local->fourthFrameKFB) ? local->GetCachedImage(local->fourthFrameNumber) : nullptr;
+	compositeZoomed(in_data, thirdImage, fourthImage, nextOpacity, centreX, centreY, &local->tempImageBuffer2.effectWorld, local);
+
+	doMercator(in_data, output, local);
+}
+
+/*******************************************************************************************************
+Zoom the active (and next) cached images about the centre of the keyframe, blend the next image
+over the active one at nextOpacity, and write the result to output (the size of the cached images).
+*******************************************************************************************************/
+static void compositeZoomed(PF_InData *in_data, const WorldHolder * activeImage, const WorldHolder * nextImage, double nextOpacity, double centreX, double centreY, PF_EffectWorld* output, const LocalSequenceData * local) {
+	if(!activeImage || !output) throw(std::exception("Error in compositeZoomed()"));
+	ZoomComposite composite;
+	composite.layers.resize(nextImage && local->nextZoomScale > 0 ? 2 : 1);
+	PlanZoomCompositeLayer(composite.layers[0], &activeImage->effectWorld, 1.0, local->activeZoomScale, 1.0, centreX, centreY, output->width, output->height);
+	if(composite.layers.size() > 1) {
+		PlanZoomCompositeLayer(composite.layers[1], &nextImage->effectWorld, nextOpacity, local->nextZoomScale, 1.0, centreX, centreY, output->width, output->height);
 	}
 
-	if (local->mercator && !local->tempImageBuffer2.handle) {
-		//Create a new "world" (aka, an image buffer).
-		switch (smartRender->input->bitdepth) {
+	PF_Err abortErr {PF_Err_NONE};
+	auto abort = [in_data, &abortErr] {
+		abortErr = PF_ABORT(in_data);
+		return abortErr != PF_Err_NONE;
+	};
+	bool finished {true};
+	switch(local->bitDepth) {
 		case 8:
-			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_8, width, height, &local->tempImageBuffer2.handle);
+			finished = ZoomCompositeTiles<PF_Pixel8>(composite, output, WorkerPool::Shared(), WorkPriority::render, abort);
 			break;
 		case 16:
-			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_16, width, height, &local->tempImageBuffer2.handle);
+			finished = ZoomCompositeTiles<PF_Pixel16>(composite, output, WorkerPool::Shared(), WorkPriority::render, abort);
 			break;
 		case 32:
-			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_32, width, height, &local->tempImageBuffer2.handle);
+			finished = ZoomCompositeTiles<PF_Pixel32>(composite, output, WorkerPool::Shared(), WorkPriority::render, abort);
 			break;
 		default:
 			break;
-		}
-		if (err) throw (err);
-
-		local->tempImageBuffer2.bitDepth = smartRender->input->bitdepth;
-		err = suites.WorldSuite3()->AEGP_FillOutPFEffectWorld(local->tempImageBuffer2.handle, &local->tempImageBuffer2.effectWorld);
-		if (err) throw (err);
 	}
-
-	
-
-
-
-	PF_LRect rectOut {0, 0, width, height};
-	ScaleAroundCentre(in_data, &local->activeKFB->cachedImage, &local->tempImageBuffer.effectWorld, &rectOut, local->activeZoomScale, 1/tempScale, 1/tempScale, 1.0);
-	if(local->nextFrameKFB && local->nextFrameKFB->isImageCached) {
-		ScaleAroundCentre(in_data, &local->nextFrameKFB->cachedImage, &local->tempImageBuffer.effectWorld, &rectOut, local->nextZoomScale, 1/tempScale, 1/tempScale, nextOpacity);
-	}
-	
-	if (!local->mercator) {
-		const double scaleAdjust = 1 + (1 / local->width) * 2;
-		ScaleAroundCentre(in_data, &local->tempImageBuffer.effectWorld, output, &smartRender->input->output_request.rect, scaleAdjust, (tempScale), tempScale, 1.0);
-	}
-	else {
-		//Render 2nd buffer for mercator
-		if (!local->thirdFrameKFB) throw(std::exception("Error: thirdFrameKFB invalid in DoCachedImages()"));
-		ScaleAroundCentre(in_data, &local->thirdFrameKFB->cachedImage, &local->tempImageBuffer2.effectWorld, &rectOut, local->activeZoomScale, 1 / tempScale, 1 / tempScale, 1.0);
-		if (local->fourthFrameKFB && local->fourthFrameKFB->isImageCached) {
-			ScaleAroundCentre(in_data, &local->fourthFrameKFB->cachedImage, &local->tempImageBuffer2.effectWorld, &rectOut, local->nextZoomScale, 1 / tempScale, 1 / tempScale, nextOpacity);
-		}
-
-		doMercator(in_data, output, local);
-	}
-	return;
-	
+	if(!finished) throw (abortErr);
 }
 
 inline PF_Pixel mixPixel(const PF_Pixel& a, const PF_Pixel& b, const double weight) noexcept{
@@ -455,7 +556,7 @@ inline PF_Pixel mixPixel(const PF_Pixel& a, const PF_Pixel& b, const double weig
 	return r;
 }
 
-PF_Err Mercator8(void* refcon, A_long x, A_long y, PF_Pixel8* in, PF_Pixel8* out ) noexcept{
+PF_Err Mercator8(void* refcon, A_long x, A_long y, PF_Pixel8* /*in*/, PF_Pixel8* out ) noexcept{
 	PF_Err err = PF_Err_NONE;
 	auto local = static_cast<LocalSequenceData*>(refcon);
 	if (!local || !local->tempImageBuffer.handle || !local->tempImageBuffer2.handle) return err;
@@ -467,9 +568,6 @@ PF_Err Mercator8(void* refcon, A_long x, A_long y, PF_Pixel8* in, PF_Pixel8* out
 	const auto inHeight = input1->height;
 	const auto shortestEdge = std::min(inWidth, inHeight);
 
-	const auto outWidth = local->mercatorOutput->width;
-	const auto outHeight = local->mercatorOutput->height;
-	
 	const double adjustedWidth = static_cast<double>(local->layerWidth) / local->scaleFactorX;
 	const double adjustedHeight = static_cast<double>(local->layerHeight) / local->scaleFactorY;
 
@@ -566,35 +664,14 @@ static void doMercator(PF_InData* in_data,  PF_EffectWorld* output,  LocalSequen
 
 /*******************************************************************************************************
 Make a chached image of the .kfb
+The image belongs to this instance (the kfb data may be shared with other instances).
+Methods with stages colour the image from the keyframe's fields and shading, which are only made when
+they are missing or out of date.  So changing only the colour settings (like cycling the colours) just
+colours the image again, without sampling the keyframe.
 *******************************************************************************************************/
-static void makeKFBCachedImage(std::shared_ptr<KFBData> &  kfb, PF_InData *in_data, PF_SmartRenderExtra* smartRender, LocalSequenceData * local) {
-	
-	PF_Err err {PF_Err_NONE};
-	AEGP_SuiteHandler suites(in_data->pica_basicP);
-	AEFX_CLR_STRUCT(kfb->cachedImage);
-	const int width = static_cast<int>(kfb->getWidth() / local->scaleFactorX);
-	const int height = static_cast<int>(kfb->getHeight() / local->scaleFactorY);
-	
-	//Create a new "world" (aka, an image buffer).
-	switch(smartRender->input->bitdepth) {
-		case 8:
-			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_8, width, height,&kfb->cachedImageAEGP);
-			if(err) throw(err);
-			break;
-		case 16:
-			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_16, width, height, &kfb->cachedImageAEGP);
-			if(err) throw(err);
-			break;
-		case 32:
-			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_32, width, height, &kfb->cachedImageAEGP);
-			if(err) throw(err);
-			break;
-		default:
-			break;
-	}
-	
-	err = suites.WorldSuite3()->AEGP_FillOutPFEffectWorld(kfb->cachedImageAEGP, &kfb->cachedImage);
-	if(err) throw(err);
+static void makeKFBCachedImage(long keyFrame, const std::shared_ptr<const KFBData> &  kfb, PF_InData *in_data, PF_SmartRenderExtra* smartRender, LocalSequenceData * local) {
+	auto & image = local->NewCachedImage(keyFrame);
+	newWorld(in_data, image, smartRender->input->bitdepth, static_cast<int>(kfb->getWidth() / local->scaleFactorX), static_cast<int>(kfb->getHeight() / local->scaleFactorY));
 
 	//Adjust zoom scales, because we don't want a zoomed image, then call GenerateImage
 	const auto backup1 = local->keyFramePercent;
@@ -605,138 +682,223 @@ static void makeKFBCachedImage(std::shared_ptr<KFBData> &  kfb, PF_InData *in_da
 	local->activeZoomScale = 1;
 	local->nextZoomScale = 0;
 	local->activeKFB = kfb;
-	GenerateImage(in_data, smartRender, &kfb->cachedImage , local);
+	const auto functions = SelectStageFunctions(local);
+	if(functions.fields) {
+		auto & stages = local->GetCachedStages(keyFrame);
+		makeCachedStages(in_data, functions, stages, image.effectWorld.width, image.effectWorld.height, local);
+		colourCachedImage(in_data, functions, stages, &image.effectWorld, local);
+	}
+	else {
+		GenerateImage(in_data, smartRender, &image.effectWorld , local, WorkPriority::build);
+	}
 	local->keyFramePercent = backup1;
 	local->activeZoomScale = backup2;
 	local->nextZoomScale = backup3;
 	local->activeKFB = backupKFB;
 
-	kfb->isImageCached = true;
 	local->saveCachedParameters();
 }
 
-
-
+/*******************************************************************************************************
+Make the fields (and with slopes, the shading) of a keyframe's cached image of width by height pixels,
+if they are missing (see MakeStageTiles).
+*******************************************************************************************************/
+static void makeCachedStages(PF_InData * in_data, const StageFunctions & functions, CachedStages & stages, A_long width, A_long height, LocalSequenceData * local) {
+	PF_Err abortErr {PF_Err_NONE};
+	auto abort = [in_data, &abortErr] {
+		abortErr = PF_ABORT(in_data);
+		return abortErr != PF_Err_NONE;
+	};
+	if(!MakeStageTiles(functions, stages, width, height, local, WorkerPool::Shared(), WorkPriority::build, abort)) throw (abortErr);
+}
 
 /*******************************************************************************************************
-Scales the input image about its centre, and writes it to output.
+Make the stages of width by height pixels that are missing on a worker pool, each tile is a group of
+rows (see spanGroupRows), like a cached image.
+abort is checked between tiles, returns false if it stopped them.  Stages partly made are cleared, so
+they are made again next time.
 *******************************************************************************************************/
-static void ScaleAroundCentre(PF_InData *in_data, PF_EffectWorld* input, PF_EffectWorld* output, const PF_Rect * rect, double scale, double postScaleX, double postScaleY, double opacity) {
-	AEGP_SuiteHandler suites(in_data->pica_basicP);
-	const float s = static_cast<float>(scale);
-	const float sX = static_cast<float>(postScaleX);
-	const float sY = static_cast<float>(postScaleY);
-	const float centreX = static_cast<float>(input->width) / 2;
-	const float centreY = static_cast<float>(input->height) / 2;
-	
-	//Note: For specifying an AE matrix, the inner brackets is a column.
-	const PF_FloatMatrix activeTrans = {{{s / sX, 0, 0}, {0, s / sY, 0}, {-(s / sX)*(centreX)+(centreX / sX), -(s / sY)*centreY + (centreY / sY), 1}}};
+bool MakeStageTiles(const StageFunctions & functions, CachedStages & stages, A_long width, A_long height, LocalSequenceData * local, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort) {
+	const bool makeFields = stages.fields.empty() || stages.width != width || stages.height != height;
+	const bool makeShading = functions.shading && (makeFields || stages.shading.empty());
+	if(!makeFields && !makeShading) return true;
+
+	prepareRender(local, width, height);
+	const size_t size = static_cast<size_t>(width) * height;
+	if(makeFields) {
+		stages.width = width;
+		stages.height = height;
+		stages.fields.assign(size, -1);
+		stages.shading.clear();
+	}
+	if(makeShading) stages.shading.assign(size * 2, 0.0f);
+
+	const long tiles = (height + spanGroupRows - 1) / spanGroupRows;
+	const bool finished = pool.RunTiles(tiles, priority, [&](long tile) {
+		const A_long first = static_cast<A_long>(tile) * spanGroupRows;
+		const A_long end = std::min(first + spanGroupRows, height);
+		for(A_long y = first; y < end; y++) {
+			const double * fields = &stages.fields[static_cast<size_t>(y) * width];
+			if(makeFields) functions.fields(local, y, 0, width, &stages.fields[static_cast<size_t>(y) * width]);
+			if(makeShading) functions.shading(local, y, 0, width, fields, &stages.shading[static_cast<size_t>(y) * width * 2]);
+		}
+	}, abort);
+	if(!finished) {
+		stages.fields.clear();
+		stages.shading.clear();
+	}
+	return finished;
+}
 
-	PF_CompositeMode comp;
-	AEFX_CLR_STRUCT(comp);
-	comp.xfer = PF_Xfer_IN_FRONT;
-	comp.opacity = roundTo8Bit(opacity * white8);
-	comp.opacitySu = roundTo16Bit(std::round(opacity * white16));
+/*******************************************************************************************************
+Colour a cached image from its fields and shading (the same size).
+*******************************************************************************************************/
+static void colourCachedImage(PF_InData * in_data, const StageFunctions & functions, const CachedStages & stages, PF_EffectWorld * image, const LocalSequenceData * local) {
+	PF_Err abortErr {PF_Err_NONE};
+	auto abort = [in_data, &abortErr] {
+		abortErr = PF_ABORT(in_data);
+		return abortErr != PF_Err_NONE;
+	};
+	const auto context = MakeRenderContext(local);
+	bool finished {true};
+	switch(local->bitDepth) {
+		case 8:
+			finished = ColourStageTiles<PF_Pixel8>(context, functions, stages, image, WorkerPool::Shared(), WorkPriority::build, abort);
+			break;
+		case 16:
+			finished = ColourStageTiles<PF_Pixel16>(context, functions, stages, image, WorkerPool::Shared(), WorkPriority::build, abort);
+			break;
+		case 32:
+			finished = ColourStageTiles<PF_Pixel32>(context, functions, stages, image, WorkerPool::Shared(), WorkPriority::build, abort);
+			break;
+		default:
+			break;
+	}
+	if(!finished) throw (abortErr);
+}
 
-	auto err = suites.WorldTransformSuite1()->transform_world(in_data->effect_ref, PF_Quality_HI, 0, in_data->field, input, &comp, nullptr, &activeTrans, 1, true, rect, output);
-	if(err) throw (err);
+/*******************************************************************************************************
+Colour the whole image on a worker pool, each tile is a group of rows (see spanGroupRows).
+abort is checked between tiles, returns false if it stopped colouring.
+*******************************************************************************************************/
+template<class PixelT>
+bool ColourStageTiles(const RenderContext & context, const StageFunctions & functions, const CachedStages & stages, PF_EffectWorld * image, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort) {
+	const A_long width = stages.width;
+	const A_long height = std::min(stages.height, image->height);
+	const long tiles = (height + spanGroupRows - 1) / spanGroupRows;
+	return pool.RunTiles(tiles, priority, [&](long tile) {
+		PF_Pixel32 colours[blendedSpanChunk];
+		const A_long first = static_cast<A_long>(tile) * spanGroupRows;
+		const A_long end = std::min(first + spanGroupRows, height);
+		for(A_long y = first; y < end; y++) {
+			auto * out = reinterpret_cast<PixelT*>(static_cast<char*>(image->data) + static_cast<size_t>(y) * image->rowbytes);
+			const double * fields = &stages.fields[static_cast<size_t>(y) * width];
+			const float * shading = functions.shading ? &stages.shading[static_cast<size_t>(y) * width * 2] : nullptr;
+			for(A_long x = 0; x < width; x += blendedSpanChunk) {
+				const A_long count = std::min(blendedSpanChunk, width - x);
+				functions.colours(context.local, fields + x, shading ? shading + x * 2 : nullptr, count, colours);
+				WriteSpan(context, colours, count, out + x);
+			}
+		}
+	}, abort);
 }
 
+template bool ColourStageTiles<PF_Pixel8>(const RenderContext &, const StageFunctions &, const CachedStages &, PF_EffectWorld *, WorkerPool &, WorkPriority, const std::function<bool()> &);
+template bool ColourStageTiles<PF_Pixel16>(const RenderContext &, const StageFunctions &, const CachedStages &, PF_EffectWorld *, WorkerPool &, WorkPriority, const std::function<bool()> &);
+template bool ColourStageTiles<PF_Pixel32>(const RenderContext &, const StageFunctions &, const CachedStages &, PF_EffectWorld *, WorkerPool &, WorkPriority, const std::function<bool()> &);
 
 /*******************************************************************************************************
-Selects a pixel iterator based on method.
-Note: method is the index of the drop-down box paramater.
+Create a new "world" (aka, an image buffer) in world, of width by height pixels at bitDepth.
 *******************************************************************************************************/
-inline PixelFunction8 selectPixelRenderFunction8(long method) {
-	switch(method) {
-		case 1:
-			return Render_KFRColouring::Render8;
-		case 2:
-			return Render_KFRDistance::Render8;
-		case 4:
-			return Render_DarkLightWave::Render8;
-		case 5:
-			return Render_WaveOnPalette::Render8;
-		case 6:
-			return Render_LogSteps::Render8;
-		case 7:
-			return Render_LogStepPalette::Render8;
+static void newWorld(PF_InData *in_data, WorldHolder & world, short bitDepth, int width, int height) {
+	PF_Err err {PF_Err_NONE};
+	AEGP_SuiteHandler suites(in_data->pica_basicP);
+	world.Destroy();
+	switch(bitDepth) {
 		case 8:
-			return Render_Panels::Render8;
-		case 9:
-			return Render_PanelsColour::Render8;
-		case 10:
-			return Render_Angle::Render8;
-		case 11:
-			return Render_AngleColour::Render8;
-		case 12:
-			return Render_DEAndAngle::Render8;
+			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_8, width, height, &world.handle);
+			break;
+		case 16:
+			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_16, width, height, &world.handle);
+			break;
+		case 32:
+			err = suites.WorldSuite3()->AEGP_New(NULL, AEGP_WorldType_32, width, height, &world.handle);
+			break;
 		default:
-			throw(std::exception("Unknown rendering method"));
+			break;
 	}
+	if(err) throw(err);
+
+	world.bitDepth = bitDepth;
+	err = suites.WorldSuite3()->AEGP_FillOutPFEffectWorld(world.handle, &world.effectWorld);
+	if(err) throw(err);
 }
 
+
+
+
+
+
 /*******************************************************************************************************
-Selects a pixel iterator based on method.
-Note: method is the index of the drop-down box paramater.
+Selects the stages of cached images based on method (see StageFunctions).
+Angle applies the colour settings before the modifier, and DEAndAngle colours from two values, so
+they don't have stages.  Neither do colours sampled from a layer.
 *******************************************************************************************************/
-inline PixelFunction16 selectPixelRenderFunction16(long method) {
-	switch(method) {
+StageFunctions SelectStageFunctions(const LocalSequenceData * local) {
+	if(local->sampling) return {};
+	switch(local->method) {
 		case 1:
-			return Render_KFRColouring::Render16;
+			return Render_KFRColouring::SelectStages(local);
 		case 2:
-			return Render_KFRDistance::Render16;
+			return Render_KFRDistance::SelectStages(local);
 		case 4:
-			return Render_DarkLightWave::Render16;
+			return Render_DarkLightWave::SelectStages(local);
 		case 5:
-			return Render_WaveOnPalette::Render16;
+			return Render_WaveOnPalette::SelectStages(local);
 		case 6:
-			return Render_LogSteps::Render16;
+			return Render_LogSteps::SelectStages(local);
 		case 7:
-			return Render_LogStepPalette::Render16;
+			return Render_LogStepPalette::SelectStages(local);
 		case 8:
-			return Render_Panels::Render16;
+			return Render_Panels::SelectStages(local);
 		case 9:
-			return Render_PanelsColour::Render16;
-		case 10:
-			return Render_Angle::Render16;
+			return Render_PanelsColour::SelectStages(local);
 		case 11:
-			return Render_AngleColour::Render16;
-		case 12:
-			return Render_DEAndAngle::Render16;
+			return Render_AngleColour::SelectStages(local);
 		default:
-			throw(std::exception("Unknown rendering method"));
+			return {};
 	}
 }
 
 /*******************************************************************************************************
-Selects a pixel iterator based on method.
+Selects a span kernel based on method, compiled for the frame's other settings (see SpanKernelSelector).
 Note: method is the index of the drop-down box paramater.
 *******************************************************************************************************/
-inline PixelFunction32 selectPixelRenderFunction32(long method) {
-	switch(method) {
+template<class PixelT>
+static SpanFunction<PixelT> selectSpanFunction(const LocalSequenceData * local) {
+	switch(local->method) {
 		case 1:
-			return Render_KFRColouring::Render32;
+			return Render_KFRColouring::SelectSpan<PixelT>(local);
 		case 2:
-			return Render_KFRDistance::Render32;
+			return Render_KFRDistance::SelectSpan<PixelT>(local);
 		case 4:
-			return Render_DarkLightWave::Render32;
+			return Render_DarkLightWave::SelectSpan<PixelT>(local);
 		case 5:
-			return Render_WaveOnPalette::Render32;
+			return Render_WaveOnPalette::SelectSpan<PixelT>(local);
 		case 6:
-			return Render_LogSteps::Render32;
+			return Render_LogSteps::SelectSpan<PixelT>(local);
 		case 7:
-			return Render_LogStepPalette::Render32;
+			return Render_LogStepPalette::SelectSpan<PixelT>(local);
 		case 8:
-			return Render_Panels::Render32;
+			return Render_Panels::SelectSpan<PixelT>(local);
 		case 9:
-			return Render_PanelsColour::Render32;
+			return Render_PanelsColour::SelectSpan<PixelT>(local);
 		case 10:
-			return Render_Angle::Render32;
+			return Render_Angle::SelectSpan<PixelT>(local);
 		case 11:
-			return Render_AngleColour::Render32;
+			return Render_AngleColour::SelectSpan<PixelT>(local);
 		case 12:
-			return Render_DEAndAngle::Render32;
+			return Render_DEAndAngle::SelectSpan<PixelT>(local);
 		default:
 			throw(std::exception("Unknown rendering method"));
 	}
@@ -744,59 +906,148 @@ inline PixelFunction32 selectPixelRenderFunction32(long method) {
 
 
 /*******************************************************************************************************
-Adjust the iteration count based on the the selected modifier
-Called by pixel functions.
+Location in a keyframe (zoomed by zoomScale) sampled by output column x or row y.
 *******************************************************************************************************/
-double doModifier(long modifier, double it) {
-	switch(modifier) {
-		case 1: //Linear
-			return it;
-		case 2: //Square Root
-			return std::sqrt(it);
-		case 3: //Cubic Root
-			return std::pow(std::fmax(0,it), 1.0 / 3.0);
-		case 4: //Logarithm
-			return std::log(std::fmax(1,it));
-		default:
-			return it;
-	}
+static inline double columnLocation(const LocalSequenceData * local, A_long x, double zoomScale) noexcept {
+	const double halfWidth = static_cast<double>(local->width) / 2;
+	return ((x * local->scaleFactorX) - halfWidth) / zoomScale + halfWidth;
 }
 
+static inline double rowLocation(const LocalSequenceData * local, A_long y, double zoomScale) noexcept {
+	const double halfHeight = static_cast<double>(local->height) / 2;
+	return ((y * local->scaleFactorY) - halfHeight) / zoomScale + halfHeight;
+}
 
 /*******************************************************************************************************
-Calculates the interation count for (x,y) by blending frames.
+Step for intra-frame distances along one axis, from a location in the active keyframe.
+The step halves from the edge to the centre (assumes zoom size 2).  A pixel uses the larger of its
+column and row steps, which is the step of the axis nearer the edge.
+*******************************************************************************************************/
+static inline double intraFrameStep(double location, int size) noexcept {
+	const double distanceToEdge = std::min(location, size - location);
+	const double percent = (distanceToEdge / static_cast<double>(size / 4));
+	return std::exp(-std::log(2.0f)*percent);
+}
+
+/*******************************************************************************************************
+Calculate where each output column and row samples the keyframes for this render, and plan how
+each keyframe is resampled on that grid.
+Must be called before rendering (the samplers read these tables rather than dividing for every pixel).
+*******************************************************************************************************/
+void PrepareFrameCoordinates(LocalSequenceData * local, A_long width, A_long height) {
+	auto & frame = local->frameCoordinates;
+	frame.blendNext = local->nextFrameKFB && local->keyFramePercent > 0.01 && local->nextZoomScale > 0;
+	frame.activeStep = 1 / local->activeZoomScale;
+	frame.nextStep = frame.blendNext ? 1 / local->nextZoomScale : 1;
+
+	frame.activeX.resize(width);
+	frame.intraStepX.resize(width);
+	frame.nextX.resize(frame.blendNext ? width : 0);
+	for(A_long x = 0; x < width; x++) {
+		frame.activeX[x] = columnLocation(local, x, local->activeZoomScale);
+		frame.intraStepX[x] = intraFrameStep(frame.activeX[x], local->width);
+		if(frame.blendNext) frame.nextX[x] = columnLocation(local, x, local->nextZoomScale);
+	}
+
+	frame.activeY.resize(height);
+	frame.intraStepY.resize(height);
+	frame.nextY.resize(frame.blendNext ? height : 0);
+	for(A_long y = 0; y < height; y++) {
+		frame.activeY[y] = rowLocation(local, y, local->activeZoomScale);
+		frame.intraStepY[y] = intraFrameStep(frame.activeY[y], local->height);
+		if(frame.blendNext) frame.nextY[y] = rowLocation(local, y, local->nextZoomScale);
+	}
+
+	//Smooth values at full size are resampled with a plan.  The next keyframe only where it overlaps.
+	frame.activePlan.kfb = nullptr;
+	frame.nextPlan.kfb = nullptr;
+	if(!local->useSmooth) return;
+	if(local->activeKFB && local->activeMipLevel == 0) {
+		PlanKFBResample(frame.activePlan, local->activeKFB.get(), frame.activeX, 0, width - 1, frame.activeY);
+	}
+	if(frame.blendNext && local->nextMipLevel == 0) {
+		A_long first = width;
+		A_long last = -1;
+		for(A_long x = 0; x < width; x++) {
+			if(frame.nextX[x] < 0 || frame.nextX[x] > local->width - 1) continue;
+			first = std::min(first, x);
+			last = x;
+		}
+		PlanKFBResample(frame.nextPlan, local->nextFrameKFB.get(), frame.nextX, first, last, frame.nextY);
+	}
+}
+
+/*******************************************************************************************************
+Get the iteration values of count pixels of row y, starting at x0.
+Each value is the bicubic sample of the active keyframe, blended with the next keyframe (where it
+overlaps).  The samples of each keyframe are taken with its resampling plan (see KFBResample.h), or
+a span at a time (see calculateIterationCountBiCubicSpan) if it has none.
 Note: Must be thread-safe, so "LocalSequenceData" should be read-only.
-Called by pixel functions.
 *******************************************************************************************************/
-double GetBlendedPixelValue(const LocalSequenceData* local, A_long x, A_long y) {
-	//Calculate pixel location, and get iteration count.
-	const double halfWidth = static_cast<double>(local->width) / 2;
-	const double halfHeight = static_cast<double>(local->height) / 2;
-	const double xCentre = (x * local->scaleFactorX) - halfWidth;
-	const double yCentre = (y * local->scaleFactorY) - halfHeight;
-	double xLocation = xCentre / local->activeZoomScale + halfWidth;
-	double yLocation = yCentre / local->activeZoomScale + halfHeight;
-
-	double iCount = local->activeKFB->calculateIterationCountBiCubic(static_cast<float>(xLocation), static_cast<float>(yLocation), local->useSmooth);
-
-	//Get iteration count from the same location in the next frame (we overlay this image)
-	if(local->nextFrameKFB && local->keyFramePercent > 0.01 && local->nextZoomScale >0) {
-		xLocation = xCentre / local->nextZoomScale + halfWidth;
-		yLocation = yCentre / local->nextZoomScale + halfHeight;
-		bool nextInBounds = (xLocation >= 0 && yLocation >= 0 && xLocation <= local->width-1 && yLocation <= local->height-1);
-		double iCountNext {0.0};
-		if(nextInBounds) {
-			iCountNext = local->nextFrameKFB->calculateIterationCountBiCubic(static_cast<float>(xLocation), static_cast<float>(yLocation), local->useSmooth);
-			double mixWeight = local->keyFramePercent;
-			iCount = iCount*(1-mixWeight) + iCountNext *(mixWeight);
+void GetBlendedPixelSpan(const LocalSequenceData* local, A_long x0, A_long y, A_long count, double * values) {
+	const auto & frame = local->frameCoordinates;
+	const double yNext = frame.blendNext ? frame.nextY[y] : 0.0;
+	const bool nextRowInBounds = frame.blendNext && yNext >= 0 && yNext <= local->height - 1;
+
+	float xs[kfbSpanBlock];
+	double nextValues[kfbSpanBlock];
+	for(A_long start = 0; start < count; start += kfbSpanBlock) {
+		const A_long n = std::min<A_long>(kfbSpanBlock, count - start);
+		const A_long x = x0 + start;
+		double * out = values + start;
+		if(frame.activePlan.kfb) {
+			ResampleKFBSpan(frame.activePlan, x, y, n, out);
+		}
+		else {
+			for(A_long i = 0; i < n; i++) xs[i] = static_cast<float>(frame.activeX[x + i]);
+			local->activeKFB->calculateIterationCountBiCubicSpan(xs, n, static_cast<float>(frame.activeY[y]), out, local->useSmooth, local->activeMipLevel);
+		}
+		if(!nextRowInBounds) continue;
+
+		//Blend in the next frame where it overlaps (a run of pixels, x increases along the row)
+		const double mixWeight = local->keyFramePercent;
+		if(frame.nextPlan.kfb) {
+			const A_long first = std::max<A_long>(x, frame.nextPlan.first);
+			const A_long last = std::min<A_long>(x + n - 1, frame.nextPlan.last);
+			if(last < first) continue;
+			ResampleKFBSpan(frame.nextPlan, first, y, last - first + 1, nextValues);
+			for(A_long i = first; i <= last; i++) out[i - x] = out[i - x] * (1 - mixWeight) + nextValues[i - first] * (mixWeight);
+			continue;
 		}
+		A_long first = n;
+		A_long last = -1;
+		for(A_long i = 0; i < n; i++) {
+			const double xLocation = frame.nextX[x + i];
+			if(xLocation < 0 || xLocation > local->width - 1) continue;
+			xs[i] = static_cast<float>(xLocation);
+			first = std::min(first, i);
+			last = i;
+		}
+		if(last < first) continue;
+		local->nextFrameKFB->calculateIterationCountBiCubicSpan(xs + first, last - first + 1, static_cast<float>(yNext), nextValues, local->useSmooth, local->nextMipLevel);
+		for(A_long i = first; i <= last; i++) out[i] = out[i] * (1 - mixWeight) + nextValues[i - first] * (mixWeight);
 	}
-	return iCount;
 }
 
 
 
 
+/*******************************************************************************************************
+True if pixels x0 to x0 + count - 1 of row y are certainly inside the set (so they needn't be sampled).
+Both keyframes must be inside where they are blended.  Only keyframes resampled with a plan are known.
+*******************************************************************************************************/
+bool SpanInside(const LocalSequenceData * local, A_long x0, A_long y, A_long count) {
+	const auto & frame = local->frameCoordinates;
+	if(!frame.activePlan.kfb || !KFBResampleInside(frame.activePlan, x0, x0 + count - 1, y)) return false;
+	if(!frame.blendNext || frame.nextY[y] < 0 || frame.nextY[y] > local->height - 1) return true;
+
+	const auto & next = frame.nextPlan;
+	if(!next.kfb) return false;
+	const A_long first = std::max<A_long>(x0, next.first);
+	const A_long last = std::min<A_long>(x0 + count - 1, next.last);
+	return last < first || KFBResampleInside(next, first, last, y);
+}
+
 /*******************************************************************************************************
 Round and clamp to an 8 bit value
 *******************************************************************************************************/
@@ -819,6 +1070,101 @@ unsigned short roundTo16Bit(double f) noexcept {
 	return i;
 }
 
+/*******************************************************************************************************
+Scale one float channel, clamp it to 0..max and round it (half up, like std::round for positive values).
+All in float, exactly as quantisePixel, so a pixel is the same whichever of them writes it.
+*******************************************************************************************************/
+static inline int quantiseChannel(float colour, float scale) noexcept {
+	float v = colour * scale;
+	v = (v > 0.0f) ? v : 0.0f;			//Also NaN to 0 (like _mm_max_ps)
+	v = (v < scale) ? v : scale;
+	return static_cast<int>(v + 0.5f);
+}
+
+#ifdef RENDER_USE_SSE2
+/*******************************************************************************************************
+Scale one float ARGB pixel, clamp it to 0..max and round it (half up, like std::round for positive values).
+*******************************************************************************************************/
+static inline __m128i quantisePixel(const PF_Pixel32 * colour, __m128 scale, __m128 max) noexcept {
+	__m128 v = _mm_mul_ps(_mm_loadu_ps(&colour->alpha), scale);
+	v = _mm_min_ps(_mm_max_ps(v, _mm_setzero_ps()), max);
+	return _mm_cvttps_epi32(_mm_add_ps(v, _mm_set1_ps(0.5f)));
+}
+#endif
+
+/*******************************************************************************************************
+Write a span of colours (see SetSpanColour) at 8-bit colour depth.
+*******************************************************************************************************/
+void WriteSpan(const RenderContext & context, const PF_Pixel32 * colours, A_long count, PF_Pixel8 * out) {
+	A_long i = 0;
+#ifdef RENDER_USE_SSE2
+	const __m128 scale = _mm_set1_ps(white8);
+	for(; i + 4 <= count; i += 4) {
+		const __m128i p01 = _mm_packs_epi32(quantisePixel(colours + i, scale, scale), quantisePixel(colours + i + 1, scale, scale));
+		const __m128i p23 = _mm_packs_epi32(quantisePixel(colours + i + 2, scale, scale), quantisePixel(colours + i + 3, scale, scale));
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_packus_epi16(p01, p23));
+	}
+#endif
+	for(; i < count; i++) {
+		out[i].alpha = white8;
+		out[i].red = static_cast<unsigned char>(quantiseChannel(colours[i].red, white8));
+		out[i].green = static_cast<unsigned char>(quantiseChannel(colours[i].green, white8));
+		out[i].blue = static_cast<unsigned char>(quantiseChannel(colours[i].blue, white8));
+	}
+	for(i = 0; i < count; i++) {
+		if(colours[i].alpha < 0) out[i] = context.inside8;
+	}
+}
+
+/*******************************************************************************************************
+Write a span of colours (see SetSpanColour) at 16-bit colour depth.
+Note: White is 0x8000, so values are offset by 0x8000 to use the signed 16-bit pack.
+*******************************************************************************************************/
+void WriteSpan(const RenderContext & context, const PF_Pixel32 * colours, A_long count, PF_Pixel16 * out) {
+	A_long i = 0;
+#ifdef RENDER_USE_SSE2
+	const __m128 scale = _mm_set1_ps(white16);
+	const __m128i offset = _mm_set1_epi32(0x8000);
+	const __m128i flip = _mm_set1_epi16(static_cast<short>(0x8000));
+	for(; i + 2 <= count; i += 2) {
+		const __m128i p0 = _mm_sub_epi32(quantisePixel(colours + i, scale, scale), offset);
+		const __m128i p1 = _mm_sub_epi32(quantisePixel(colours + i + 1, scale, scale), offset);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_xor_si128(_mm_packs_epi32(p0, p1), flip));
+	}
+#endif
+	for(; i < count; i++) {
+		out[i].alpha = white16;
+		out[i].red = static_cast<unsigned short>(quantiseChannel(colours[i].red, white16));
+		out[i].green = static_cast<unsigned short>(quantiseChannel(colours[i].green, white16));
+		out[i].blue = static_cast<unsigned short>(quantiseChannel(colours[i].blue, white16));
+	}
+	for(i = 0; i < count; i++) {
+		if(colours[i].alpha < 0) out[i] = context.inside16;
+	}
+}
+
+/*******************************************************************************************************
+Write a span of colours (see SetSpanColour) at 32-bit colour depth.
+Note: Negative values cause rendering issues, so are clamped to 0.
+*******************************************************************************************************/
+void WriteSpan(const RenderContext & context, const PF_Pixel32 * colours, A_long count, PF_Pixel32 * out) {
+	A_long i = 0;
+#ifdef RENDER_USE_SSE2
+	for(; i < count; i++) {
+		_mm_storeu_ps(&out[i].alpha, _mm_max_ps(_mm_loadu_ps(&colours[i].alpha), _mm_setzero_ps()));
+	}
+#endif
+	for(; i < count; i++) {
+		out[i].alpha = white32;
+		out[i].red = colours[i].red < 0 ? 0 : colours[i].red;
+		out[i].green = colours[i].green < 0 ? 0 : colours[i].green;
+		out[i].blue = colours[i].blue < 0 ? 0 : colours[i].blue;
+	}
+	for(i = 0; i < count; i++) {
+		if(colours[i].alpha < 0) out[i] = context.inside32;
+	}
+}
+
 /*******************************************************************************************************
 Set the colour of the pixel to the "inside colour" selected by the user.
 *******************************************************************************************************/
@@ -877,68 +1223,70 @@ void GetColours(const LocalSequenceData* local, double iCount, RGB & highColour,
 
 
 /*******************************************************************************************************
-Adds slopes colour calculations to r,g,b
+Adds slopes colour calculations to r,g,b. Standard (like KF)
 r,g,b are colour values from 0.0 to 1.0
 p[x][y] is a maxtrix of itaration values around point p[1][1] (may be a minimal cross)
 *******************************************************************************************************/
-void doSlopes(double p[][3], const LocalSequenceData* local, double& r, double& g, double& b) {
-	if(local->slopeMethod == 1) {
-		//Standard (like KF)
-		double diffx = (p[0][1] - p[2][1]) / 2.0f;
-		double diffy = (p[1][0] - p[1][2]) / 2.0f;
-		double diff = diffx*local->slopeAngleX + diffy*local->slopeAngleY;
-
-		double p1 = fmax(1, p[1][1]);
-		diff = (p1 + diff) / p1;
-
-		//Different to KF code, as I want it frame independant, might need improving
-		diff = pow(diff, local->slopeShadowDepth * std::log(p[1][1] / 5000 + 1) * (local->width));
-
-		if(diff > 1) {
-			diff = (atan(diff) - pi / 4) / (pi / 4);
-			diff = diff*local->slopeStrength / 100;
-			r = (1 - diff)*r;
-			g = (1 - diff)*g;
-			b = (1 - diff)*b;
-		}
-		else {
-			diff = 1 / diff;
-			diff = (atan(diff) - pi / 4) / (pi / 4);
-			diff = diff*local->slopeStrength / 100;;
-			r = (1 - diff)*r + diff;
-			g = (1 - diff)*g + diff;
-			b = (1 - diff)*b + diff;
-		}
+void doSlopesStandard(double p[][3], const LocalSequenceData* local, double& r, double& g, double& b) {
+	double diffx = (p[0][1] - p[2][1]) / 2.0f;
+	double diffy = (p[1][0] - p[1][2]) / 2.0f;
+	double diff = diffx*local->slopeAngleX + diffy*local->slopeAngleY;
+
+	double p1 = fmax(1, p[1][1]);
+	diff = (p1 + diff) / p1;
+
+	//Different to KF code, as I want it frame independant, might need improving
+	diff = pow(diff, local->slopeShadowDepth * std::log(p[1][1] / 5000 + 1) * (local->width));
+
+	if(diff > 1) {
+		diff = (atan(diff) - pi / 4) / (pi / 4);
+		diff = diff*local->slopeStrength / 100;
+		r = (1 - diff)*r;
+		g = (1 - diff)*g;
+		b = (1 - diff)*b;
+	}
+	else {
+		diff = 1 / diff;
+		diff = (atan(diff) - pi / 4) / (pi / 4);
+		diff = diff*local->slopeStrength / 100;;
+		r = (1 - diff)*r + diff;
+		g = (1 - diff)*g + diff;
+		b = (1 - diff)*b + diff;
 	}
-	else if(local->slopeMethod == 2) {
-		//Angle Only
-		double dx = (p[0][1] - p[2][1]);
-		double dy = (p[1][0] - p[1][2]);
-
-		//For clean colouring we need to take colour from nearby pixel at stationaty points.
-		if(dx == 0 && dy == 0) {
-			dx = (p[0][0] - p[2][0]);
+}
+
+/*******************************************************************************************************
+Adds slopes colour calculations to r,g,b. Angle Only
+r,g,b are colour values from 0.0 to 1.0
+p[x][y] is a maxtrix of itaration values around point p[1][1]
+*******************************************************************************************************/
+void doSlopesAngle(double p[][3], const LocalSequenceData* local, double& r, double& g, double& b) {
+	double dx = (p[0][1] - p[2][1]);
+	double dy = (p[1][0] - p[1][2]);
+
+	//For clean colouring we need to take colour from nearby pixel at stationaty points.
+	if(dx == 0 && dy == 0) {
+		dx = (p[0][0] - p[2][0]);
+		if(dx == 0) {
+			dx = (p[0][2] - p[2][2]);
 			if(dx == 0) {
-				dx = (p[0][2] - p[2][2]);
-				if(dx == 0) {
-					dy = (p[0][0] - p[0][2]);
-					if(dy == 0) dy = (p[2][0] - p[2][2]);
-				}
+				dy = (p[0][0] - p[0][2]);
+				if(dy == 0) dy = (p[2][0] - p[2][2]);
 			}
 		}
+	}
 
-		double angle = std::atan2(dy*16, dx*16) + pi;
-		angle += (local->slopeAngle / 360.0) *2*pi;
-		double colour = (std::sin(angle) + 1) / 2;
-		
-		auto depth = local->slopeShadowDepth / 100;
-		colour = (1 - depth) + colour*depth;
+	double angle = std::atan2(dy*16, dx*16) + pi;
+	angle += (local->slopeAngle / 360.0) *2*pi;
+	double colour = (std::sin(angle) + 1) / 2;
+	
+	auto depth = local->slopeShadowDepth / 100;
+	colour = (1 - depth) + colour*depth;
 
-		colour *= 1+(local->slopeStrength / 100);
-		r *= colour;
-		g *= colour;
-		b *= colour;
-	}
+	colour *= 1+(local->slopeStrength / 100);
+	r *= colour;
+	g *= colour;
+	b *= colour;
 }
 
 /*******************************************************************************************************
@@ -950,23 +1298,17 @@ For use in frame-by-frame (not suitable for cached images).
 No intra-frame complensation, so will create the pulsating look.
 *******************************************************************************************************/
 void GetBlendedDistanceMatrix(double matrix[][3], const LocalSequenceData* local, A_long x, A_long y) {
-	const double halfWidth = static_cast<double>(local->width) / 2.0;
-	const double halfHeight = static_cast<double>(local->height) / 2.0;
-	const double xCentre = (x * local->scaleFactorX) - halfWidth;
-	const double yCentre = (y * local->scaleFactorY) - halfHeight;
-	double xLocation = xCentre / local->activeZoomScale + halfWidth;
-	double yLocation = yCentre / local->activeZoomScale + halfHeight;
-
-	local->activeKFB->getDistanceMatrix(matrix, static_cast<double>(xLocation), static_cast<double>(yLocation), 1 / static_cast<double>(local->activeZoomScale));
-
-	if(local->nextFrameKFB && local->keyFramePercent > 0.01 && local->nextZoomScale > 0) {
-		xLocation = xCentre / local->nextZoomScale + halfWidth;
-		yLocation = yCentre / local->nextZoomScale + halfHeight;
+	const auto & frame = local->frameCoordinates;
+	local->activeKFB->getDistanceMatrix(matrix, frame.activeX[x], frame.activeY[y], frame.activeStep);
+
+	if(frame.blendNext) {
+		const double xLocation = frame.nextX[x];
+		const double yLocation = frame.nextY[y];
 		bool nextInBounds = (xLocation >= 1 && yLocation >= 1 && xLocation <= local->width - 2 && yLocation <= local->height - 2);
 
 		if(nextInBounds) {
 			double next[3][3];
-			local->nextFrameKFB->getDistanceMatrix(next, static_cast<double>(xLocation), static_cast<double>(yLocation), 1 / local->nextZoomScale);
+			local->nextFrameKFB->getDistanceMatrix(next, xLocation, yLocation, frame.nextStep);
 			const float mixWeight = static_cast<float>(local->keyFramePercent);
 			for(int i = 0; i < 3; i++) for(int j = 0; j < 3; j++) {
 				matrix[i][j] = (1 - mixWeight) * matrix[i][j] + next[i][j] * mixWeight;
@@ -983,32 +1325,10 @@ It interpolate over smaller distances near the centre of the image
 minmal (default=false) will only fill a cross (unless overidden in local)
 *******************************************************************************************************/
 void getDistanceIntraFrame(double p[][3], A_long x, A_long y, const LocalSequenceData* local, bool minimal) {
-	double step = 0.5;
-
-	//Calculate pixel location.
-	double halfWidth = static_cast<double>(local->width) / 2.0f;
-	double halfHeight = static_cast<double>(local->height) / 2.0f;
-	double xCentre = (x * local->scaleFactorX) - halfWidth;
-	double yCentre = (y * local->scaleFactorY) - halfHeight;
-	double xLocation = xCentre / local->activeZoomScale + halfWidth;
-	double yLocation = yCentre / local->activeZoomScale + halfHeight;
-	double xf = static_cast<double>(xLocation);
-	double yf = static_cast<double>(yLocation);
-
-	double adjustX = xf / static_cast<double>(local->scaleFactorX);
-	double adjustY = yf / static_cast<double>(local->scaleFactorY);
-
-	double distanceToEdgeX = std::min(xf, local->width - xf);
-	double distanceToEdgeY = std::min(yf, local->height - yf);
-	double distanceToEdge = std::min(distanceToEdgeX, distanceToEdgeY);
-
-	double percentX = (distanceToEdgeX / static_cast<double>(local->width / 4));
-	double percentY = (distanceToEdgeY / static_cast<double>(local->height / 4));
-	double percent = std::min(percentX, percentY);
-	step = std::exp(-std::log(2.0f)*percent); //Assumes zoom size 2
-
+	const auto & frame = local->frameCoordinates;
+	const double step = std::max(frame.intraStepX[x], frame.intraStepY[y]);
 	bool min = minimal && !local->overrideMinimalDistance;
-	local->activeKFB->getDistanceMatrix(p, static_cast<double>(xLocation), static_cast<double>(yLocation), step, min);
+	local->activeKFB->getDistanceMatrix(p, frame.activeX[x], frame.activeY[y], step, min);
 }
 
 
@@ -1082,7 +1402,7 @@ ARGBdouble sampleLayerPixel(const LocalSequenceData * local, double x, double y)
 Render (non smart)
 We won't support older versions of AE.  Just set pixels to black.
 *******************************************************************************************************/
-PF_Err NonSmartRender(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef *params[], PF_LayerDef	*output) {
+PF_Err NonSmartRender(PF_InData *in_data, PF_OutData * /*out_data*/, PF_ParamDef * /*params*/[], PF_LayerDef	*output) {
 	PF_Err err = PF_Err_NONE;
 	AEGP_SuiteHandler suites(in_data->pica_basicP);
 	auto lines = output->extent_hint.bottom - output->extent_hint.top;
@@ -1101,7 +1421,7 @@ PF_Err NonSmartRender(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef *par
 Sets a pixel to black (8 bit pixel).
 Called by a pixel iterator.
 *******************************************************************************************************/
-static PF_Err SetToBlack8(void* refcon, A_long x, A_long y, PF_Pixel8* in, PF_Pixel8* out) {
+static PF_Err SetToBlack8(void* /*refcon*/, A_long /*x*/, A_long /*y*/, PF_Pixel8* /*in*/, PF_Pixel8* out) {
 	out->red = 0;
 	out->blue = 0;
 	out->green = 0;
@@ -1113,7 +1433,7 @@ static PF_Err SetToBlack8(void* refcon, A_long x, A_long y, PF_Pixel8* in, PF_Pi
 Sets a pixel to black (16 bit pixel)
 Called by a pixel iterator.
 *******************************************************************************************************/
-static PF_Err SetToBlack16(void* refcon, A_long x, A_long y, PF_Pixel16* in, PF_Pixel16* out) {
+static PF_Err SetToBlack16(void* /*refcon*/, A_long /*x*/, A_long /*y*/, PF_Pixel16* /*in*/, PF_Pixel16* out) {
 	out->red = 0;
 	out->blue = 0;
 	out->green = 0;
@@ -18,6 +18,10 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "KFMovieMaker.h"
 #include "Parameters.h"
 #include "LocalSequenceData.h"
+#include "WorkerPool.h"
+
+#include <cmath>
+#include <functional>
 
 constexpr unsigned char black8 = 0;
 constexpr unsigned char white8 = 0xff;
@@ -27,13 +31,17 @@ constexpr float black32 = 0.0;
 constexpr float white32 = 1.0;
 constexpr double pi = 3.14159265358979323846;
 constexpr int colourRange = 1024;
+constexpr A_long blendedSpanChunk = 256;		//Pixels sampled at a time by RenderKernelSpan.
+constexpr A_long insideSpanRun = 64;			//Pixels checked at a time for being inside the set (see SpanInside).
 
 PF_Err SmartPreRender(PF_InData * in_data, PF_OutData * out_data, PF_PreRenderExtra* preRender);
 PF_Err SmartRender(PF_InData * in_data, PF_OutData * out_data,  PF_SmartRenderExtra* smartRender);
-double doModifier(long modifier, double it);
+void PrepareFrameCoordinates(LocalSequenceData * local, A_long width, A_long height);
 void GetBlendedDistanceMatrix(double matrix[][3], const LocalSequenceData * local, A_long x, A_long y);
-double GetBlendedPixelValue(const LocalSequenceData* local, A_long x, A_long y);
-void doSlopes(double p[][3], const LocalSequenceData * local, double & r, double & g, double & b);
+void GetBlendedPixelSpan(const LocalSequenceData* local, A_long x0, A_long y, A_long count, double * values);
+bool SpanInside(const LocalSequenceData * local, A_long x0, A_long y, A_long count);
+void doSlopesStandard(double p[][3], const LocalSequenceData * local, double & r, double & g, double & b);
+void doSlopesAngle(double p[][3], const LocalSequenceData * local, double & r, double & g, double & b);
 void getDistanceIntraFrame(double p[][3], A_long x, A_long y, const LocalSequenceData * local, bool minimal = false);
 ARGBdouble sampleLayerPixel(const LocalSequenceData * local, double x, double y);
 PF_Err NonSmartRender(PF_InData *in_data, PF_OutData *out_data, PF_ParamDef *params[], PF_LayerDef	*output);
@@ -42,4 +50,277 @@ unsigned short roundTo16Bit(double f) noexcept;
 void GetColours(const LocalSequenceData* local, double iCount, RGB & highColour, RGB & lowColour, double & mixWeight, bool scaleLikeKF=true);
 PF_Err SetInsideColour8(const LocalSequenceData * local, PF_Pixel8 * out);
 PF_Err SetInsideColour16(const LocalSequenceData * local, PF_Pixel16 * out);
-PF_Err SetInsideColour32(const LocalSequenceData * local, PF_Pixel32 * out);
\ No newline at end of file
+PF_Err SetInsideColour32(const LocalSequenceData * local, PF_Pixel32 * out);
+
+//What the render methods need for one render, gathered once rather than for every pixel.
+//The per-pixel adapters (Render8/16/32) expect a pointer to one of these as their refcon.
+struct RenderContext {
+	const LocalSequenceData * local {nullptr};
+	PF_Pixel8 inside8 {};
+	PF_Pixel16 inside16 {};
+	PF_Pixel32 inside32 {};
+};
+
+RenderContext MakeRenderContext(const LocalSequenceData * local);
+template<class PixelT> bool RenderSpanTiles(const RenderContext & context, PF_EffectWorld * output, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort = nullptr);
+
+//Function prototype for span kernels (renders x0 to x1 of row y).
+template<class PixelT> using SpanFunction = void(*)(const RenderContext & context, A_long y, A_long x0, A_long x1, PixelT * out);
+
+//Methods colour a span as floats (0.0 to 1.0 per channel), whatever the output depth.  WriteSpan then
+//converts the whole span to the output depth.  Inside pixels have a negative alpha, and are written
+//with the inside colour.
+void WriteSpan(const RenderContext & context, const PF_Pixel32 * colours, A_long count, PF_Pixel8 * out);
+void WriteSpan(const RenderContext & context, const PF_Pixel32 * colours, A_long count, PF_Pixel16 * out);
+void WriteSpan(const RenderContext & context, const PF_Pixel32 * colours, A_long count, PF_Pixel32 * out);
+
+//The colour channels are cleared too, as WriteSpan converts them before writing the inside colour
+//(left as they were, they can be denormals, which are very slow to convert).
+inline void SetSpanInside(PF_Pixel32 * out) noexcept {
+	*out = PF_Pixel32 {-1, 0, 0, 0};
+}
+
+inline void SetSpanColour(PF_Pixel32 * out, double red, double green, double blue) noexcept {
+	out->alpha = white32;
+	out->red = static_cast<float>(red);
+	out->green = static_cast<float>(green);
+	out->blue = static_cast<float>(blue);
+}
+
+//The results of the methods' RenderCommon functions (-1 is an inside pixel).
+inline void SetSpanColour(PF_Pixel32 * out, double grey) noexcept {
+	if(grey == -1) SetSpanInside(out);
+	else SetSpanColour(out, grey, grey, grey);
+}
+
+inline void SetSpanColour(PF_Pixel32 * out, const RGBdouble & colour) noexcept {
+	if(colour.red == -1) SetSpanInside(out);
+	else SetSpanColour(out, colour.red, colour.green, colour.blue);
+}
+
+inline void SetSpanColour(PF_Pixel32 * out, const ARGBdouble & colour) noexcept {
+	if(colour.red == -1) SetSpanInside(out);
+	else SetSpanColour(out, colour.red, colour.green, colour.blue);
+}
+
+//Colour pixels x0 to x0 + count - 1 of row y, from their blended iteration values.
+//Kernel::Colour(local, x, y, iCount) returns a method's colour for one pixel.
+//This doesn't depend on the output depth, so it is compiled once for each kernel.
+template<class Kernel>
+void SpanColours(const LocalSequenceData * local, A_long x0, A_long y, A_long count, const double * iCounts, PF_Pixel32 * colours) {
+	for(A_long i = 0; i < count; i++) SetSpanColour(colours + i, Kernel::Colour(local, x0 + i, y, iCounts[i]));
+}
+
+//Render pixels x0 to x1 (exclusive) of row y with a method's kernel, at any colour depth.
+//The pixels are sampled, coloured and written a chunk at a time.  Runs of a chunk that are certainly
+//inside the set (see SpanInside) get the inside colour without being sampled.
+template<class PixelT, class Kernel>
+void RenderKernelSpan(const RenderContext & context, A_long y, A_long x0, A_long x1, PixelT * out) {
+	double iCounts[blendedSpanChunk];
+	PF_Pixel32 colours[blendedSpanChunk];
+	for(A_long x = x0; x < x1; ) {
+		const A_long count = (x1 - x < blendedSpanChunk) ? x1 - x : blendedSpanChunk;
+		A_long sampleFrom = 0;		//Start of the pixels waiting to be sampled
+		for(A_long run = 0; run < count; run += insideSpanRun) {
+			const A_long runCount = (count - run < insideSpanRun) ? count - run : insideSpanRun;
+			if(!SpanInside(context.local, x + run, y, runCount)) continue;
+			if(run > sampleFrom) {
+				GetBlendedPixelSpan(context.local, x + sampleFrom, y, run - sampleFrom, iCounts);
+				SpanColours<Kernel>(context.local, x + sampleFrom, y, run - sampleFrom, iCounts, colours + sampleFrom);
+			}
+			for(A_long i = run; i < run + runCount; i++) SetSpanInside(colours + i);
+			sampleFrom = run + runCount;
+		}
+		if(count > sampleFrom) {
+			GetBlendedPixelSpan(context.local, x + sampleFrom, y, count - sampleFrom, iCounts);
+			SpanColours<Kernel>(context.local, x + sampleFrom, y, count - sampleFrom, iCounts, colours + sampleFrom);
+		}
+		WriteSpan(context, colours, count, out);
+		x += count;
+		out += count;
+	}
+}
+
+//Settings that are constant for a frame, that the span kernels are compiled for (see SpanKernelSelector).
+//The code run for each pixel then has no branches on them.
+template<long Modifier, bool Sampling, bool Slopes, bool IntraFrame, long SlopeMethod>
+struct RenderFeatures {
+	static constexpr long modifier = Modifier;				//1 linear, 2 square root, 3 cubic root, 4 logarithm
+	static constexpr bool sampling = Sampling;				//Colours are sampled from a layer
+	static constexpr bool slopes = Slopes;
+	static constexpr bool intraFrame = IntraFrame;			//Distances from within the frame (scaling mode 1), rather than blended keyframes
+	static constexpr long slopeMethod = SlopeMethod;		//1 standard, 2 angle only (0 without slopes)
+};
+
+//Settings a method reads as well as the modifier and slopes (so only the kernels it needs are compiled).
+enum RenderFeatureUse : unsigned {
+	usesSampling = 1,
+	usesDistance = 2,		//Reads distances even without slopes, so the scaling mode always matters.
+};
+
+//Chooses Maker::Make<Kernel<RenderFeatures<...>>>() for a frame's settings, once per frame.
+//Settings a method doesn't read are left at their defaults.  Slopes with an unknown slope method
+//do nothing, so use the kernel without slopes.
+template<class Maker, template<class> class Kernel, unsigned Uses>
+struct KernelSelector {
+	using Result = typename Maker::Result;
+
+	static Result Select(const LocalSequenceData * local) {
+		switch(local->modifier) {
+			case 2:
+				return sampling<2>(local);
+			case 3:
+				return sampling<3>(local);
+			case 4:
+				return sampling<4>(local);
+			default:
+				return sampling<1>(local);
+		}
+	}
+
+	private:
+	template<long Modifier>
+	static Result sampling(const LocalSequenceData * local) {
+		if constexpr((Uses & usesSampling) != 0) {
+			if(local->sampling) return slopes<Modifier, true>(local);
+		}
+		return slopes<Modifier, false>(local);
+	}
+
+	template<long Modifier, bool Sampling>
+	static Result slopes(const LocalSequenceData * local) {
+		if(local->slopesEnabled && local->slopeMethod == 1) return scaling<Modifier, Sampling, true, 1>(local);
+		if(local->slopesEnabled && local->slopeMethod == 2) return scaling<Modifier, Sampling, true, 2>(local);
+		return scaling<Modifier, Sampling, false, 0>(local);
+	}
+
+	template<long Modifier, bool Sampling, bool Slopes, long SlopeMethod>
+	static Result scaling(const LocalSequenceData * local) {
+		if constexpr(Slopes || (Uses & usesDistance) != 0) {
+			if(local->scalingMode == 1) return Maker::template Make<Kernel<RenderFeatures<Modifier, Sampling, Slopes, true, SlopeMethod>>>();
+		}
+		return Maker::template Make<Kernel<RenderFeatures<Modifier, Sampling, Slopes, false, SlopeMethod>>>();
+	}
+};
+
+template<class PixelT>
+struct SpanKernelMaker {
+	using Result = SpanFunction<PixelT>;
+	template<class Kernel> static Result Make() { return RenderKernelSpan<PixelT, Kernel>; }
+};
+
+//Chooses the span function for a method's Kernel<RenderFeatures<...>> (see RenderKernelSpan) for a
+//frame's settings, once per frame.
+template<class PixelT, template<class> class Kernel, unsigned Uses>
+using SpanKernelSelector = KernelSelector<SpanKernelMaker<PixelT>, Kernel, Uses>;
+
+//Adjust the iteration count based on the the selected modifier.
+template<long Modifier>
+inline double doModifier(double it) {
+	if constexpr(Modifier == 2) return std::sqrt(it);		//Square Root
+	else if constexpr(Modifier == 3) return std::pow(std::fmax(0, it), 1.0 / 3.0);		//Cubic Root
+	else if constexpr(Modifier == 4) return std::log(std::fmax(1, it));		//Logarithm
+	else return it;		//Linear
+}
+
+//Adds slopes colour calculations to r,g,b (see doSlopesStandard and doSlopesAngle).
+template<long SlopeMethod>
+inline void doSlopes(double p[][3], const LocalSequenceData * local, double & r, double & g, double & b) {
+	if constexpr(SlopeMethod == 1) doSlopesStandard(p, local, r, g, b);
+	else if constexpr(SlopeMethod == 2) doSlopesAngle(p, local, r, g, b);
+}
+
+/*******************************************************************************************************
+Staged cached images.
+Most methods colour a pixel from one value, its field (the iteration count or distance after the
+modifier), and then shade the colour with the slopes.  Both slope methods scale the colour and add to
+it, by amounts that don't depend on the colour.  So a cached image can be kept as the fields and the
+shading of the keyframe, and only coloured again when the colour settings change (see DoCachedImages).
+As well as Colour, the kernels of these methods have:
+	Field(local, x, y, iCount)				the field of a pixel (-1 inside the set)
+	Map(local, field)						the colour of a field, before the slopes
+	SlopeDistances(distance, local, x, y)	the distances the slopes are made from
+	slopeMethod								0 without slopes
+*******************************************************************************************************/
+
+//The stages of a method's cached images, compiled for a frame's settings (see StageKernelSelector).
+//Methods without stages have none, their cached images are rendered whole.
+struct StageFunctions {
+	void (*fields)(const LocalSequenceData * local, A_long y, A_long x0, A_long x1, double * out) {nullptr};
+	void (*shading)(const LocalSequenceData * local, A_long y, A_long x0, A_long x1, const double * fields, float * out) {nullptr};
+	void (*colours)(const LocalSequenceData * local, const double * fields, const float * shading, A_long count, PF_Pixel32 * out) {nullptr};
+};
+
+//A cached image's stages, made and coloured on a pool like RenderSpanTiles (without AE).
+StageFunctions SelectStageFunctions(const LocalSequenceData * local);
+bool MakeStageTiles(const StageFunctions & functions, CachedStages & stages, A_long width, A_long height, LocalSequenceData * local, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort = nullptr);
+template<class PixelT> bool ColourStageTiles(const RenderContext & context, const StageFunctions & functions, const CachedStages & stages, PF_EffectWorld * image, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort = nullptr);
+
+//The slopes of a pixel as colour * scale + add.  The slopes of red 0 are add, and of green 1 are scale + add.
+template<long SlopeMethod>
+inline void SlopeShading(double p[][3], const LocalSequenceData * local, float & scale, float & add) {
+	double r {0}, g {1}, b {0};
+	doSlopes<SlopeMethod>(p, local, r, g, b);
+	scale = static_cast<float>(g - r);
+	add = static_cast<float>(r);
+}
+
+//The fields of pixels x0 to x1 (exclusive) of row y.  Runs certainly inside the set aren't sampled.
+template<class Kernel>
+void FieldKernelSpan(const LocalSequenceData * local, A_long y, A_long x0, A_long x1, double * out) {
+	for(A_long x = x0; x < x1; x += insideSpanRun) {
+		const A_long count = (x1 - x < insideSpanRun) ? x1 - x : insideSpanRun;
+		double * fields = out + (x - x0);
+		if(SpanInside(local, x, y, count)) {
+			for(A_long i = 0; i < count; i++) fields[i] = -1;
+			continue;
+		}
+		GetBlendedPixelSpan(local, x, y, count, fields);
+		for(A_long i = 0; i < count; i++) fields[i] = Kernel::Field(local, x + i, y, fields[i]);
+	}
+}
+
+//The shading (scale then add) of pixels x0 to x1 (exclusive) of row y.  Pixels inside the set aren't shaded.
+template<class Kernel>
+void ShadingKernelSpan(const LocalSequenceData * local, A_long y, A_long x0, A_long x1, const double * fields, float * out) {
+	double distance[3][3];
+	for(A_long x = x0; x < x1; x++, fields++, out += 2) {
+		out[0] = 1;
+		out[1] = 0;
+		if(*fields == -1) continue;
+		Kernel::SlopeDistances(distance, local, x, y);
+		SlopeShading<Kernel::slopeMethod>(distance, local, out[0], out[1]);
+	}
+}
+
+//Colour count pixels from their fields and shading (nullptr without slopes).
+template<class Kernel>
+void ColourKernelSpan(const LocalSequenceData * local, const double * fields, const float * shading, A_long count, PF_Pixel32 * out) {
+	for(A_long i = 0; i < count; i++) {
+		if(fields[i] == -1) {
+			SetSpanInside(out + i);
+			continue;
+		}
+		SetSpanColour(out + i, Kernel::Map(local, fields[i]));
+		if(shading) {
+			const float scale = shading[i * 2];
+			const float add = shading[i * 2 + 1];
+			out[i].red = out[i].red * scale + add;
+			out[i].green = out[i].green * scale + add;
+			out[i].blue = out[i].blue * scale + add;
+		}
+	}
+}
+
+struct StageKernelMaker {
+	using Result = StageFunctions;
+	template<class Kernel> static Result Make() {
+		if constexpr(Kernel::slopeMethod != 0) return {FieldKernelSpan<Kernel>, ShadingKernelSpan<Kernel>, ColourKernelSpan<Kernel>};
+		else return {FieldKernelSpan<Kernel>, nullptr, ColourKernelSpan<Kernel>};
+	}
+};
+
+//Chooses the stages of a method's Kernel<RenderFeatures<...>> for a frame's settings.  Colours sampled
+//from a layer aren't staged, so the kernels are always compiled without sampling.
+template<template<class> class Kernel, unsigned Uses>
+using StageKernelSelector = KernelSelector<StageKernelMaker, Kernel, Uses & ~static_cast<unsigned>(usesSampling)>;
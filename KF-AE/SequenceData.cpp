@@ -57,7 +57,7 @@ PF_Err SequenceData::SequenceSetup(PF_InData *in_data, PF_OutData *out_data) {
 After Effects Event Management
 AE tells us to flatten the sequence data.  Usually for saving the project file.
 *******************************************************************************************************/
-PF_Err SequenceData::SequenceFlatten(PF_InData *in_data, PF_OutData *out_data) {
+PF_Err SequenceData::SequenceFlatten(PF_InData *in_data, PF_OutData * /*out_data*/) {
 	DebugMessage("Sequence Flatten\n");
 	AEGP_SuiteHandler suites(globalTL_in_data->pica_basicP);
 	auto handleSuite = suites.HandleSuite1();
@@ -107,7 +107,7 @@ PF_Err SequenceData::SequenceResetup(PF_InData *in_data, PF_OutData *out_data) {
 After Effects Event Management
 AE tells us to destroy the sequence data
 *******************************************************************************************************/
-PF_Err SequenceData::SequenceSetdown(PF_InData *in_data, PF_OutData *out_data) {
+PF_Err SequenceData::SequenceSetdown(PF_InData * /*in_data*/, PF_OutData * /*out_data*/) {
 	DebugMessage("Sequence Shutdown\n");
 	return PF_Err_NONE;
 }
@@ -150,7 +150,9 @@ void SequenceData::SetFileName(std::string & str)
 	}
 
 	//Convert to c-style string because we need flat data for AE.
+	#ifdef _MSC_VER
 	#pragma warning(disable: 4996) //VC++ unchecked iterators warning on str.copy (used safely in this case)
+	#endif
 	auto length = str.copy(kfrFileName, sizeof(kfrFileName)-1, 0);
 	kfrFileName[length] = '\0';
 
@@ -163,7 +165,7 @@ void SequenceData::SetFileName(std::string & str)
 Unflatten the local data
 Private member function
 *******************************************************************************************************/
-PF_Err SequenceData::Unflatten(PF_InData *in_data) {
+PF_Err SequenceData::Unflatten(PF_InData * /*in_data*/) {
 	DebugMessage("Sequence Unflatten\n");
 	AEGP_SuiteHandler suites(globalTL_in_data->pica_basicP);
 	auto handleSuite = suites.HandleSuite1();
@@ -0,0 +1,101 @@
+/********************************************************************************************
+CacheTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The shared keyframe cache (see KFBCache.h), with a budget of a few keyframes:
+ - The least recently used (inserted or found) keyframe is released first.
+ - A keyframe held outside the cache is pinned, and released once it is let go.
+ - Memory held outside the cache (cached images, see SetHeldBytes) releases keyframes to make room.
+ - Everything a keyframe uses is counted: its storage, a mapped file, and what is built from it.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBCache.h"
+
+#include <filesystem>
+
+constexpr int width = 300, height = 200;
+
+static std::shared_ptr<const KFBData> keyFrame(const std::string & fileName) {
+	auto data = std::make_shared<KFBData>(width, height);
+	data->ReadKFBFile(fileName);
+	return data;
+}
+
+//Which of the keys are cached (without counting as a use), eg. "AC-".
+static std::string cached(KFBCache & cache, const std::string & keys) {
+	std::string result;
+	for(char k : keys) result += cache.Contains(std::string(1, k)) ? k : '-';
+	return result;
+}
+
+int main() {
+	UseTestAE();
+	const auto fileName = TestFileName("cache.kfb");
+	WriteTestKFB(fileName, MakeTestKFB(width, height, 1000, 100000));
+	KFBCache & cache = KFBCache::Shared();
+	const size_t size = keyFrame(fileName)->memoryUsage();
+	TEST_CHECK(size >= static_cast<size_t>(width) * height * (sizeof(int) + sizeof(double)), "a keyframe counts its storage");
+
+	//Room for three keyframes.
+	cache.SetBudget(size * 3 + size / 2);
+	const auto evicted = cache.GetStats().evictions;
+	for(const char * key : {"A", "B", "C"}) cache.Insert(key, keyFrame(fileName));
+	TEST_CHECK(cached(cache, "ABCD") == "ABC-" && cache.GetStats().usedBytes == size * 3, "three keyframes fit");
+	cache.Find("A");
+	cache.Insert("D", keyFrame(fileName));
+	TEST_CHECK(cached(cache, "ABCD") == "A-CD", "the least recently used (B) is released, not A which was found since: " + cached(cache, "ABCD"));
+
+	//C is the oldest, but held (eg. by a render), so A goes instead.  Let go, C goes next.
+	auto held = cache.Find("C");
+	cache.Find("D");
+	cache.Insert("E", keyFrame(fileName));
+	TEST_CHECK(cached(cache, "ACDE") == "-CDE", "a held keyframe is pinned: " + cached(cache, "ACDE"));
+	held = nullptr;
+	cache.Insert("F", keyFrame(fileName));
+	TEST_CHECK(cached(cache, "CDEF") == "-DEF", "a keyframe let go is released: " + cached(cache, "CDEF"));
+	TEST_CHECK(cache.GetStats().evictions - evicted == 3, "three keyframes were released");
+
+	//Every keyframe held: the budget is exceeded rather than releasing any.
+	std::vector<std::shared_ptr<const KFBData>> all {cache.Find("D"), cache.Find("E"), cache.Find("F")};
+	cache.Insert("G", keyFrame(fileName));
+	TEST_CHECK(cached(cache, "DEFG") == "DEFG" && cache.GetStats().usedBytes == size * 4, "pinned keyframes are kept over budget");
+	all.clear();
+
+	//An instance's cached images take the room of two keyframes.
+	const int instance = 0;
+	cache.SetHeldBytes(&instance, size * 2);
+	auto stats = cache.GetStats();
+	TEST_CHECK(stats.heldBytes == size * 2 && stats.entries == 1 && stats.usedBytes == size * 3 && cached(cache, "G") == "G", "held memory releases the oldest keyframes: " + cached(cache, "DEFG"));
+	cache.SetHeldBytes(&instance, 0);
+	TEST_CHECK(cache.GetStats().heldBytes == 0 && cache.GetStats().usedBytes == size, "held memory is given back");
+
+	//Built data and mapped files count too.
+	{
+		auto data = std::make_shared<KFBData>(width, height);
+		data->ReadKFBFile(fileName);
+		data->PrepareMipLevel(2);
+		TEST_CHECK(data->memoryUsage() >= size + sizeof(double) * (width / 2) * (height / 2), "mip levels are counted");
+
+		auto mapped = std::make_shared<KFBData>(width, height, KFBStorage::mapped);
+		mapped->ReadKFBFile(fileName);
+		TEST_CHECK(mapped->memoryUsage() == std::filesystem::file_size(fileName), "a mapped keyframe counts its file");
+		cache.Insert("M", mapped);
+		TEST_CHECK(cache.GetStats().usedBytes == size + std::filesystem::file_size(fileName), "the cache counts a mapped keyframe");
+	}
+
+	cache.Clear();
+	std::filesystem::remove(fileName);
+	return TestResult();
+}
@@ -0,0 +1,137 @@
+/********************************************************************************************
+CompactTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Compact storage must sample the same values as standard storage, for a keyframe with a deep
+range of iterations (from about 1e3 up to 1e7, where a float can't hold the smooth value).
+Checked for whole pixels, bicubic samples and the bicubic spans (at every SIMD level), read
+from the .kfb and from a .kfbc sidecar.
+The tiles next to the set are too deep for 16 bit iterations, so both kinds of tile are checked
+(see KFBData::packCompact), and compact storage must still take about half the memory.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "KFBSpan.h"
+#include "OS.h"
+#include "WorkerPool.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <random>
+
+//The padding is extrapolated in doubles and stored as a float raw value, so samples that reach into it
+//can differ by float rounding of the difference between the smooth value and its iteration.
+constexpr double paddingTolerance = 1e-5;
+
+/*******************************************************************************************************
+Compare every way of sampling a compact keyframe with a standard one.
+*******************************************************************************************************/
+static void compare(const KFBData & standard, const KFBData & compact, const std::string & source) {
+	const long width = standard.getWidth();
+	const long height = standard.getHeight();
+
+	//Whole pixels are exactly the kfb's values.
+	long pixelErrors = 0;
+	for(long y = 0; y < height - 2; y++) {
+		for(long x = 0; x < width - 2; x++) {
+			if(standard.getIterationCountSmooth(x, y) != compact.getIterationCountSmooth(x, y) || standard.getIterationCount(x, y) != compact.getIterationCount(x, y)) pixelErrors++;
+		}
+	}
+	TEST_CHECK(pixelErrors == 0, source + ": " + std::to_string(pixelErrors) + " pixels differ");
+
+	//Bicubic samples, including the padding.
+	std::mt19937 random(7);
+	std::uniform_real_distribution<double> xs(-1.5, width - 0.5);
+	std::uniform_real_distribution<double> ys(-1.5, height - 0.5);
+	double largest = 0;
+	for(int i = 0; i < 200000; i++) {
+		const double x = xs(random);
+		const double y = ys(random);
+		largest = std::max(largest, std::abs(standard.calculateIterationCountBiCubic(x, y) - compact.calculateIterationCountBiCubic(x, y)));
+	}
+	TEST_CHECK(largest <= paddingTolerance, source + ": bicubic samples differ by " + std::to_string(largest));
+
+	//Spans of a row at every SIMD level.
+	std::vector<float> spanX(width);
+	std::vector<double> expected(width);
+	std::vector<double> actual(width);
+	for(long x = 0; x < width; x++) spanX[x] = static_cast<float>(x * 0.999 + 0.25);
+	for(int level = 0; level <= static_cast<int>(DetectSIMDLevel()); level++) {
+		SetKFBSpanLevel(static_cast<SIMDLevel>(level));
+		largest = 0;
+		for(long y = 0; y < height; y += 7) {
+			const double spanY = y + 0.375;
+			standard.calculateIterationCountBiCubicSpan(spanX.data(), width, spanY, expected.data());
+			compact.calculateIterationCountBiCubicSpan(spanX.data(), width, spanY, actual.data());
+			largest = std::max(largest, MaxDifference(expected.data(), actual.data(), width));
+		}
+		TEST_CHECK(largest <= paddingTolerance, source + ": spans at SIMD level " + std::to_string(level) + " differ by " + std::to_string(largest));
+	}
+	SetKFBSpanLevel(DetectSIMDLevel());
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+
+	const int width = 1283, height = 721;
+	const auto keyframe = MakeTestKFB(width, height, 1000, 10000000, 0.3);
+	const auto fileName = TestFileName("compact.kfb");
+	WriteTestKFB(fileName, keyframe);
+
+	KFBData standard(width, height);
+	standard.ReadKFBFile(fileName, &pool);
+	KFBData compact(width, height, KFBStorage::compact);
+	compact.ReadKFBFile(fileName, &pool);
+	compare(standard, compact, "kfb");
+	std::printf("Memory for %dx%d: standard %.1f MB, compact %.1f MB\n", width, height, standard.memoryUsage() / 1e6, compact.memoryUsage() / 1e6);
+	const size_t cells = static_cast<size_t>(width + 4) * (height + 4);
+	TEST_CHECK(compact.memoryUsage() > cells * (sizeof(float) + sizeof(uint16_t)) + cells / 16, "some tiles keep their iterations as they are");
+	TEST_CHECK(compact.memoryUsage() * 100 <= standard.memoryUsage() * 55, "compact storage takes about half the memory");
+
+	//A shallow keyframe has no deep tiles.
+	{
+		const auto shallow = MakeTestKFB(width, height, 1000, 20000, 0.3, 3);
+		WriteTestKFB(fileName, shallow);
+		KFBData shallowStandard(width, height);
+		shallowStandard.ReadKFBFile(fileName, &pool);
+		KFBData shallowCompact(width, height, KFBStorage::compact);
+		shallowCompact.ReadKFBFile(fileName, &pool);
+		TEST_CHECK(shallowCompact.memoryUsage() < cells * (sizeof(float) + sizeof(uint16_t)) + cells / 16, "a shallow keyframe has no deep tiles");
+		compare(shallowStandard, shallowCompact, "shallow kfb");
+		WriteTestKFB(fileName, keyframe);
+	}
+
+	//From a sidecar (made from the standard keyframe).
+	standard.WriteSidecar(fileName);
+	KFBData fromSidecar(width, height, KFBStorage::compact);
+	TEST_CHECK(fromSidecar.ReadSidecar(fileName), "the sidecar is read");
+	compare(standard, fromSidecar, "sidecar");
+
+	//Span speed of each storage.
+	std::vector<float> spanX(width);
+	std::vector<double> out(width);
+	for(long x = 0; x < width; x++) spanX[x] = static_cast<float>(x * 0.999 + 0.25);
+	for(auto * kfb : {&standard, &compact}) {
+		const double seconds = TimeBest(5, [&] {
+			for(long y = 0; y < height - 1; y++) kfb->calculateIterationCountBiCubicSpan(spanX.data(), width, y + 0.375, out.data());
+		});
+		std::printf("Bicubic spans, %s: %.2f ns per sample\n", (kfb == &standard) ? "standard" : "compact", seconds * 1e9 / (static_cast<double>(width) * (height - 1)));
+	}
+
+	std::filesystem::remove(fileName);
+	std::filesystem::remove(KFBSidecarFileName(fileName));
+	return TestResult();
+}
@@ -0,0 +1,233 @@
+/********************************************************************************************
+CompositeTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Cached images are composited straight into the output (see ZoomComposite.h).  This compares a
+frame of a zone plate against the ideal (the zone plate averaged over each output pixel) for the
+compositor and for the three pass path it replaced: the active and next images drawn onto a
+buffer twice the output size with bicubic samples, then the buffer reduced by half.  AE's
+transform_world can't run here, so the old path is emulated (Catmull-Rom samples, and a 2x2
+average for the reduction).
+The keyframes are the zone plate averaged over each of their pixels, the next one zoomed in twice
+as far (so it has twice the detail).  The compositor must be at least as close to the ideal as the
+old path, at every depth and blend.  Also with the next keyframe fully opaque near the start of a
+blend, shrunk to about half (nextZoomScale near 0.5), measured in the middle of the frame where it
+covers.  Prints the PSNR and ns per output pixel of each.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+#include "ZoomComposite.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <type_traits>
+
+constexpr int width = 960, height = 540;
+constexpr double centreX = width / 2.0, centreY = height / 2.0;
+constexpr int subSamples = 4;			//Per axis, when averaging the zone plate over a pixel
+constexpr double roundingDB = 0.001;	//At exactly half size both paths are the same filter, so only differ by rounding
+
+//The zone plate, at a location in the active keyframe.  Half a cycle per pixel at the sides.
+static double zonePlate(double x, double y) {
+	const double k = 3.14159265358979323846 / width;
+	const double dx = x - centreX, dy = y - centreY;
+	return 0.5 + 0.5 * std::cos(k * (dx * dx + dy * dy));
+}
+
+//The zone plate averaged over the square centred on (x, y), size across (active keyframe pixels).
+static double averaged(double x, double y, double size) {
+	double total = 0;
+	for(int j = 0; j < subSamples; j++) {
+		for(int i = 0; i < subSamples; i++) total += zonePlate(x + ((i + 0.5) / subSamples - 0.5) * size, y + ((j + 0.5) / subSamples - 0.5) * size);
+	}
+	return total / (subSamples * subSamples);
+}
+
+/*******************************************************************************************************
+An image of the zone plate zoomed by zoom about the centre (pixel centres are whole numbers), each
+pixel the average over it.
+*******************************************************************************************************/
+static std::vector<float> zoneImage(double zoom) {
+	std::vector<float> values(static_cast<size_t>(width) * height);
+	for(int y = 0; y < height; y++) {
+		for(int x = 0; x < width; x++) values[static_cast<size_t>(y) * width + x] = static_cast<float>(averaged((x - centreX) / zoom + centreX, (y - centreY) / zoom + centreY, 1 / zoom));
+	}
+	return values;
+}
+
+//Channel values of each depth.
+static float white(PF_Pixel8 *) {return white8;}
+static float white(PF_Pixel16 *) {return white16;}
+static float white(PF_Pixel32 *) {return white32;}
+
+template <class PixelT>
+static PixelT makePixel(const float * c) {
+	const float w = white(static_cast<PixelT*>(nullptr));
+	PixelT p;
+	if constexpr(std::is_same_v<PixelT, PF_Pixel32>) {
+		p = {c[0], c[1], c[2], c[3]};
+	}
+	else {
+		using Channel = decltype(p.red);
+		auto q = [w](float v) {return static_cast<Channel>(std::lround(std::clamp(v, 0.0f, w)));};
+		p = {q(c[0]), q(c[1]), q(c[2]), q(c[3])};
+	}
+	return p;
+}
+
+template <class PixelT>
+static void toFrame(const std::vector<float> & values, TestFrame<PixelT> & frame) {
+	const float w = white(static_cast<PixelT*>(nullptr));
+	for(size_t i = 0; i < values.size(); i++) {
+		const float c[4] {w, values[i] * w, values[i] * w, values[i] * w};
+		frame.pixels[i] = makePixel<PixelT>(c);
+	}
+}
+
+/*******************************************************************************************************
+The emulated three pass path: both layers drawn onto a buffer twice the size (quantised to the
+depth, like the buffer was), then each output pixel the average of its 2x2 buffer pixels.
+*******************************************************************************************************/
+template <class PixelT>
+static void bicubicSample(const TestFrame<PixelT> & image, double u, double v, float * c) {
+	const A_long w = image.world.width, h = image.world.height;
+	c[0] = c[1] = c[2] = c[3] = 0;
+	if(u < -0.5 || v < -0.5 || u > w - 0.5 || v > h - 0.5) return;
+	auto weight = [](double t) {
+		t = std::abs(t);
+		if(t < 1) return (1.5 * t - 2.5) * t * t + 1;
+		if(t < 2) return ((-0.5 * t + 2.5) * t - 4) * t + 2;
+		return 0.0;
+	};
+	const long x0 = static_cast<long>(std::floor(u)) - 1, y0 = static_cast<long>(std::floor(v)) - 1;
+	for(long j = y0; j < y0 + 4; j++) {
+		const double wy = weight(j - v);
+		for(long i = x0; i < x0 + 4; i++) {
+			const float wxy = static_cast<float>(weight(i - u) * wy);
+			const auto & p = image.pixels[static_cast<size_t>(std::clamp<long>(j, 0, h - 1)) * w + std::clamp<long>(i, 0, w - 1)];
+			c[0] += wxy * p.alpha;
+			c[1] += wxy * p.red;
+			c[2] += wxy * p.green;
+			c[3] += wxy * p.blue;
+		}
+	}
+}
+
+template <class PixelT>
+static void oldComposite(const TestFrame<PixelT> & active, const TestFrame<PixelT> & next, double zoom, double opacity, TestFrame<PixelT> & output) {
+	const float w = white(static_cast<PixelT*>(nullptr));
+	std::vector<PixelT> buffer(static_cast<size_t>(width) * height * 4);
+	for(A_long by = 0; by < height * 2; by++) {
+		for(A_long bx = 0; bx < width * 2; bx++) {
+			//The buffer pixel's centre, in output pixels.
+			const double ox = bx / 2.0 - 0.25, oy = by / 2.0 - 0.25;
+			float c[4], n[4];
+			bicubicSample(active, (ox - centreX) / zoom + centreX, (oy - centreY) / zoom + centreY, c);
+			bicubicSample(next, (ox - centreX) / (zoom / 2) + centreX, (oy - centreY) / (zoom / 2) + centreY, n);
+			const float a = static_cast<float>(opacity);
+			const float below = 1 - std::clamp(a * n[0] / w, 0.0f, 1.0f);
+			for(int i = 0; i < 4; i++) c[i] = a * n[i] + below * c[i];
+			buffer[static_cast<size_t>(by) * width * 2 + bx] = makePixel<PixelT>(c);
+		}
+	}
+	for(A_long y = 0; y < height; y++) {
+		for(A_long x = 0; x < width; x++) {
+			float c[4] {};
+			for(int j = 0; j < 2; j++) {
+				for(int i = 0; i < 2; i++) {
+					const auto & p = buffer[static_cast<size_t>(2 * y + j) * width * 2 + 2 * x + i];
+					c[0] += p.alpha / 4.0f;
+					c[1] += p.red / 4.0f;
+					c[2] += p.green / 4.0f;
+					c[3] += p.blue / 4.0f;
+				}
+			}
+			output.pixels[static_cast<size_t>(y) * width + x] = makePixel<PixelT>(c);
+		}
+	}
+}
+
+template <class PixelT>
+static void newComposite(const TestFrame<PixelT> & active, const TestFrame<PixelT> & next, double zoom, double opacity, TestFrame<PixelT> & output, WorkerPool & pool) {
+	ZoomComposite composite;
+	composite.layers.resize(2);
+	PlanZoomCompositeLayer(composite.layers[0], &active.world, 1.0, zoom, 1.0, centreX, centreY, width, height);
+	PlanZoomCompositeLayer(composite.layers[1], &next.world, opacity, zoom / 2, 1.0, centreX, centreY, width, height);
+	ZoomCompositeTiles<PixelT>(composite, &output.world, pool, WorkPriority::render);
+}
+
+//PSNR (dB) of the colour channels against the ideal (0 to 1), over the middle "part" of the frame (across and down).
+template <class PixelT>
+static double psnr(const TestFrame<PixelT> & frame, const std::vector<float> & ideal, double part = 1) {
+	const double w = white(static_cast<PixelT*>(nullptr));
+	double total = 0;
+	long count = 0;
+	for(int y = 0; y < height; y++) {
+		if(std::abs(y - centreY) > part * height / 2) continue;
+		for(int x = 0; x < width; x++) {
+			if(std::abs(x - centreX) > part * width / 2) continue;
+			const size_t i = static_cast<size_t>(y) * width + x;
+			for(double c : {static_cast<double>(frame.pixels[i].red), static_cast<double>(frame.pixels[i].green), static_cast<double>(frame.pixels[i].blue)}) {
+				const double e = c / w - ideal[i];
+				total += e * e;
+			}
+			count++;
+		}
+	}
+	return 10 * std::log10(1 / (total / (3.0 * count)));
+}
+
+//The active keyframe zoomed by 2^percent, and the next one over it (at half that) with opacity.
+//Measured over the middle "part" of the frame.
+template <class PixelT>
+static void compare(const std::vector<float> & activeValues, const std::vector<float> & nextValues, const std::vector<float> & ideal, double percent, double opacity, double part, int depth, WorkerPool & pool) {
+	const double zoom = std::pow(2.0, percent);
+	TestFrame<PixelT> active(width, height), next(width, height), before(width, height), after(width, height);
+	toFrame(activeValues, active);
+	toFrame(nextValues, next);
+	const double oldSeconds = TimeBest(1, [&] {oldComposite(active, next, zoom, opacity, before);});
+	const double newSeconds = TimeBest(3, [&] {newComposite(active, next, zoom, opacity, after, pool);});
+	const double oldPSNR = psnr(before, ideal, part);
+	const double newPSNR = psnr(after, ideal, part);
+	TEST_CHECK(newPSNR >= oldPSNR - roundingDB, std::to_string(depth) + "-bit blend " + std::to_string(percent) + " (opacity " + std::to_string(opacity) + "): the compositor is further from the ideal (" + std::to_string(newPSNR) + " dB) than the old path (" + std::to_string(oldPSNR) + " dB)");
+	std::printf("%2d-bit, blend %4.2f (zoom %4.2f, opacity %4.2f):   %5.1f %7.1f   %5.1f %7.1f\n", depth, percent, zoom, opacity, oldPSNR, oldSeconds * 1e9 / (width * height), newPSNR, newSeconds * 1e9 / (width * height));
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(1);
+	const auto activeValues = zoneImage(1);
+	const auto nextValues = zoneImage(2);
+
+	std::printf("%dx%d zone plate                                 old path          compositor\n", width, height);
+	std::printf("                                                  dB    ns/px      dB    ns/px\n");
+	for(double percent : {0.05, 0.35, 0.65, 0.95}) {
+		//The ideal frame: the zone plate averaged over each output pixel.
+		const auto ideal = zoneImage(std::pow(2.0, percent));
+		compare<PF_Pixel8>(activeValues, nextValues, ideal, percent, percent, 1.0, 8, pool);
+		compare<PF_Pixel16>(activeValues, nextValues, ideal, percent, percent, 1.0, 16, pool);
+		compare<PF_Pixel32>(activeValues, nextValues, ideal, percent, percent, 1.0, 32, pool);
+	}
+
+	//Zooming out: the next keyframe opaque and shrunk to about half, measured inside the middle half it covers
+	//(away from its edge, which blends with the active keyframe).
+	for(double percent : {0.0, 0.03, 0.1}) {
+		const auto ideal = zoneImage(std::pow(2.0, percent));
+		compare<PF_Pixel8>(activeValues, nextValues, ideal, percent, 1.0, 0.45, 8, pool);
+		compare<PF_Pixel16>(activeValues, nextValues, ideal, percent, 1.0, 0.45, 16, pool);
+		compare<PF_Pixel32>(activeValues, nextValues, ideal, percent, 1.0, 0.45, 32, pool);
+	}
+	return TestResult();
+}
@@ -0,0 +1,164 @@
+/********************************************************************************************
+FrameTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Sample locations are looked up from per-frame column and row tables (see PrepareFrameCoordinates).
+The tables and the intra-frame step must give exactly what each pixel used to calculate for itself,
+and the distance matrices sampled with them must be unchanged, for several zooms and downsampled
+renders.  Prints ns per pixel of the distance matrices both ways.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+constexpr int width = 960, height = 540;
+
+/*******************************************************************************************************
+The per-pixel calculations the tables replaced.
+*******************************************************************************************************/
+static void pixelLocation(const LocalSequenceData * local, A_long x, A_long y, double zoomScale, double & xLocation, double & yLocation) {
+	const double halfWidth = static_cast<double>(local->width) / 2;
+	const double halfHeight = static_cast<double>(local->height) / 2;
+	const double xCentre = (x * local->scaleFactorX) - halfWidth;
+	const double yCentre = (y * local->scaleFactorY) - halfHeight;
+	xLocation = xCentre / zoomScale + halfWidth;
+	yLocation = yCentre / zoomScale + halfHeight;
+}
+
+static double pixelIntraStep(const LocalSequenceData * local, double xf, double yf) {
+	const double distanceToEdgeX = std::min(xf, local->width - xf);
+	const double distanceToEdgeY = std::min(yf, local->height - yf);
+	const double percentX = (distanceToEdgeX / static_cast<double>(local->width / 4));
+	const double percentY = (distanceToEdgeY / static_cast<double>(local->height / 4));
+	const double percent = std::min(percentX, percentY);
+	return std::exp(-std::log(2.0f)*percent);		//Assumes zoom size 2
+}
+
+static void pixelDistanceIntraFrame(double p[][3], A_long x, A_long y, const LocalSequenceData * local) {
+	double xLocation, yLocation;
+	pixelLocation(local, x, y, local->activeZoomScale, xLocation, yLocation);
+	local->activeKFB->getDistanceMatrix(p, xLocation, yLocation, pixelIntraStep(local, xLocation, yLocation));
+}
+
+static void pixelBlendedDistanceMatrix(double matrix[][3], const LocalSequenceData * local, A_long x, A_long y) {
+	double xLocation, yLocation;
+	pixelLocation(local, x, y, local->activeZoomScale, xLocation, yLocation);
+	local->activeKFB->getDistanceMatrix(matrix, xLocation, yLocation, 1 / local->activeZoomScale);
+	if(!(local->nextFrameKFB && local->keyFramePercent > 0.01 && local->nextZoomScale > 0)) return;
+
+	pixelLocation(local, x, y, local->nextZoomScale, xLocation, yLocation);
+	if(!(xLocation >= 1 && yLocation >= 1 && xLocation <= local->width - 2 && yLocation <= local->height - 2)) return;
+	double next[3][3];
+	local->nextFrameKFB->getDistanceMatrix(next, xLocation, yLocation, 1 / local->nextZoomScale);
+	const float mixWeight = static_cast<float>(local->keyFramePercent);
+	for(int i = 0; i < 3; i++) for(int j = 0; j < 3; j++) {
+		matrix[i][j] = (1 - mixWeight) * matrix[i][j] + next[i][j] * mixWeight;
+	}
+}
+
+/*******************************************************************************************************
+Every pixel's matrices, from the tables and per pixel.  Returns the number that differ.
+*******************************************************************************************************/
+template <typename Table, typename Pixel>
+static long compareMatrices(const LocalSequenceData * local, A_long outWidth, A_long outHeight, Table table, Pixel pixel) {
+	long errors = 0;
+	for(A_long y = 0; y < outHeight; y++) {
+		for(A_long x = 0; x < outWidth; x++) {
+			double a[3][3], b[3][3];
+			table(a, x, y);
+			pixel(b, x, y);
+			if(std::memcmp(a, b, sizeof(a)) != 0) errors++;
+		}
+	}
+	return errors;
+}
+
+template <typename Matrix>
+static double timeMatrices(A_long outWidth, A_long outHeight, Matrix matrix) {
+	double total = 0;
+	const double seconds = TimeBest(3, [&] {
+		for(A_long y = 0; y < outHeight; y++) {
+			for(A_long x = 0; x < outWidth; x++) {
+				double p[3][3];
+				matrix(p, x, y);
+				total += p[0][1];
+			}
+		}
+	});
+	KeepResult(total);
+	return seconds * 1e9 / (static_cast<double>(outWidth) * outHeight);
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(1);
+	const auto activeFile = TestFileName("active.kfb");
+	const auto nextFile = TestFileName("next.kfb");
+	WriteTestKFB(activeFile, MakeTestKFB(width, height, 1000, 100000, 0.2, 1));
+	WriteTestKFB(nextFile, MakeTestKFB(width, height, 3000, 100000, 0.3, 2));
+	auto active = std::make_shared<KFBData>(width, height);
+	active->ReadKFBFile(activeFile, &pool);
+	auto next = std::make_shared<KFBData>(width, height);
+	next->ReadKFBFile(nextFile, &pool);
+	auto local = MakeTestSequence(active, next);
+
+	std::printf("ns per pixel                               intra-frame        blended\n");
+	std::printf("                                        per pixel  table  per pixel  table\n");
+	for(double scaleFactor : {1.0, 2.0, 1.5}) {
+		for(double zoom : {1.37, 1.0, 1.93}) {
+			local->scaleFactorX = local->scaleFactorY = scaleFactor;
+			local->activeZoomScale = zoom;
+			local->nextZoomScale = zoom / 2;
+			const A_long outWidth = static_cast<A_long>(width / scaleFactor);
+			const A_long outHeight = static_cast<A_long>(height / scaleFactor);
+			PrepareFrameCoordinates(local.get(), outWidth, outHeight);
+			const auto & frame = local->frameCoordinates;
+			const std::string name = "scale " + std::to_string(scaleFactor) + " zoom " + std::to_string(zoom);
+
+			long locationErrors = 0, stepErrors = 0;
+			for(A_long y = 0; y < outHeight; y++) {
+				for(A_long x = 0; x < outWidth; x++) {
+					double xLocation, yLocation, xNext, yNext;
+					pixelLocation(local.get(), x, y, local->activeZoomScale, xLocation, yLocation);
+					pixelLocation(local.get(), x, y, local->nextZoomScale, xNext, yNext);
+					if(frame.activeX[x] != xLocation || frame.activeY[y] != yLocation || frame.nextX[x] != xNext || frame.nextY[y] != yNext) locationErrors++;
+					if(std::max(frame.intraStepX[x], frame.intraStepY[y]) != pixelIntraStep(local.get(), xLocation, yLocation)) stepErrors++;
+				}
+			}
+			TEST_CHECK(locationErrors == 0, name + ": " + std::to_string(locationErrors) + " locations differ");
+			TEST_CHECK(stepErrors == 0, name + ": " + std::to_string(stepErrors) + " intra-frame steps differ");
+
+			auto intraTable = [&](double p[][3], A_long x, A_long y) {getDistanceIntraFrame(p, x, y, local.get());};
+			auto intraPixel = [&](double p[][3], A_long x, A_long y) {pixelDistanceIntraFrame(p, x, y, local.get());};
+			auto blendedTable = [&](double p[][3], A_long x, A_long y) {GetBlendedDistanceMatrix(p, local.get(), x, y);};
+			auto blendedPixel = [&](double p[][3], A_long x, A_long y) {pixelBlendedDistanceMatrix(p, local.get(), x, y);};
+			const long intraErrors = compareMatrices(local.get(), outWidth, outHeight, intraTable, intraPixel);
+			const long blendedErrors = compareMatrices(local.get(), outWidth, outHeight, blendedTable, blendedPixel);
+			TEST_CHECK(intraErrors == 0, name + ": " + std::to_string(intraErrors) + " intra-frame matrices differ");
+			TEST_CHECK(blendedErrors == 0, name + ": " + std::to_string(blendedErrors) + " blended matrices differ");
+
+			std::printf("Scale %3.1f, zoom %4.2f (%4dx%3d):       %7.1f %7.1f   %7.1f %7.1f\n", scaleFactor, zoom, outWidth, outHeight,
+				timeMatrices(outWidth, outHeight, intraPixel), timeMatrices(outWidth, outHeight, intraTable),
+				timeMatrices(outWidth, outHeight, blendedPixel), timeMatrices(outWidth, outHeight, blendedTable));
+		}
+	}
+
+	std::filesystem::remove(activeFile);
+	std::filesystem::remove(nextFile);
+	return TestResult();
+}
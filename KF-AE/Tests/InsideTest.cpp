@@ -0,0 +1,107 @@
+/********************************************************************************************
+InsideTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Runs of pixels certainly inside the set aren't sampled (see KFBData::PrepareInsideMask and
+SpanInside).  Skipping them must never change a pixel: every method, with and without slopes, at
+8, 16 and 32 bits, renders exactly the same with the inside masks as with keyframes that have none.
+Scenes with nothing inside, partly inside and almost all inside.
+Prints ms per frame of each method without and with the masks (8-bit).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+
+#include <cstdio>
+#include <filesystem>
+
+constexpr int width = 640, height = 360;
+
+struct Scene {
+	const char * name;
+	double inside;			//Size of the set in the keyframes (see MakeTestKFB)
+	double zoom;			//Of the active keyframe (the next is at half)
+};
+
+static std::shared_ptr<const KFBData> readKeyframe(const std::string & fileName, WorkerPool & pool) {
+	auto kfb = std::make_shared<KFBData>(width, height);
+	kfb->ReadKFBFile(fileName, &pool);
+	return kfb;
+}
+
+/*******************************************************************************************************
+Frames with and without the masks are the same.
+*******************************************************************************************************/
+template <class PixelT>
+static void compare(LocalSequenceData * masked, LocalSequenceData * unmasked, WorkerPool & pool, const std::string & name) {
+	TestFrame<PixelT> a(width, height), b(width, height);
+	RenderTestFrame(masked, a, pool);
+	RenderTestFrame(unmasked, b, pool);
+	const long differences = a.differences(b);
+	TEST_CHECK(differences == 0, name + ": " + std::to_string(differences) + " pixels differ with the inside masks");
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(1);
+	const auto activeFile = TestFileName("active.kfb");
+	const auto nextFile = TestFileName("next.kfb");
+
+	for(const Scene & scene : {Scene {"nothing inside", 0, 1.37}, Scene {"partly inside", 0.6, 1.37}, Scene {"almost all inside", 1.6, 2.5}}) {
+		WriteTestKFB(activeFile, MakeTestKFB(width, height, 1000, 100000, scene.inside, 1));
+		WriteTestKFB(nextFile, MakeTestKFB(width, height, 3000, 100000, scene.inside, 2));
+
+		//The same keyframes twice, one pair never gets its inside masks.
+		auto masked = MakeTestSequence(readKeyframe(activeFile, pool), readKeyframe(nextFile, pool));
+		auto unmasked = MakeTestSequence(readKeyframe(activeFile, pool), readKeyframe(nextFile, pool));
+		for(auto * local : {masked.get(), unmasked.get()}) {
+			local->activeZoomScale = scene.zoom;
+			local->nextZoomScale = scene.zoom / 2;
+		}
+		PrepareTestRender(masked.get(), width, height);
+		PrepareTestRender(unmasked.get(), width, height, false);
+		TEST_CHECK(masked->activeKFB->getInsideMask() && !unmasked->activeKFB->getInsideMask(), std::string(scene.name) + ": only one pair has masks");
+
+		long skipped = 0;
+		for(A_long y = 0; y < height; y++) {
+			for(A_long x = 0; x < width; x += insideSpanRun) {
+				const A_long count = std::min<A_long>(insideSpanRun, width - x);
+				if(SpanInside(masked.get(), x, y, count)) skipped += count;
+				TEST_CHECK(!SpanInside(unmasked.get(), x, y, count), std::string(scene.name) + ": runs are only skipped with a mask");
+			}
+		}
+		std::printf("%s (%.0f%% of pixels skipped), ms per %dx%d frame (8-bit)   no mask    mask\n", scene.name, 100.0 * skipped / (width * height), width, height);
+		for(const auto & method : testMethods) {
+			for(bool slopes : {false, true}) {
+				for(auto * local : {masked.get(), unmasked.get()}) {
+					local->method = method.method;
+					local->slopesEnabled = slopes;
+				}
+				const std::string name = std::string(scene.name) + " " + method.name + (slopes ? " slopes" : "");
+				compare<PF_Pixel8>(masked.get(), unmasked.get(), pool, name + " 8-bit");
+				compare<PF_Pixel16>(masked.get(), unmasked.get(), pool, name + " 16-bit");
+				compare<PF_Pixel32>(masked.get(), unmasked.get(), pool, name + " 32-bit");
+				if(slopes) continue;
+
+				TestFrame<PF_Pixel8> frame(width, height);
+				const double without = TimeBest(3, [&] {RenderTestFrame(unmasked.get(), frame, pool);});
+				const double with = TimeBest(3, [&] {RenderTestFrame(masked.get(), frame, pool);});
+				std::printf("%-16s                              %7.2f %7.2f\n", method.name, without * 1e3, with * 1e3);
+			}
+		}
+	}
+
+	std::filesystem::remove(activeFile);
+	std::filesystem::remove(nextFile);
+	return TestResult();
+}
@@ -0,0 +1,148 @@
+/********************************************************************************************
+LoaderTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Loading keyframes on demand and ahead (see KFBLoader).  Each keyframe is decoded once however it
+is asked for (counted by the shared cache's misses, as every load looks there first):
+ - Keyframes prefetched twice, then loaded by several threads at once.
+ - A render asking for a keyframe queued behind others loads it straight away, rather than waiting
+   for the queue.
+ - Cancelled (and no longer wanted) prefetches are not loaded, and can still be loaded on demand.
+Every keyframe loaded must match its file.
+Also checks the pool takes a render's decode jobs (WorkPriority::load) before those of loads ahead.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBLoader.h"
+
+#include <chrono>
+#include <filesystem>
+#include <thread>
+
+constexpr int width = 1280, height = 720;
+constexpr int keyFrames = 6;
+
+static std::vector<TestKFB> expected;
+
+static bool matches(const std::shared_ptr<const KFBData> & data, long keyFrame) {
+	return TEST_CHECK(data && MatchesTestKFB(*data, expected[keyFrame]), "keyframe " + std::to_string(keyFrame) + " matches its file");
+}
+
+//Waits (up to a minute) until the cache holds "count" keyframes.
+static bool waitForEntries(size_t count) {
+	const auto started = std::chrono::steady_clock::now();
+	while(KFBCache::Shared().GetStats().entries < count) {
+		if(std::chrono::steady_clock::now() - started > std::chrono::seconds(60)) return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	return true;
+}
+
+static void checkDedupe(KFBLoader & loader) {
+	KFBCache::Shared().Clear();
+	const auto before = KFBCache::Shared().GetStats().misses;
+	loader.Prefetch({0, 1, 2});
+	loader.Prefetch({0, 1, 2});
+
+	std::vector<std::shared_ptr<const KFBData>> loaded(4 * 3);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < 4; t++) {
+		threads.emplace_back([&, t] {
+			UseTestAE();
+			for(long k = 0; k < 3; k++) loaded[t * 3 + k] = loader.Load(k);
+		});
+	}
+	for(auto & thread : threads) thread.join();
+	for(long k = 0; k < 3; k++) {
+		matches(loaded[k], k);
+		for(int t = 1; t < 4; t++) TEST_CHECK(loaded[t * 3 + k] == loaded[k], "every thread gets the same copy of keyframe " + std::to_string(k));
+	}
+	TEST_CHECK(KFBCache::Shared().GetStats().misses - before == 3, std::to_string(KFBCache::Shared().GetStats().misses - before) + " decodes of 3 keyframes");
+}
+
+static void checkDemandDuringPrefetch(KFBLoader & loader) {
+	KFBCache::Shared().Clear();
+	const auto before = KFBCache::Shared().GetStats().misses;
+	std::vector<long> all;
+	for(long k = 0; k < keyFrames; k++) all.push_back(k);
+	loader.Prefetch(all);
+	const auto last = loader.Load(keyFrames - 1);
+	const auto decoded = KFBCache::Shared().GetStats().misses - before;
+	matches(last, keyFrames - 1);
+	TEST_CHECK(decoded < keyFrames, "the last keyframe queued was loaded without waiting for the queue");
+
+	//The rest of the queue is still loaded ahead, once each.
+	TEST_CHECK(waitForEntries(keyFrames), "the rest of the queue is loaded");
+	for(long k = 0; k < keyFrames; k++) matches(loader.Load(k), k);
+	TEST_CHECK(KFBCache::Shared().GetStats().misses - before == keyFrames, "each keyframe is decoded once");
+}
+
+static void checkCancel(KFBLoader & loader) {
+	KFBCache::Shared().Clear();
+	const auto before = KFBCache::Shared().GetStats().misses;
+	loader.Prefetch({0, 1, 2, 3, 4, 5});
+	loader.Prefetch({5});
+	loader.Cancel();
+
+	//Loads already started finish, nothing else is loaded.
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	const auto started = KFBCache::Shared().GetStats().misses - before;
+	TEST_CHECK(started <= kfbLoaderThreads, std::to_string(started) + " cancelled keyframes were loaded");
+	std::this_thread::sleep_for(std::chrono::milliseconds(500));
+	TEST_CHECK(KFBCache::Shared().GetStats().misses - before == started, "nothing more is loaded after cancelling");
+
+	for(long k = 0; k < keyFrames; k++) matches(loader.Load(k), k);
+}
+
+//With the only worker busy, a decode job for a load ahead is queued before one a render is waiting for.
+static void checkPriority() {
+	WorkerPool pool(1);
+	std::mutex lock;
+	std::vector<WorkPriority> order;
+	std::promise<void> release;
+	auto busy = pool.Submit([gate = release.get_future().share()] {gate.wait();}, WorkPriority::render);
+	auto ahead = pool.Submit([&] {std::lock_guard<std::mutex> l(lock); order.push_back(WorkPriority::decode);}, WorkPriority::decode);
+	auto demand = pool.Submit([&] {std::lock_guard<std::mutex> l(lock); order.push_back(WorkPriority::load);}, WorkPriority::load);
+	std::this_thread::sleep_for(std::chrono::milliseconds(50));
+	release.set_value();
+	busy.wait();
+	ahead.wait();
+	demand.wait();
+	TEST_CHECK(order.size() == 2 && order[0] == WorkPriority::load, "a render's decode jobs run before those of loads ahead");
+}
+
+int main() {
+	UseTestAE();
+	std::vector<std::string> files, keys;
+	for(int k = 0; k < keyFrames; k++) {
+		expected.push_back(MakeTestKFB(width, height, 1000 + k * 100, 100000, 0.2, k + 1));
+		files.push_back(TestFileName("loader" + std::to_string(k) + ".kfb"));
+		keys.push_back(files.back());
+		WriteTestKFB(files.back(), expected.back());
+	}
+	KFBCache::Shared().SetBudget(size_t(1) << 34);
+
+	{
+		KFBLoader loader;
+		loader.SetSequence(files, keys, width, height, KFBStorage::standard);
+		checkDedupe(loader);
+		checkDemandDuringPrefetch(loader);
+		checkCancel(loader);
+	}
+	checkPriority();
+
+	KFBCache::Shared().Clear();
+	for(const auto & file : files) std::filesystem::remove(file);
+	return TestResult();
+}
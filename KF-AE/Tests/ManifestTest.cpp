@@ -0,0 +1,112 @@
+/********************************************************************************************
+ManifestTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The manifest's background scan (see KFBManifest::scanFile) streams each .kfb rather than holding
+its sections.  Its statistics must be what the whole keyframe gives: the size, ranges, percentiles
+of every kfbScanSamples'th value, and the hash of the whole file.  Keyframes span several chunks.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "KFBManifest.h"
+
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+/*******************************************************************************************************
+The statistics of a whole keyframe, worked out from the arrays.
+*******************************************************************************************************/
+static KFBKeyFrameStats expectedStats(const TestKFB & kfb, const std::string & fileName) {
+	KFBKeyFrameStats stats;
+	stats.width = kfb.width;
+	stats.height = kfb.height;
+	stats.maxIterations = kfb.maxIterations;
+	const size_t count = kfb.iterations.size();
+	const size_t stride = std::max<size_t>(1, count / kfbScanSamples);
+	std::vector<double> smooth(count);
+	for(size_t i = 0; i < count; i++) smooth[i] = static_cast<double>(kfb.iterations[i]) + 1 - static_cast<double>(kfb.raw[i]);
+	stats.minIteration = *std::min_element(kfb.iterations.begin(), kfb.iterations.end());
+	stats.maxIteration = *std::max_element(kfb.iterations.begin(), kfb.iterations.end());
+	stats.minSmooth = *std::min_element(smooth.begin(), smooth.end());
+	stats.maxSmooth = *std::max_element(smooth.begin(), smooth.end());
+
+	std::vector<int> iterationSamples;
+	std::vector<double> smoothSamples;
+	for(size_t i = 0; i < count; i += stride) {
+		iterationSamples.push_back(kfb.iterations[i]);
+		smoothSamples.push_back(smooth[i]);
+	}
+	std::sort(iterationSamples.begin(), iterationSamples.end());
+	std::sort(smoothSamples.begin(), smoothSamples.end());
+	const double percentiles[3] = {0.01, 0.5, 0.99};
+	for(int p = 0; p < 3; p++) {
+		const size_t index = static_cast<size_t>(percentiles[p] * (iterationSamples.size() - 1));
+		stats.iterationPercentiles[p] = iterationSamples[index];
+		stats.smoothPercentiles[p] = smoothSamples[index];
+	}
+
+	std::ifstream file {fileName, std::ios::binary};
+	const std::vector<char> bytes {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+	stats.hash = HashKFBBytes(kfbHashSeed, bytes.data(), bytes.size());
+	return stats;
+}
+
+static void compare(const KFBKeyFrameStats & actual, const KFBKeyFrameStats & expected) {
+	const std::string name = actual.fileName + ": ";
+	TEST_CHECK(actual.width == expected.width && actual.height == expected.height && actual.maxIterations == expected.maxIterations, name + "size or max iterations differ");
+	TEST_CHECK(actual.minIteration == expected.minIteration && actual.maxIteration == expected.maxIteration, name + "iteration range differs");
+	TEST_CHECK(actual.minSmooth == expected.minSmooth && actual.maxSmooth == expected.maxSmooth, name + "smooth range differs");
+	TEST_CHECK(actual.iterationPercentiles == expected.iterationPercentiles, name + "iteration percentiles differ");
+	TEST_CHECK(actual.smoothPercentiles == expected.smoothPercentiles, name + "smooth percentiles differ");
+	TEST_CHECK(actual.hash == expected.hash, name + "hash differs");
+}
+
+int main() {
+	UseTestAE();
+	const fs::path folder = TestFileName("manifest");
+	fs::create_directory(folder);
+	const std::vector<std::pair<std::string, TestKFB>> keyFrames {
+		{"a.kfb", MakeTestKFB(800, 600, 1000, 100000, 0.2, 1)},
+		{"b.kfb", MakeTestKFB(1024, 1024, 3000, 50000, 0.4, 2)},
+	};
+	for(const auto & k : keyFrames) WriteTestKFB((folder / k.first).string(), k.second);
+
+	{
+		KFBManifest manifest;
+		manifest.Open((folder / "sequence.kfr").string());
+		TEST_CHECK(manifest.GetFiles().size() == keyFrames.size(), "every keyframe is listed");
+
+		//Keyframes are numbered in reverse name order.
+		const auto started = std::chrono::steady_clock::now();
+		for(long k = 0; k < static_cast<long>(keyFrames.size()); k++) {
+			KFBKeyFrameStats stats;
+			while(!manifest.GetStats(k, stats) && std::chrono::steady_clock::now() - started < std::chrono::seconds(60)) {
+				std::this_thread::sleep_for(std::chrono::milliseconds(10));
+			}
+			const auto & expected = keyFrames[keyFrames.size() - 1 - k];
+			if(!TEST_CHECK(stats.scanned && stats.fileName == expected.first, "keyframe " + std::to_string(k) + " is scanned")) continue;
+			compare(stats, expectedStats(expected.second, (folder / expected.first).string()));
+		}
+	}
+
+	fs::remove_all(folder);
+	return TestResult();
+}
@@ -0,0 +1,90 @@
+/********************************************************************************************
+MappedTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Mapped storage reads samples straight from the mapped .kfb (see KFBData::mappedValue), making
+the padding as it goes.  It must sample exactly the same values as decoded (standard) storage:
+whole pixels, bicubic samples and spans, and distance matrices, including the padding and its
+corners.  Checked for a mapped .kfb and a mapped sidecar, and for a keyframe barely bigger than
+the padding.  Then times bicubic samples and distance matrices of both.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "WorkerPool.h"
+
+#include <cstdio>
+#include <filesystem>
+
+static void check(int width, int height, WorkerPool & pool, bool timed) {
+	const auto keyframe = MakeTestKFB(width, height, 1000, 1000000, 0.3, width);
+	const auto fileName = TestFileName("mapped.kfb");
+	WriteTestKFB(fileName, keyframe);
+	const std::string size = std::to_string(width) + "x" + std::to_string(height);
+
+	KFBData standard(width, height);
+	standard.ReadKFBFile(fileName, &pool);
+	{
+		KFBData mapped(width, height, KFBStorage::mapped);
+		mapped.ReadKFBFile(fileName, &pool);
+		TEST_CHECK(MatchesTestKFB(mapped, keyframe), size + ": mapped storage matches the file");
+		CompareKFBSampling(standard, mapped, size + " kfb");
+
+		if(timed) {
+			std::printf("%s keyframe, ns per sample      standard   mapped\n", size.c_str());
+			auto bicubic = [&](const KFBData & kfb) {
+				double total = 0;
+				const double seconds = TimeBest(3, [&] {
+					for(long y = 0; y < height; y++) {
+						for(long x = 0; x < width; x++) total += kfb.calculateIterationCountBiCubic(x + 0.3, y + 0.6);
+					}
+				});
+				KeepResult(total);
+				return seconds * 1e9 / (static_cast<double>(width) * height);
+			};
+			auto matrix = [&](const KFBData & kfb) {
+				double total = 0;
+				const double seconds = TimeBest(3, [&] {
+					for(long y = 0; y < height; y++) {
+						for(long x = 0; x < width; x++) {
+							double p[3][3];
+							kfb.getDistanceMatrix(p, x + 0.3, y + 0.6, 1.0);
+							total += p[0][0];
+						}
+					}
+				});
+				KeepResult(total);
+				return seconds * 1e9 / (static_cast<double>(width) * height);
+			};
+			std::printf("Bicubic:                           %8.1f %8.1f\n", bicubic(standard), bicubic(mapped));
+			std::printf("Distance matrix:                   %8.1f %8.1f\n", matrix(standard), matrix(mapped));
+		}
+
+		standard.WriteSidecar(fileName);
+		KFBData fromSidecar(width, height, KFBStorage::mapped);
+		TEST_CHECK(fromSidecar.ReadSidecar(fileName), size + ": the sidecar is mapped");
+		CompareKFBSampling(standard, fromSidecar, size + " sidecar");
+	}
+
+	std::filesystem::remove(fileName);
+	std::filesystem::remove(KFBSidecarFileName(fileName));
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	check(5, 4, pool, false);
+	check(1931, 1087, pool, true);
+	return TestResult();
+}
@@ -0,0 +1,180 @@
+/********************************************************************************************
+MipTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Mip levels of the smooth data (see KFBData::PrepareMipLevel):
+ - The level chosen for a step, and level 0 (no mip) for steps under 2.
+ - Each pixel of level n outside the set is the average of its 2^n square block of the keyframe
+   (a box filter), and a block wholly inside the set keeps the inside value.
+ - Sampling level n is the bicubic interpolation of that box filtered image, at the matching
+   position (pixel centres line up with the centres of their blocks).
+ - Building levels doesn't change sampling at full size.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "KFBSpan.h"
+#include "WorkerPool.h"
+
+#include <filesystem>
+#include <random>
+
+constexpr int width = 512, height = 384;
+constexpr int levels = 3;
+constexpr double tolerance = 1e-9;		//Relative, the levels are averaged a level at a time
+
+//A box filtered image, and whether each of its blocks is wholly outside (or inside) the set.
+struct BoxImage {
+	long width {0};
+	long height {0};
+	std::vector<double> values;
+	std::vector<char> outside;
+	std::vector<char> inside;
+
+	double value(long x, long y) const {
+		x = std::clamp(x, 0L, width - 1);
+		y = std::clamp(y, 0L, height - 1);
+		return values[y * width + x];
+	}
+	//Bicubic sample, the same way as KFBData (clamped at the edges).
+	double sample(double x, double y) const {
+		const long xl = static_cast<long>(std::floor(x));
+		const long yl = static_cast<long>(std::floor(y));
+		double columns[4];
+		for(int i = 0; i < 4; i++) {
+			columns[i] = biCubicStep(value(xl + i - 1, yl - 1), value(xl + i - 1, yl), value(xl + i - 1, yl + 1), value(xl + i - 1, yl + 2), y - yl);
+		}
+		return biCubicStep(columns[0], columns[1], columns[2], columns[3], x - xl);
+	}
+};
+
+static BoxImage boxFilter(const TestKFB & keyframe, int level) {
+	const long size = 1L << level;
+	BoxImage box;
+	box.width = width >> level;
+	box.height = height >> level;
+	for(long y = 0; y < box.height; y++) {
+		for(long x = 0; x < box.width; x++) {
+			double total = 0;
+			int insideCount = 0;
+			for(long j = 0; j < size; j++) {
+				for(long i = 0; i < size; i++) {
+					const size_t index = static_cast<size_t>(x * size + i) * height + (y * size + j);		//The kfb is column major
+					const double v = static_cast<double>(keyframe.iterations[index]) + 1 - static_cast<double>(keyframe.raw[index]);
+					total += v;
+					insideCount += (keyframe.iterations[index] >= keyframe.maxIterations);
+				}
+			}
+			box.values.push_back(total / static_cast<double>(size * size));
+			box.outside.push_back(insideCount == 0);
+			box.inside.push_back(insideCount == size * size);
+		}
+	}
+	return box;
+}
+
+static bool near(double expected, double actual) {
+	return std::abs(expected - actual) <= tolerance * std::max(1.0, std::abs(expected));
+}
+
+/*******************************************************************************************************
+Level n against the box filtered keyframe (from the file's values), at the centre of each of its pixels and at random points.
+*******************************************************************************************************/
+static void checkLevel(const KFBData & kfb, const TestKFB & keyframe, int level) {
+	const std::string name = "level " + std::to_string(level);
+	const auto box = boxFilter(keyframe, level);
+	const double size = static_cast<double>(1 << level);
+	auto position = [&](double boxX) {return (boxX + 0.5) * size - 0.5;};		//Keyframe co-ordinate of a level co-ordinate
+
+	long outsideErrors = 0, insideErrors = 0, outsideBlocks = 0, insideBlocks = 0;
+	for(long y = 0; y < box.height; y++) {
+		for(long x = 0; x < box.width; x++) {
+			const double sample = kfb.calculateIterationCountBiCubic(position(x), position(y), true, level);
+			if(box.outside[y * box.width + x]) {
+				outsideBlocks++;
+				outsideErrors += !near(box.values[y * box.width + x], sample);
+			}
+			if(box.inside[y * box.width + x]) {
+				insideBlocks++;
+				insideErrors += (sample != box.values[y * box.width + x]);
+			}
+		}
+	}
+	TEST_CHECK(outsideBlocks > 0 && outsideErrors == 0, name + ": " + std::to_string(outsideErrors) + " of " + std::to_string(outsideBlocks) + " pixels outside the set differ from the box filter");
+	TEST_CHECK(insideBlocks > 0 && insideErrors == 0, name + ": " + std::to_string(insideErrors) + " of " + std::to_string(insideBlocks) + " pixels inside the set aren't the inside value");
+
+	//Between the pixel centres, away from the set (where the box filter's 4x4 neighbourhood is all outside).
+	std::mt19937 random(level);
+	std::uniform_real_distribution<double> xs(-1.0, box.width);
+	std::uniform_real_distribution<double> ys(-1.0, box.height);
+	long samples = 0, errors = 0;
+	double largest = 0;
+	for(int i = 0; i < 100000; i++) {
+		const double x = xs(random), y = ys(random);
+		const long xl = static_cast<long>(std::floor(x)), yl = static_cast<long>(std::floor(y));
+		bool outside = true;
+		for(long j = -1; j <= 2; j++) {
+			for(long k = -1; k <= 2; k++) outside = outside && box.outside[std::clamp(yl + j, 0L, box.height - 1) * box.width + std::clamp(xl + k, 0L, box.width - 1)];
+		}
+		if(!outside) continue;
+		samples++;
+		const double expected = box.sample(x, y);
+		const double actual = kfb.calculateIterationCountBiCubic(position(x), position(y), true, level);
+		largest = std::max(largest, std::abs(expected - actual) / std::max(1.0, std::abs(expected)));
+		errors += !near(expected, actual);
+	}
+	TEST_CHECK(samples > 10000 && errors == 0, name + ": " + std::to_string(errors) + " of " + std::to_string(samples) + " samples differ from the box filter's (by up to " + std::to_string(largest) + ")");
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	const auto fileName = TestFileName("mip.kfb");
+	const auto keyframe = MakeTestKFB(width, height, 1000, 1000000, 0.3);
+	WriteTestKFB(fileName, keyframe);
+
+	KFBData kfb(width, height);
+	kfb.ReadKFBFile(fileName, &pool);
+	KFBData plain(width, height);
+	plain.ReadKFBFile(fileName, &pool);
+
+	TEST_CHECK(kfb.PrepareMipLevel(1.0, &pool) == 0 && kfb.PrepareMipLevel(1.99, &pool) == 0, "steps under 2 use the keyframe itself");
+	for(int level = 1; level <= levels; level++) {
+		const double step = static_cast<double>(1 << level);
+		TEST_CHECK(kfb.PrepareMipLevel(step, &pool) == level && kfb.PrepareMipLevel(step * 1.5, &pool) == level, "a step of " + std::to_string(step) + " uses level " + std::to_string(level));
+		checkLevel(kfb, keyframe, level);
+	}
+
+	//Level 0 is the same as a keyframe without mip levels.
+	std::mt19937 random(11);
+	std::uniform_real_distribution<double> xs(-1.5, width - 0.5);
+	std::uniform_real_distribution<double> ys(-1.5, height - 0.5);
+	long differ = 0;
+	for(int i = 0; i < 100000; i++) {
+		const double x = xs(random), y = ys(random);
+		differ += (kfb.calculateIterationCountBiCubic(x, y) != plain.calculateIterationCountBiCubic(x, y)) || (kfb.calculateIterationCountBiCubic(x, y, true, 0) != plain.calculateIterationCountBiCubic(x, y));
+	}
+	std::vector<float> spanX(width);
+	std::vector<double> expected(width), actual(width);
+	for(long x = 0; x < width; x++) spanX[x] = static_cast<float>(x * 0.999 + 0.25);
+	for(long y = 0; y < height; y += 5) {
+		plain.calculateIterationCountBiCubicSpan(spanX.data(), width, y + 0.375, expected.data());
+		kfb.calculateIterationCountBiCubicSpan(spanX.data(), width, y + 0.375, actual.data());
+		differ += (MaxDifference(expected.data(), actual.data(), width) != 0);
+	}
+	TEST_CHECK(differ == 0, "level 0 is unchanged by building mip levels (" + std::to_string(differ) + " differ)");
+
+	std::filesystem::remove(fileName);
+	return TestResult();
+}
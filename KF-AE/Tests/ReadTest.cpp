@@ -0,0 +1,205 @@
+/********************************************************************************************
+ReadTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Reading a .kfb: the banded read and transpose must give exactly the file's values (checked
+against a plain per-pixel read), any number of decode workers must give the same bytes, and a
+damaged file must throw.  Prints the decode speed, and that of the per-value reader it replaced
+(kept below as the baseline), which must decode the same values.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "WorkerPool.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+
+/*******************************************************************************************************
+The reader before banded reads: one value per read, rotated as it goes, then the padding.
+Fills padded row major arrays (like standard storage).
+*******************************************************************************************************/
+static void baselineRead(const std::string & fileName, int width, int height, std::vector<int> & data, std::vector<double> & smoothData) {
+	const int memWidth = width + 4, memHeight = height + 4;
+	auto makeIndex = [memWidth](long x, long y) {return y * memWidth + x;};
+	data.assign(static_cast<size_t>(memWidth) * memHeight, 0);
+	smoothData.assign(data.size(), 0);
+	std::ifstream file {fileName, std::ios::binary | std::ios::in};
+	char id[3];
+	file.read(id, 3);
+	int w, h;
+	file.read(reinterpret_cast<char*>(&w), sizeof(w));
+	file.read(reinterpret_cast<char*>(&h), sizeof(h));
+	for(long x = 0; x < width; x++) {
+		for(long y = 0; y < height; y++) file.read(reinterpret_cast<char *>(&data[makeIndex(x + 2, y + 2)]), sizeof(int));
+	}
+	int colourDiv, numColours, maxIterations;
+	file.read(reinterpret_cast<char*>(&colourDiv), sizeof(int));
+	file.read(reinterpret_cast<char*>(&numColours), sizeof(int));
+	for(int i = 0; i < numColours * 3; i++) file.get();
+	file.read(reinterpret_cast<char*>(&maxIterations), sizeof(int));
+	float temp;
+	for(long x = 0; x < width; x++) {
+		for(long y = 0; y < height; y++) {
+			file.read(reinterpret_cast<char*>(&temp), sizeof(temp));
+			const auto index = makeIndex(x + 2, y + 2);
+			smoothData[index] = static_cast<double>(data[index]) + 1 - static_cast<double>(temp);
+		}
+	}
+
+	for(int x = 0; x < memWidth; x++) {
+		auto edge = data[makeIndex(x, 2)];
+		auto diff = edge - data[makeIndex(x, 3)];
+		data[makeIndex(x, 1)] = std::max(edge + diff, 0);
+		data[makeIndex(x, 0)] = std::max(edge + (diff * 2), 0);
+		edge = data[makeIndex(x, memHeight - 3)];
+		diff = edge - data[makeIndex(x, memHeight - 4)];
+		data[makeIndex(x, memHeight - 2)] = std::max(edge + diff, 0);
+		data[makeIndex(x, memHeight - 1)] = std::max(edge + (diff * 2), 0);
+	}
+	for(int y = 0; y < memHeight; y++) {
+		auto edge = data[makeIndex(2, y)];
+		auto diff = edge - data[makeIndex(3, y)];
+		data[makeIndex(1, y)] = std::max(edge + diff, 0);
+		data[makeIndex(0, y)] = std::max(edge + (diff * 2), 0);
+		edge = data[makeIndex(memWidth - 3, y)];
+		diff = edge - data[makeIndex(memWidth - 4, y)];
+		data[makeIndex(memWidth - 2, y)] = std::max(edge + diff, 0);
+		data[makeIndex(memWidth - 1, y)] = std::max(edge + (diff * 2), 0);
+	}
+	for(int x = 0; x < memWidth; x++) {
+		auto edge = smoothData[makeIndex(x, 2)];
+		auto diff = edge - smoothData[makeIndex(x, 3)];
+		smoothData[makeIndex(x, 1)] = std::fmax(edge + diff, 0.0f);
+		smoothData[makeIndex(x, 0)] = std::fmax(edge + (diff * 2), 0.0f);
+		edge = smoothData[makeIndex(x, memHeight - 3)];
+		diff = edge - smoothData[makeIndex(x, memHeight - 4)];
+		smoothData[makeIndex(x, memHeight - 2)] = std::fmax(edge + diff, 0.0f);
+		smoothData[makeIndex(x, memHeight - 1)] = std::fmax(edge + (diff * 2), 0.0f);
+	}
+	for(int y = 0; y < memHeight; y++) {
+		auto edge = smoothData[makeIndex(2, y)];
+		auto diff = edge - smoothData[makeIndex(3, y)];
+		smoothData[makeIndex(1, y)] = std::fmax(edge + diff, 0.0f);
+		smoothData[makeIndex(0, y)] = std::fmax(edge + (diff * 2), 0.0f);
+		edge = smoothData[makeIndex(memWidth - 3, y)];
+		diff = edge - smoothData[makeIndex(memWidth - 4, y)];
+		smoothData[makeIndex(memWidth - 2, y)] = std::fmax(edge + diff, 0.0f);
+		smoothData[makeIndex(memWidth - 1, y)] = std::fmax(edge + (diff * 2), 0.0f);
+	}
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+
+	//Sizes that aren't a multiple of the band, block or vector width.
+	for(auto size : {std::pair<int, int>{7, 5}, {257, 131}, {1023, 577}}) {
+		const auto expected = MakeTestKFB(size.first, size.second, 1000, 100000);
+		const auto fileName = TestFileName("read.kfb");
+		WriteTestKFB(fileName, expected);
+		KFBData kfb(size.first, size.second);
+		kfb.ReadKFBFile(fileName, &pool);
+		TEST_CHECK(kfb.maxIterations == expected.maxIterations && kfb.numColours == 4, "header of " + std::to_string(size.first) + "x" + std::to_string(size.second));
+		TEST_CHECK(MatchesTestKFB(kfb, expected), "decode of " + std::to_string(size.first) + "x" + std::to_string(size.second));
+		std::filesystem::remove(fileName);
+	}
+
+	//A damaged file throws (and doesn't crash).
+	{
+		const auto expected = MakeTestKFB(300, 200, 1000, 100000);
+		const auto fileName = TestFileName("truncated.kfb");
+		WriteTestKFB(fileName, expected);
+		std::filesystem::resize_file(fileName, std::filesystem::file_size(fileName) / 2);
+		bool threw = false;
+		try {
+			KFBData kfb(300, 200);
+			kfb.ReadKFBFile(fileName, &pool);
+		}
+		catch(...) {
+			threw = true;
+		}
+		TEST_CHECK(threw, "a truncated file throws");
+
+		threw = false;
+		try {
+			KFBData kfb(301, 200);
+			kfb.ReadKFBFile(fileName, &pool);
+		}
+		catch(...) {
+			threw = true;
+		}
+		TEST_CHECK(threw, "the wrong size throws");
+		std::filesystem::remove(fileName);
+	}
+
+	//Any number of workers decodes the same bytes (padding included), one worker is the reference.
+	{
+		const int width = 1501, height = 907;
+		const auto expected = MakeTestKFB(width, height, 1000, 1000000);
+		const auto fileName = TestFileName("pools.kfb");
+		WriteTestKFB(fileName, expected);
+		const size_t cells = static_cast<size_t>(width + 4) * (height + 4);
+		std::unique_ptr<KFBData> reference;
+		for(int threads : {1, 2, 3, 4, 8, 16}) {
+			WorkerPool sized(threads);
+			auto kfb = std::make_unique<KFBData>(width, height);
+			const double seconds = TimeBest(3, [&] {
+				kfb = std::make_unique<KFBData>(width, height);
+				kfb->ReadKFBFile(fileName, &sized);
+			});
+			std::printf("Decode %dx%d with %d workers: %.1f ms\n", width, height, threads, seconds * 1e3);
+			if(!reference) {
+				TEST_CHECK(MatchesTestKFB(*kfb, expected), "decode with one worker");
+				reference = std::move(kfb);
+				continue;
+			}
+			const bool same = std::equal(kfb->getIterationData(), kfb->getIterationData() + cells, reference->getIterationData())
+				&& std::memcmp(kfb->getSmoothData(), reference->getSmoothData(), cells * sizeof(double)) == 0;
+			TEST_CHECK(same, "decode with " + std::to_string(threads) + " workers matches one worker");
+		}
+		std::filesystem::remove(fileName);
+	}
+
+	//Decode speed (the file is in the OS cache after the first read).
+	{
+		const int width = 2560, height = 1440;
+		const auto expected = MakeTestKFB(width, height, 1000, 10000000);
+		const auto fileName = TestFileName("speed.kfb");
+		WriteTestKFB(fileName, expected);
+		const double megabytes = std::filesystem::file_size(fileName) / 1e6;
+		std::unique_ptr<KFBData> kfb;
+		const double seconds = TimeBest(5, [&] {
+			kfb = std::make_unique<KFBData>(width, height);
+			kfb->ReadKFBFile(fileName, &pool);
+		});
+		TEST_CHECK(MatchesTestKFB(*kfb, expected), "decode of the large file");
+
+		std::vector<int> data;
+		std::vector<double> smooth;
+		const double baselineSeconds = TimeBest(3, [&] {baselineRead(fileName, width, height, data, smooth);});
+		const bool same = std::equal(data.begin(), data.end(), kfb->getIterationData())
+			&& std::memcmp(smooth.data(), kfb->getSmoothData(), smooth.size() * sizeof(double)) == 0;
+		TEST_CHECK(same, "the baseline reader decodes the same values");
+		std::printf("Decode %dx%d (%.1f MB), baseline reader: %.1f ms, %.0f MB/s\n", width, height, megabytes, baselineSeconds * 1e3, megabytes / baselineSeconds);
+		std::printf("Decode %dx%d (%.1f MB): %.1f ms, %.0f MB/s with %d workers\n", width, height, megabytes, seconds * 1e3, megabytes / seconds, pool.getThreads());
+		std::filesystem::remove(fileName);
+	}
+
+	return TestResult();
+}
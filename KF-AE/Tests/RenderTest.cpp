@@ -0,0 +1,148 @@
+/********************************************************************************************
+RenderTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The span kernels are compiled for each combination of the per-frame settings (modifier, slopes,
+slope method and scaling mode) and chosen once per frame.  For every method, combination and
+colour depth, a frame rendered a row at a time must equal one rendered a pixel at a time through
+the method's per-pixel adapter (Render8/16/32), which chooses the kernel again for every pixel like
+the per-pixel render did.  Slopes with an unknown slope method must render as no slopes.
+Prints ms per frame of each (8-bit), for the gain of each combination.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+#include "Render-KFRColouring.h"
+#include "Render-KFRDistance.h"
+#include "Render-DarkLightWave.h"
+#include "Render-WaveOnPalette.h"
+#include "Render-LogSteps.h"
+#include "Render-LogStepPalette.h"
+#include "Render-Panels.h"
+#include "Render-PanelsColour.h"
+#include "Render-Angle.h"
+#include "Render-AngleColour.h"
+#include "Render-DEAndAngle.h"
+
+#include <cstdio>
+#include <filesystem>
+
+constexpr int width = 480, height = 270;
+
+//A method's per-pixel adapters.
+struct PixelAdapters {
+	PF_Err (*render8)(void *, A_long, A_long, PF_Pixel8 *, PF_Pixel8 *);
+	PF_Err (*render16)(void *, A_long, A_long, PF_Pixel16 *, PF_Pixel16 *);
+	PF_Err (*render32)(void *, A_long, A_long, PF_Pixel32 *, PF_Pixel32 *);
+};
+
+template <class Method>
+constexpr PixelAdapters adaptersOf() {return {Method::Render8, Method::Render16, Method::Render32};}
+
+static PixelAdapters pixelAdapters(long method) {
+	switch(method) {
+		case 2: return adaptersOf<Render_KFRDistance>();
+		case 4: return adaptersOf<Render_DarkLightWave>();
+		case 5: return adaptersOf<Render_WaveOnPalette>();
+		case 6: return adaptersOf<Render_LogSteps>();
+		case 7: return adaptersOf<Render_LogStepPalette>();
+		case 8: return adaptersOf<Render_Panels>();
+		case 9: return adaptersOf<Render_PanelsColour>();
+		case 10: return adaptersOf<Render_Angle>();
+		case 11: return adaptersOf<Render_AngleColour>();
+		case 12: return adaptersOf<Render_DEAndAngle>();
+		default: return adaptersOf<Render_KFRColouring>();
+	}
+}
+
+static auto adapter(const PixelAdapters & adapters, PF_Pixel8 *) {return adapters.render8;}
+static auto adapter(const PixelAdapters & adapters, PF_Pixel16 *) {return adapters.render16;}
+static auto adapter(const PixelAdapters & adapters, PF_Pixel32 *) {return adapters.render32;}
+
+/*******************************************************************************************************
+Render a frame a pixel at a time through the method's adapter.
+*******************************************************************************************************/
+template <class PixelT>
+static void renderPixels(const LocalSequenceData * local, TestFrame<PixelT> & frame) {
+	auto context = MakeRenderContext(local);
+	const auto render = adapter(pixelAdapters(local->method), static_cast<PixelT*>(nullptr));
+	for(A_long y = 0; y < frame.world.height; y++) {
+		for(A_long x = 0; x < frame.world.width; x++) render(&context, x, y, nullptr, &frame.pixels[static_cast<size_t>(y) * frame.world.width + x]);
+	}
+}
+
+static std::string describe(const LocalSequenceData * local, const char * methodName, int depth) {
+	return std::string(methodName) + " modifier " + std::to_string(local->modifier) + (local->slopesEnabled ? " slopes " + std::to_string(local->slopeMethod) : std::string(" no slopes"))
+		+ " scaling " + std::to_string(local->scalingMode) + " " + std::to_string(depth) + "-bit";
+}
+
+/*******************************************************************************************************
+Spans and pixels match for one combination, at one depth.  Returns the seconds taken by each.
+*******************************************************************************************************/
+template <class PixelT>
+static std::pair<double, double> compare(const LocalSequenceData * local, WorkerPool & pool, const char * methodName, int depth) {
+	TestFrame<PixelT> spans(width, height), pixels(width, height);
+	const double spanSeconds = TimeBest(2, [&] {RenderTestFrame(local, spans, pool);});
+	const double pixelSeconds = TimeBest(1, [&] {renderPixels(local, pixels);});
+	const long differences = spans.differences(pixels);
+	TEST_CHECK(differences == 0, describe(local, methodName, depth) + ": " + std::to_string(differences) + " pixels of spans differ from pixels");
+	return {spanSeconds, pixelSeconds};
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(1);			//Times one thread, like the per-pixel render
+	const auto activeFile = TestFileName("active.kfb");
+	const auto nextFile = TestFileName("next.kfb");
+	WriteTestKFB(activeFile, MakeTestKFB(width, height, 1000, 100000, 0.2, 1));
+	WriteTestKFB(nextFile, MakeTestKFB(width, height, 3000, 100000, 0.3, 2));
+	auto active = std::make_shared<KFBData>(width, height);
+	active->ReadKFBFile(activeFile, &pool);
+	auto next = std::make_shared<KFBData>(width, height);
+	next->ReadKFBFile(nextFile, &pool);
+
+	auto local = MakeTestSequence(active, next);
+	PrepareTestRender(local.get(), width, height);
+
+	std::printf("ms per %dx%d frame (8-bit)                      pixels    spans  gain\n", width, height);
+	for(const auto & method : testMethods) {
+		local->method = method.method;
+		for(long modifier = 1; modifier <= 4; modifier++) {
+			local->modifier = modifier;
+			for(long slopeMethod = 0; slopeMethod <= 2; slopeMethod++) {
+				local->slopesEnabled = (slopeMethod != 0);
+				local->slopeMethod = std::max(1L, slopeMethod);
+				for(int scalingMode = 1; scalingMode <= 2; scalingMode++) {
+					local->scalingMode = scalingMode;
+					const auto [spans, pixels] = compare<PF_Pixel8>(local.get(), pool, method.name, 8);
+					compare<PF_Pixel16>(local.get(), pool, method.name, 16);
+					compare<PF_Pixel32>(local.get(), pool, method.name, 32);
+					std::printf("%-46s %8.2f %8.2f %5.2fx\n", describe(local.get(), method.name, 8).c_str(), pixels * 1e3, spans * 1e3, pixels / spans);
+				}
+			}
+
+			//Slopes with an unknown slope method do nothing.
+			local->slopesEnabled = false;
+			TestFrame<PF_Pixel16> none(width, height), unknown(width, height);
+			RenderTestFrame(local.get(), none, pool);
+			local->slopesEnabled = true;
+			local->slopeMethod = 3;
+			RenderTestFrame(local.get(), unknown, pool);
+			TEST_CHECK(none.differences(unknown) == 0, describe(local.get(), method.name, 16) + ": an unknown slope method differs from no slopes");
+		}
+	}
+
+	std::filesystem::remove(activeFile);
+	std::filesystem::remove(nextFile);
+	return TestResult();
+}
@@ -0,0 +1,151 @@
+/********************************************************************************************
+ResampleTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+A resample plan (see KFBResample.h) must sample what the span sampler does: exactly at whole
+pixels, and otherwise to the last few bits (the steps are taken in the other order), for
+standard, compact and tiled storage, zoomed in and out (within the keyframe).
+Frames rendered with the plans must be the same as without them (to a rounding of the 32-bit colour).
+Prints ns per pixel of both samplers, and ms per frame of each method rendered each way.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+
+constexpr int width = 960, height = 540;
+
+//Where a frame zoomed by "zoom" about the centre samples the keyframe.
+static std::vector<double> frameLocations(int size, double zoom) {
+	std::vector<double> locations(size);
+	for(int i = 0; i < size; i++) locations[i] = (i - size / 2.0) / zoom + size / 2.0;
+	return locations;
+}
+
+/*******************************************************************************************************
+Largest difference between the two samplers relative to the value (0 if identical).
+*******************************************************************************************************/
+static double relativeDifference(const std::vector<double> & expected, const std::vector<double> & actual) {
+	double largest = 0;
+	for(size_t i = 0; i < expected.size(); i++) {
+		if(expected[i] == actual[i]) continue;
+		largest = std::max(largest, std::fabs(expected[i] - actual[i]) / std::max(1.0, std::fabs(expected[i])));
+	}
+	return largest;
+}
+
+/*******************************************************************************************************
+Plans against the span sampler, and the time each takes.
+*******************************************************************************************************/
+static void compareSamplers(const std::string & fileName, WorkerPool & pool) {
+	std::printf("ns per pixel                   span    plan  relative difference\n");
+	for(auto storage : {KFBStorage::standard, KFBStorage::compact, KFBStorage::tiled}) {
+		const char * storageName = (storage == KFBStorage::standard) ? "standard" : ((storage == KFBStorage::compact) ? "compact" : "tiled");
+		KFBData kfb(width, height, storage);
+		kfb.ReadKFBFile(fileName, &pool);
+
+		for(double zoom : {1.0, 1.37, 0.6, 3.1}) {
+			//Zoomed out, only the columns and rows within the keyframe are planned (like the next keyframe).
+			const auto xs = frameLocations(width, zoom);
+			const auto ys = frameLocations(height, zoom);
+			int first = 0, last = width - 1, top = 0, bottom = height - 1;
+			while(xs[first] < 0) first++;
+			while(xs[last] > width - 1) last--;
+			while(ys[top] < 0) top++;
+			while(ys[bottom] > height - 1) bottom--;
+			const int count = last - first + 1;
+			std::vector<float> spanXs(xs.begin() + first, xs.begin() + last + 1);
+			std::vector<double> expected(static_cast<size_t>(count) * (bottom - top + 1)), actual(expected.size());
+
+			const double spanSeconds = TimeBest(3, [&] {
+				for(int y = top; y <= bottom; y++) kfb.calculateIterationCountBiCubicSpan(spanXs.data(), count, static_cast<float>(ys[y]), &expected[static_cast<size_t>(y - top) * count]);
+			});
+			const double planSeconds = TimeBest(3, [&] {
+				KFBResamplePlan plan;
+				PlanKFBResample(plan, &kfb, xs, first, last, ys);
+				for(int y = top; y <= bottom; y++) ResampleKFBSpan(plan, first, y, count, &actual[static_cast<size_t>(y - top) * count]);
+			});
+			const double pixels = static_cast<double>(expected.size());
+
+			const std::string name = std::string(storageName) + " zoom " + std::to_string(zoom);
+			const double difference = relativeDifference(expected, actual);
+			if(zoom == 1.0) TEST_CHECK(difference == 0, name + ": whole pixels differ by " + std::to_string(difference));
+			TEST_CHECK(difference < 1e-12, name + ": plans differ from spans by " + std::to_string(difference));
+			std::printf("%-8s zoom %4.2f:      %7.1f %7.1f  %.1e\n", storageName, zoom, spanSeconds * 1e9 / pixels, planSeconds * 1e9 / pixels, difference);
+		}
+	}
+}
+
+/*******************************************************************************************************
+A frame rendered without plans (the span sampler instead).
+*******************************************************************************************************/
+template <class PixelT>
+static void renderWithoutPlans(LocalSequenceData * local, TestFrame<PixelT> & frame, WorkerPool & pool) {
+	auto & coordinates = local->frameCoordinates;
+	const auto activePlan = coordinates.activePlan.kfb;
+	const auto nextPlan = coordinates.nextPlan.kfb;
+	coordinates.activePlan.kfb = nullptr;
+	coordinates.nextPlan.kfb = nullptr;
+	RenderTestFrame(local, frame, pool);
+	coordinates.activePlan.kfb = activePlan;
+	coordinates.nextPlan.kfb = nextPlan;
+}
+
+static float largestChannelDifference(const TestFrame<PF_Pixel32> & a, const TestFrame<PF_Pixel32> & b) {
+	float largest = 0;
+	for(size_t i = 0; i < a.pixels.size(); i++) {
+		largest = std::max({largest, std::fabs(a.pixels[i].red - b.pixels[i].red), std::fabs(a.pixels[i].green - b.pixels[i].green), std::fabs(a.pixels[i].blue - b.pixels[i].blue)});
+	}
+	return largest;
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(1);
+	const auto activeFile = TestFileName("active.kfb");
+	const auto nextFile = TestFileName("next.kfb");
+	WriteTestKFB(activeFile, MakeTestKFB(width, height, 1000, 100000, 0.2, 1));
+	WriteTestKFB(nextFile, MakeTestKFB(width, height, 3000, 100000, 0.3, 2));
+	compareSamplers(activeFile, pool);
+
+	auto active = std::make_shared<KFBData>(width, height);
+	active->ReadKFBFile(activeFile, &pool);
+	auto next = std::make_shared<KFBData>(width, height);
+	next->ReadKFBFile(nextFile, &pool);
+	auto local = MakeTestSequence(active, next);
+	PrepareTestRender(local.get(), width, height);
+	TEST_CHECK(local->frameCoordinates.activePlan.kfb && local->frameCoordinates.nextPlan.kfb, "both keyframes are planned");
+
+	std::printf("ms per %dx%d frame (8-bit)   no plan    plan\n", width, height);
+	for(const auto & method : testMethods) {
+		local->method = method.method;
+		TestFrame<PF_Pixel32> planned(width, height), unplanned(width, height);
+		RenderTestFrame(local.get(), planned, pool);
+		renderWithoutPlans(local.get(), unplanned, pool);
+		const float difference = largestChannelDifference(planned, unplanned);
+		TEST_CHECK(difference < 1e-5f, std::string(method.name) + ": plans change the colour by " + std::to_string(difference));
+		if(difference > 0) std::printf("%s: plans change the colour by %.1e\n", method.name, difference);
+
+		TestFrame<PF_Pixel8> frame(width, height);
+		const double withoutSeconds = TimeBest(3, [&] {renderWithoutPlans(local.get(), frame, pool);});
+		const double withSeconds = TimeBest(3, [&] {RenderTestFrame(local.get(), frame, pool);});
+		std::printf("%-16s              %7.2f %7.2f\n", method.name, withoutSeconds * 1e3, withSeconds * 1e3);
+	}
+
+	std::filesystem::remove(activeFile);
+	std::filesystem::remove(nextFile);
+	return TestResult();
+}
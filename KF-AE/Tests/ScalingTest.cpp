@@ -0,0 +1,124 @@
+/********************************************************************************************
+ScalingTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Work is split over a WorkerPool (see WorkerPool.h).
+A thread waiting for its tiles (RunTiles) must only run those tiles, never other queued jobs, as
+it may hold a lock those jobs need (eg. KFBData::buildMutex while building mip levels and the
+inside mask).  Checked with every worker stuck on a lock this thread holds, and jobs
+queued behind them that take the lock too.
+Then prints how decoding a keyframe, building its mip levels and rendering a frame scale with the
+number of workers (1 up to the cores of this machine).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <thread>
+
+constexpr int width = 1920, height = 1080;
+
+/*******************************************************************************************************
+Holds a lock while the pool's workers are stuck on it, with more jobs that take it queued behind
+them.  Tiles run while it is held must all run on this thread, and no queued job may.
+*******************************************************************************************************/
+static void checkWaitsUnderLock(const std::string & fileName) {
+	constexpr int threads = 2;
+	WorkerPool pool(threads);
+	std::mutex lock;
+	std::atomic<long> stuck {0}, ranHere {0};
+	const auto holder = std::this_thread::get_id();
+	std::vector<std::future<void>> jobs;
+	{
+		std::lock_guard<std::mutex> held(lock);
+		for(int i = 0; i < threads * 4; i++) {
+			jobs.push_back(pool.Submit([&] {
+				if(std::this_thread::get_id() == holder) {
+					ranHere++;
+					return;
+				}
+				stuck++;
+				std::lock_guard<std::mutex> waiting(lock);
+			}, WorkPriority::render));
+		}
+		while(stuck < threads) std::this_thread::yield();
+
+		std::atomic<long> tiles {0};
+		const bool finished = pool.RunTiles(64, WorkPriority::build, [&](long) {tiles++;});
+		TEST_CHECK(finished && tiles == 64, "every tile ran with the workers stuck");
+
+		//The keyframe builders, while the same workers are stuck.
+		WorkerPool decodePool(1);
+		KFBData kfb(width, height);
+		kfb.ReadKFBFile(fileName, &decodePool);
+		TEST_CHECK(kfb.PrepareMipLevel(4, &pool) == 2, "mip levels are built with the workers stuck");
+		kfb.PrepareInsideMask(&pool);
+		TEST_CHECK(kfb.getInsideMask() != nullptr, "the inside mask is built with the workers stuck");
+		TEST_CHECK(ranHere == 0, std::to_string(ranHere.load()) + " queued jobs ran on the thread holding the lock");
+	}
+	for(auto & job : jobs) pool.Wait(job);
+}
+
+int main() {
+	UseTestAE();
+	const auto activeFile = TestFileName("active.kfb");
+	const auto nextFile = TestFileName("next.kfb");
+	WriteTestKFB(activeFile, MakeTestKFB(width, height, 1000, 100000, 0.2, 1));
+	WriteTestKFB(nextFile, MakeTestKFB(width, height, 3000, 100000, 0.3, 2));
+	checkWaitsUnderLock(activeFile);
+
+	const int cores = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+	std::vector<int> counts;
+	for(int n = 1; n < cores; n *= 2) counts.push_back(n);
+	counts.push_back(cores);
+
+	std::printf("%d cores, %dx%d, ms (speed up)        decode          mip levels     render (8-bit)\n", cores, width, height);
+	double decodeOne = 0, mipOne = 0, renderOne = 0;
+	for(int n : counts) {
+		WorkerPool pool(n);
+		const double decode = TimeBest(3, [&] {
+			KFBData kfb(width, height);
+			kfb.ReadKFBFile(activeFile, &pool);
+		});
+
+		auto active = std::make_shared<KFBData>(width, height);
+		active->ReadKFBFile(activeFile, &pool);
+		auto next = std::make_shared<KFBData>(width, height);
+		next->ReadKFBFile(nextFile, &pool);
+		const double mip = TimeBest(3, [&] {
+			KFBData kfb(width, height);
+			kfb.ReadKFBFile(activeFile, &pool);
+			kfb.PrepareMipLevel(8, &pool);
+		}) - decode;
+
+		auto local = MakeTestSequence(active, next);
+		PrepareTestRender(local.get(), width, height);
+		TestFrame<PF_Pixel8> frame(width, height);
+		const double render = TimeBest(3, [&] {RenderTestFrame(local.get(), frame, pool);});
+
+		if(n == 1) {
+			decodeOne = decode;
+			mipOne = mip;
+			renderOne = render;
+		}
+		std::printf("%3d workers                          %7.1f (%4.2fx)  %7.1f (%4.2fx)  %7.1f (%4.2fx)\n", n,
+			decode * 1e3, decodeOne / decode, mip * 1e3, mipOne / std::max(mip, 1e-9), render * 1e3, renderOne / render);
+	}
+
+	std::filesystem::remove(activeFile);
+	std::filesystem::remove(nextFile);
+	return TestResult();
+}
@@ -0,0 +1,299 @@
+/********************************************************************************************
+SharedMemoryTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Shared storage between real processes (POSIX only, each reader is a forked process):
+ - Many processes reading at once decode the keyframe once, and all get the file's values.
+ - A block left decoding by a process that died is claimed again.  So is one whose owner's ID has
+   been given to another process, but not one whose owner is still running.
+ - A failed decode doesn't leave the block stuck, each later reader claims it again.
+ - The block is removed once the last keyframe using it (in any process) has gone.
+ - A block is named by the file's path, size and time.
+The block's header is inspected directly, so this knows the layout of KFBSharedHeader.  The tests
+hold the block open (as a user) so it is still there to inspect once the readers have gone.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "OS.h"
+#include "WorkerPool.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+constexpr int readers = 8;
+constexpr int width = 641, height = 479;
+
+//KFBSharedState and the packing of KFBSharedHeader::state (see KFBData.cpp).
+enum {stateEmpty = 0, stateDecoding, stateReady, stateFailed};
+inline uint64_t stateOf(uint64_t state) {return state & 0xFF;}
+inline uint64_t ownerOf(uint64_t state) {return (state >> 8) & 0xFFFFFFFF;}
+inline uint64_t generationOf(uint64_t state) {return state >> 40;}
+inline uint64_t makeState(uint64_t generation, unsigned long owner, uint64_t state) {return (generation << 40) | (static_cast<uint64_t>(owner) << 8) | state;}
+inline uint64_t makeStarted(uint64_t generation, uint64_t started) {return (generation << 40) | (started & ((uint64_t(1) << 40) - 1));}
+struct SharedHeader {
+	std::atomic<uint64_t> state;
+	std::atomic<uint64_t> ownerStarted;
+	std::atomic<uint32_t> users;
+};
+
+//Exit codes of a reader.
+enum {readMatched = 0, readDiffered = 1, readThrew = 2};
+
+/*******************************************************************************************************
+Start a process that reads a keyframe into shared storage, and checks it against the file.
+*******************************************************************************************************/
+static pid_t startReader(const std::string & fileName, const TestKFB & expected) {
+	const pid_t pid = fork();
+	if(pid != 0) return pid;
+	int code = readMatched;
+	try {
+		WorkerPool pool(2);
+		KFBData kfb(width, height, KFBStorage::shared);
+		kfb.ReadKFBFile(fileName, &pool);
+		if(!MatchesTestKFB(kfb, expected)) code = readDiffered;
+	}
+	catch(...) {
+		code = readThrew;
+	}
+	std::fflush(stdout);
+	_exit(code);
+}
+
+static int waitFor(pid_t pid) {
+	int status = 0;
+	waitpid(pid, &status, 0);
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+/*******************************************************************************************************
+The shared block of a .kfb (created if need be, at its full size), held open as one of its users.
+*******************************************************************************************************/
+static std::string blockName(const std::string & fileName) {
+	return KFBSharedMemoryName(KFBSharedHash(fileName), width, height);
+}
+static SharedMemory holdBlock(const std::string & fileName) {
+	const size_t cells = static_cast<size_t>(width + 4) * (height + 4);
+	const size_t smoothOffset = (cells * sizeof(int) + kfbPageSize - 1) / kfbPageSize * kfbPageSize;
+	auto block = OpenSharedMemory(blockName(fileName), kfbPageSize + smoothOffset + cells * sizeof(double));
+	reinterpret_cast<SharedHeader*>(block.data)->users++;
+	return block;
+}
+static SharedHeader & blockHeader(SharedMemory & block) {
+	return *reinterpret_cast<SharedHeader*>(block.data);
+}
+static void removeBlock(const std::string & fileName) {
+	shm_unlink(("/" + blockName(fileName)).c_str());
+}
+static void releaseBlock(const std::string & fileName, SharedMemory & block) {
+	CloseSharedMemory(block);
+	removeBlock(fileName);
+}
+static bool blockExists(const std::string & fileName) {
+	const int fd = shm_open(("/" + blockName(fileName)).c_str(), O_RDWR, 0600);
+	if(fd < 0) return false;
+	close(fd);
+	return true;
+}
+
+/*******************************************************************************************************
+Many readers at once: one decodes (a single claim), all match the file.
+*******************************************************************************************************/
+static void testContention() {
+	for(uint32_t round = 0; round < 4; round++) {
+		const auto expected = MakeTestKFB(width, height, 1000, 1000000, 0.2, round + 1);
+		const auto fileName = TestFileName("contention.kfb");
+		WriteTestKFB(fileName, expected);
+		removeBlock(fileName);
+		auto block = holdBlock(fileName);
+
+		std::vector<pid_t> pids;
+		for(int i = 0; i < readers; i++) pids.push_back(startReader(fileName, expected));
+		int matched = 0;
+		for(auto pid : pids) matched += (waitFor(pid) == readMatched);
+		TEST_CHECK(matched == readers, "round " + std::to_string(round) + ": " + std::to_string(matched) + " of " + std::to_string(readers) + " readers matched the file");
+
+		const auto state = blockHeader(block).state.load();
+		TEST_CHECK(stateOf(state) == stateReady && generationOf(state) == 1, "round " + std::to_string(round) + ": decoded once (generation " + std::to_string(generationOf(state)) + ")");
+		TEST_CHECK(blockHeader(block).users == 1, "round " + std::to_string(round) + ": every reader let the block go");
+		releaseBlock(fileName, block);
+		std::filesystem::remove(fileName);
+	}
+}
+
+/*******************************************************************************************************
+A block left decoding (or failed) by a process that has since died is claimed again.
+*******************************************************************************************************/
+static void testAbandoned(uint64_t leftState, const std::string & description) {
+	const auto expected = MakeTestKFB(width, height, 1000, 1000000);
+	const auto fileName = TestFileName("abandoned.kfb");
+	WriteTestKFB(fileName, expected);
+	removeBlock(fileName);
+	auto block = holdBlock(fileName);
+
+	//The first owner claims the block and dies without finishing.
+	const pid_t owner = fork();
+	if(owner == 0) {
+		blockHeader(block).state.store(makeState(1, CurrentProcessID(), leftState));
+		blockHeader(block).ownerStarted.store(makeStarted(1, ProcessStartTime(CurrentProcessID())));
+		_exit(0);
+	}
+	waitFor(owner);
+	TEST_CHECK(!IsProcessRunning(owner), description + ": the first owner has finished");
+
+	std::vector<pid_t> pids;
+	for(int i = 0; i < readers; i++) pids.push_back(startReader(fileName, expected));
+	int matched = 0;
+	for(auto pid : pids) matched += (waitFor(pid) == readMatched);
+	TEST_CHECK(matched == readers, description + ": " + std::to_string(matched) + " of " + std::to_string(readers) + " readers matched the file");
+
+	const auto state = blockHeader(block).state.load();
+	TEST_CHECK(stateOf(state) == stateReady && generationOf(state) == 2 && ownerOf(state) != owner, description + ": claimed again once (generation " + std::to_string(generationOf(state)) + ")");
+	releaseBlock(fileName, block);
+	std::filesystem::remove(fileName);
+}
+
+/*******************************************************************************************************
+A block left decoding by a process whose ID is now another (running) process's: this process stands in
+for it, with a different start time.  With the start time it really has, it is still decoding, so a
+reader waits for it rather than claiming the block.
+*******************************************************************************************************/
+static void testReusedOwnerID() {
+	const auto expected = MakeTestKFB(width, height, 1000, 1000000);
+	const auto fileName = TestFileName("reused.kfb");
+	WriteTestKFB(fileName, expected);
+	const auto self = CurrentProcessID();
+	const uint64_t started = ProcessStartTime(self);
+	TEST_CHECK(started != 0, "the start time of this process is known");
+
+	for(bool reused : {false, true}) {
+		const std::string description = reused ? "reused owner ID" : "running owner";
+		removeBlock(fileName);
+		auto block = holdBlock(fileName);
+		blockHeader(block).state.store(makeState(1, self, stateDecoding));
+		blockHeader(block).ownerStarted.store(makeStarted(1, reused ? started + 1 : started));
+		const pid_t reader = startReader(fileName, expected);
+		if(reused) {
+			TEST_CHECK(waitFor(reader) == readMatched, description + ": the reader matched the file");
+		}
+		else {
+			std::this_thread::sleep_for(std::chrono::milliseconds(500));
+			kill(reader, SIGKILL);
+			waitFor(reader);
+		}
+		const auto state = blockHeader(block).state.load();
+		if(reused) TEST_CHECK(stateOf(state) == stateReady && generationOf(state) == 2, description + ": claimed again (generation " + std::to_string(generationOf(state)) + ")");
+		else TEST_CHECK(stateOf(state) == stateDecoding && generationOf(state) == 1 && ownerOf(state) == self, description + ": not claimed while its owner runs");
+		releaseBlock(fileName, block);
+	}
+	std::filesystem::remove(fileName);
+}
+
+/*******************************************************************************************************
+A file that can't be decoded: every reader throws (without waiting for the one before), and each
+claims the failed block again.
+*******************************************************************************************************/
+static void testFailedDecode() {
+	const auto expected = MakeTestKFB(width, height, 1000, 1000000);
+	const auto fileName = TestFileName("failed.kfb");
+	WriteTestKFB(fileName, expected);
+	std::filesystem::resize_file(fileName, std::filesystem::file_size(fileName) - 1000);
+	removeBlock(fileName);
+	auto block = holdBlock(fileName);
+
+	const auto start = std::chrono::steady_clock::now();
+	std::vector<pid_t> pids;
+	for(int i = 0; i < readers; i++) pids.push_back(startReader(fileName, expected));
+	int threw = 0;
+	for(auto pid : pids) threw += (waitFor(pid) == readThrew);
+	const double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	TEST_CHECK(threw == readers, "failed decode: " + std::to_string(threw) + " of " + std::to_string(readers) + " readers threw");
+	TEST_CHECK(seconds < 30, "failed decode: readers didn't wait for each other (" + std::to_string(seconds) + " s)");
+
+	const auto state = blockHeader(block).state.load();
+	TEST_CHECK(stateOf(state) == stateFailed && generationOf(state) == readers, "failed decode: each reader claimed the block (generation " + std::to_string(generationOf(state)) + ")");
+	releaseBlock(fileName, block);
+	std::filesystem::remove(fileName);
+}
+
+/*******************************************************************************************************
+Nothing holds the block: it goes with the last reader, or the last keyframe in this process.
+*******************************************************************************************************/
+static void testRemovedWhenUnused() {
+	const auto expected = MakeTestKFB(width, height, 1000, 1000000);
+	const auto fileName = TestFileName("unused.kfb");
+	WriteTestKFB(fileName, expected);
+	removeBlock(fileName);
+
+	std::vector<pid_t> pids;
+	for(int i = 0; i < readers; i++) pids.push_back(startReader(fileName, expected));
+	int matched = 0;
+	for(auto pid : pids) matched += (waitFor(pid) == readMatched);
+	TEST_CHECK(matched == readers, "unused: " + std::to_string(matched) + " of " + std::to_string(readers) + " readers matched the file");
+	TEST_CHECK(!blockExists(fileName), "the last reader removes the block");
+
+	WorkerPool pool(2);
+	auto first = std::make_unique<KFBData>(width, height, KFBStorage::shared);
+	first->ReadKFBFile(fileName, &pool);
+	auto second = std::make_unique<KFBData>(width, height, KFBStorage::shared);
+	second->ReadKFBFile(fileName, &pool);
+	TEST_CHECK(MatchesTestKFB(*second, expected), "a second keyframe in this process uses the block");
+	first = nullptr;
+	TEST_CHECK(blockExists(fileName), "the block stays while a keyframe uses it");
+	second = nullptr;
+	TEST_CHECK(!blockExists(fileName), "the block goes with the last keyframe");
+
+	//Opened again after that, it is a new block.
+	KFBData again(width, height, KFBStorage::shared);
+	again.ReadKFBFile(fileName, &pool);
+	TEST_CHECK(MatchesTestKFB(again, expected), "the keyframe is decoded into a new block");
+	std::filesystem::remove(fileName);
+}
+
+int main() {
+	UseTestAE();
+	testContention();
+	testAbandoned(stateDecoding, "dead owner");
+	testAbandoned(stateFailed, "failed owner");
+	testFailedDecode();
+	testReusedOwnerID();
+	testRemovedWhenUnused();
+
+	//Blocks are named by the file's path, size and time.
+	const auto fileName = TestFileName("name.kfb");
+	const auto copyName = TestFileName("name copy.kfb");
+	WriteTestKFB(fileName, MakeTestKFB(64, 48, 1000, 100000));
+	std::filesystem::copy_file(fileName, copyName, std::filesystem::copy_options::overwrite_existing);
+	std::filesystem::last_write_time(copyName, std::filesystem::last_write_time(fileName));
+	const uint64_t hash = KFBSharedHash(fileName);
+	TEST_CHECK(KFBSharedHash(copyName) != hash, "a copy of a keyframe has its own block");
+	TEST_CHECK(KFBSharedHash("./" + fileName) == hash, "a keyframe has one block however its path is written");
+	std::filesystem::last_write_time(fileName, std::filesystem::last_write_time(fileName) + std::chrono::seconds(10));
+	TEST_CHECK(KFBSharedHash(fileName) != hash, "a touched keyframe has a new block");
+	std::filesystem::remove(fileName);
+	std::filesystem::remove(copyName);
+
+	return TestResult();
+}
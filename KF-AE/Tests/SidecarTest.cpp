@@ -0,0 +1,132 @@
+/********************************************************************************************
+SidecarTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+.kfbc sidecars (see KFBData::WriteSidecar and ReadSidecar):
+ - Every storage writes its sidecar from what it already holds, and it is the same file
+   (byte for byte) as the one standard storage writes.  Except compact storage, whose padding is
+   rounded to a float (see CompactTest), so only the keyframe itself is compared.
+ - A sidecar is only used while the .kfb has the size and modified time it was made from.
+ - The loader writes a sidecar the first time, for each storage, and reads it after that.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBLoader.h"
+
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+
+namespace fs = std::filesystem;
+
+constexpr int width = 333, height = 251;
+
+static const struct {
+	KFBStorage storage;
+	const char * name;
+	bool exact;			//Samples exactly like standard storage, padding included
+} storages[] {
+	{KFBStorage::standard, "standard", true},
+	{KFBStorage::compact, "compact", false},
+	{KFBStorage::tiled, "tiled", true},
+	{KFBStorage::mapped, "mapped", true},
+};
+
+static std::vector<char> contents(const std::string & fileName) {
+	std::ifstream file {fileName, std::ios::binary};
+	return {std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+}
+
+static void checkWrittenFromEachStorage(const std::string & fileName, const TestKFB & keyframe) {
+	const auto sidecarName = KFBSidecarFileName(fileName);
+	KFBData standard(width, height);
+	standard.ReadKFBFile(fileName);
+	standard.WriteSidecar(fileName);
+	const auto expected = contents(sidecarName);
+
+	for(const auto & [storage, name, exact] : storages) {
+		fs::remove(sidecarName);
+		{
+			KFBData kfb(width, height, storage);
+			kfb.ReadKFBFile(fileName);
+			kfb.WriteSidecar(fileName);
+		}
+		if(exact) TEST_CHECK(contents(sidecarName) == expected, std::string(name) + " storage writes the same sidecar as standard storage");
+		KFBData fromSidecar(width, height);
+		TEST_CHECK(fromSidecar.ReadSidecar(fileName) && MatchesTestKFB(fromSidecar, keyframe), std::string(name) + " storage's sidecar is read");
+	}
+}
+
+static void checkValidation(const std::string & fileName, const TestKFB & keyframe) {
+	KFBData standard(width, height);
+	standard.ReadKFBFile(fileName);
+	standard.WriteSidecar(fileName);
+	KFBData kfb(width, height);
+	TEST_CHECK(kfb.ReadSidecar(fileName), "an up to date sidecar is read");
+
+	//Touched (same contents): the modified time differs, so it is decoded again.
+	const auto modified = fs::last_write_time(fileName);
+	fs::last_write_time(fileName, modified + std::chrono::seconds(10));
+	TEST_CHECK(!kfb.ReadSidecar(fileName), "a sidecar older than the .kfb is not read");
+	fs::last_write_time(fileName, modified);
+	TEST_CHECK(kfb.ReadSidecar(fileName), "the sidecar is read again once the time is back");
+
+	//A different size, with the time put back.
+	{
+		std::ofstream file {fileName, std::ios::binary | std::ios::app};
+		file.put(0);
+	}
+	fs::last_write_time(fileName, modified);
+	TEST_CHECK(!kfb.ReadSidecar(fileName), "a sidecar of a .kfb of another size is not read");
+	WriteTestKFB(fileName, keyframe);
+}
+
+static void checkLoader(const std::string & fileName, const TestKFB & keyframe) {
+	const auto sidecarName = KFBSidecarFileName(fileName);
+	KFBData standard(width, height);
+	standard.ReadKFBFile(fileName);
+	for(const auto & [storage, name, exact] : storages) {
+		fs::remove(sidecarName);
+		fs::file_time_type written;
+		for(int pass = 0; pass < 2; pass++) {
+			KFBCache::Shared().Clear();
+			KFBLoader loader;
+			loader.SetUseSidecars(true);
+			loader.SetSequence({fileName}, {fileName}, width, height, storage);
+			const auto data = loader.Load(0);
+			const std::string when = std::string(name) + ((pass == 0) ? ", first load: " : ", from the sidecar: ");
+			TEST_CHECK(data && data->getStorage() == storage && MatchesTestKFB(*data, keyframe), when + "the keyframe matches its file");
+			if(!TEST_CHECK(fs::exists(sidecarName), when + "there is a sidecar")) break;
+			if(pass == 0) written = fs::last_write_time(sidecarName);
+			TEST_CHECK(fs::last_write_time(sidecarName) == written, when + "the sidecar is not written again");
+			if(data && exact) CompareKFBSampling(standard, *data, when);
+		}
+	}
+	KFBCache::Shared().Clear();
+}
+
+int main() {
+	UseTestAE();
+	const auto keyframe = MakeTestKFB(width, height, 1000, 100000, 0.3);
+	const auto fileName = TestFileName("sidecar.kfb");
+	WriteTestKFB(fileName, keyframe);
+
+	checkWrittenFromEachStorage(fileName, keyframe);
+	checkValidation(fileName, keyframe);
+	checkLoader(fileName, keyframe);
+
+	fs::remove(fileName);
+	fs::remove(KFBSidecarFileName(fileName));
+	return TestResult();
+}
@@ -0,0 +1,96 @@
+/********************************************************************************************
+SpanTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The bicubic span sampler must give exactly the per-pixel result (calculateIterationCountBiCubic)
+at every SIMD level, for standard, compact and tiled storage: zoomed in, zoomed out past the
+edges (clamped) and at whole pixels.  Prints ns per pixel of each, sampling like a frame.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "KFBSpan.h"
+#include "OS.h"
+#include "WorkerPool.h"
+
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+
+constexpr int width = 1920, height = 1080;
+const char * const levelNames[] = {"scalar", "SSE2", "AVX2", "AVX-512"};
+
+//Where a frame zoomed by "zoom" about the centre samples the keyframe (like PrepareFrameCoordinates).
+static std::vector<float> frameColumns(double zoom) {
+	std::vector<float> xs(width);
+	for(int x = 0; x < width; x++) xs[x] = static_cast<float>((x - width / 2.0) / zoom + width / 2.0);
+	return xs;
+}
+static double frameRow(int y, double zoom) {
+	return static_cast<float>((y - height / 2.0) / zoom + height / 2.0);
+}
+
+/*******************************************************************************************************
+Sample a frame a row at a time, with spans (the current SIMD level) or per pixel.
+*******************************************************************************************************/
+static void sampleFrame(const KFBData & kfb, double zoom, bool span, std::vector<double> & out) {
+	const auto xs = frameColumns(zoom);
+	out.resize(static_cast<size_t>(width) * height);
+	for(int y = 0; y < height; y++) {
+		double * row = &out[static_cast<size_t>(y) * width];
+		if(span) {
+			kfb.calculateIterationCountBiCubicSpan(xs.data(), width, frameRow(y, zoom), row);
+		}
+		else {
+			for(int x = 0; x < width; x++) row[x] = kfb.calculateIterationCountBiCubic(xs[x], frameRow(y, zoom));
+		}
+	}
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	const auto keyframe = MakeTestKFB(width, height, 1000, 1000000, 0.25);
+	const auto fileName = TestFileName("span.kfb");
+	WriteTestKFB(fileName, keyframe);
+	const int levels = static_cast<int>(DetectSIMDLevel()) + 1;
+
+	std::printf("ns per pixel (%dx%d)           per pixel", width, height);
+	for(int level = 0; level < levels; level++) std::printf(" %9s", levelNames[level]);
+	std::printf("\n");
+
+	for(auto storage : {KFBStorage::standard, KFBStorage::compact, KFBStorage::tiled}) {
+		const char * storageName = (storage == KFBStorage::standard) ? "standard" : ((storage == KFBStorage::compact) ? "compact" : "tiled");
+		KFBData kfb(width, height, storage);
+		kfb.ReadKFBFile(fileName, &pool);
+
+		for(double zoom : {1.0, 1.37, 0.6, 3.1}) {
+			std::vector<double> expected, actual;
+			const double perPixel = TimeBest(3, [&] {sampleFrame(kfb, zoom, false, expected);});
+			std::printf("%-8s zoom %4.2f:            %9.1f", storageName, zoom, perPixel * 1e9 / (width * height));
+			for(int level = 0; level < levels; level++) {
+				SetKFBSpanLevel(static_cast<SIMDLevel>(level));
+				const double seconds = TimeBest(3, [&] {sampleFrame(kfb, zoom, true, actual);});
+				std::printf(" %9.1f", seconds * 1e9 / (width * height));
+				TEST_CHECK(std::memcmp(expected.data(), actual.data(), expected.size() * sizeof(double)) == 0,
+					std::string(storageName) + " zoom " + std::to_string(zoom) + ": " + levelNames[level] + " spans differ from per-pixel samples");
+			}
+			std::printf("\n");
+		}
+	}
+	SetKFBSpanLevel(DetectSIMDLevel());
+
+	std::filesystem::remove(fileName);
+	return TestResult();
+}
@@ -0,0 +1,188 @@
+/********************************************************************************************
+StageTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The stages of cached images (see CacheStage and StageFunctions).  For every method with stages, a
+cached image is made like DoCachedImages does, and the settings changed one at a time:
+ - Each change makes its own stage and the ones after it out of date (isCacheInvalid), and no others.
+ - Only the stages released are made again, so a colour change doesn't make the fields or shading.
+ - The image coloured from the stages kept is bit for bit the same as a cached image made whole
+   (from stages made for it alone), at every colour depth.
+A cached image made whole must also be the same as one rendered by the span kernels.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+
+#include <atomic>
+#include <filesystem>
+
+constexpr int width = 320, height = 240;
+
+//The stage functions, counting the rows they make.
+static StageFunctions madeFrom;
+static std::atomic<long> fieldRows {0};
+static std::atomic<long> shadingRows {0};
+
+static void countFields(const LocalSequenceData * local, A_long y, A_long x0, A_long x1, double * out) {
+	fieldRows++;
+	madeFrom.fields(local, y, x0, x1, out);
+}
+
+static void countShading(const LocalSequenceData * local, A_long y, A_long x0, A_long x1, const double * fields, float * out) {
+	shadingRows++;
+	madeFrom.shading(local, y, x0, x1, fields, out);
+}
+
+static StageFunctions counted(const StageFunctions & functions) {
+	madeFrom = functions;
+	StageFunctions result = functions;
+	if(functions.fields) result.fields = countFields;
+	if(functions.shading) result.shading = countShading;
+	return result;
+}
+
+//A setting changed, and the first stage it makes out of date.
+struct Change {
+	const char * name;
+	CacheStage stage;
+	void (*apply)(LocalSequenceData * local);
+};
+
+static const Change changes[] {
+	{"colour offset", CacheStage::colours, [](LocalSequenceData * local) {local->colourOffset += 100;}},
+	{"colour division", CacheStage::colours, [](LocalSequenceData * local) {local->colourDivision = 5;}},
+	{"inside colour", CacheStage::colours, [](LocalSequenceData * local) {local->insideColour = RGB(200, 100, 50);}},
+	{"distance clamp", CacheStage::colours, [](LocalSequenceData * local) {local->distanceClamp = 0;}},
+	{"special", CacheStage::colours, [](LocalSequenceData * local) {local->special = 3;}},
+	{"slopes on", CacheStage::shading, [](LocalSequenceData * local) {local->slopesEnabled = true; local->slopeMethod = 1;}},
+	{"colour offset with slopes", CacheStage::colours, [](LocalSequenceData * local) {local->colourOffset += 100;}},
+	{"slope strength", CacheStage::shading, [](LocalSequenceData * local) {local->slopeStrength = 75;}},
+	{"slope shadow depth", CacheStage::shading, [](LocalSequenceData * local) {local->slopeShadowDepth = 8;}},
+	{"slope angle", CacheStage::shading, [](LocalSequenceData * local) {local->slopeAngle = 120; local->slopeAngleX = -0.5; local->slopeAngleY = 0.866;}},
+	{"slope method", CacheStage::shading, [](LocalSequenceData * local) {local->slopeMethod = 2;}},
+	{"modifier", CacheStage::fields, [](LocalSequenceData * local) {local->modifier = 2;}},
+	{"smooth", CacheStage::fields, [](LocalSequenceData * local) {local->useSmooth = false;}},
+	{"slopes off", CacheStage::shading, [](LocalSequenceData * local) {local->slopesEnabled = false;}},
+};
+
+static const char * stageNames[] {"fields are", "shading is", "image is"};
+
+/*******************************************************************************************************
+Like DoCachedImages and makeKFBCachedImage: releases the first stage out of date, then makes the stages
+missing and colours the image from them.
+*******************************************************************************************************/
+template <class PixelT>
+static void makeCachedImage(LocalSequenceData * local, TestFrame<PixelT> & frame, WorkerPool & pool) {
+	for(const auto stage : {CacheStage::fields, CacheStage::shading, CacheStage::colours}) {
+		if(local->isCacheInvalid(stage)) {
+			local->DisposeOfCachedImages(stage);
+			break;
+		}
+	}
+	const auto functions = counted(SelectStageFunctions(local));
+	auto & stages = local->GetCachedStages(0);
+	MakeStageTiles(functions, stages, width, height, local, pool, WorkPriority::build);
+	ColourStageTiles<PixelT>(MakeRenderContext(local), functions, stages, &frame.world, pool, WorkPriority::build);
+	local->saveCachedParameters();
+}
+
+//A cached image made whole, from stages made for it alone.
+template <class PixelT>
+static void makeWholeImage(LocalSequenceData * local, TestFrame<PixelT> & frame, WorkerPool & pool) {
+	const auto functions = SelectStageFunctions(local);
+	CachedStages stages;
+	MakeStageTiles(functions, stages, width, height, local, pool, WorkPriority::build);
+	ColourStageTiles<PixelT>(MakeRenderContext(local), functions, stages, &frame.world, pool, WorkPriority::build);
+}
+
+//Checks which stages are out of date, from first on.
+static void checkInvalid(const LocalSequenceData * local, int first, const std::string & when) {
+	for(int stage = 0; stage < 3; stage++) {
+		const bool expected = (stage >= first);
+		TEST_CHECK(local->isCacheInvalid(static_cast<CacheStage>(stage)) == expected, when + ": the " + stageNames[stage] + (expected ? " out of date" : " kept"));
+	}
+}
+
+/*******************************************************************************************************
+Make the cached image (at the depth of PixelT) again after a change, and check it against one made whole.
+*******************************************************************************************************/
+template <class PixelT>
+static void checkRebuild(LocalSequenceData * local, const std::string & when, int invalid, WorkerPool & pool) {
+	checkInvalid(local, invalid, when);
+	const bool hasShading = SelectStageFunctions(local).shading != nullptr;
+	fieldRows = 0;
+	shadingRows = 0;
+	TestFrame<PixelT> staged(width, height), whole(width, height);
+	makeCachedImage(local, staged, pool);
+	makeWholeImage(local, whole, pool);
+	TEST_CHECK((fieldRows == height) == (invalid == 0), when + ": the fields are " + ((invalid == 0) ? "made again" : "kept") + " (" + std::to_string(fieldRows) + " rows made)");
+	TEST_CHECK((shadingRows == height) == (hasShading && invalid <= 1), when + ": the shading is " + ((hasShading && invalid <= 1) ? "made again" : "kept") + " (" + std::to_string(shadingRows) + " rows made)");
+	const long differ = staged.differences(whole);
+	TEST_CHECK(differ == 0, when + ": " + std::to_string(differ) + " pixels differ from the image made whole");
+	checkInvalid(local, 3, when + ", made again");
+}
+
+int main() {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	const auto fileName = TestFileName("stage.kfb");
+	WriteTestKFB(fileName, MakeTestKFB(width, height, 1000, 100000, 0.2, 1));
+	auto keyFrame = std::make_shared<KFBData>(width, height);
+	keyFrame->ReadKFBFile(fileName, &pool);
+
+	for(const auto & [method, methodName] : testMethods) {
+		//Set up like makeKFBCachedImage, unzoomed without the next keyframe.
+		auto local = MakeTestSequence(keyFrame, nullptr);
+		local->method = method;
+		local->bitDepth = 8;
+		local->activeZoomScale = 1;
+		local->nextZoomScale = 0;
+		local->keyFramePercent = 0;
+		if(!SelectStageFunctions(local.get()).fields) continue;
+		const std::string name = methodName;
+
+		checkInvalid(local.get(), 0, name + ", nothing cached");
+		TestFrame<PF_Pixel8> staged(width, height), rendered(width, height);
+		makeCachedImage(local.get(), staged, pool);
+		PrepareTestRender(local.get(), width, height);
+		RenderTestFrame(local.get(), rendered, pool);
+		TEST_CHECK(staged.differences(rendered) == 0, name + ": the cached image is the same as the span kernels' (" + std::to_string(staged.differences(rendered)) + " pixels differ)");
+
+		for(const auto & change : changes) {
+			change.apply(local.get());
+			checkRebuild<PF_Pixel8>(local.get(), name + ", " + change.name, static_cast<int>(change.stage), pool);
+		}
+
+		//With slopes, then at the other colour depths.
+		local->slopesEnabled = true;
+		checkRebuild<PF_Pixel8>(local.get(), name + ", slopes on again", static_cast<int>(CacheStage::shading), pool);
+		local->bitDepth = 16;
+		checkRebuild<PF_Pixel16>(local.get(), name + ", 16-bit", static_cast<int>(CacheStage::colours), pool);
+		local->bitDepth = 32;
+		checkRebuild<PF_Pixel32>(local.get(), name + ", 32-bit", static_cast<int>(CacheStage::colours), pool);
+
+		//Releasing the fields releases the shading made from them.
+		local->DisposeOfCachedImages(CacheStage::shading);
+		TEST_CHECK(!local->GetCachedStages(0).fields.empty() && local->GetCachedStages(0).shading.empty(), name + ": releasing the shading keeps the fields");
+		local->DisposeOfCachedImages(CacheStage::fields);
+		TEST_CHECK(local->GetCachedStages(0).fields.empty() && local->GetCachedStages(0).shading.empty(), name + ": releasing the fields releases the shading");
+
+		//Colours sampled from a layer have no stages, and are never cached.
+		local->sampling = true;
+		TEST_CHECK(!SelectStageFunctions(local.get()).fields && local->isCacheInvalid(CacheStage::fields), name + ": sampling a layer has no stages");
+	}
+
+	std::filesystem::remove(fileName);
+	return TestResult();
+}
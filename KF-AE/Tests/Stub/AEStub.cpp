@@ -0,0 +1,96 @@
+/********************************************************************************************
+AEStub.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The After Effects suites the tests use (see AEStub.h).  Memory handles and worlds are plain heap
+blocks, the rest of the suites are missing (the code that needs them isn't tested).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "AEStub.h"
+
+#include <cstdlib>
+
+/*******************************************************************************************************
+Memory handles.  A handle points at its block, like AE's.
+*******************************************************************************************************/
+static PF_Handle newHandle(A_u_long size) {
+	void ** handle = static_cast<void **>(std::malloc(sizeof(void *)));
+	if(!handle) return nullptr;
+	*handle = std::malloc(size ? size : 1);
+	if(!*handle) {
+		std::free(handle);
+		return nullptr;
+	}
+	return handle;
+}
+static void * lockHandle(PF_Handle handle) {
+	return *static_cast<void **>(handle);
+}
+static void unlockHandle(PF_Handle) {
+}
+static void disposeHandle(PF_Handle handle) {
+	if(!handle) return;
+	std::free(*static_cast<void **>(handle));
+	std::free(handle);
+}
+static PF_HandleSuite1 handleSuite {newHandle, lockHandle, unlockHandle, disposeHandle};
+
+/*******************************************************************************************************
+Worlds (zero filled).
+*******************************************************************************************************/
+struct StubWorld {
+	PF_EffectWorld world {};
+};
+static A_Err newWorld(void *, int type, A_long width, A_long height, AEGP_WorldH * out) {
+	const A_long pixelSize = (type == AEGP_WorldType_8) ? 4 : ((type == AEGP_WorldType_16) ? 8 : 16);
+	auto stub = new StubWorld {};
+	stub->world.width = width;
+	stub->world.height = height;
+	stub->world.rowbytes = width * pixelSize;
+	stub->world.world_flags = (type == AEGP_WorldType_8) ? 0 : PF_WorldFlag_DEEP;
+	stub->world.data = std::calloc(static_cast<size_t>(width) * height, pixelSize);
+	if(!stub->world.data) {
+		delete stub;
+		return PF_Err_OUT_OF_MEMORY;
+	}
+	*out = reinterpret_cast<AEGP_WorldH>(stub);
+	return PF_Err_NONE;
+}
+static A_Err disposeWorld(AEGP_WorldH handle) {
+	auto stub = reinterpret_cast<StubWorld *>(handle);
+	if(!stub) return PF_Err_NONE;
+	std::free(stub->world.data);
+	delete stub;
+	return PF_Err_NONE;
+}
+static A_Err fillOutWorld(AEGP_WorldH handle, PF_EffectWorld * world) {
+	*world = reinterpret_cast<StubWorld *>(handle)->world;
+	return PF_Err_NONE;
+}
+static AEGP_WorldSuite3 worldSuite {newWorld, disposeWorld, fillOutWorld};
+
+/*******************************************************************************************************
+Suite handler
+*******************************************************************************************************/
+AEGP_SuiteHandler::AEGP_SuiteHandler(SPBasicSuite *) {}
+PF_HandleSuite1 * AEGP_SuiteHandler::HandleSuite1() {return &handleSuite;}
+AEGP_WorldSuite3 * AEGP_SuiteHandler::WorldSuite3() {return &worldSuite;}
+PF_Iterate8Suite1 * AEGP_SuiteHandler::Iterate8Suite1() {return nullptr;}
+PF_Iterate16Suite1 * AEGP_SuiteHandler::Iterate16Suite1() {return nullptr;}
+PF_IterateFloatSuite1 * AEGP_SuiteHandler::IterateFloatSuite1() {return nullptr;}
+PF_Sampling8Suite1 * AEGP_SuiteHandler::Sampling8Suite1() {return nullptr;}
+PF_Sampling16Suite1 * AEGP_SuiteHandler::Sampling16Suite1() {return nullptr;}
+PF_SamplingFloatSuite1 * AEGP_SuiteHandler::SamplingFloatSuite1() {return nullptr;}
+PF_WorldTransformSuite1 * AEGP_SuiteHandler::WorldTransformSuite1() {return nullptr;}
+PF_ANSICallbacksSuite1 * AEGP_SuiteHandler::ANSICallbacksSuite1() {return nullptr;}
@@ -0,0 +1,194 @@
+#pragma once
+/********************************************************************************************
+AEStub.h
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+The parts of the After Effects SDK the plug-in's sources use, so they can be built for the
+tests without the SDK.  Every SDK header the plug-in includes is made to include this (see
+CMakeLists.txt).  Only the declarations are here, the suites the tests need are implemented in
+AEStub.cpp (memory handles and worlds).  Nothing here matches the SDK's layout, so it can't be
+used to build the plug-in itself.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+typedef int32_t A_long;
+typedef uint32_t A_u_long;
+typedef int A_Err;
+typedef int PF_Err;
+typedef int PF_Cmd;
+typedef int32_t PF_Fixed;
+typedef int PF_ParamFlags;
+typedef int PF_ParamUIFlags;
+typedef void * PF_Handle;
+typedef void * PF_ProgPtr;
+typedef void * PF_PluginDataPtr;
+typedef void * PF_PluginDataCB;
+typedef struct _AEGP_WorldH * AEGP_WorldH;
+struct SPBasicSuite {};
+
+enum {PF_Err_NONE = 0, PF_Err_OUT_OF_MEMORY = 4, PF_Err_INTERNAL_STRUCT_DAMAGED = 512, PF_Err_INVALID_CALLBACK = 515, PF_Interrupt_CANCEL = 516};
+enum {PF_Cmd_ABOUT, PF_Cmd_GLOBAL_SETUP, PF_Cmd_GLOBAL_SETDOWN, PF_Cmd_PARAMS_SETUP, PF_Cmd_USER_CHANGED_PARAM, PF_Cmd_SEQUENCE_SETUP,
+	PF_Cmd_SEQUENCE_RESETUP, PF_Cmd_SEQUENCE_FLATTEN, PF_Cmd_SEQUENCE_SETDOWN, PF_Cmd_RENDER, PF_Cmd_SMART_PRE_RENDER, PF_Cmd_SMART_RENDER};
+enum {PF_Param_BUTTON, PF_Param_FLOAT_SLIDER, PF_Param_POPUP, PF_Param_CHECKBOX, PF_Param_GROUP_START, PF_Param_GROUP_END, PF_Param_COLOR, PF_Param_ANGLE, PF_Param_LAYER};
+enum {PF_ParamFlag_SUPERVISE = 1, PF_ParamFlag_CANNOT_TIME_VARY = 2, PF_ParamFlag_START_COLLAPSED = 4};
+enum {PF_Precision_INTEGER, PF_Precision_TENTHS, PF_Precision_HUNDREDTHS, PF_Precision_THOUSANDTHS, PF_Precision_TEN_THOUSANDTHS};
+enum {PF_OutFlag_DEEP_COLOR_AWARE = 1, PF_OutFlag_SEQUENCE_DATA_NEEDS_FLATTENING = 2, PF_OutFlag_PIX_INDEPENDENT = 4, PF_OutFlag_FORCE_RERENDER = 8, PF_OutFlag_DISPLAY_ERROR_MESSAGE = 16};
+enum {PF_OutFlag2_SUPPORTS_SMART_RENDER = 1, PF_OutFlag2_FLOAT_COLOR_AWARE = 2};
+enum {PF_WorldFlag_DEEP = 1};
+enum {PF_Xfer_IN_FRONT = 1};
+enum {PF_Quality_HI = 1};
+enum {PF_Stage_DEVELOP = 0};
+enum {AEGP_WorldType_8 = 1, AEGP_WorldType_16, AEGP_WorldType_32};
+
+#define PF_VERSION(a, b, c, d, e) 0
+#define DllExport
+#define AE_RESERVED_INFO 0
+#define AEFX_CLR_STRUCT(s) std::memset(&(s), 0, sizeof(s))
+#define PF_ABORT(in_data) ((in_data)->inter.abort((in_data)->effect_ref))
+#define PF_PROGRESS(in_data, c, t) ((in_data)->inter.progress((in_data)->effect_ref, c, t))
+#define PF_REGISTER_EFFECT(a, b, c, d, e, f) ((void)(a), (void)(b), PF_Err {0})
+
+struct PF_RationalScale {A_long num; A_u_long den;};
+struct PF_Pixel8 {unsigned char alpha, red, green, blue;};
+struct PF_Pixel16 {unsigned short alpha, red, green, blue;};
+struct PF_Pixel32 {float alpha, red, green, blue;};
+typedef PF_Pixel8 PF_Pixel;
+typedef PF_Pixel32 PF_PixelFloat;
+struct PF_Rect {A_long left, top, right, bottom;};
+typedef PF_Rect PF_LRect;
+struct PF_FloatMatrix {float mat[3][3];};
+
+struct PF_EffectWorld {
+	A_long world_flags;
+	A_long rowbytes;
+	A_long width, height;
+	PF_Rect extent_hint;
+	void * data;
+	A_long origin_x, origin_y;
+};
+typedef PF_EffectWorld PF_LayerDef;
+
+struct PF_CompositeMode {int xfer; int rand_seed; unsigned char opacity; int rgb_only; unsigned short opacitySu;};
+struct PF_SampPB {PF_EffectWorld * src;};
+
+struct PF_ParamDef {
+	int param_type;
+	char name[32];
+	int flags;
+	int ui_flags;
+	union {A_long id; A_long change_flags;} uu;
+	union {
+		struct {union {const char * namesptr;} u;} button_d;
+		struct {double valid_min, valid_max, slider_min, slider_max, value, dephault; short precision;} fs_d;
+		struct {short dephault, value, num_choices; union {const char * namesptr;} u;} pd;
+		struct {A_long value, dephault; union {const char * nameptr;} u;} bd;
+		struct {PF_Pixel value, dephault;} cd;
+		struct {PF_Fixed value, dephault;} ad;
+	} u;
+};
+
+struct PF_InteractCallbacks {
+	PF_Err (*checkout_param)(PF_ProgPtr, A_long, A_long, A_long, A_u_long, PF_ParamDef *);
+	PF_Err (*checkin_param)(PF_ProgPtr, PF_ParamDef *);
+	PF_Err (*add_param)(PF_ProgPtr, A_long, PF_ParamDef *);
+	PF_Err (*abort)(PF_ProgPtr);
+	PF_Err (*progress)(PF_ProgPtr, A_long, A_long);
+};
+
+struct PF_InData {
+	PF_InteractCallbacks inter;
+	PF_ProgPtr effect_ref;
+	A_long current_time, time_step;
+	A_u_long time_scale;
+	A_long width, height;
+	PF_RationalScale downsample_x, downsample_y;
+	int field;
+	PF_Handle sequence_data;
+	SPBasicSuite * pica_basicP;
+};
+
+struct PF_OutData {A_long my_version; A_long out_flags, out_flags2; char return_msg[256]; A_long num_params; PF_Handle sequence_data;};
+struct PF_RenderRequest {PF_LRect rect;};
+struct PF_CheckoutResult {};
+struct PF_PreRenderInput {PF_RenderRequest output_request; short bitdepth;};
+struct PF_PreRenderOutput {PF_LRect result_rect, max_result_rect; bool solid;};
+struct PF_PreRenderCallbacks {PF_Err (*checkout_layer)(PF_ProgPtr, A_long, A_long, const PF_RenderRequest *, A_long, A_long, A_u_long, PF_CheckoutResult *);};
+struct PF_PreRenderExtra {PF_PreRenderInput * input; PF_PreRenderOutput * output; PF_PreRenderCallbacks * cb;};
+struct PF_SmartRenderInput {PF_RenderRequest output_request; short bitdepth;};
+struct PF_SmartRenderCallbacks {PF_Err (*checkout_layer_pixels)(PF_ProgPtr, A_long, PF_EffectWorld **); PF_Err (*checkout_output)(PF_ProgPtr, PF_EffectWorld **);};
+struct PF_SmartRenderExtra {PF_SmartRenderInput * input; PF_SmartRenderCallbacks * cb;};
+struct PF_UserChangedParamExtra {A_long param_index;};
+
+//Suites
+struct PF_HandleSuite1 {
+	PF_Handle (*host_new_handle)(A_u_long);
+	void * (*host_lock_handle)(PF_Handle);
+	void (*host_unlock_handle)(PF_Handle);
+	void (*host_dispose_handle)(PF_Handle);
+};
+struct AEGP_WorldSuite3 {
+	A_Err (*AEGP_New)(void *, int, A_long, A_long, AEGP_WorldH *);
+	A_Err (*AEGP_Dispose)(AEGP_WorldH);
+	A_Err (*AEGP_FillOutPFEffectWorld)(AEGP_WorldH, PF_EffectWorld *);
+};
+template <class P> struct PF_IterSuite {
+	PF_Err (*iterate)(PF_InData *, A_long, A_long, PF_EffectWorld *, const PF_Rect *, void *, PF_Err (*)(void *, A_long, A_long, P *, P *), PF_EffectWorld *);
+	PF_Err (*iterate_generic)(A_long, void *, PF_Err (*)(void *, A_long, A_long, A_long));
+};
+typedef PF_IterSuite<PF_Pixel8> PF_Iterate8Suite1;
+typedef PF_IterSuite<PF_Pixel16> PF_Iterate16Suite1;
+typedef PF_IterSuite<PF_Pixel32> PF_IterateFloatSuite1;
+struct PF_Sampling8Suite1 {
+	PF_Err (*subpixel_sample)(PF_ProgPtr, PF_Fixed, PF_Fixed, const PF_SampPB *, PF_Pixel *);
+	PF_Err (*area_sample)(PF_ProgPtr, PF_Fixed, PF_Fixed, const PF_SampPB *, PF_Pixel *);
+};
+struct PF_Sampling16Suite1 {PF_Err (*subpixel_sample16)(PF_ProgPtr, PF_Fixed, PF_Fixed, const PF_SampPB *, PF_Pixel16 *);};
+struct PF_SamplingFloatSuite1 {PF_Err (*subpixel_sample_float)(PF_ProgPtr, PF_Fixed, PF_Fixed, const PF_SampPB *, PF_Pixel32 *);};
+struct PF_WorldTransformSuite1 {
+	PF_Err (*transform_world)(PF_ProgPtr, int, A_long, int, PF_EffectWorld *, const PF_CompositeMode *, void *, const PF_FloatMatrix *, A_long, bool, const PF_Rect *, PF_EffectWorld *);
+};
+struct PF_ANSICallbacksSuite1 {int (*sprintf)(char *, const char *, ...);};
+
+struct AEGP_SuiteHandler {
+	AEGP_SuiteHandler(SPBasicSuite * basic);
+	PF_HandleSuite1 * HandleSuite1();
+	AEGP_WorldSuite3 * WorldSuite3();
+	PF_Iterate8Suite1 * Iterate8Suite1();
+	PF_Iterate16Suite1 * Iterate16Suite1();
+	PF_IterateFloatSuite1 * IterateFloatSuite1();
+	PF_Sampling8Suite1 * Sampling8Suite1();
+	PF_Sampling16Suite1 * Sampling16Suite1();
+	PF_SamplingFloatSuite1 * SamplingFloatSuite1();
+	PF_WorldTransformSuite1 * WorldTransformSuite1();
+	PF_ANSICallbacksSuite1 * ANSICallbacksSuite1();
+};
+
+//Like MSVC's, the copy is always terminated (and truncated to fit).
+inline int strncpy_s(char * destination, const char * source, size_t count) {
+	if(count == 0) return 0;
+	const size_t length = std::min(std::strlen(source), count - 1);
+	std::memcpy(destination, source, length);
+	destination[length] = '\0';
+	return 0;
+}
+template <size_t N> int strncpy_s(char (&destination)[N], const char * source, size_t count) {
+	return strncpy_s(static_cast<char *>(destination), source, std::min(count, N));
+}
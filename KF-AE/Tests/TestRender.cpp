@@ -0,0 +1,104 @@
+/********************************************************************************************
+TestRender.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Rendering frames for the tests (see TestRender.h).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestRender.h"
+
+#include <cstring>
+
+const std::vector<TestMethod> testMethods = {
+	{1, "KFRColouring"},
+	{2, "KFRDistance"},
+	{4, "DarkLightWave"},
+	{5, "WaveOnPalette"},
+	{6, "LogSteps"},
+	{7, "LogStepPalette"},
+	{8, "Panels"},
+	{9, "PanelsColour"},
+	{10, "Angle"},
+	{11, "AngleColour"},
+	{12, "DEAndAngle"},
+};
+
+/*******************************************************************************************************
+A sequence blending two keyframes (see TestRender.h).
+*******************************************************************************************************/
+std::unique_ptr<LocalSequenceData> MakeTestSequence(std::shared_ptr<const KFBData> active, std::shared_ptr<const KFBData> next) {
+	auto local = std::make_unique<LocalSequenceData>();
+	local->width = active->getWidth();
+	local->height = active->getHeight();
+	local->activeKFB = active;
+	local->nextFrameKFB = next;
+	local->activeZoomScale = 1.37;
+	local->nextZoomScale = 0.685;
+	local->keyFramePercent = 0.4;
+	local->numKFRColours = 8;
+	for(int i = 0; i < 8; i++) local->kfrColours[i] = RGB(static_cast<unsigned char>(i * 30), static_cast<unsigned char>(255 - i * 30), static_cast<unsigned char>(i * 10));
+	local->colourDivision = 3;
+	local->insideColour = RGB(10, 20, 30);
+	local->slopeShadowDepth = 5;
+	local->slopeStrength = 50;
+	local->slopeAngle = 45;
+	local->slopeAngleX = 0.7;
+	local->slopeAngleY = 0.7;
+	local->distanceClamp = 1;
+	local->special = 1;
+	return local;
+}
+
+/*******************************************************************************************************
+Like Render.cpp's prepareRender.
+*******************************************************************************************************/
+void PrepareTestRender(LocalSequenceData * local, A_long width, A_long height, bool insideMask) {
+	const double scaleFactor = std::min(local->scaleFactorX, local->scaleFactorY);
+	local->activeMipLevel = local->activeKFB->PrepareMipLevel(scaleFactor / local->activeZoomScale);
+	local->nextMipLevel = local->nextFrameKFB ? local->nextFrameKFB->PrepareMipLevel(scaleFactor / local->nextZoomScale) : 0;
+	if(insideMask) {
+		local->activeKFB->PrepareInsideMask();
+		if(local->nextFrameKFB) local->nextFrameKFB->PrepareInsideMask();
+	}
+	PrepareFrameCoordinates(local, width, height);
+}
+
+/*******************************************************************************************************
+Render a whole frame (see TestRender.h).
+*******************************************************************************************************/
+template <class PixelT>
+void RenderTestFrame(const LocalSequenceData * local, TestFrame<PixelT> & frame, WorkerPool & pool) {
+	const auto context = MakeRenderContext(local);
+	RenderSpanTiles<PixelT>(context, &frame.world, pool, WorkPriority::render);
+}
+
+template void RenderTestFrame(const LocalSequenceData *, TestFrame<PF_Pixel8> &, WorkerPool &);
+template void RenderTestFrame(const LocalSequenceData *, TestFrame<PF_Pixel16> &, WorkerPool &);
+template void RenderTestFrame(const LocalSequenceData *, TestFrame<PF_Pixel32> &, WorkerPool &);
+
+/*******************************************************************************************************
+Frames are compared bit for bit.
+*******************************************************************************************************/
+template <class PixelT>
+long TestFrame<PixelT>::differences(const TestFrame & other) const {
+	long count = 0;
+	for(size_t i = 0; i < pixels.size(); i++) {
+		if(std::memcmp(&pixels[i], &other.pixels[i], sizeof(PixelT)) != 0) count++;
+	}
+	return count;
+}
+
+template struct TestFrame<PF_Pixel8>;
+template struct TestFrame<PF_Pixel16>;
+template struct TestFrame<PF_Pixel32>;
@@ -0,0 +1,62 @@
+#pragma once
+/********************************************************************************************
+TestRender.h
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Rendering frames for the tests, without AE: a sequence blending two keyframes part way through
+a zoom, and frames of each colour depth to render it into.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "Render.h"
+
+#include <memory>
+
+//The render methods (LocalSequenceData::method) that don't need anything from AE.
+struct TestMethod {
+	long method;
+	const char * name;
+};
+extern const std::vector<TestMethod> testMethods;
+
+//A sequence the size of the keyframes, zoomed in 1.37 times on the active keyframe and blending in
+//the next (at half the zoom) 40%.  Colours from a palette of 8, slopes set up but off.
+std::unique_ptr<LocalSequenceData> MakeTestSequence(std::shared_ptr<const KFBData> active, std::shared_ptr<const KFBData> next);
+
+//A frame of one colour depth.
+template <class PixelT>
+struct TestFrame {
+	std::vector<PixelT> pixels;
+	PF_EffectWorld world {};
+
+	TestFrame(int width, int height) : pixels(static_cast<size_t>(width) * height) {
+		world.width = width;
+		world.height = height;
+		world.rowbytes = width * static_cast<A_long>(sizeof(PixelT));
+		world.data = pixels.data();
+		world.extent_hint = PF_Rect {0, 0, width, height};
+	}
+	TestFrame(const TestFrame &) = delete;
+	TestFrame & operator=(const TestFrame &) = delete;
+
+	long differences(const TestFrame & other) const;		//Pixels that aren't bit for bit the same
+};
+
+//Prepare the keyframes and sample locations like a render does (mip levels, the inside masks unless
+//insideMask is false, and the frame coordinates).
+void PrepareTestRender(LocalSequenceData * local, A_long width, A_long height, bool insideMask = true);
+
+//Render a whole frame with the method's span kernels on the pool (after PrepareTestRender).
+template <class PixelT>
+void RenderTestFrame(const LocalSequenceData * local, TestFrame<PixelT> & frame, WorkerPool & pool);
@@ -0,0 +1,231 @@
+/********************************************************************************************
+TestSupport.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Shared parts of the tests (see TestSupport.h).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFMovieMaker.h"
+#include "KFBData.h"
+#include "OS.h"
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <fstream>
+#include <random>
+#include <stdexcept>
+
+static std::atomic<int> failures {0};
+static volatile double keptResult {0};
+
+/*******************************************************************************************************
+Report a failed check.
+*******************************************************************************************************/
+bool TestCheck(bool passed, const char * condition, const std::string & message, const char * file, int line) {
+	if(!passed) {
+		failures++;
+		std::printf("FAILED %s:%d: %s (%s)\n", file, line, message.c_str(), condition);
+		std::fflush(stdout);
+	}
+	return passed;
+}
+
+int TestFailures() {
+	return failures.load();
+}
+
+int TestResult() {
+	if(failures.load() == 0) {
+		std::printf("All checks passed\n");
+		return 0;
+	}
+	std::printf("%d checks failed\n", failures.load());
+	return 1;
+}
+
+/*******************************************************************************************************
+Timed results are written somewhere the compiler must assume is read.
+*******************************************************************************************************/
+void KeepResult(double value) {
+	keptResult = value;
+}
+
+/*******************************************************************************************************
+Let the calling thread use the AE memory suites, and other threads (like global setup does).
+*******************************************************************************************************/
+void UseTestAE() {
+	static SPBasicSuite basicSuite;
+	static PF_InData inData = [] {
+		PF_InData data {};
+		data.pica_basicP = &basicSuite;
+		return data;
+	}();
+	globalTL_in_data = &inData;
+	globalBasicSuite = &basicSuite;
+}
+
+/*******************************************************************************************************
+A synthetic keyframe (see TestSupport.h).
+The smooth value falls from maxIterations at the edge of the set to about minimum at the corners,
+steeply near the set like a real keyframe, so neighbouring pixels can be far apart.
+*******************************************************************************************************/
+TestKFB MakeTestKFB(int width, int height, int minimum, int maxIterations, double inside, uint32_t seed) {
+	TestKFB kfb;
+	kfb.width = width;
+	kfb.height = height;
+	kfb.maxIterations = maxIterations;
+	const size_t size = static_cast<size_t>(width) * height;
+	kfb.iterations.resize(size);
+	kfb.raw.resize(size);
+
+	std::mt19937 random(seed);
+	std::uniform_real_distribution<double> noise(-0.25, 0.25);
+	const double radius = inside * std::min(width, height) / 2;
+	const double far = std::hypot(width / 2.0, height / 2.0) - radius;
+	const double range = static_cast<double>(maxIterations) - minimum;
+	for(int x = 0; x < width; x++) {
+		for(int y = 0; y < height; y++) {
+			const size_t i = static_cast<size_t>(x) * height + y;
+			const double distance = std::hypot(x - width / 2.0, y - height / 2.0) - radius;
+			if(distance <= 0) {
+				kfb.iterations[i] = maxIterations;
+				kfb.raw[i] = 0;
+				continue;
+			}
+			//About 1 / distance near the set, minimum at the far corners.
+			const double fall = (1.0 / (1.0 + distance) - 1.0 / (1.0 + far)) / (1.0 - 1.0 / (1.0 + far));
+			double smooth = minimum + range * fall * 0.999 + 3.0 * std::sin(x * 0.37) * std::cos(y * 0.23) + noise(random);
+			smooth = std::clamp(smooth, static_cast<double>(minimum), static_cast<double>(maxIterations) - 1);
+			const double iteration = std::floor(smooth);
+			kfb.iterations[i] = static_cast<int>(iteration);
+			kfb.raw[i] = static_cast<float>(iteration + 1 - smooth);
+		}
+	}
+	return kfb;
+}
+
+/*******************************************************************************************************
+Write a keyframe as a .kfb file (with a few colours).
+*******************************************************************************************************/
+void WriteTestKFB(const std::string & fileName, const TestKFB & kfb) {
+	std::ofstream file {fileName, std::ios::binary | std::ios::out | std::ios::trunc};
+	if(!file) throw(std::runtime_error("Unable to create test KFB file"));
+	file.write("KFB", 3);
+	file.write(reinterpret_cast<const char*>(&kfb.width), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&kfb.height), sizeof(int));
+	file.write(reinterpret_cast<const char*>(kfb.iterations.data()), kfb.iterations.size() * sizeof(int));
+	const int colourDiv = 1;
+	const int numColours = 4;
+	file.write(reinterpret_cast<const char*>(&colourDiv), sizeof(int));
+	file.write(reinterpret_cast<const char*>(&numColours), sizeof(int));
+	const unsigned char colours[numColours * 3] = {0, 0, 0, 255, 0, 0, 0, 255, 0, 0, 0, 255};
+	file.write(reinterpret_cast<const char*>(colours), sizeof(colours));
+	file.write(reinterpret_cast<const char*>(&kfb.maxIterations), sizeof(int));
+	file.write(reinterpret_cast<const char*>(kfb.raw.data()), kfb.raw.size() * sizeof(float));
+	if(!file) throw(std::runtime_error("Unable to write test KFB file"));
+}
+
+/*******************************************************************************************************
+A file name in the current directory, unique to this process.
+*******************************************************************************************************/
+std::string TestFileName(const std::string & name) {
+	return "kfbtest-" + std::to_string(CurrentProcessID()) + "-" + name;
+}
+
+/*******************************************************************************************************
+Every pixel of a decoded keyframe must match the file.
+(The padded edge isn't compared, it is extrapolated.)
+*******************************************************************************************************/
+bool MatchesTestKFB(const KFBData & kfb, const TestKFB & expected) {
+	int reported = 0;
+	for(long y = 0; y < expected.height - 2; y++) {
+		for(long x = 0; x < expected.width - 2; x++) {
+			if(kfb.getIterationCount(x, y) != expected.iteration(x, y) || kfb.getIterationCountSmooth(x, y) != expected.smooth(x, y)) {
+				TEST_CHECK(false, "pixel " + std::to_string(x) + "," + std::to_string(y) + " differs from the file");
+				if(++reported == 10) return false;
+			}
+		}
+	}
+	return reported == 0;
+}
+
+/*******************************************************************************************************
+Largest difference between two arrays.
+*******************************************************************************************************/
+double MaxDifference(const double * a, const double * b, size_t count) {
+	double largest = 0;
+	for(size_t i = 0; i < count; i++) largest = std::max(largest, std::abs(a[i] - b[i]));
+	return largest;
+}
+
+/*******************************************************************************************************
+Every way of sampling two keyframes must give identical results (see TestSupport.h).
+The samples within 3 pixels of an edge read the padding, the corners from both sides.
+*******************************************************************************************************/
+void CompareKFBSampling(const KFBData & expected, const KFBData & actual, const std::string & source) {
+	const long width = expected.getWidth();
+	const long height = expected.getHeight();
+
+	long pixelErrors = 0;
+	for(long y = -2; y < height; y++) {
+		for(long x = -2; x < width; x++) {
+			if(expected.getIterationCountSmooth(x, y) != actual.getIterationCountSmooth(x, y) || expected.getIterationCount(x, y) != actual.getIterationCount(x, y)) pixelErrors++;
+		}
+	}
+	TEST_CHECK(pixelErrors == 0, source + ": " + std::to_string(pixelErrors) + " pixels differ");
+
+	long bicubicErrors = 0, bilinearErrors = 0, matrixErrors = 0;
+	auto sample = [&](double x, double y, double step) {
+		if(expected.calculateIterationCountBiCubic(x, y) != actual.calculateIterationCountBiCubic(x, y)) bicubicErrors++;
+		if(expected.calculateIterationCountBiLinearNoPad(x + 2, y + 2) != actual.calculateIterationCountBiLinearNoPad(x + 2, y + 2)) bilinearErrors++;
+		double a[3][3], b[3][3];
+		expected.getDistanceMatrix(a, x, y, step);
+		actual.getDistanceMatrix(b, x, y, step);
+		if(MaxDifference(&a[0][0], &b[0][0], 9) != 0) matrixErrors++;
+	};
+	std::mt19937 random(3);
+	std::uniform_real_distribution<double> xs(-3, width + 1);
+	std::uniform_real_distribution<double> ys(-3, height + 1);
+	std::uniform_real_distribution<double> steps(0.25, 4);
+	for(int i = 0; i < 200000; i++) {
+		const double x = xs(random);
+		const double y = ys(random);
+		sample(x, y, (i & 1) ? 1.0 : steps(random));
+	}
+	for(double y = -3; y <= height + 1; y += 0.375) {
+		const bool edgeRow = y < 1 || y > height - 2;
+		for(double x = -3; x <= width + 1; x += 0.375) {
+			if(!edgeRow && x > 1 && x < width - 2) x = width - 2;		//Only the left and right edges
+			sample(x, y, 1.0);
+			sample(x, y, 0.5);
+		}
+	}
+	TEST_CHECK(bicubicErrors == 0, source + ": " + std::to_string(bicubicErrors) + " bicubic samples differ");
+	TEST_CHECK(bilinearErrors == 0, source + ": " + std::to_string(bilinearErrors) + " bilinear samples differ");
+	TEST_CHECK(matrixErrors == 0, source + ": " + std::to_string(matrixErrors) + " distance matrices differ");
+
+	std::vector<float> spanX(width);
+	std::vector<double> expectedSpan(width);
+	std::vector<double> actualSpan(width);
+	for(long x = 0; x < width; x++) spanX[x] = static_cast<float>(x * 0.9993 + 0.125);
+	double largest = 0;
+	for(long y = 0; y < height; y += 5) {
+		expected.calculateIterationCountBiCubicSpan(spanX.data(), width, y + 0.625, expectedSpan.data());
+		actual.calculateIterationCountBiCubicSpan(spanX.data(), width, y + 0.625, actualSpan.data());
+		largest = std::max(largest, MaxDifference(expectedSpan.data(), actualSpan.data(), width));
+	}
+	TEST_CHECK(largest == 0, source + ": spans differ by " + std::to_string(largest));
+}
@@ -0,0 +1,82 @@
+#pragma once
+/********************************************************************************************
+TestSupport.h
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Shared parts of the tests: checks, timing, the AE memory suites for the calling thread and
+synthetic .kfb files.
+Each test is a program that prints what it measured and returns non-zero if a check failed.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+//Check a condition, reporting it (and counting it as a failure) if it is false.
+#define TEST_CHECK(condition, message) TestCheck((condition), #condition, (message), __FILE__, __LINE__)
+bool TestCheck(bool passed, const char * condition, const std::string & message, const char * file, int line);
+int TestFailures();
+int TestResult();			//Return from main (prints a summary)
+
+//Let the calling thread use the AE memory suites (like AE's own threads).
+void UseTestAE();
+
+//Seconds taken by the fastest of "repeats" calls of f.
+template <typename F>
+double TimeBest(int repeats, F f) {
+	double best = 1e300;
+	for(int r = 0; r < repeats; r++) {
+		const auto start = std::chrono::steady_clock::now();
+		f();
+		best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+	}
+	return best;
+}
+
+//Keeps a result of timed work, so the compiler can't drop the work.
+void KeepResult(double value);
+
+//A keyframe as stored in a .kfb (column major: index x * height + y).
+struct TestKFB {
+	int width {0};
+	int height {0};
+	int maxIterations {0};
+	std::vector<int> iterations;
+	std::vector<float> raw;				//smooth = iteration + 1 - raw
+
+	double smooth(long x, long y) const {
+		const size_t i = static_cast<size_t>(x) * height + y;
+		return static_cast<double>(iterations[i]) + 1 - static_cast<double>(raw[i]);
+	}
+	int iteration(long x, long y) const {return iterations[static_cast<size_t>(x) * height + y];}
+};
+
+//A keyframe like a deep zoom: iterations from "minimum", rising towards the set (a disc "inside"
+//of the shorter side across, at maxIterations).  A continuous smooth field with some noise.
+TestKFB MakeTestKFB(int width, int height, int minimum, int maxIterations, double inside = 0.2, uint32_t seed = 1);
+void WriteTestKFB(const std::string & fileName, const TestKFB & kfb);
+std::string TestFileName(const std::string & name);		//In the current directory, unique to this process
+
+//Every pixel of a decoded keyframe matches the file (reports the first few that don't).
+class KFBData;
+bool MatchesTestKFB(const KFBData & kfb, const TestKFB & expected);
+
+//Every way of sampling "actual" (pixels, bicubic and bilinear samples, spans and distance matrices,
+//including the padding) gives exactly what "expected" gives.  "source" names it in failures.
+void CompareKFBSampling(const KFBData & expected, const KFBData & actual, const std::string & source);
+
+//Largest difference between two arrays.
+double MaxDifference(const double * a, const double * b, size_t count);
@@ -0,0 +1,93 @@
+/********************************************************************************************
+TiledTest.cpp
+
+Author:			KF Movie Maker contributors
+
+Licence:		GNU Affero General Public License
+
+Tiled storage must sample exactly the same values as standard (row) storage: whole pixels,
+bicubic samples and spans, and distance matrices, read from the .kfb or a sidecar.
+Then times both layouts sampling a frame in row order (the frame path), rotated a quarter turn
+(so each output row walks down a column of the keyframe) and the distance matrices.
+Run with a size to time a bigger keyframe, eg. "TiledTest 7680 4320" for 8K.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "TestSupport.h"
+#include "KFBData.h"
+#include "WorkerPool.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+
+/*******************************************************************************************************
+Nanoseconds per output pixel of a frame the size of the keyframe, zoomed in slightly and turned by
+"angle" (radians) about the centre.
+*******************************************************************************************************/
+template <typename Sample>
+static double timeFrame(const KFBData & kfb, double angle, Sample sample) {
+	const long width = kfb.getWidth();
+	const long height = kfb.getHeight();
+	const double c = std::cos(angle) * 0.97, s = std::sin(angle) * 0.97;
+	double total = 0;
+	const double seconds = TimeBest(3, [&] {
+		for(long y = 0; y < height; y++) {
+			for(long x = 0; x < width; x++) {
+				const double dx = x - width / 2.0, dy = y - height / 2.0;
+				total += sample(width / 2.0 + dx * c - dy * s, height / 2.0 + dx * s + dy * c);
+			}
+		}
+	});
+	KeepResult(total);
+	return seconds * 1e9 / (static_cast<double>(width) * height);
+}
+
+int main(int argc, char * argv[]) {
+	UseTestAE();
+	WorkerPool pool(std::max(1u, std::thread::hardware_concurrency()));
+	const int width = (argc > 2) ? std::atoi(argv[1]) : 1931;
+	const int height = (argc > 2) ? std::atoi(argv[2]) : 1087;
+
+	const auto keyframe = MakeTestKFB(width, height, 1000, 1000000, 0.3);
+	const auto fileName = TestFileName("tiled.kfb");
+	WriteTestKFB(fileName, keyframe);
+
+	KFBData standard(width, height);
+	standard.ReadKFBFile(fileName, &pool);
+	KFBData tiled(width, height, KFBStorage::tiled);
+	tiled.ReadKFBFile(fileName, &pool);
+	TEST_CHECK(MatchesTestKFB(tiled, keyframe), "tiled storage matches the file");
+	CompareKFBSampling(standard, tiled, "kfb");
+
+	standard.WriteSidecar(fileName);
+	KFBData fromSidecar(width, height, KFBStorage::tiled);
+	TEST_CHECK(fromSidecar.ReadSidecar(fileName), "the sidecar is read");
+	CompareKFBSampling(standard, fromSidecar, "sidecar");
+
+	std::printf("%dx%d keyframe, ns per pixel     standard   tiled\n", width, height);
+	for(double angle : {0.0, 1.5707963267948966}) {
+		const char * name = (angle == 0) ? "row order" : "turned 90";
+		auto bicubic = [](const KFBData & kfb) {return [&kfb](double x, double y) {return kfb.calculateIterationCountBiCubic(x, y);};};
+		auto matrix = [](const KFBData & kfb) {
+			return [&kfb](double x, double y) {
+				double p[3][3];
+				kfb.getDistanceMatrix(p, x, y, 1.0);
+				return p[0][0];
+			};
+		};
+		std::printf("Bicubic, %s:           %8.1f %8.1f\n", name, timeFrame(standard, angle, bicubic(standard)), timeFrame(tiled, angle, bicubic(tiled)));
+		std::printf("Distance matrix, %s:   %8.1f %8.1f\n", name, timeFrame(standard, angle, matrix(standard)), timeFrame(tiled, angle, matrix(tiled)));
+	}
+
+	std::filesystem::remove(fileName);
+	std::filesystem::remove(KFBSidecarFileName(fileName));
+	return TestResult();
+}
@@ -20,6 +20,8 @@ along with this program.  If not, see <https://www.gnu.org/licenses/>.
 #include "../OS.h"
 
 #include <Windows.h>
+#include <intrin.h>
+#include <immintrin.h>
 /*******************************************************************************************************
 Write a message to the debug stream.
 *******************************************************************************************************/
@@ -60,3 +62,154 @@ std::string ShowFileOpenDialogKFR() {
 	if (result) return std::string(ofn.lpstrFile);
 	return "";
 }
+
+/*******************************************************************************************************
+Map a whole file into memory (read only).
+The pages are shared with the OS file cache, so multiple processes mapping the same file share memory.
+Throws if the file can't be mapped.
+*******************************************************************************************************/
+MappedFile MapFileReadOnly(const std::string & fileName) {
+	MappedFile file {};
+	HANDLE fileHandle = CreateFile(fileName.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if(fileHandle == INVALID_HANDLE_VALUE) throw(std::exception("Unable to open file for mapping"));
+
+	LARGE_INTEGER size {};
+	if(!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0) {
+		CloseHandle(fileHandle);
+		throw(std::exception("Unable to map empty file"));
+	}
+
+	HANDLE mappingHandle = CreateFileMapping(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(!mappingHandle) {
+		CloseHandle(fileHandle);
+		throw(std::exception("Unable to create file mapping"));
+	}
+
+	const void * view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if(!view) {
+		CloseHandle(mappingHandle);
+		CloseHandle(fileHandle);
+		throw(std::exception("Unable to map view of file"));
+	}
+
+	file.data = static_cast<const char *>(view);
+	file.size = static_cast<size_t>(size.QuadPart);
+	file.fileHandle = fileHandle;
+	file.mappingHandle = mappingHandle;
+	return file;
+}
+
+/*******************************************************************************************************
+Release a file mapped with MapFileReadOnly. Safe to call on an empty MappedFile.
+*******************************************************************************************************/
+void UnmapFile(MappedFile & file) noexcept {
+	if(file.data) UnmapViewOfFile(file.data);
+	if(file.mappingHandle) CloseHandle(file.mappingHandle);
+	if(file.fileHandle) CloseHandle(file.fileHandle);
+	file = MappedFile {};
+}
+
+/*******************************************************************************************************
+Open (or create) a named block of memory shared by all processes in this session.
+The block is backed by the page file, and is freed by the OS once every process has closed it.
+A new block is zero filled.  Throws if the block can't be created, or an existing block is too small.
+*******************************************************************************************************/
+SharedMemory OpenSharedMemory(const std::string & name, size_t size) {
+	SharedMemory memory {};
+	const auto fullName = "Local\\" + name;
+	const DWORD sizeHigh = static_cast<DWORD>(static_cast<unsigned long long>(size) >> 32);
+	const DWORD sizeLow = static_cast<DWORD>(size & 0xFFFFFFFF);
+	HANDLE mappingHandle = CreateFileMapping(INVALID_HANDLE_VALUE, nullptr, PAGE_READWRITE, sizeHigh, sizeLow, fullName.c_str());
+	if(!mappingHandle) throw(std::exception("Unable to create shared memory"));
+	const bool created = (GetLastError() != ERROR_ALREADY_EXISTS);
+
+	void * view = MapViewOfFile(mappingHandle, FILE_MAP_ALL_ACCESS, 0, 0, 0);
+	if(!view) {
+		CloseHandle(mappingHandle);
+		throw(std::exception("Unable to map view of shared memory"));
+	}
+
+	//An existing block keeps its original size.
+	MEMORY_BASIC_INFORMATION info {};
+	if(!VirtualQuery(view, &info, sizeof(info)) || info.RegionSize < size) {
+		UnmapViewOfFile(view);
+		CloseHandle(mappingHandle);
+		throw(std::exception("Shared memory is smaller than expected"));
+	}
+
+	memory.data = static_cast<char *>(view);
+	memory.size = size;
+	memory.created = created;
+	memory.mappingHandle = mappingHandle;
+	return memory;
+}
+
+/*******************************************************************************************************
+Release shared memory opened with OpenSharedMemory. Safe to call on an empty SharedMemory.
+*******************************************************************************************************/
+void CloseSharedMemory(SharedMemory & memory) noexcept {
+	if(memory.data) UnmapViewOfFile(memory.data);
+	if(memory.mappingHandle) CloseHandle(memory.mappingHandle);
+	memory = SharedMemory {};
+}
+
+/*******************************************************************************************************
+Remove the name of a shared memory block.  Nothing to do on Windows, where the block (and its name) go
+once the last process closes it.
+*******************************************************************************************************/
+void RemoveSharedMemory(const std::string & /*name*/) noexcept {
+}
+
+/*******************************************************************************************************
+ID of this process.
+*******************************************************************************************************/
+unsigned long CurrentProcessID() noexcept {
+	return GetCurrentProcessId();
+}
+
+/*******************************************************************************************************
+Check if a process is still running.
+A process we aren't allowed to open is assumed to be running.
+*******************************************************************************************************/
+bool IsProcessRunning(unsigned long processID) noexcept {
+	HANDLE process = OpenProcess(SYNCHRONIZE, FALSE, processID);
+	if(!process) return GetLastError() == ERROR_ACCESS_DENIED;
+	const bool running = (WaitForSingleObject(process, 0) == WAIT_TIMEOUT);
+	CloseHandle(process);
+	return running;
+}
+
+/*******************************************************************************************************
+When a process started, so a process ID that has been reused can be told apart.
+Returns 0 if it isn't known.
+*******************************************************************************************************/
+uint64_t ProcessStartTime(unsigned long processID) noexcept {
+	HANDLE process = OpenProcess(PROCESS_QUERY_LIMITED_INFORMATION, FALSE, processID);
+	if(!process) return 0;
+	FILETIME created, exited, kernel, user;
+	const bool known = GetProcessTimes(process, &created, &exited, &kernel, &user);
+	CloseHandle(process);
+	if(!known) return 0;
+	return (static_cast<uint64_t>(created.dwHighDateTime) << 32) | created.dwLowDateTime;
+}
+
+/*******************************************************************************************************
+The widest vector instruction set the CPU (and Windows) supports.
+AVX registers are only usable if the OS saves them (OSXSAVE and XCR0).
+*******************************************************************************************************/
+SIMDLevel DetectSIMDLevel() noexcept {
+	int info[4];
+	__cpuid(info, 0);
+	const int highestID = info[0];
+	__cpuid(info, 1);
+	if(!(info[3] & (1 << 26))) return SIMDLevel::scalar;							//SSE2
+	const bool osSavesAVX = (info[2] & (1 << 27)) && (info[2] & (1 << 28));			//OSXSAVE and AVX
+	if(!osSavesAVX || highestID < 7) return SIMDLevel::sse2;
+
+	const unsigned long long xcr0 = _xgetbv(0);
+	if((xcr0 & 0x06) != 0x06) return SIMDLevel::sse2;								//XMM and YMM state
+	__cpuidex(info, 7, 0);
+	if((info[1] & (1 << 16)) && (xcr0 & 0xE0) == 0xE0) return SIMDLevel::avx512;	//AVX-512F, and opmask/ZMM state
+	if(info[1] & (1 << 5)) return SIMDLevel::avx2;
+	return SIMDLevel::sse2;
+}
@@ -0,0 +1,273 @@
+/********************************************************************************************
+WorkerPool.cpp
+
+Author:			(c) 2019 Adam Sakareassen
+
+Description:	A fixed set of worker threads for splitting work (eg. decoding a keyframe) across
+				the machine.
+
+Licence:		GNU Affero General Public License
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <exception>
+
+constexpr size_t scratchBlockSize = 1 << 20;		//Smallest block of scratch memory.
+constexpr size_t scratchAlignment = 64;
+
+static thread_local const WorkerPool * threadPool {nullptr};		//The pool this thread works for (if any)
+static thread_local int threadWorker {-1};
+
+/*******************************************************************************************************
+Constructor
+Starts the worker threads (at least one).
+*******************************************************************************************************/
+WorkerPool::WorkerPool(int threads)
+{
+	threads = std::max(threads, 1);
+	for(int i = 0; i < threads; i++) queues.push_back(std::make_unique<Queue>());
+	for(int i = 0; i < threads; i++) workers.emplace_back(&WorkerPool::workerLoop, this, i);
+}
+
+/*******************************************************************************************************
+Destructor
+Queued jobs are still run before the threads finish.
+*******************************************************************************************************/
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(auto & worker : workers) worker.join();
+}
+
+/*******************************************************************************************************
+The pool shared by the whole plug-in.  One thread per core.
+Note: Never destroyed, joining threads while the DLL is being unloaded can deadlock.
+*******************************************************************************************************/
+WorkerPool & WorkerPool::Shared() {
+	static WorkerPool * pool = new WorkerPool(static_cast<int>(std::thread::hardware_concurrency()));
+	return *pool;
+}
+
+/*******************************************************************************************************
+Queue a job.  Any exception it throws is passed on by the future.
+A worker queues its own jobs, other threads spread theirs over the workers.
+*******************************************************************************************************/
+std::future<void> WorkerPool::Submit(std::function<void()> job, WorkPriority priority) {
+	std::packaged_task<void()> task(std::move(job));
+	auto result = task.get_future();
+	int worker = currentWorker();
+	if(worker < 0) worker = static_cast<int>(nextQueue.fetch_add(1, std::memory_order_relaxed) % queues.size());
+	{
+		std::lock_guard<std::mutex> lock(queues[worker]->mutex);
+		queues[worker]->jobs[static_cast<int>(priority)].push_back(std::move(task));
+	}
+	queued.fetch_add(1);
+	{
+		std::lock_guard<std::mutex> lock(sleepMutex);		//A worker about to sleep has checked queued.
+	}
+	wake.notify_one();
+	return result;
+}
+
+/*******************************************************************************************************
+Wait for a job to finish, running other queued jobs in the meantime.
+Rethrows any exception thrown by the job.
+Note: Any queued job may run on this thread, so don't wait while holding a lock that jobs take (use
+RunTiles instead).
+*******************************************************************************************************/
+void WorkerPool::Wait(std::future<void> & result) {
+	if(!result.valid()) return;
+	while(result.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+		if(!runOne()) result.wait_for(std::chrono::milliseconds(1));
+	}
+	result.get();
+}
+
+/*******************************************************************************************************
+The tiles of one RunTiles.  Shared with its helper jobs, as a helper may only start after RunTiles
+has returned (it then finds no tiles left).
+*******************************************************************************************************/
+struct WorkerPool::TileRun {
+	const std::function<void(long)> * tile {nullptr};
+	long count {0};
+	std::atomic<long> next {0};					//Next tile to claim
+	std::atomic<bool> aborted {false};
+	std::mutex mutex;
+	std::condition_variable done;
+	long finished {0};							//Tiles finished (or skipped).  Guarded by mutex
+	std::exception_ptr error;					//First exception thrown by a tile.  Guarded by mutex
+};
+
+/*******************************************************************************************************
+Claim and run the next tile.  Returns false if there were none left.
+*******************************************************************************************************/
+bool WorkerPool::runTile(TileRun & run) {
+	const long i = run.next.fetch_add(1);
+	if(i >= run.count) return false;
+	std::exception_ptr error;
+	if(!run.aborted.load(std::memory_order_relaxed)) {
+		try {
+			ScratchScope scope(ScratchArena::ForThread());
+			(*run.tile)(i);
+		}
+		catch(...) {
+			error = std::current_exception();
+		}
+	}
+	std::lock_guard<std::mutex> lock(run.mutex);
+	if(error && !run.error) run.error = error;
+	if(++run.finished == run.count) run.done.notify_all();
+	return true;
+}
+
+/*******************************************************************************************************
+Run tile(0) to tile(count - 1) on the pool, and wait for them (running tiles on this thread too).
+While waiting this thread only runs these tiles, never other queued jobs, so it may be called while
+holding a lock that other jobs take (eg. KFBData::buildMutex).
+abort is called on this thread between tiles (and while waiting).  Once it returns true, tiles not
+yet started are skipped.  Returns false if aborted.
+Each tile's scratch memory (see ScratchArena::ForThread) is given back when it finishes.
+Rethrows the first exception thrown by a tile, once every tile has finished.
+*******************************************************************************************************/
+bool WorkerPool::RunTiles(long count, WorkPriority priority, const std::function<void(long)> & tile, const std::function<bool()> & abort) {
+	if(count <= 0) return true;
+	auto run = std::make_shared<TileRun>();
+	run->tile = &tile;
+	run->count = count;
+	const long helpers = std::min(count - 1, static_cast<long>(workers.size()));
+	for(long i = 0; i < helpers; i++) Submit([run] {while(runTile(*run)) {}}, priority);
+
+	do {
+		if(abort && !run->aborted && abort()) run->aborted = true;
+	} while(runTile(*run));
+
+	//Tiles use the caller's objects, so every one must finish before returning (or throwing).
+	while(true) {
+		{
+			std::unique_lock<std::mutex> lock(run->mutex);
+			if(run->finished == count) break;
+			run->done.wait_for(lock, std::chrono::milliseconds(1));
+			if(run->finished == count) break;
+		}
+		if(abort && !run->aborted && abort()) run->aborted = true;
+	}
+	if(run->error) std::rethrow_exception(run->error);
+	return !run->aborted;
+}
+
+/*******************************************************************************************************
+Index of this thread's worker, or -1 if it isn't one of this pool's workers.
+*******************************************************************************************************/
+int WorkerPool::currentWorker() const {
+	return (threadPool == this) ? threadWorker : -1;
+}
+
+/*******************************************************************************************************
+Take the highest priority job for worker (-1 for a thread outside the pool).
+A worker takes its own newest job, or steals the oldest job of another worker.
+*******************************************************************************************************/
+bool WorkerPool::take(int worker, std::packaged_task<void()> & task) {
+	if(queued.load() <= 0) return false;
+	const int n = static_cast<int>(queues.size());
+	for(int p = 0; p < workPriorities; p++) {
+		if(worker >= 0) {
+			auto & queue = *queues[worker];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if(!queue.jobs[p].empty()) {
+				task = std::move(queue.jobs[p].back());
+				queue.jobs[p].pop_back();
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+		for(int i = 1; i <= n; i++) {
+			const int victim = (std::max(worker, 0) + i) % n;
+			if(victim == worker) continue;
+			auto & queue = *queues[victim];
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			if(!queue.jobs[p].empty()) {
+				task = std::move(queue.jobs[p].front());
+				queue.jobs[p].pop_front();
+				queued.fetch_sub(1);
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*******************************************************************************************************
+Run one queued job on this thread.  Returns false if there were none.
+*******************************************************************************************************/
+bool WorkerPool::runOne() {
+	std::packaged_task<void()> task;
+	if(!take(currentWorker(), task)) return false;
+	task();
+	return true;
+}
+
+/*******************************************************************************************************
+Worker thread.  Runs jobs until the pool is destroyed (and every queued job has run).
+*******************************************************************************************************/
+void WorkerPool::workerLoop(int worker) {
+	threadPool = this;
+	threadWorker = worker;
+	while(true) {
+		std::packaged_task<void()> task;
+		if(take(worker, task)) {
+			task();
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleepMutex);
+		wake.wait(lock, [this] {return stopping || queued.load() > 0; });
+		if(stopping && queued.load() <= 0) return;
+	}
+}
+
+/*******************************************************************************************************
+This thread's scratch memory.
+*******************************************************************************************************/
+ScratchArena & ScratchArena::ForThread() {
+	static thread_local ScratchArena arena;
+	return arena;
+}
+
+/*******************************************************************************************************
+Hands out bytes of scratch memory (aligned to a cache line).  A block that is too small is replaced.
+*******************************************************************************************************/
+void * ScratchArena::allocate(size_t bytes) {
+	bytes = (bytes + scratchAlignment - 1) & ~(scratchAlignment - 1);
+	if(block < blocks.size() && offset + bytes > blocks[block].size) {
+		block++;
+		offset = 0;
+	}
+	if(block >= blocks.size() || bytes > blocks[block].size) {
+		const size_t size = std::max(bytes, scratchBlockSize);
+		Block b;
+		b.memory.reset(new char[size + scratchAlignment]);
+		b.size = size;
+		if(block >= blocks.size()) blocks.push_back(std::move(b));
+		else blocks[block] = std::move(b);
+	}
+	char * memory = blocks[block].memory.get();
+	memory += (scratchAlignment - reinterpret_cast<uintptr_t>(memory) % scratchAlignment) % scratchAlignment;
+	void * result = memory + offset;
+	offset += bytes;
+	return result;
+}
@@ -0,0 +1,124 @@
+#pragma once
+/********************************************************************************************
+WorkerPool.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+A fixed set of worker threads that run submitted jobs.
+Each worker has its own queue of jobs for each priority.  A worker runs its newest job first
+(the one most likely to be in its cache), and when it has none it steals the oldest job of
+another worker.  Higher priority jobs are always taken first, from any queue.
+A thread waiting for a job (see Wait) runs other queued jobs while it waits, so jobs may
+submit and wait for further jobs without running out of threads.
+Work split into tiles (see RunTiles) can be abandoned between tiles.  A thread waiting for its
+tiles only runs those tiles, so it may hold a lock while it waits.
+The pool only uses the standard library, so it can be used (and measured) outside AE.
+Note: Jobs have no globalTL_in_data, so must not use the AE suites (KFBData falls back to the
+basic suite kept at global setup, see globalBasicSuite).
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+//Job priorities, highest first.
+enum class WorkPriority : int {
+	render = 0,			//Tiles of a frame being rendered
+	load,				//Decoding keyframes a render is waiting for
+	build,				//Cached images, mip levels and grids
+	decode,				//Decoding keyframes loaded ahead
+};
+constexpr int workPriorities = 4;
+
+//Scratch memory for one thread.  Memory is handed out in order and given back to a mark
+//(see ScratchScope), so it is reused without going to the heap.
+class ScratchArena {
+	public:
+		ScratchArena() {};
+		ScratchArena(const ScratchArena &) = delete;
+		ScratchArena & operator=(const ScratchArena &) = delete;
+
+		template<class T> T * Allocate(size_t count) {return static_cast<T*>(allocate(count * sizeof(T)));}
+		std::pair<size_t, size_t> Mark() const {return {block, offset};}
+		void Release(std::pair<size_t, size_t> mark) {block = mark.first; offset = mark.second;}
+
+		static ScratchArena & ForThread();
+
+	private:
+		struct Block {
+			std::unique_ptr<char[]> memory;
+			size_t size {0};
+		};
+		std::vector<Block> blocks;
+		size_t block {0};			//Block being handed out, and how much of it is used
+		size_t offset {0};
+
+		void * allocate(size_t bytes);
+};
+
+//Gives back the scratch memory allocated while in scope.
+class ScratchScope {
+	public:
+		explicit ScratchScope(ScratchArena & arena) : arena(arena), mark(arena.Mark()) {};
+		~ScratchScope() {arena.Release(mark);}
+		ScratchScope(const ScratchScope &) = delete;
+		ScratchScope & operator=(const ScratchScope &) = delete;
+
+	private:
+		ScratchArena & arena;
+		std::pair<size_t, size_t> mark;
+};
+
+class WorkerPool {
+	public:
+		explicit WorkerPool(int threads);
+		~WorkerPool();
+		WorkerPool(const WorkerPool &) = delete;
+		WorkerPool & operator=(const WorkerPool &) = delete;
+
+		int getThreads() {return static_cast<int>(workers.size());}
+		std::future<void> Submit(std::function<void()> job, WorkPriority priority = WorkPriority::build);
+		void Wait(std::future<void> & result);
+		bool RunTiles(long count, WorkPriority priority, const std::function<void(long)> & tile, const std::function<bool()> & abort = nullptr);
+
+		static WorkerPool & Shared();
+
+	private:
+		//The jobs of one worker.
+		struct Queue {
+			std::mutex mutex;
+			std::array<std::deque<std::packaged_task<void()>>, workPriorities> jobs;
+		};
+		std::vector<std::unique_ptr<Queue>> queues;
+		std::vector<std::thread> workers;
+		std::atomic<long> queued {0};				//Jobs in all the queues
+		std::atomic<unsigned> nextQueue {0};		//Queue for the next job submitted from outside the pool
+		std::mutex sleepMutex;
+		std::condition_variable wake;
+		bool stopping {false};
+
+		struct TileRun;
+		static bool runTile(TileRun & run);
+		int currentWorker() const;
+		bool take(int worker, std::packaged_task<void()> & task);
+		bool runOne();
+		void workerLoop(int worker);
+};
@@ -0,0 +1,63 @@
+#pragma once
+/********************************************************************************************
+ZoomComposite.h
+
+Author:			(c) 2019 Adam Sakareassen
+
+Licence:		GNU Affero General Public License
+
+Compositing zoomed images (the cached image of each keyframe) straight into the output.
+Each layer is an image scaled about a centre, laid over the layers below it with an opacity.
+Scaling about a centre is separable, so a layer is planned as the source taps and weights of
+each output column, and the same for each output row.  A row is then the vertical step of the
+source rows it needs, stepped horizontally at each output column.
+
+Each output pixel is the average of the image over the pixel, from a Catmull-Rom interpolation
+of the running totals of the source pixels (so every source pixel contributes, however small the
+layer is drawn).  Source pixels beyond the edge of the image repeat the edge, and the part of each
+output pixel beyond the edge is transparent.
+Images are composited as premultiplied pixels, like AE's.
+The compositor only uses the worker pool (not the AE suites), so it can be used (and measured)
+outside AE.
+
+********************************************************************************************
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Affero General Public License for more details.
+
+You should have received a copy of the GNU Affero General Public License
+along with this program.  If not, see <https://www.gnu.org/licenses/>.
+********************************************************************************************/
+#include "KFMovieMaker.h"
+#include "WorkerPool.h"
+
+#include <functional>
+#include <vector>
+
+//The source taps and weights of each output column (or row) of one layer.
+struct ZoomCompositeAxis {
+	std::vector<long> left;				//First source pixel of each output pixel
+	std::vector<int> taps;				//Number of source pixels (0 if the output pixel misses the image)
+	std::vector<float> weights;			//stride weights for each output pixel
+	std::vector<float> coverage;		//Part of each output pixel covered by the image
+	int stride {0};
+	long first {0};						//Source pixels first to last are read by some output pixel.
+	long last {-1};
+};
+
+//One image scaled about a centre (see PlanZoomCompositeLayer).
+struct ZoomCompositeLayer {
+	const PF_EffectWorld * image {nullptr};
+	float opacity {1};
+	ZoomCompositeAxis columns;
+	ZoomCompositeAxis rows;
+};
+
+//The layers of an output image, bottom first.
+struct ZoomComposite {
+	std::vector<ZoomCompositeLayer> layers;
+};
+
+void PlanZoomCompositeLayer(ZoomCompositeLayer & layer, const PF_EffectWorld * image, double opacity, double zoomScale, double outputScale, double centreX, double centreY, A_long width, A_long height);
+template<class PixelT> bool ZoomCompositeTiles(const ZoomComposite & composite, PF_EffectWorld * output, WorkerPool & pool, WorkPriority priority, const std::function<bool()> & abort = nullptr);